@@ -53,6 +53,7 @@ LOCAL_SRC_FILES := \
   CpriCryptPri.c \
   CpriECC.c \
   CpriHash.c \
+  CpriKDFa.c \
   CpriMisc.c \
   CpriRNG.c \
   CpriRSA.c \
@@ -293,6 +294,7 @@ LOCAL_SRC_FILES := \
   Ticket.c \
   Time.c \
   TpmFail.c \
+  TpmInstance.c \
   Unique.c \
   Unseal.c \
   VerifySignature.c \
@@ -11,16 +11,18 @@
 #ifdef __linux__
 
 #include <sys/time.h>
+#include <time.h>
 // Function clock() does not provide accurate wall clock time on linux, let's
 // substitite it with our own caclulations.
 //
 // Return current wall clock modulo milliseconds.
-static UINT64 clock(void)
+static UINT64 WallClock(void)
 {
   struct timeval tv;
   gettimeofday(&tv, NULL);
   return (UINT64)tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
+#define clock() WallClock()
 #else
 #include <time.h>
 #endif
@@ -87,6 +89,26 @@ _plat__ClockTimeElapsed(
 }
 //
 //
+//          _plat__ClockNanoseconds()
+//
+//     Function returns a monotonic time in nanoseconds. The time is not adjusted by _plat__ClockAdjustRate() and
+//     only the difference between two calls is meaningful.
+//
+LIB_EXPORT unsigned long long
+_plat__ClockNanoseconds(
+     void
+     )
+{
+#ifdef __linux__
+     struct timespec      now;
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+#else
+     return (unsigned long long)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+//
+//
 //        _plat__ClockAdjustRate()
 //
 //     Adjust the clock rate
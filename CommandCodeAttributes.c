@@ -80,17 +80,17 @@ CommandIsImplemented(
 //
 //     return a TPMA_CC structure for the given command code
 //
+//     s_ccAttr has an entry for each command code from TPM_CC_FIRST to TPM_CC_LAST, in order, so the
+//     attributes of a command are found by indexing it with the command code.
+//
 TPMA_CC
 CommandGetAttribute(
     TPM_CC                commandCode          // IN: command code
     )
 {
-    UINT32      size = sizeof(s_ccAttr) / sizeof(s_ccAttr[0]);
-    UINT32      i;
-    for(i = 0; i < size; i++) {
-        if(s_ccAttr[i].commandIndex == (UINT16) commandCode)
-            return s_ccAttr[i];
-    }
+    if(   commandCode >= TPM_CC_FIRST && commandCode <= TPM_CC_LAST
+       && s_ccAttr[commandCode - TPM_CC_FIRST].commandIndex == (UINT16) commandCode)
+        return s_ccAttr[commandCode - TPM_CC_FIRST];
     // This function should be called in the way that the command code
     // attribute is available.
     FAIL(FATAL_ERROR_INTERNAL);
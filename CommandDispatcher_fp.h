@@ -8,6 +8,42 @@
 #ifndef TPM2_COMMANDDISPATCHER_FP_H_
 #define TPM2_COMMANDDISPATCHER_FP_H_
 
+// Unmarshals a request handle. |allow_null| is passed to the unmarshaling
+// function of handle types that may be TPM_RH_NULL.
+typedef TPM_RC HANDLE_UNMARSHAL_FUNCTION(
+    TPM_HANDLE *handle,                // OUT: the handle
+    BYTE **buffer,                     // IN/OUT: the request
+    INT32 *size,                       // IN/OUT: bytes left in the request
+    BOOL allow_null                    // IN: TPM_RH_NULL is allowed
+    );
+
+// Unmarshals the parameters of a command, executes it and marshals the
+// response. This is the signature of the generated Exec_ functions.
+typedef TPM_RC COMMAND_EXEC_FUNCTION(
+    TPMI_ST_COMMAND_TAG tag,
+    BYTE **req_parameter_buffer,
+    INT32 *req_parameter_buffer_size,
+    TPM_HANDLE req_handles[],
+    UINT32 *res_handle_buffer_size,
+    UINT32 *res_parameter_buffer_size
+    );
+
+typedef struct {
+  HANDLE_UNMARSHAL_FUNCTION *unmarshal;  // NULL after the last handle
+  BOOL allow_null;
+} HANDLE_DESCRIPTOR;
+
+// A command of the generated command descriptor table.
+typedef struct {
+  COMMAND_EXEC_FUNCTION *exec;           // NULL if not implemented
+  HANDLE_DESCRIPTOR handles[MAX_HANDLE_NUM];
+} COMMAND_DESCRIPTOR;
+
+// The descriptor of command code c is g_commandDescriptors[c - TPM_CC_FIRST].
+// It is used by CommandDispatcher() and ParseHandleBuffer().
+extern const COMMAND_DESCRIPTOR
+    g_commandDescriptors[TPM_CC_LAST - TPM_CC_FIRST + 1];
+
 TPM_RC CommandDispatcher(
     TPMI_ST_COMMAND_TAG tag,           // IN: Input command tag
     TPM_CC command_code,               // IN: Command code
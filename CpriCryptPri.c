@@ -9,6 +9,16 @@
 
 #include "CryptoEngine.h"
 #include "OsslCryptoEngine.h"
+#ifdef TPM_MULTI_INSTANCE
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#include <pthread.h>
+#include <openssl/crypto.h>
+#endif
+//
+//     The crypto engine state is kept in the instance selected by the calling thread.
+//
+THREAD_LOCAL struct cpri_instance *g_cpriInstance;
+#endif // TPM_MULTI_INSTANCE
 static void Trap(const char *function, int line, int code);
 FAIL_FUNCTION       TpmFailFunction = (FAIL_FUNCTION)&Trap;
 //
@@ -92,3 +102,118 @@ _cpri__Startup(
 #endif     // TPM_ALG_ECC
               && _cpri__SymStartup());
 }
+#ifdef TPM_MULTI_INSTANCE
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+//
+//
+//          OpenSSL Locking
+//
+//     Before version 1.1, OpenSSL is only safe to call from several threads once the application has given it
+//     locks and a way to tell the threads apart. They are installed by the first _cpri__InstanceCreate().
+//
+static pthread_mutex_t     *s_opensslLocks;
+static pthread_once_t       s_opensslLocksOnce = PTHREAD_ONCE_INIT;
+static THREAD_LOCAL char    s_opensslThread;    // its address identifies the thread
+static void
+OpensslLock(
+   int                  mode,
+   int                  n,
+   const char          *file,
+   int                  line
+   )
+{
+   UNREFERENCED(file);
+   UNREFERENCED(line);
+   if(mode & CRYPTO_LOCK)
+       pthread_mutex_lock(&s_opensslLocks[n]);
+   else
+       pthread_mutex_unlock(&s_opensslLocks[n]);
+}
+static void
+OpensslThreadId(
+   CRYPTO_THREADID     *id
+   )
+{
+   CRYPTO_THREADID_set_pointer(id, &s_opensslThread);
+}
+static void
+OpensslLocksInstall(
+   void
+   )
+{
+   int                  i;
+   pthread_mutex_t     *locks = malloc(CRYPTO_num_locks() * sizeof(pthread_mutex_t));
+   if(locks == NULL)
+       return;
+   for(i = 0; i < CRYPTO_num_locks(); i++)
+       pthread_mutex_init(&locks[i], NULL);
+   s_opensslLocks = locks;
+   CRYPTO_THREADID_set_callback(OpensslThreadId);
+   CRYPTO_set_locking_callback(OpensslLock);
+}
+#endif // OPENSSL_VERSION_NUMBER
+//
+//
+//          _cpri__InstanceCreate()
+//
+//     This function creates the crypto engine state of a TPM instance.
+//
+//     Return Value                      Meaning
+//
+//     NULL                              out of memory
+//     not NULL                          the instance
+//
+LIB_EXPORT CPRI_INSTANCE *
+_cpri__InstanceCreate(
+   void
+   )
+{
+   CPRI_INSTANCE       *instance;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+   pthread_once(&s_opensslLocksOnce, OpensslLocksInstall);
+   if(s_opensslLocks == NULL)
+       return NULL;
+#endif
+   instance = calloc(1, sizeof(CPRI_INSTANCE));
+   if(instance == NULL)
+       return NULL;
+   instance->sym = SymInstanceCreate();
+   if(instance->sym == NULL)
+   {
+       free(instance);
+       return NULL;
+   }
+   return instance;
+}
+//
+//
+//          _cpri__InstanceDestroy()
+//
+//     This function frees the crypto engine state of a TPM instance.
+//
+LIB_EXPORT void
+_cpri__InstanceDestroy(
+   CPRI_INSTANCE       *instance
+   )
+{
+   if(instance == NULL)
+       return;
+   if(g_cpriInstance == instance)
+       g_cpriInstance = NULL;
+   SymInstanceDestroy(instance->sym);
+   free(instance);
+}
+//
+//
+//          _cpri__InstanceSelect()
+//
+//     This function selects the crypto engine state used by the calling thread.
+//
+LIB_EXPORT void
+_cpri__InstanceSelect(
+   CPRI_INSTANCE       *instance
+   )
+{
+   g_cpriInstance = instance;
+}
+#endif // TPM_MULTI_INSTANCE
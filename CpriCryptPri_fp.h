@@ -10,5 +10,11 @@
 LIB_EXPORT CRYPT_RESULT _cpri__InitCryptoUnits(FAIL_FUNCTION failFunction);
 LIB_EXPORT BOOL _cpri__Startup(void);
 LIB_EXPORT void _cpri__StopCryptoUnits(void);
+#ifdef TPM_MULTI_INSTANCE
+typedef struct cpri_instance CPRI_INSTANCE;
+LIB_EXPORT CPRI_INSTANCE *_cpri__InstanceCreate(void);
+LIB_EXPORT void _cpri__InstanceDestroy(CPRI_INSTANCE *instance);
+LIB_EXPORT void _cpri__InstanceSelect(CPRI_INSTANCE *instance);
+#endif  // TPM_MULTI_INSTANCE
 
 #endif  // __TPM2_CPRICRYPTPRI_FP_H
@@ -9,117 +9,171 @@
 
 #include     "OsslCryptoEngine.h"
 #include     "CpriHashData.c"
-#define OSSL_HASH_STATE_DATA_SIZE     (MAX_HASH_STATE_SIZE - 8)
+//
+//     The state of a hash is the context of the OpenSSL digest functions for the algorithm. It holds no
+//     pointers, so a sequence is kept in a CPRI_HASH_STATE and resumed from it without a conversion, and the
+//     digest functions use the instructions of the processor (SHA extensions, AVX2) that OpenSSL selects.
+//     inUse is cleared when there is no hash in progress.
+//
 typedef struct {
    union    {
-       EVP_MD_CTX context;
-       BYTE         data[OSSL_HASH_STATE_DATA_SIZE];
+#ifdef TPM_ALG_SHA1
+       SHA_CTX      sha1;
+#endif
+#if defined TPM_ALG_SHA256 || defined TPM_ALG_SM3_256
+       SHA256_CTX   sha256;
+#endif
+#if defined TPM_ALG_SHA384 || defined TPM_ALG_SHA512
+       SHA512_CTX   sha512;
+#endif
    } u;
-   INT16            copySize;
+   BOOL             inUse;
 } OSSL_HASH_STATE;
 //
-//     Temporary aliasing of SM3 to SHA256 until SM3 is available
 //
-#define EVP_sm3_256 EVP_sha256
+//          Static Functions
 //
+//          HashInit()
 //
-//          Static Functions
+//     This function starts a hash in state. SM3 is aliased to SHA256 until SM3 is available. The function
+//     puts the TPM into failure mode if the hash algorithm is not supported.
 //
-//          GetHashServer()
+//     Return Value                      Meaning
 //
-//     This function returns the address of the hash server function
+//     0                                 hash is TPM_ALG_NULL
+//     >0                                digest size
 //
-static EVP_MD *
-GetHashServer(
-     TPM_ALG_ID      hashAlg
-)
+static UINT16
+HashInit(
+    TPM_ALG_ID           hashAlg,           // IN: hash algorithm
+    OSSL_HASH_STATE     *state              // OUT: the started hash
+    )
 {
-   switch (hashAlg)
-   {
+    state->inUse = TRUE;
+    switch(hashAlg)
+    {
 #ifdef TPM_ALG_SHA1
-   case TPM_ALG_SHA1:
-       return (EVP_MD *)EVP_sha1();
-       break;
+    case TPM_ALG_SHA1:
+        SHA1_Init(&state->u.sha1);
+        return SHA_DIGEST_LENGTH;
 #endif
 #ifdef TPM_ALG_SHA256
-   case TPM_ALG_SHA256:
-       return (EVP_MD *)EVP_sha256();
-       break;
+    case TPM_ALG_SHA256:
+#endif
+#ifdef TPM_ALG_SM3_256
+    case TPM_ALG_SM3_256:
+#endif
+#if defined TPM_ALG_SHA256 || defined TPM_ALG_SM3_256
+        SHA256_Init(&state->u.sha256);
+        return SHA256_DIGEST_LENGTH;
 #endif
 #ifdef TPM_ALG_SHA384
-   case TPM_ALG_SHA384:
-       return (EVP_MD *)EVP_sha384();
-       break;
+    case TPM_ALG_SHA384:
+        SHA384_Init(&state->u.sha512);
+        return SHA384_DIGEST_LENGTH;
 #endif
 #ifdef TPM_ALG_SHA512
-   case TPM_ALG_SHA512:
-       return (EVP_MD *)EVP_sha512();
-       break;
-#endif
-#ifdef TPM_ALG_SM3_256
-   case TPM_ALG_SM3_256:
-       return (EVP_MD *)EVP_sm3_256();
-       break;
+    case TPM_ALG_SHA512:
+        SHA512_Init(&state->u.sha512);
+        return SHA512_DIGEST_LENGTH;
 #endif
-   case TPM_ALG_NULL:
-       return NULL;
-   default:
-       FAIL(FATAL_ERROR_INTERNAL);
-   }
-   return NULL; // Never reached.
+    case TPM_ALG_NULL:
+        break;
+    default:
+        FAIL(FATAL_ERROR_INTERNAL);
+    }
+    state->inUse = FALSE;
+    return 0;
 }
 //
 //
-//        MarshalHashState()
-//
-//     This function copies an OpenSSL() hash context into a caller provided buffer.
-//
-//     Return Value                     Meaning
+//          HashUpdate()
 //
-//     >0                               the number of bytes of buf used.
+//     This function adds data to a hash started by HashInit().
 //
-static UINT16
-MarshalHashState(
-    EVP_MD_CTX         *ctxt,               // IN: Context to marshal
-    BYTE               *buf                 // OUT: The buffer that will receive the
-                                            //     context. This buffer is at least
-                                            //     MAX_HASH_STATE_SIZE byte
+static void
+HashUpdate(
+    TPM_ALG_ID           hashAlg,           // IN: hash algorithm
+    OSSL_HASH_STATE     *state,             // IN/OUT: the hash
+    UINT32               dataSize,          // IN: the size of data
+    const BYTE          *data               // IN: data to be hashed
     )
 {
-    // make sure everything will fit
-    pAssert(ctxt->digest->ctx_size <= OSSL_HASH_STATE_DATA_SIZE);
-    // Copy the context data
-    memcpy(buf, (void*) ctxt->md_data, ctxt->digest->ctx_size);
-    return (UINT16)ctxt->digest->ctx_size;
+    switch(hashAlg)
+    {
+#ifdef TPM_ALG_SHA1
+    case TPM_ALG_SHA1:
+        SHA1_Update(&state->u.sha1, data, dataSize);
+        break;
+#endif
+#ifdef TPM_ALG_SHA256
+    case TPM_ALG_SHA256:
+#endif
+#ifdef TPM_ALG_SM3_256
+    case TPM_ALG_SM3_256:
+#endif
+#if defined TPM_ALG_SHA256 || defined TPM_ALG_SM3_256
+        SHA256_Update(&state->u.sha256, data, dataSize);
+        break;
+#endif
+#ifdef TPM_ALG_SHA384
+    case TPM_ALG_SHA384:
+        SHA384_Update(&state->u.sha512, data, dataSize);
+        break;
+#endif
+#ifdef TPM_ALG_SHA512
+    case TPM_ALG_SHA512:
+        SHA512_Update(&state->u.sha512, data, dataSize);
+        break;
+#endif
+    default:
+        FAIL(FATAL_ERROR_INTERNAL);
+    }
 }
 //
 //
-//        GetHashState()
+//          HashFinal()
 //
-//     This function will unmarshal a caller provided buffer into an OpenSSL() hash context. The function returns
-//     the number of bytes copied (which may be zero).
+//     This function completes a hash started by HashInit() and places the full digest in digest.
 //
-static UINT16
-GetHashState(
-    EVP_MD_CTX         *ctxt,               // OUT: The context structure to receive the
-                                            //     result of unmarshaling.
-    TPM_ALG_ID          algType,            // IN: The hash algorithm selector
-    BYTE               *buf                 // IN: Buffer containing marshaled hash data
+static void
+HashFinal(
+    TPM_ALG_ID           hashAlg,           // IN: hash algorithm
+    OSSL_HASH_STATE     *state,             // IN/OUT: the hash
+    BYTE                *digest             // OUT: the digest
     )
 {
-    EVP_MD             *evpmdAlgorithm = NULL;
-    pAssert(ctxt != NULL);
-    EVP_MD_CTX_init(ctxt);
-    evpmdAlgorithm = GetHashServer(algType);
-    if(evpmdAlgorithm == NULL)
-        return 0;
-    // This also allocates the ctxt->md_data
-    if((EVP_DigestInit_ex(ctxt, evpmdAlgorithm, NULL)) != 1)
+    state->inUse = FALSE;
+    switch(hashAlg)
+    {
+#ifdef TPM_ALG_SHA1
+    case TPM_ALG_SHA1:
+        SHA1_Final(digest, &state->u.sha1);
+        break;
+#endif
+#ifdef TPM_ALG_SHA256
+    case TPM_ALG_SHA256:
+#endif
+#ifdef TPM_ALG_SM3_256
+    case TPM_ALG_SM3_256:
+#endif
+#if defined TPM_ALG_SHA256 || defined TPM_ALG_SM3_256
+        SHA256_Final(digest, &state->u.sha256);
+        break;
+#endif
+#ifdef TPM_ALG_SHA384
+    case TPM_ALG_SHA384:
+        SHA384_Final(digest, &state->u.sha512);
+        break;
+#endif
+#ifdef TPM_ALG_SHA512
+    case TPM_ALG_SHA512:
+        SHA512_Final(digest, &state->u.sha512);
+        break;
+#endif
+    default:
         FAIL(FATAL_ERROR_INTERNAL);
-    pAssert(ctxt->digest->ctx_size < sizeof(ALIGNED_HASH_STATE));
-    memcpy(ctxt->md_data, buf, ctxt->digest->ctx_size);
-//
-    return (UINT16)ctxt->digest->ctx_size;
+    }
 }
 //
 //
@@ -160,11 +214,8 @@ _cpri__HashStartup(
     // On startup, make sure that the structure sizes are compatible. It would
     // be nice if this could be done at compile time but I couldn't figure it out.
     CPRI_HASH_STATE *cpriState = NULL;
-//     NUMBYTES        evpCtxSize = sizeof(EVP_MD_CTX);
     NUMBYTES        cpriStateSize = sizeof(cpriState->state);
-//     OSSL_HASH_STATE *osslState;
     NUMBYTES        osslStateSize = sizeof(OSSL_HASH_STATE);
-//     int             dataSize = sizeof(osslState->u.data);
     pAssert(cpriStateSize >= osslStateSize);
     return TRUE;
 }
@@ -272,23 +323,16 @@ _cpri__CopyHashState (
     CPRI_HASH_STATE         *in                    // IN: source of the state
     )
 {
-    OSSL_HASH_STATE    *i = (OSSL_HASH_STATE *)&in->state;
-    OSSL_HASH_STATE    *o = (OSSL_HASH_STATE *)&out->state;
-    pAssert(sizeof(i) <= sizeof(in->state));
-    EVP_MD_CTX_init(&o->u.context);
-    EVP_MD_CTX_copy_ex(&o->u.context, &i->u.context);
-    o->copySize = i->copySize;
-    out->hashAlg = in->hashAlg;
+    *out = *in;
     return sizeof(CPRI_HASH_STATE);
 }
 //
 //
 //         _cpri__StartHash()
 //
-//      Functions starts a hash stack Start a hash stack and returns the digest size. As a side effect, the value of
-//      stateSize in hashState is updated to indicate the number of bytes of state that were saved. This function
-//      calls GetHashServer() and that function will put the TPM into failure mode if the hash algorithm is not
-//      supported.
+//      Functions starts a hash stack Start a hash stack and returns the digest size. The state of a sequence is
+//      the same as that of a single hash, so it can be saved and resumed as it is. This function calls HashInit()
+//      and that function will put the TPM into failure mode if the hash algorithm is not supported.
 //
 //      Return Value                      Meaning
 //
@@ -302,46 +346,11 @@ _cpri__StartHash(
     CPRI_HASH_STATE         *hashState             // OUT: the state of hash stack.
     )
 {
-    EVP_MD_CTX           localState;
-   OSSL_HASH_STATE    *state = (OSSL_HASH_STATE *)&hashState->state;
-   BYTE               *stateData = state->u.data;
-   EVP_MD_CTX         *context;
-   EVP_MD             *evpmdAlgorithm = NULL;
-   UINT16              retVal = 0;
-   if(sequence)
-       context = &localState;
-   else
-       context = &state->u.context;
-   hashState->hashAlg = hashAlg;
-   EVP_MD_CTX_init(context);
-   evpmdAlgorithm = GetHashServer(hashAlg);
-   if(evpmdAlgorithm == NULL)
-       goto Cleanup;
-   if(EVP_DigestInit_ex(context, evpmdAlgorithm, NULL) != 1)
-       FAIL(FATAL_ERROR_INTERNAL);
-   retVal = (CRYPT_RESULT)EVP_MD_CTX_size(context);
-Cleanup:
-   if(retVal > 0)
-   {
-       if (sequence)
-       {
-            if((state->copySize = MarshalHashState(context, stateData)) == 0)
-            {
-                // If MarshalHashState returns a negative number, it is an error
-                // code and not a hash size so copy the error code to be the return
-                // from this function and set the actual stateSize to zero.
-                retVal = state->copySize;
-                state->copySize = 0;
-            }
-            // Do the cleanup
-            EVP_MD_CTX_cleanup(context);
-       }
-       else
-            state->copySize = -1;
-   }
-   else
-       state->copySize = 0;
-   return retVal;
+    OSSL_HASH_STATE    *state = (OSSL_HASH_STATE *)&hashState->state;
+    // A sequence and a single hash keep the same state
+    UNREFERENCED_PARAMETER(sequence);
+    hashState->hashAlg = hashAlg;
+    return HashInit(hashAlg, state);
 }
 //
 //
@@ -357,35 +366,11 @@ _cpri__UpdateHash(
    BYTE                      *data            // IN: data to be hashed
    )
 {
-   EVP_MD_CTX       localContext;
    OSSL_HASH_STATE *state = (OSSL_HASH_STATE *)&hashState->state;
-   BYTE            *stateData = state->u.data;
-   EVP_MD_CTX      *context;
-   CRYPT_RESULT     retVal = CRYPT_SUCCESS;
-//
     // If there is no context, return
-    if(state->copySize == 0)
+    if(!state->inUse)
         return;
-    if(state->copySize > 0)
-    {
-        context = &localContext;
-        if((retVal = GetHashState(context, hashState->hashAlg, stateData)) <= 0)
-            return;
-    }
-    else
-        context = &state->u.context;
-    if(EVP_DigestUpdate(context, data, dataSize) != 1)
-        FAIL(FATAL_ERROR_INTERNAL);
-    else if(    state->copySize > 0
-                && (retVal= MarshalHashState(context, stateData)) >= 0)
-    {
-        // retVal is the size of the marshaled data. Make sure that it is consistent
-        // by ensuring that we didn't get more than allowed
-        if(retVal < state->copySize)
-             FAIL(FATAL_ERROR_INTERNAL);
-        else
-             EVP_MD_CTX_cleanup(context);
-    }
+    HashUpdate(hashState->hashAlg, state, dataSize, data);
     return;
 }
 //
@@ -408,50 +393,21 @@ _cpri__CompleteHash(
     BYTE                    *dOut                   // OUT: hash digest
     )
 {
-    EVP_MD_CTX          localState;
     OSSL_HASH_STATE    *state = (OSSL_HASH_STATE *)&hashState->state;
-    BYTE               *stateData = state->u.data;
-    EVP_MD_CTX         *context;
-    UINT16              retVal;
-    int                 hLen;
+    UINT16              hLen;
     BYTE                temp[MAX_DIGEST_SIZE];
-    BYTE               *rBuffer = dOut;
-    if(state->copySize == 0)
+    if(!state->inUse)
         return 0;
-    if(state->copySize > 0)
+    hLen = _cpri__GetDigestSize(hashState->hashAlg);
+    if(hLen <= dOutSize)
     {
-        context = &localState;
-        if((retVal = GetHashState(context, hashState->hashAlg, stateData)) <= 0)
-            goto Cleanup;
+        HashFinal(hashState->hashAlg, state, dOut);
+        return hLen;
     }
-    else
-        context = &state->u.context;
-   hLen = EVP_MD_CTX_size(context);
-   if((unsigned)hLen > dOutSize)
-       rBuffer = temp;
-   if(EVP_DigestFinal_ex(context, rBuffer, NULL) == 1)
-   {
-       if(rBuffer != dOut)
-       {
-            if(dOut != NULL)
-            {
-                memcpy(dOut, temp, dOutSize);
-            }
-            retVal = (UINT16)dOutSize;
-       }
-       else
-       {
-            retVal = (UINT16)hLen;
-       }
-       state->copySize = 0;
-   }
-   else
-   {
-       retVal = 0; // Indicate that no data is returned
-   }
-Cleanup:
-   EVP_MD_CTX_cleanup(context);
-   return retVal;
+    HashFinal(hashState->hashAlg, state, temp);
+    if(dOut != NULL)
+        memcpy(dOut, temp, dOutSize);
+    return (UINT16)dOutSize;
 }
 //
 //
@@ -506,44 +462,25 @@ _cpri__HashBlock(
       BYTE              *digest              //   OUT: hash digest
       )
 {
-      EVP_MD_CTX        hashContext;
-      EVP_MD           *hashServer = NULL;
-      UINT16            retVal = 0;
+      OSSL_HASH_STATE   state;
       BYTE              b[MAX_DIGEST_SIZE]; // temp buffer in case digestSize not
       // a full digest
-      unsigned int      dSize = _cpri__GetDigestSize(hashAlg);
+      UINT16            dSize;
       // If there is no digest to compute return
-      if(dSize == 0)
+      if((dSize = HashInit(hashAlg, &state)) == 0)
           return 0;
-      // After the call to EVP_MD_CTX_init(), will need to call EVP_MD_CTX_cleanup()
-      EVP_MD_CTX_init(&hashContext);     // Initialize the local hash context
-      hashServer = GetHashServer(hashAlg); // Find the hash server
-      // It is an error if the digest size is non-zero but there is no                server
-      if(   (hashServer == NULL)
-         || (EVP_DigestInit_ex(&hashContext, hashServer, NULL) != 1)
-         || (EVP_DigestUpdate(&hashContext, data, dataSize) != 1))
-          FAIL(FATAL_ERROR_INTERNAL);
-      else
+      HashUpdate(hashAlg, &state, dataSize, data);
+      // If the size of the digest produced (dSize) is larger than the available
+      // buffer (digestSize), then put the digest in a temp buffer and only copy
+      // the most significant part into the available buffer.
+      if(dSize > digestSize)
       {
-          // If the size of the digest produced (dSize) is larger than                the available
-          // buffer (digestSize), then put the digest in a temp buffer                and only copy
-          // the most significant part into the available buffer.
-          if(dSize > digestSize)
-          {
-               if(EVP_DigestFinal_ex(&hashContext, b, &dSize) != 1)
-                   FAIL(FATAL_ERROR_INTERNAL);
-               memcpy(digest, b, digestSize);
-               retVal = (UINT16)digestSize;
-          }
-          else
-          {
-               if((EVP_DigestFinal_ex(&hashContext, digest, &dSize)) !=               1)
-                   FAIL(FATAL_ERROR_INTERNAL);
-               retVal = (UINT16) dSize;
-          }
+          HashFinal(hashAlg, &state, b);
+          memcpy(digest, b, digestSize);
+          return (UINT16)digestSize;
       }
-      EVP_MD_CTX_cleanup(&hashContext);
-      return retVal;
+      HashFinal(hashAlg, &state, digest);
+      return dSize;
 }
 //
 //
@@ -669,13 +606,11 @@ _cpri__MGF1(
    BYTE               *seed            //   IN: seed size
    )
 {
-   EVP_MD_CTX           hashContext;
-   EVP_MD              *hashServer = NULL;
+   OSSL_HASH_STATE      state;
    CRYPT_RESULT         retVal = 0;
    BYTE                 b[MAX_DIGEST_SIZE]; // temp buffer in case mask is not an
    // even multiple of a full digest
    CRYPT_RESULT         dSize = _cpri__GetDigestSize(hashAlg);
-   unsigned int         digestSize = (UINT32)dSize;
    UINT32               remaining;
    UINT32               counter;
    BYTE                 swappedCounter[4];
@@ -685,152 +620,36 @@ _cpri__MGF1(
    // If there is no digest to compute return
    if(dSize <= 0)
        return 0;
-   EVP_MD_CTX_init(&hashContext);     // Initialize the local hash context
-   hashServer = GetHashServer(hashAlg); // Find the hash server
-   if(hashServer == NULL)
-       // If there is no server, then there is no digest
-       return 0;
    for(counter = 0, remaining = mSize; remaining > 0; counter++)
    {
        // Because the system may be either Endian...
        UINT32_TO_BYTE_ARRAY(counter, swappedCounter);
         // Start the hash and include the seed and counter
-        if(    (EVP_DigestInit_ex(&hashContext, hashServer, NULL) != 1)
-            || (EVP_DigestUpdate(&hashContext, seed, sSize) != 1)
-            || (EVP_DigestUpdate(&hashContext, swappedCounter, 4) != 1)
-          )
-             FAIL(FATAL_ERROR_INTERNAL);
+        HashInit(hashAlg, &state);
+        HashUpdate(hashAlg, &state, sSize, seed);
+        HashUpdate(hashAlg, &state, 4, swappedCounter);
         // Handling the completion depends on how much space remains in the mask
         // buffer. If it can hold the entire digest, put it there. If not
         // put the digest in a temp buffer and only copy the amount that
         // will fit into the mask buffer.
         if(remaining < (unsigned)dSize)
         {
-             if(EVP_DigestFinal_ex(&hashContext, b, &digestSize) != 1)
-                 FAIL(FATAL_ERROR_INTERNAL);
+             HashFinal(hashAlg, &state, b);
              memcpy(mask, b, remaining);
              break;
         }
         else
         {
-             if(EVP_DigestFinal_ex(&hashContext, mask, &digestSize) != 1)
-                 FAIL(FATAL_ERROR_INTERNAL);
+             HashFinal(hashAlg, &state, mask);
              remaining -= dSize;
              mask = &mask[dSize];
         }
         retVal = (CRYPT_RESULT)mSize;
    }
-   EVP_MD_CTX_cleanup(&hashContext);
     return retVal;
 }
 //
 //
-//          _cpri_KDFa()
-//
-//      This function performs the key generation according to Part 1 of the TPM specification.
-//      This function returns the number of bytes generated which may be zero.
-//      The key and keyStream pointers are not allowed to be NULL. The other pointer values may be NULL.
-//      The value of sizeInBits must be no larger than (2^18)-1 = 256K bits (32385 bytes).
-//      The once parameter is set to allow incremental generation of a large value. If this flag is TRUE,
-//      sizeInBits will be used in the HMAC computation but only one iteration of the KDF is performed. This
-//      would be used for XOR obfuscation so that the mask value can be generated in digest-sized chunks
-//      rather than having to be generated all at once in an arbitrarily large buffer and then XORed() into the
-//      result. If once is TRUE, then sizeInBits must be a multiple of 8.
-//      Any error in the processing of this command is considered fatal.
-//
-//      Return Value                      Meaning
-//
-//      0                                 hash algorithm is not supported or is TPM_ALG_NULL
-//      >0                                the number of bytes in the keyStream buffer
-//
-LIB_EXPORT UINT16
-_cpri__KDFa(
-    TPM_ALG_ID          hashAlg,             //   IN: hash algorithm used in HMAC
-    TPM2B              *key,                 //   IN: HMAC key
-    const char         *label,               //   IN: a 0-byte terminated label used in KDF
-    TPM2B              *contextU,            //   IN: context U
-    TPM2B              *contextV,            //   IN: context V
-    UINT32              sizeInBits,          //   IN: size of generated key in bit
-    BYTE               *keyStream,           //   OUT: key buffer
-    UINT32             *counterInOut,        //   IN/OUT: caller may provide the iteration
-                                             //       counter for incremental operations to
-                                             //       avoid large intermediate buffers.
-    BOOL                once                 //   IN: TRUE if only one iteration is performed
-                                             //       FALSE if iteration count determined by
-                                             //       "sizeInBits"
-    )
-{
-    UINT32                         counter = 0;    // counter value
-    INT32                          lLen = 0;       // length of the label
-    INT16                          hLen;           // length of the hash
-    INT16                          bytes;          // number of bytes to produce
-    BYTE                          *stream = keyStream;
-    BYTE                           marshaledUint32[4];
-    CPRI_HASH_STATE                hashState;
-    TPM2B_MAX_HASH_BLOCK           hmacKey;
-    pAssert(key != NULL && keyStream != NULL);
-    pAssert(once == FALSE || (sizeInBits & 7) == 0);
-    if(counterInOut != NULL)
-        counter = *counterInOut;
-    // Prepare label buffer. Calculate its size and keep the last 0 byte
-    if(label != NULL)
-        for(lLen = 0; label[lLen++] != 0; );
-    // Get the hash size. If it is less than or 0, either the
-    // algorithm is not supported or the hash is TPM_ALG_NULL
-//
-   // In either case the digest size is zero. This is the only return
-   // other than the one at the end. All other exits from this function
-   // are fatal errors. After we check that the algorithm is supported
-   // anything else that goes wrong is an implementation flaw.
-   if((hLen = (INT16) _cpri__GetDigestSize(hashAlg)) == 0)
-       return 0;
-   // If the size of the request is larger than the numbers will handle,
-   // it is a fatal error.
-   pAssert(((sizeInBits + 7)/ 8) <= INT16_MAX);
-   bytes = once ? hLen : (INT16)((sizeInBits + 7) / 8);
-   // Generate required bytes
-   for (; bytes > 0; stream = &stream[hLen], bytes = bytes - hLen)
-   {
-       if(bytes < hLen)
-           hLen = bytes;
-        counter++;
-        // Start HMAC
-        if(_cpri__StartHMAC(hashAlg,
-                            FALSE,
-                            &hashState,
-                            key->size,
-                            &key->buffer[0],
-                            &hmacKey.b)          <= 0)
-            FAIL(FATAL_ERROR_INTERNAL);
-        // Adding counter
-        UINT32_TO_BYTE_ARRAY(counter, marshaledUint32);
-        _cpri__UpdateHash(&hashState, sizeof(UINT32), marshaledUint32);
-        // Adding label
-        if(label != NULL)
-            _cpri__UpdateHash(&hashState,   lLen, (BYTE *)label);
-        // Adding contextU
-        if(contextU != NULL)
-            _cpri__UpdateHash(&hashState, contextU->size, contextU->buffer);
-        // Adding contextV
-        if(contextV != NULL)
-            _cpri__UpdateHash(&hashState, contextV->size, contextV->buffer);
-        // Adding size in bits
-        UINT32_TO_BYTE_ARRAY(sizeInBits, marshaledUint32);
-        _cpri__UpdateHash(&hashState, sizeof(UINT32), marshaledUint32);
-        // Compute HMAC. At the start of each iteration, hLen is set
-        // to the smaller of hLen and bytes. This causes bytes to decrement
-        // exactly to zero to complete the loop
-        _cpri__CompleteHMAC(&hashState, &hmacKey.b, hLen, stream);
-   }
-   // Mask off bits if the required bits is not a multiple of byte size
-   if((sizeInBits % 8) != 0)
-       keyStream[0] &= ((1 << (sizeInBits % 8)) - 1);
-   if(counterInOut != NULL)
-       *counterInOut = counter;
-   return (CRYPT_RESULT)((sizeInBits + 7)/8);
-}
-//
-//
 //
 //         _cpri__KDFe()
 //
@@ -45,6 +45,23 @@ _cpri__KDFa(TPM_ALG_ID hashAlg,  //   IN: hash algorithm used in HMAC
                        //   iteration count determined by "sizeInBits"
             );
 LIB_EXPORT UINT16
+_cpri__KDFaStart(KDFa_STREAM *kdf,      //   OUT: the stream to start
+                 TPM_ALG_ID hashAlg,    //   IN: hash algorithm used in HMAC
+                 TPM2B *key,            //   IN: HMAC key
+                 const char *label,     //   IN: a 0-byte terminated label used in KDF
+                 TPM2B *contextU,       //   IN: context U
+                 TPM2B *contextV,       //   IN: context V
+                 UINT32 sizeInBits      //   IN: size of generated key in bit
+                 );
+LIB_EXPORT UINT16
+_cpri__KDFaNext(KDFa_STREAM *kdf,  //   IN/OUT: the stream
+                UINT16 size,       //   IN: the number of bytes wanted
+                BYTE *stream       //   OUT: the next bytes of the stream
+                );
+LIB_EXPORT void
+_cpri__KDFaEnd(KDFa_STREAM *kdf  //   IN/OUT: the stream to close
+               );
+LIB_EXPORT UINT16
 _cpri__KDFe(TPM_ALG_ID hashAlg,  //   IN: hash algorithm used in HMAC
             TPM2B *Z,            //   IN: Z
             const char *label,   //   IN: a 0 terminated label using in KDF
@@ -0,0 +1,185 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include     "CryptoEngine.h"
+//
+//     The KDFa() of Part 1 of the TPM specification. It only uses the hash functions of the CryptoEngine(), so
+//     the OpenSSL engine and the embedded one share it.
+//
+//
+//          _cpri__KDFaStart()
+//
+//      This function starts a KDFa() stream. The HMAC is keyed with key here and each block of the stream
+//      is produced by _cpri__KDFaNext() from a copy of the keyed states. The key may be discarded after this
+//      call, but label, contextU and contextV are used by every block and have to stay until
+//      _cpri__KDFaEnd(). The counter of the first block is one unless the caller sets kdf->counter.
+//
+//      Return Value                      Meaning
+//
+//      0                                 hash algorithm is not supported or is TPM_ALG_NULL
+//      >0                                the digest size of the algorithm
+//
+LIB_EXPORT UINT16
+_cpri__KDFaStart(
+    KDFa_STREAM        *kdf,                 //   OUT: the stream to start
+    TPM_ALG_ID          hashAlg,             //   IN: hash algorithm used in HMAC
+    TPM2B              *key,                 //   IN: HMAC key
+    const char         *label,               //   IN: a 0-byte terminated label used in KDF
+    TPM2B              *contextU,            //   IN: context U
+    TPM2B              *contextV,            //   IN: context V
+    UINT32              sizeInBits           //   IN: size of generated key in bit
+    )
+{
+    TPM2B_MAX_HASH_BLOCK           oPadKey;
+    pAssert(kdf != NULL && key != NULL);
+    if((kdf->digestSize = _cpri__GetDigestSize(hashAlg)) == 0)
+        return 0;
+    // Key the HMAC once
+    if(_cpri__StartHMAC(hashAlg, FALSE, &kdf->iPadState, key->size,
+                        key->buffer, &oPadKey.b) == 0)
+        FAIL(FATAL_ERROR_INTERNAL);
+    _cpri__StartHash(hashAlg, FALSE, &kdf->oPadState);
+    _cpri__UpdateHash(&kdf->oPadState, oPadKey.t.size, oPadKey.t.buffer);
+    // Keep the label size with its last 0 byte
+    kdf->labelSize = 0;
+    if(label != NULL)
+        for(kdf->labelSize = 0; label[kdf->labelSize++] != 0; );
+    kdf->label = label;
+    kdf->contextU = contextU;
+    kdf->contextV = contextV;
+    kdf->sizeInBits = sizeInBits;
+    kdf->counter = 0;
+    return kdf->digestSize;
+}
+//
+//
+//          _cpri__KDFaNext()
+//
+//      This function produces the next block of a KDFa() stream. It returns the first size bytes of the block,
+//      or the whole block if size is larger than the digest.
+//
+//      Return Value                      Meaning
+//
+//      >0                                the number of bytes placed in stream
+//
+LIB_EXPORT UINT16
+_cpri__KDFaNext(
+    KDFa_STREAM        *kdf,                 //   IN/OUT: the stream
+    UINT16              size,                //   IN: the number of bytes wanted
+    BYTE               *stream               //   OUT: the next bytes of the stream
+    )
+{
+    CPRI_HASH_STATE                hashState;
+    BYTE                           marshaledUint32[4];
+    BYTE                           inner[MAX_DIGEST_SIZE];
+    if(size > kdf->digestSize)
+        size = kdf->digestSize;
+    kdf->counter++;
+    // Start from the keyed iPad state
+    _cpri__CopyHashState(&hashState, &kdf->iPadState);
+    // Adding counter
+    UINT32_TO_BYTE_ARRAY(kdf->counter, marshaledUint32);
+    _cpri__UpdateHash(&hashState, sizeof(UINT32), marshaledUint32);
+    // Adding label
+    if(kdf->label != NULL)
+        _cpri__UpdateHash(&hashState, kdf->labelSize, (BYTE *)kdf->label);
+    // Adding contextU
+    if(kdf->contextU != NULL)
+        _cpri__UpdateHash(&hashState, kdf->contextU->size, kdf->contextU->buffer);
+    // Adding contextV
+    if(kdf->contextV != NULL)
+        _cpri__UpdateHash(&hashState, kdf->contextV->size, kdf->contextV->buffer);
+    // Adding size in bits
+    UINT32_TO_BYTE_ARRAY(kdf->sizeInBits, marshaledUint32);
+    _cpri__UpdateHash(&hashState, sizeof(UINT32), marshaledUint32);
+    _cpri__CompleteHash(&hashState, kdf->digestSize, inner);
+    // Finish the HMAC from the keyed oPad state
+    _cpri__CopyHashState(&hashState, &kdf->oPadState);
+    _cpri__UpdateHash(&hashState, kdf->digestSize, inner);
+    return _cpri__CompleteHash(&hashState, size, stream);
+}
+//
+//
+//          _cpri__KDFaEnd()
+//
+//      This function closes a KDFa() stream started by _cpri__KDFaStart().
+//
+LIB_EXPORT void
+_cpri__KDFaEnd(
+    KDFa_STREAM        *kdf                  //   IN/OUT: the stream to close
+    )
+{
+    if(kdf != NULL && kdf->digestSize != 0)
+    {
+        _cpri__CompleteHash(&kdf->iPadState, 0, NULL);
+        _cpri__CompleteHash(&kdf->oPadState, 0, NULL);
+    }
+}
+//
+//
+//          _cpri_KDFa()
+//
+//      This function performs the key generation according to Part 1 of the TPM specification.
+//      This function returns the number of bytes generated which may be zero.
+//      The key and keyStream pointers are not allowed to be NULL. The other pointer values may be NULL.
+//      The value of sizeInBits must be no larger than (2^18)-1 = 256K bits (32385 bytes).
+//      The once parameter is set to allow incremental generation of a large value. If this flag is TRUE,
+//      sizeInBits will be used in the HMAC computation but only one iteration of the KDF is performed. This
+//      would be used for XOR obfuscation so that the mask value can be generated in digest-sized chunks
+//      rather than having to be generated all at once in an arbitrarily large buffer and then XORed() into the
+//      result. If once is TRUE, then sizeInBits must be a multiple of 8.
+//      Any error in the processing of this command is considered fatal.
+//
+//      Return Value                      Meaning
+//
+//      0                                 hash algorithm is not supported or is TPM_ALG_NULL
+//      >0                                the number of bytes in the keyStream buffer
+//
+LIB_EXPORT UINT16
+_cpri__KDFa(
+    TPM_ALG_ID          hashAlg,             //   IN: hash algorithm used in HMAC
+    TPM2B              *key,                 //   IN: HMAC key
+    const char         *label,               //   IN: a 0-byte terminated label used in KDF
+    TPM2B              *contextU,            //   IN: context U
+    TPM2B              *contextV,            //   IN: context V
+    UINT32              sizeInBits,          //   IN: size of generated key in bit
+    BYTE               *keyStream,           //   OUT: key buffer
+    UINT32             *counterInOut,        //   IN/OUT: caller may provide the iteration
+                                             //       counter for incremental operations to
+                                             //       avoid large intermediate buffers.
+    BOOL                once                 //   IN: TRUE if only one iteration is performed
+                                             //       FALSE if iteration count determined by
+                                             //       "sizeInBits"
+    )
+{
+    KDFa_STREAM                    kdf;
+    INT16                          hLen;           // length of the hash
+    INT16                          bytes;          // number of bytes to produce
+    BYTE                          *stream = keyStream;
+    pAssert(key != NULL && keyStream != NULL);
+    pAssert(once == FALSE || (sizeInBits & 7) == 0);
+    // Get the hash size. If it is 0, either the algorithm is not supported or
+    // the hash is TPM_ALG_NULL. In either case the digest size is zero. This is
+    // the only return other than the one at the end. All other exits from this
+    // function are fatal errors.
+    if((hLen = (INT16) _cpri__KDFaStart(&kdf, hashAlg, key, label, contextU,
+                                        contextV, sizeInBits)) == 0)
+        return 0;
+    if(counterInOut != NULL)
+        kdf.counter = *counterInOut;
+    // If the size of the request is larger than the numbers will handle,
+    // it is a fatal error.
+    pAssert(((sizeInBits + 7)/ 8) <= INT16_MAX);
+    bytes = once ? hLen : (INT16)((sizeInBits + 7) / 8);
+    // Generate required bytes. The last block is cut to the bytes that remain.
+    for(; bytes > 0; bytes = bytes - hLen)
+        stream = &stream[_cpri__KDFaNext(&kdf, (UINT16)bytes, stream)];
+    _cpri__KDFaEnd(&kdf);
+    // Mask off bits if the required bits is not a multiple of byte size
+    if((sizeInBits % 8) != 0)
+        keyStream[0] &= ((1 << (sizeInBits % 8)) - 1);
+    if(counterInOut != NULL)
+        *counterInOut = kdf.counter;
+    return (CRYPT_RESULT)((sizeInBits + 7)/8);
+}
@@ -15,7 +15,9 @@
 //          Includes
 //
 #include "OsslCryptoEngine.h"
+#ifndef TPM_MULTI_INSTANCE
 int         s_entropyFailure;
+#endif
 //
 //
 //          Functions
@@ -5,6 +5,9 @@
 // Level 00 Revision 01.16
 // October 30, 2014
 
+#include <stdlib.h>
+#include <string.h>
+
 #include       "OsslCryptoEngine.h"
 //
 //     The following sets of defines are used to allow use of the SM4 algorithm identifier while waiting for the
@@ -16,16 +19,134 @@ typedef   AES_KEY SM4_KEY;
 #define   SM4_decrypt                    AES_decrypt
 #define   SM4_encrypt                    AES_encrypt
 //
+//     The AES functions use the EVP ciphers of OpenSSL. These use the AES instructions of the processor when
+//     it has them, and they work on several blocks at a time in the modes that allow it (CTR, ECB and CBC
+//     decryption). The expanded key of each cipher is kept in a small cache of the recently used keys, so that a
+//     key that is used again, like the context encryption key, is not expanded again. The cache is cleared by
+//     _cpri__SymStartup(). With TPM_MULTI_INSTANCE, each instance has its own cache.
+//
+typedef enum
+{
+   AES_ECB_ENCRYPT,
+   AES_ECB_DECRYPT,
+   AES_CBC_ENCRYPT,
+   AES_CBC_DECRYPT,
+   AES_CFB_ENCRYPT,
+   AES_CFB_DECRYPT,
+   AES_CTR,
+   AES_OFB,
+   AES_MODE_COUNT
+} AES_MODE;
+#define AES_KEY_CACHE_SIZE      4
+typedef struct
+{
+   UINT32               keySizeInBits;      // 0 when the entry is free
+   BYTE                 key[MAX_AES_KEY_BYTES];
+   UINT32               lastUse;
+   EVP_CIPHER_CTX      *ctx[AES_MODE_COUNT];
+} AES_KEY_CACHE_ENTRY;
+#ifndef TPM_MULTI_INSTANCE
+static AES_KEY_CACHE_ENTRY   s_aesKeyCache[AES_KEY_CACHE_SIZE];
+static UINT32                s_aesKeyCacheUse;
+#endif
+//
+//     The ciphers of each mode for 128, 192 and 256-bit keys
+//
+static const EVP_CIPHER *(* const s_aesCiphers[AES_MODE_COUNT][3])(void) =
+{
+   {EVP_aes_128_ecb,    EVP_aes_192_ecb,    EVP_aes_256_ecb},       // AES_ECB_ENCRYPT
+   {EVP_aes_128_ecb,    EVP_aes_192_ecb,    EVP_aes_256_ecb},       // AES_ECB_DECRYPT
+   {EVP_aes_128_cbc,    EVP_aes_192_cbc,    EVP_aes_256_cbc},       // AES_CBC_ENCRYPT
+   {EVP_aes_128_cbc,    EVP_aes_192_cbc,    EVP_aes_256_cbc},       // AES_CBC_DECRYPT
+   {EVP_aes_128_cfb128, EVP_aes_192_cfb128, EVP_aes_256_cfb128},    // AES_CFB_ENCRYPT
+   {EVP_aes_128_cfb128, EVP_aes_192_cfb128, EVP_aes_256_cfb128},    // AES_CFB_DECRYPT
+   {EVP_aes_128_ctr,    EVP_aes_192_ctr,    EVP_aes_256_ctr},       // AES_CTR
+   {EVP_aes_128_ofb,    EVP_aes_192_ofb,    EVP_aes_256_ofb}        // AES_OFB
+};
+//
+//
+//      AesKeyCacheFree()
+//
+//     This function frees the cipher contexts of a cache entry and clears its key.
+//
+static void
+AesKeyCacheFree(
+   AES_KEY_CACHE_ENTRY     *entry           // IN/OUT: the entry to free
+   )
+{
+   int              i;
+   for(i = 0; i < AES_MODE_COUNT; i++)
+       if(entry->ctx[i] != NULL)
+           EVP_CIPHER_CTX_free(entry->ctx[i]);
+   OPENSSL_cleanse(entry, sizeof(*entry));
+}
+#ifdef TPM_MULTI_INSTANCE
+//
+//     With TPM_MULTI_INSTANCE, the cache is kept in the sym_state of the crypto engine instance selected by
+//     the calling thread.
+//
+struct sym_state
+{
+   AES_KEY_CACHE_ENTRY      s_aesKeyCache[AES_KEY_CACHE_SIZE];
+   UINT32                   s_aesKeyCacheUse;
+};
+//
+//
+//      SymInstanceCreate()
+//
+//     This function allocates the symmetric cipher state of a crypto engine instance.
+//
+//     Return Value                      Meaning
+//
+//     NULL                              out of memory
+//     not NULL                          the state
+//
+struct sym_state *
+SymInstanceCreate(
+   void
+   )
+{
+   return calloc(1, sizeof(struct sym_state));
+}
+//
+//
+//      SymInstanceDestroy()
+//
+//     This function frees the symmetric cipher state of a crypto engine instance and the cipher contexts
+//     in its cache.
+//
+void
+SymInstanceDestroy(
+   struct sym_state        *sym
+   )
+{
+   int              i;
+   if(sym == NULL)
+       return;
+   for(i = 0; i < AES_KEY_CACHE_SIZE; i++)
+       AesKeyCacheFree(&sym->s_aesKeyCache[i]);
+   free(sym);
+}
+#define s_aesKeyCache           (g_cpriInstance->sym->s_aesKeyCache)
+#define s_aesKeyCacheUse        (g_cpriInstance->sym->s_aesKeyCacheUse)
+#endif // TPM_MULTI_INSTANCE
+//
 //
 //      Utility Functions
 //
 //      _cpri_SymStartup()
 //
+//     This function clears the cache of the AES key schedules.
+//
 LIB_EXPORT BOOL
 _cpri__SymStartup(
       void
 )
 {
+      int       i;
+      for(i = 0; i < AES_KEY_CACHE_SIZE; i++)
+          AesKeyCacheFree(&s_aesKeyCache[i]);
+      s_aesKeyCacheUse = 0;
       return TRUE;
 }
 //
@@ -67,6 +188,88 @@ _cpri__GetSymmetricBlockSize(
 //
 //      AES Encryption
 //
+//
+//      AesContext()
+//
+//     This function returns the cipher context of a key for a mode. The context is taken from the cache when
+//     the key was used before; otherwise, the least recently used key of the cache is replaced. The caller sets
+//     the IV of the context before using it.
+//
+static EVP_CIPHER_CTX *
+AesContext(
+   UINT32               keySizeInBits,      // IN: key size in bit
+   BYTE                *key,                // IN: key buffer
+   AES_MODE             mode                // IN: the mode and direction
+   )
+{
+   AES_KEY_CACHE_ENTRY     *entry = NULL;
+   EVP_CIPHER_CTX          *ctx;
+   UINT32                   keySize = (keySizeInBits + 7) / 8;
+   int                      i;
+   if(keySize > MAX_AES_KEY_BYTES)
+       FAIL(FATAL_ERROR_INTERNAL);
+   for(i = 0; i < AES_KEY_CACHE_SIZE; i++)
+   {
+       if(   s_aesKeyCache[i].keySizeInBits == keySizeInBits
+          && memcmp(s_aesKeyCache[i].key, key, keySize) == 0)
+       {
+           entry = &s_aesKeyCache[i];
+           break;
+       }
+   }
+   if(entry == NULL)
+   {
+       // Replace the least recently used key. A free entry has not been used.
+       entry = &s_aesKeyCache[0];
+       for(i = 1; i < AES_KEY_CACHE_SIZE; i++)
+           if(s_aesKeyCache[i].lastUse < entry->lastUse)
+               entry = &s_aesKeyCache[i];
+       AesKeyCacheFree(entry);
+       entry->keySizeInBits = keySizeInBits;
+       memcpy(entry->key, key, keySize);
+   }
+   entry->lastUse = ++s_aesKeyCacheUse;
+   if(entry->ctx[mode] == NULL)
+   {
+       // Create the key schedule of the mode
+       if(keySizeInBits != 128 && keySizeInBits != 192 && keySizeInBits != 256)
+           FAIL(FATAL_ERROR_INTERNAL);
+       if((ctx = EVP_CIPHER_CTX_new()) == NULL)
+           FAIL(FATAL_ERROR_INTERNAL);
+       if(EVP_CipherInit_ex(ctx, s_aesCiphers[mode][(keySizeInBits - 128) / 64](),
+                            NULL, key, NULL,
+                            mode != AES_ECB_DECRYPT && mode != AES_CBC_DECRYPT
+                            && mode != AES_CFB_DECRYPT) != 1)
+           FAIL(FATAL_ERROR_INTERNAL);
+       EVP_CIPHER_CTX_set_padding(ctx, 0);
+       entry->ctx[mode] = ctx;
+   }
+   return entry->ctx[mode];
+}
+//
+//
+//      AesCrypt()
+//
+//     This function starts the cipher of ctx again with iv and runs it over dIn into dOut, which may be the
+//     same buffer.
+//
+static void
+AesCrypt(
+   EVP_CIPHER_CTX      *ctx,                // IN: cipher context from AesContext()
+   BYTE                *iv,                 // IN: IV, or NULL for ECB
+   BYTE                *dOut,               // OUT: the output data
+   INT32                dSize,              // IN: data size
+   BYTE                *dIn                 // IN: the input data
+   )
+{
+   int              outSize;
+   if(   EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, -1) != 1
+      || EVP_CipherUpdate(ctx, dOut, &outSize, dIn, dSize) != 1
+      || outSize != dSize)
+       FAIL(FATAL_ERROR_INTERNAL);
+}
+//
+//
 //      _cpri__AESEncryptCBC()
 //
 //     This function performs AES encryption in CBC chain mode. The input dIn buffer is encrypted into dOut.
@@ -90,10 +293,7 @@ _cpri__AESEncryptCBC(
     BYTE                *dIn            // IN: data buffer
     )
 {
-    AES_KEY         AesKey;
-    BYTE           *pIv;
     INT32           dSize;              // Need a signed version
-    int             i;
     pAssert(dOut != NULL && key != NULL && iv != NULL && dIn != NULL);
     if(dInSize == 0)
         return CRYPT_SUCCESS;
@@ -103,21 +303,9 @@ _cpri__AESEncryptCBC(
     // cipher block size
     if((dSize % 16) != 0)
         return CRYPT_PARAMETER;
-    // Create AES encrypt key schedule
-    if (AES_set_encrypt_key(key, keySizeInBits, &AesKey) != 0)
-        FAIL(FATAL_ERROR_INTERNAL);
-    // XOR the data block into the IV, encrypt the IV into the IV
-    // and then copy the IV to the output
-    for(; dSize > 0; dSize -= 16)
-    {
-         pIv = iv;
-         for(i = 16; i > 0; i--)
-             *pIv++ ^= *dIn++;
-         AES_encrypt(iv, iv, &AesKey);
-         pIv = iv;
-         for(i = 16; i > 0; i--)
-             *dOut++ = *pIv++;
-    }
+    AesCrypt(AesContext(keySizeInBits, key, AES_CBC_ENCRYPT), iv, dOut, dSize, dIn);
+    // The last cipher text block is the IV of the next block
+    memcpy(iv, &dOut[dSize - 16], 16);
     return CRYPT_SUCCESS;
 }
 //
@@ -145,11 +333,7 @@ _cpri__AESDecryptCBC(
     BYTE                *dIn            // IN: data buffer
     )
 {
-    AES_KEY         AesKey;
-    BYTE           *pIv;
-    int             i;
     BYTE            tmp[16];
-    BYTE           *pT = NULL;
     INT32           dSize;
     pAssert(dOut != NULL && key != NULL && iv != NULL && dIn != NULL);
     if(dInSize == 0)
@@ -160,27 +344,11 @@ _cpri__AESDecryptCBC(
     // cipher block size
     if((dSize % 16) != 0)
         return CRYPT_PARAMETER;
-    // Create AES key schedule
-    if (AES_set_decrypt_key(key, keySizeInBits, &AesKey) != 0)
-        FAIL(FATAL_ERROR_INTERNAL);
-    // Copy the input data to a temp buffer, decrypt the buffer into the output;
-    // XOR in the IV, and copy the temp buffer to the IV and repeat.
-    for(; dSize > 0; dSize -= 16)
-    {
-//
-        pT = tmp;
-        for(i = 16; i> 0; i--)
-            *pT++ = *dIn++;
-        AES_decrypt(tmp, dOut, &AesKey);
-        pIv = iv;
-        pT = tmp;
-        for(i = 16; i> 0; i--)
-        {
-            *dOut++ ^= *pIv;
-            *pIv++ = *pT++;
-        }
-   }
-   return CRYPT_SUCCESS;
+    // Keep the last cipher text block for the IV, in case dIn is dOut
+    memcpy(tmp, &dIn[dSize - 16], 16);
+    AesCrypt(AesContext(keySizeInBits, key, AES_CBC_DECRYPT), iv, dOut, dSize, dIn);
+    memcpy(iv, tmp, 16);
+    return CRYPT_SUCCESS;
 }
 //
 //
@@ -205,34 +373,19 @@ _cpri__AESEncryptCFB(
    BYTE                *dIn            // IN: data buffer
    )
 {
-   BYTE           *pIv = NULL;
-   AES_KEY         AesKey;
    INT32           dSize;               // Need a signed version of dInSize
-   int             i;
+   INT32           last;                // bytes in the last block
    pAssert(dOut != NULL && key != NULL && iv != NULL && dIn != NULL);
    if(dInSize == 0)
        return CRYPT_SUCCESS;
    pAssert(dInSize <= INT32_MAX);
    dSize = (INT32)dInSize;
-   // Create AES encryption key schedule
-   if (AES_set_encrypt_key(key, keySizeInBits, &AesKey) != 0)
-       FAIL(FATAL_ERROR_INTERNAL);
-   // Encrypt the IV into the IV, XOR in the data, and copy to output
-   for(; dSize > 0; dSize -= 16)
-   {
-       // Encrypt the current value of the IV
-       AES_encrypt(iv, iv, &AesKey);
-       pIv = iv;
-       for(i = (int)(dSize < 16) ? dSize : 16; i > 0; i--)
-           // XOR the data into the IV to create the cipher text
-           // and put into the output
-           *dOut++ = *pIv++ ^= *dIn++;
-   }
-   // If the inner loop (i loop) was smaller than 16, then dSize would have been
-   // smaller than 16 and it is now negative. If it is negative, then it indicates
-   // how many bytes are needed to pad out the IV for the next round.
-   for(; dSize < 0; dSize++)
-       *pIv++ = 0;
+   AesCrypt(AesContext(keySizeInBits, key, AES_CFB_ENCRYPT), iv, dOut, dSize, dIn);
+   // The IV for the next round is the last cipher text block. If that block is
+   // not full, it is padded with zeros.
+   last = ((dSize - 1) % 16) + 1;
+   memset(iv, 0, 16);
+   memcpy(iv, &dOut[dSize - last], last);
    return CRYPT_SUCCESS;
 }
 //
@@ -259,37 +412,21 @@ _cpri__AESDecryptCFB(
    BYTE                *dIn            // IN: data buffer
    )
 {
-   BYTE           *pIv = NULL;
    BYTE            tmp[16];
-   int             i;
-   BYTE           *pT;
-   AES_KEY         AesKey;
    INT32           dSize;
+   INT32           last;                // bytes in the last block
    pAssert(dOut != NULL && key != NULL && iv != NULL && dIn != NULL);
    if(dInSize == 0)
        return CRYPT_SUCCESS;
    pAssert(dInSize <= INT32_MAX);
    dSize = (INT32)dInSize;
-   // Create AES encryption key schedule
-   if (AES_set_encrypt_key(key, keySizeInBits, &AesKey) != 0)
-       FAIL(FATAL_ERROR_INTERNAL);
-   for(; dSize > 0; dSize -= 16)
-   {
-       // Encrypt the IV into the temp buffer
-       AES_encrypt(iv, tmp, &AesKey);
-       pT = tmp;
-       pIv = iv;
-       for(i = (dSize < 16) ? dSize : 16; i > 0; i--)
-           // Copy the current cipher text to IV, XOR
-           // with the temp buffer and put into the output
-           *dOut++ = *pT++ ^ (*pIv++ = *dIn++);
-   }
-   // If the inner loop (i loop) was smaller than 16, then dSize
-   // would have been smaller than 16 and it is now negative
-   // If it is negative, then it indicates how may fill bytes
-   // are needed to pad out the IV for the next round.
-   for(; dSize < 0; dSize++)
-       *pIv++ = 0;
+   // Keep the last cipher text block, padded with zeros, for the IV of the
+   // next round, in case dIn is dOut
+   last = ((dSize - 1) % 16) + 1;
+   memset(tmp, 0, 16);
+   memcpy(tmp, &dIn[dSize - last], last);
+   AesCrypt(AesContext(keySizeInBits, key, AES_CFB_DECRYPT), iv, dOut, dSize, dIn);
+   memcpy(iv, tmp, 16);
    return CRYPT_SUCCESS;
 }
 //
@@ -315,9 +452,7 @@ _cpri__AESEncryptCTR(
    BYTE                *dIn            // IN: data buffer
    )
 {
-   BYTE            tmp[16];
-   BYTE           *pT;
-   AES_KEY         AesKey;
+   UINT32          carry;
    int             i;
    INT32           dSize;
    pAssert(dOut != NULL && key != NULL && iv != NULL && dIn != NULL);
@@ -325,21 +460,15 @@ _cpri__AESEncryptCTR(
        return CRYPT_SUCCESS;
    pAssert(dInSize <= INT32_MAX);
    dSize = (INT32)dInSize;
-   // Create AES encryption schedule
-   if (AES_set_encrypt_key(key, keySizeInBits, &AesKey) != 0)
-       FAIL(FATAL_ERROR_INTERNAL);
-   for(; dSize > 0; dSize -= 16)
+   AesCrypt(AesContext(keySizeInBits, key, AES_CTR), iv, dOut, dSize, dIn);
+   // Add the number of blocks to the counter (counter is big-endian so start
+   // at end)
+   carry = (UINT32)(dSize + 15) / 16;
+   for(i = 15; i >= 0 && carry != 0; i--)
    {
-       // Encrypt the current value of the IV(counter)
-       AES_encrypt(iv, (BYTE *)tmp, &AesKey);
-        //increment the counter (counter is big-endian so start at end)
-        for(i = 15; i >= 0; i--)
-            if((iv[i] += 1) != 0)
-                break;
-        // XOR the encrypted counter value with input and put into output
-        pT = tmp;
-        for(i = (dSize < 16) ? dSize : 16; i > 0; i--)
-            *dOut++ = *dIn++ ^ *pT++;
+       carry += iv[i];
+       iv[i] = (BYTE)carry;
+       carry >>= 8;
    }
    return CRYPT_SUCCESS;
 }
@@ -362,7 +491,6 @@ _cpri__AESEncryptECB(
     BYTE                *dIn            // IN: clear text buffer
     )
 {
-    AES_KEY          AesKey;
     INT32            dSize;
     pAssert(dOut != NULL && key != NULL && dIn != NULL);
     if(dInSize == 0)
@@ -373,16 +501,8 @@ _cpri__AESEncryptECB(
     // cipher block size
     if((dSize % 16) != 0)
         return CRYPT_PARAMETER;
-    // Create AES encrypting key schedule
-    if (AES_set_encrypt_key(key, keySizeInBits, &AesKey) != 0)
-        FAIL(FATAL_ERROR_INTERNAL);
-    for(; dSize > 0; dSize -= 16)
-    {
-        AES_encrypt(dIn, dOut, &AesKey);
-        dIn = &dIn[16];
-        dOut = &dOut[16];
-    }
-   return CRYPT_SUCCESS;
+    AesCrypt(AesContext(keySizeInBits, key, AES_ECB_ENCRYPT), NULL, dOut, dSize, dIn);
+    return CRYPT_SUCCESS;
 }
 //
 //
@@ -405,7 +525,6 @@ _cpri__AESDecryptECB(
    BYTE                *dIn            // IN: cipher text buffer
    )
 {
-   AES_KEY         AesKey;
    INT32           dSize;
    pAssert(dOut != NULL && key != NULL && dIn != NULL);
    if(dInSize == 0)
@@ -416,15 +535,7 @@ _cpri__AESDecryptECB(
    // cipher block size
    if((dSize % 16) != 0)
        return CRYPT_PARAMETER;
-   // Create AES decryption key schedule
-   if (AES_set_decrypt_key(key, keySizeInBits, &AesKey) != 0)
-       FAIL(FATAL_ERROR_INTERNAL);
-   for(; dSize > 0; dSize -= 16)
-   {
-       AES_decrypt(dIn, dOut, &AesKey);
-       dIn = &dIn[16];
-       dOut = &dOut[16];
-   }
+   AesCrypt(AesContext(keySizeInBits, key, AES_ECB_DECRYPT), NULL, dOut, dSize, dIn);
    return CRYPT_SUCCESS;
 }
 //
@@ -455,28 +566,31 @@ _cpri__AESEncryptOFB(
    BYTE               *dIn            // IN: data buffer
    )
 {
-   BYTE           *pIv;
-   AES_KEY         AesKey;
+   BYTE            tmp[16];
    INT32           dSize;
+   INT32           full;                // bytes before the last block
    int             i;
    pAssert(dOut != NULL && key != NULL && iv != NULL && dIn != NULL);
    if(dInSize == 0)
        return CRYPT_SUCCESS;
    pAssert(dInSize <= INT32_MAX);
    dSize = (INT32)dInSize;
-   // Create AES key schedule
-   if (AES_set_encrypt_key(key, keySizeInBits, &AesKey) != 0)
-       FAIL(FATAL_ERROR_INTERNAL);
-   // This is written so that dIn and dOut may be the same
-   for(; dSize > 0; dSize -= 16)
+   full = ((dSize - 1) / 16) * 16;
+   if(full > 0)
    {
-       // Encrypt the current value of the "IV"
-       AES_encrypt(iv, iv, &AesKey);
-        // XOR the encrypted IV into dIn to create the cipher text (dOut)
-        pIv = iv;
-        for(i = (dSize < 16) ? dSize : 16; i > 0; i--)
-            *dOut++ = (*pIv++ ^ *dIn++);
+       // Run the cipher over all but the last block. The output of the cipher
+       // for the block before the last one is that block of dOut XOR dIn; dIn
+       // is kept in case it is dOut.
+       memcpy(tmp, &dIn[full - 16], 16);
+       AesCrypt(AesContext(keySizeInBits, key, AES_OFB), iv, dOut, full, dIn);
+       for(i = 0; i < 16; i++)
+           iv[i] = tmp[i] ^ dOut[full - 16 + i];
    }
+   // Encrypt the "IV" of the last block, which is returned, and XOR it into the
+   // last block
+   AesCrypt(AesContext(keySizeInBits, key, AES_ECB_ENCRYPT), NULL, iv, 16, iv);
+   for(i = 0; i < dSize - full; i++)
+       dOut[full + i] = iv[i] ^ dIn[full + i];
    return CRYPT_SUCCESS;
 }
 #ifdef    TPM_ALG_SM4
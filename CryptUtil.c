@@ -216,7 +216,7 @@ CryptStartHMAC(
                                             //       in HMAC update and completion
     )
 {
-    HASH_STATE         *hashState = (HASH_STATE *)hmacState;
+    HASH_STATE         *hashState = &hmacState->hashState;
     CRYPT_RESULT       retVal;
     // This has to come before the pAssert in case we             all calling this function
     // during testing. If so, the first instance will             have no arguments but the
@@ -253,7 +253,7 @@ CryptStartHMACSequence(
                                               //       in HMAC update and completion
     )
 {
-    HASH_STATE         *hashState = (HASH_STATE *)hmacState;
+    HASH_STATE         *hashState = &hmacState->hashState;
     CRYPT_RESULT       retVal;
     TEST_HASH(hashAlg);
     hashState->type = HASH_STATE_EMPTY;
@@ -361,6 +361,36 @@ CryptUpdateDigest2B(
 }
 //
 //
+//      CryptUpdateDigests()
+//
+//      This function adds the same array of octets to several hash states, such as the banks of an event
+//      sequence. The hash functions of the banks cannot share a pass over the data, so the data is passed to
+//      them in slices that stay in the data cache while every bank hashes them. A large buffer is then read from
+//      memory once rather than once per bank.
+//
+#define HASH_SLICE_SIZE     4096
+void
+CryptUpdateDigests(
+    UINT32              count,              // IN: number of hash states
+    HASH_STATE         *hashStates,         // IN/OUT: the hash states
+    UINT32              banks,              // IN: bit i is set to update hashStates[i]
+    UINT32              dataSize,           // IN: the size of data
+    BYTE               *data                // IN: data to be hashed
+    )
+{
+    UINT32              sliceSize;
+    UINT32              i;
+    for(; dataSize > 0; dataSize -= sliceSize, data += sliceSize)
+    {
+        sliceSize = dataSize < HASH_SLICE_SIZE ? dataSize : HASH_SLICE_SIZE;
+        for(i = 0; i < count; i++)
+            if((banks & (1 << i)) != 0)
+                CryptUpdateDigest(&hashStates[i], sliceSize, data);
+    }
+    return;
+}
+//
+//
 //      10.2.4.10 CryptUpdateDigestInt()
 //
 //      This function is used to include an integer value to a hash stack. The function marshals the integer into its
@@ -540,6 +570,80 @@ CryptCompleteHMAC2B(
 }
 //
 //
+//      CryptStartHMACCached2B()
+//
+//      This function starts an HMAC with key and keeps its iPad state in cache. When cache holds the same iPad
+//      state, and so the same key and hash algorithm, the oPad state of cache is used to complete the HMAC;
+//      otherwise, the oPad state of key is computed into cache. The HMAC is completed with
+//      CryptCompleteHMACCached2B() and the same cache.
+//
+//      Return Value                    Meaning
+//
+//      >0                              the digest size of the algorithm
+//      =0                              the hashAlg was TPM_ALG_NULL
+//
+UINT16
+CryptStartHMACCached2B(
+    TPMI_ALG_HASH       hashAlg,            // IN: hash algorithm
+    TPM2B              *key,                // IN: HMAC key
+    HMAC_CACHE         *cache,              // IN/OUT: the cached states
+    HMAC_STATE         *hmacState           // OUT: the state of HMAC stack
+    )
+{
+    HASH_STATE         *hashState = &hmacState->hashState;
+    TPM2B_HASH_BLOCK    oPadKey;
+    UINT16              digestSize;
+    TEST_HASH(hashAlg);
+    // Clear the state so that the bytes the hash does not use compare equal
+    MemorySet(&hashState->state, 0, sizeof(hashState->state));
+    digestSize = _cpri__StartHMAC(hashAlg, TRUE, &hashState->state, key->size,
+                                  key->buffer, &oPadKey.b);
+    if(digestSize == 0)
+    {
+        hashState->type = HASH_STATE_EMPTY;
+        return 0;
+    }
+    hashState->type = HASH_STATE_HASH;
+    if(   cache->oPadState.type != HASH_STATE_HASH
+       || !MemoryEqual(&cache->iPadState, &hashState->state, sizeof(cache->iPadState)))
+    {
+        MemoryCopy(&cache->iPadState, &hashState->state, sizeof(cache->iPadState),
+                   sizeof(cache->iPadState));
+        _cpri__StartHash(hashAlg, TRUE, &cache->oPadState.state);
+        _cpri__UpdateHash(&cache->oPadState.state, oPadKey.t.size, oPadKey.t.buffer);
+        cache->oPadState.type = HASH_STATE_HASH;
+    }
+    return digestSize;
+}
+//
+//
+//      CryptCompleteHMACCached2B()
+//
+//      This function completes an HMAC started by CryptStartHMACCached2B(). The HMAC result is returned in
+//      a TPM2B, and digest->size is the number of bytes requested.
+//
+//      Return Value                    Meaning
+//
+//      >=0                             the number of bytes placed in digest
+//
+UINT16
+CryptCompleteHMACCached2B(
+    HMAC_CACHE         *cache,              // IN: the cached states
+    HMAC_STATE         *hmacState,          // IN: the state of HMAC stack
+    TPM2B              *digest              // OUT: HMAC
+    )
+{
+    HASH_STATE         *hashState = &hmacState->hashState;
+    BYTE                inner[MAX_DIGEST_SIZE];
+    UINT16              innerSize;
+    innerSize = CryptCompleteHash(hashState, sizeof(inner), inner);
+    _cpri__CopyHashState(&hashState->state, &cache->oPadState.state);
+    _cpri__UpdateHash(&hashState->state, innerSize, inner);
+    return digest->size = _cpri__CompleteHash(&hashState->state, digest->size,
+                                              digest->buffer);
+}
+//
+//
 //      10.2.4.16 CryptHashStateImportExport()
 //
 //      This function is used to prepare a hash state context for LIB_EXPORT or to import it into the internal
@@ -1988,22 +2092,26 @@ CryptXORObfuscation(
    BYTE                   mask[MAX_DIGEST_SIZE]; // Allocate a digest sized buffer
    BYTE                  *pm;
    UINT32                 i;
-   UINT32                 counter = 0;
-   UINT16                 hLen = CryptGetHashDigestSize(hash);
+   KDFa_STREAM            kdf;
+   UINT16                 hLen;
    UINT32                 requestSize = dataSize * 8;
    INT32                  remainBytes = (INT32) dataSize;
-   pAssert((key != NULL) && (data != NULL) && (hLen != 0));
-   // Call KDFa to generate XOR mask
+   pAssert((key != NULL) && (data != NULL));
+   TEST_HASH(hash);
+   // Key the KDFa stream once for the whole XOR mask
+   hLen = _cpri__KDFaStart(&kdf, hash, key, "XOR", contextU, contextV,
+                           requestSize);
+   pAssert(hLen != 0);
    for(; remainBytes > 0; remainBytes -= hLen)
    {
-       // Make a call to KDFa to get next iteration
-       CryptKDFaOnce(hash, key, "XOR", contextU, contextV,
-                     requestSize, mask, &counter);
-          // XOR next piece of the data
-          pm = mask;
-          for(i = hLen < remainBytes ? hLen : remainBytes; i > 0; i--)
-              *data++ ^= *pm++;
+       // Get the next piece of the mask
+       i = _cpri__KDFaNext(&kdf, (UINT16)(hLen < remainBytes ? hLen : remainBytes),
+                           mask);
+       // XOR next piece of the data
+       for(pm = mask; i > 0; i--)
+           *data++ ^= *pm++;
    }
+   _cpri__KDFaEnd(&kdf);
    return;
 }
 #endif //TPM_ALG_KEYED_HASH //%5
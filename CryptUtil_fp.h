@@ -46,6 +46,10 @@ LIB_EXPORT UINT16
 CryptCompleteHMAC2B(HMAC_STATE *hmacState,  // IN: the state of HMAC stack
                     TPM2B *digest           // OUT: HMAC
                     );
+UINT16 CryptCompleteHMACCached2B(HMAC_CACHE *cache,      // IN: the cached states
+                                 HMAC_STATE *hmacState,  // IN: the state of HMAC stack
+                                 TPM2B *digest           // OUT: HMAC
+                                 );
 LIB_EXPORT UINT16
 CryptCompleteHash(void *state,        // IN: the state of hash stack
                   UINT16 digestSize,  // IN: size of digest buffer
@@ -294,6 +298,11 @@ CryptStartHMAC2B(TPMI_ALG_HASH hashAlg,  // IN: hash algorithm
                  HMAC_STATE *hmacState  // OUT: the state of HMAC stack. It will
                                         // be used in HMAC update and completion
                  );
+UINT16 CryptStartHMACCached2B(TPMI_ALG_HASH hashAlg,  // IN: hash algorithm
+                              TPM2B *key,             // IN: HMAC key
+                              HMAC_CACHE *cache,      // IN/OUT: the cached states
+                              HMAC_STATE *hmacState   // OUT: the state of HMAC stack
+                              );
 UINT16 CryptStartHMACSequence2B(TPMI_ALG_HASH hashAlg,  // IN: hash algorithm
                                 TPM2B *key,             // IN: HMAC key
                                 HMAC_STATE *hmacState  // OUT: the state of HMAC
@@ -344,6 +353,12 @@ void CryptUpdateDigest(void *digestState,  // IN: the state of hash stack
 LIB_EXPORT void CryptUpdateDigest2B(void *digestState,  // IN: the digest state
                                     TPM2B *bIn  // IN: 2B containing the data
                                     );
+void CryptUpdateDigests(UINT32 count,            // IN: number of hash states
+                        HASH_STATE *hashStates,  // IN/OUT: the hash states
+                        UINT32 banks,  // IN: bit i is set to update hashStates[i]
+                        UINT32 dataSize,  // IN: the size of data
+                        BYTE *data        // IN: data to be hashed
+                        );
 void CryptUpdateDigestInt(void *state,     // IN: the state of hash stack
                           UINT32 intSize,  // IN: the size of 'intValue' in byte
                           void *intValue   // IN: integer value to be hashed
@@ -355,6 +370,13 @@ TPM_RC CryptVerifySignature(
     TPM2B_DIGEST *digest,      // IN: The digest being validated
     TPMT_SIGNATURE *signature  // IN: signature
     );
+void CryptXORObfuscation(TPM_ALG_ID hash,   //   IN: hash algorithm for KDF
+                         TPM2B *key,        //   IN: KDF key
+                         TPM2B *contextU,   //   IN: contextU
+                         TPM2B *contextV,   //   IN: contextV
+                         UINT32 dataSize,   //   IN: size of data buffer
+                         BYTE *data         //   IN/OUT: data to be XORed in place
+                         );
 void KDFa(TPM_ALG_ID hash,      //   IN: hash algorithm used in HMAC
           TPM2B *key,           //   IN: HMAC key
           const char *label,    //   IN: a null-terminated label for KDF
@@ -103,6 +103,23 @@ typedef struct _HASH_STATE
    ALIGNED_HASH_STATE       state;
    TPM_ALG_ID               hashAlg;
 } CPRI_HASH_STATE, *PCPRI_HASH_STATE;
+//
+//     This is the state of a KDFa() stream. The HMAC is keyed once when the stream is started and each counter
+//     block starts from a copy of the keyed states, so the stream may be produced a block at a time without
+//     keying the HMAC again. The label and the contexts are referenced, not copied.
+//
+typedef struct
+{
+   CPRI_HASH_STATE          iPadState;          // HMAC state after the key XOR iPad
+   CPRI_HASH_STATE          oPadState;          // hash state after the key XOR oPad
+   const char              *label;
+   TPM2B                   *contextU;
+   TPM2B                   *contextV;
+   UINT32                   sizeInBits;
+   UINT32                   counter;            // counter of the last block
+   UINT16                   labelSize;          // including the terminating 0
+   UINT16                   digestSize;
+} KDFa_STREAM;
 extern const HASH_INFO   g_hashData[HASH_COUNT + 1];
 //
 //     This is for the external hash state. This implementation assumes that the size of the exported hash state
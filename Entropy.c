@@ -9,19 +9,18 @@
 #include <stdint.h>
 #include <memory.h>
 #include "TpmBuildSwitches.h"
+#include "PlatformData.h"
 //
 //
 //          Local values
 //
-//     This is the last 32-bits of hardware entropy produced. We have to check to see that two consecutive 32-
+//     lastEntropy, in PlatformData.h, is the last 32-bits of hardware entropy produced. We have to check to see that two consecutive 32-
 //     bit values are not the same because (according to FIPS 140-2, annex C
 //           “If each call to a RNG produces blocks of n bits (where n > 15), the first n-bit block generated after
 //           power-up, initialization, or reset shall not be used, but shall be saved for comparison with the next n-
 //           bit block to be generated. Each subsequent generation of an n-bit block shall be compared with the
 //           previously generated block. The test shall fail if any two compared n-bit blocks are equal.”
 //
-extern uint32_t               lastEntropy;
-extern int                    firstValue;
 //
 //
 //          _plat__GetEntropy()
@@ -62,11 +62,13 @@ TPM2_EventSequenceComplete(
 
    out->results.count = 0;
 
+   // Update last piece of data
+   CryptUpdateDigests(HASH_COUNT, hashObject->state.hashState,
+                      (1 << HASH_COUNT) - 1, in->buffer.t.size, in->buffer.t.buffer);
+
    for(i = 0; i < HASH_COUNT; i++)
    {
        hashAlg = CryptGetHashAlgByIndex(i);
-       // Update last piece of data
-       CryptUpdateDigest2B(&hashObject->state.hashState[i], &in->buffer.b);
        // Complete hash
        out->results.digests[out->results.count].hashAlg = hashAlg;
        CryptCompleteHash(&hashObject->state.hashState[i],
@@ -5,6 +5,7 @@
 // Level 00 Revision 01.16
 // October 30, 2014
 
+#define EXEC_COMMAND_C
 #include     "InternalRoutines.h"
 #include     "ExecCommand_fp.h"
 #include     "HandleProcess_fp.h"
@@ -15,8 +16,73 @@
 //
 // #include "CommandResponseSizes_fp.h"
 //
+#ifdef TPM_COMMAND_PROFILE
+//
+//
+//           ProfileRecord()
+//
+//     This function adds the time of a phase of a command to the histogram of the phase. The bucket is found
+//     as described for PROFILE_HISTOGRAM in ExecCommand_fp.h. Nothing is recorded for a command code that is
+//     not implemented, such as that of a command whose header could not be unmarshaled but whose DA or
+//     clock update still had to be committed.
+//
+static void
+ProfileRecord(
+    TPM_CC               commandCode,       //   IN: command code
+    UINT32               phase,             //   IN: phase of the command
+    UINT64               time               //   IN: time of the phase in ns
+    )
+{
+    PROFILE_HISTOGRAM   *histogram;
+    UINT32               octave = 2;
+    UINT32               bucket;
+    if(!CommandIsImplemented(commandCode))
+        return;
+    histogram = &s_commandProfile[commandCode - TPM_CC_FIRST].phases[phase];
+    if(time < 4)
+        bucket = (UINT32)time;
+    else
+    {
+        while(octave < 33 && (time >> (octave + 1)) != 0)
+            octave++;
+        if(octave == 33)
+            bucket = PROFILE_BUCKETS - 1;
+        else
+            bucket = 4 * (octave - 1) + (UINT32)((time >> (octave - 2)) & 3);
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->totalNs += time;
+    if(time > histogram->maxNs)
+        histogram->maxNs = time;
+}
+//
+//
+//           ProfileMark()
+//
+//     This function records the time since *mark as the time of a phase of a command and sets *mark to the
+//     current time.
+//
+static void
+ProfileMark(
+    TPM_CC               commandCode,       //   IN: command code
+    UINT32               phase,             //   IN: the phase that completed
+    UINT64              *mark               //   IN/OUT: start of the phase
+    )
+{
+    UINT64               now = _plat__ClockNanoseconds();
+    ProfileRecord(commandCode, phase, now - *mark);
+    *mark = now;
+}
+#define PROFILE_START()         (profileMark = _plat__ClockNanoseconds())
+#define PROFILE_MARK(phase)     ProfileMark(commandCode, (phase), &profileMark)
+#else
+#define PROFILE_START()
+#define PROFILE_MARK(phase)
+#endif  // TPM_COMMAND_PROFILE
 //
-//           ExecuteCommand()
+//
+//           ProcessCommand()
 //
 //     The function performs the following steps.
 //     a) Parses the command header from input buffer.
@@ -38,12 +104,24 @@
 //          3) update the audit sessions and nonces
 //     h) Assembles handle, parameter and session buffers for response and return.
 //
-LIB_EXPORT void
-ExecuteCommand(
+//     In a batch, the NV state and the time are checked by ExecuteCommandBatch() and the NV commit is left
+//     to it. The unused part of the response buffer is cleared only when it is the buffer of the TPM.
+//
+//     With TPM_COMMAND_PROFILE, the time of each phase is added to the profile of the command code once
+//     the phase completes, and the time of the whole command once the response is built.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              in a batch, the command changed NV
+//     FALSE                             NV is unchanged or has been committed
+//
+static BOOL
+ProcessCommand(
     unsigned    int      requestSize,       //   IN: command buffer size
     unsigned    char    *request,           //   IN: command buffer
     unsigned    int     *responseSize,      //   OUT: response buffer size
-    unsigned    char    **response          //   OUT: response buffer
+    unsigned    char    **response,         //   OUT: response buffer
+    BOOL                 batch              //   IN: called by ExecuteCommandBatch()
     )
 {
     // Command local variables
@@ -79,6 +157,11 @@ ExecuteCommand(
    INT32                      bufferSize;          // size of buffer being used for
                                                    // marshaling or unmarshaling
    UINT32                     i;                    // local temp
+   BOOL                       uncommitted = FALSE;  // NV changes left to the batch
+#ifdef TPM_COMMAND_PROFILE
+   UINT64                     profileStart = _plat__ClockNanoseconds();
+   UINT64                     profileMark = profileStart;
+#endif
 // This next function call is used in development to size the command and response
 // buffers. The values printed are the sizes of the internal structures and
 // not the sizes of the canonical forms of the command response structures. Also,
@@ -100,7 +183,7 @@ ExecuteCommand(
    {
        // Do failure mode processing
        TpmFailureMode (requestSize, request, responseSize, response);
-       return;
+       return FALSE;
    }
 #ifndef EMBEDDED_MODE
    if(setjmp(g_jumpBuffer) != 0)
@@ -108,24 +191,29 @@ ExecuteCommand(
        // Get here if we got a longjump putting us into failure mode
        g_inFailureMode = TRUE;
        result = TPM_RC_FAILURE;
+       // The response may have been partly marshaled
+       MemorySet(MemoryGetResponseBuffer(commandCode), 0, MAX_RESPONSE_SIZE);
        goto Fail;
    }
 #endif  // EMBEDDED_MODE   ^^^ not defined
    // Assume that everything is going to work.
    result = TPM_RC_SUCCESS;
-   // Query platform to get the NV state. The result state is saved internally
-   // and will be reported by NvIsAvailable(). The reference code requires that
-   // accessibility of NV does not change during the execution of a command.
-   // Specifically, if NV is available when the command execution starts and then
-   // is not available later when it is necessary to write to NV, then the TPM
-   // will go into failure mode.
-   NvCheckState();
-   // Due to the limitations of the simulation, TPM clock must be explicitly
-   // synchronized with the system clock whenever a command is received.
-   // This function call is not necessary in a hardware TPM. However, taking
-   // a snapshot of the hardware timer at the beginning of the command allows
-   // the time value to be consistent for the duration of the command execution.
-   TimeUpdateToCurrent();
+   if(!batch)
+   {
+       // Query platform to get the NV state. The result state is saved internally
+       // and will be reported by NvIsAvailable(). The reference code requires that
+       // accessibility of NV does not change during the execution of a command.
+       // Specifically, if NV is available when the command execution starts and then
+       // is not available later when it is necessary to write to NV, then the TPM
+       // will go into failure mode.
+       NvCheckState();
+       // Due to the limitations of the simulation, TPM clock must be explicitly
+       // synchronized with the system clock whenever a command is received.
+       // This function call is not necessary in a hardware TPM. However, taking
+       // a snapshot of the hardware timer at the beginning of the command allows
+       // the time value to be consistent for the duration of the command execution.
+       TimeUpdateToCurrent();
+   }
    // Any command through this function will unceremoniously end the
    // _TPM_Hash_Data/_TPM_Hash_End sequence.
    if(g_DRTMHandle != TPM_RH_UNASSIGNED)
@@ -184,6 +272,7 @@ ExecuteCommand(
              result = TPM_RC_INITIALIZE;
              goto Cleanup;
         }
+     PROFILE_MARK(PROFILE_HEADER);
      // Start regular command process.
      // Parse Handle buffer.
      result = ParseHandleBuffer(commandCode, &buffer, &size, handles, &handleNum);
@@ -206,6 +295,7 @@ ExecuteCommand(
            goto Cleanup;
        }
    }
+   PROFILE_MARK(PROFILE_HANDLES);
    // Authorization session handling for the command.
    if(tag == TPM_ST_SESSIONS)
    {
@@ -261,6 +351,7 @@ ExecuteCommand(
          if(result != TPM_RC_SUCCESS)
              goto Cleanup;
    }
+   PROFILE_MARK(PROFILE_SESSIONS);
    // CommandDispatcher returns a response handle buffer and a response parameter
    // buffer if it succeeds. It will also set the parameterSize field in the
    // buffer if the tag is TPM_RC_SESSIONS.
@@ -273,12 +364,14 @@ ExecuteCommand(
                               &resParmSize);
    if(result != TPM_RC_SUCCESS)
        goto Cleanup;
+   PROFILE_MARK(PROFILE_DISPATCH);
    // Build the session area at the end of the parameter area.
    BuildResponseSession(tag,
                         commandCode,
                         resHandleSize,
                         resParmSize,
                         &resAuthSize);
+   PROFILE_MARK(PROFILE_RESPONSE_SESSION);
 Cleanup:
    // This implementation loads an "evict" object to a transient object slot in
    // RAM whenever an "evict" object handle is used in a command so that the
@@ -328,8 +421,15 @@ Fail:
      if(g_updateNV && !g_inFailureMode)
      {
          g_updateNV = FALSE;
-         if(!NvCommit())
-              FAIL(FATAL_ERROR_INTERNAL);
+         if(batch)
+              uncommitted = TRUE;
+         else
+         {
+              PROFILE_START();
+              if(!NvCommit())
+                  FAIL(FATAL_ERROR_INTERNAL);
+              PROFILE_MARK(PROFILE_NV_COMMIT);
+         }
      }
      // Marshal the response header.
      buffer = MemoryGetResponseBuffer(commandCode);
@@ -339,7 +439,234 @@ Fail:
      pAssert(*responseSize <= MAX_RESPONSE_SIZE);
      TPM_RC_Marshal(&result, &buffer, &bufferSize);
      *response = MemoryGetResponseBuffer(commandCode);
-     // Clear unused bit in response buffer.
-     MemorySet(*response + *responseSize, 0, MAX_RESPONSE_SIZE - *responseSize);
-     return;
+     // Clear unused bit in response buffer. A buffer of the caller only
+     // holds what was marshaled.
+     if(s_responseTarget == NULL)
+         MemorySet(*response + *responseSize, 0, MAX_RESPONSE_SIZE - *responseSize);
+#ifdef TPM_COMMAND_PROFILE
+     ProfileRecord(commandCode, PROFILE_TOTAL,
+                   _plat__ClockNanoseconds() - profileStart);
+#endif
+     return uncommitted;
+}
+//
+//
+//           ExecuteCommand()
+//
+//     This function executes one command, as described in ProcessCommand(). The response stays in the
+//     response buffer of the TPM until the next command.
+//
+LIB_EXPORT void
+ExecuteCommand(
+    unsigned    int      requestSize,       //   IN: command buffer size
+    unsigned    char    *request,           //   IN: command buffer
+    unsigned    int     *responseSize,      //   OUT: response buffer size
+    unsigned    char    **response          //   OUT: response buffer
+    )
+{
+    ProcessCommand(requestSize, request, responseSize, response, FALSE);
+}
+//
+//
+//           ProcessCommandInBuffer()
+//
+//     This function processes a command as ProcessCommand() does, but marshals the response into buffer,
+//     which holds at least MAX_RESPONSE_SIZE bytes.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              in a batch, the command changed NV
+//     FALSE                             NV is unchanged or has been committed
+//
+static BOOL
+ProcessCommandInBuffer(
+    unsigned    int      requestSize,       //   IN: command buffer size
+    unsigned    char    *request,           //   IN: command buffer
+    unsigned    char    *buffer,            //   OUT: response buffer
+    unsigned    int     *responseSize,      //   OUT: response size
+    BOOL                 batch              //   IN: called by ExecuteCommandBatch()
+    )
+{
+    unsigned    char    *response;
+    BOOL                 uncommitted;
+    s_responseTarget = buffer;
+    uncommitted = ProcessCommand(requestSize, request, responseSize, &response,
+                                 batch);
+    s_responseTarget = NULL;
+    // In failure mode, the response is built in a buffer of its own
+    if(response != buffer)
+        MemoryCopy(buffer, response, *responseSize, MAX_RESPONSE_SIZE);
+    return uncommitted;
+}
+//
+//
+//           ExecuteCommandToBuffer()
+//
+//     This function executes one command, as described in ProcessCommand(), and marshals the response
+//     directly into a buffer of the caller instead of the response buffer of the TPM. Only the response is
+//     written to buffer, and the response buffer of the TPM is not used, so there is nothing to copy or clear
+//     afterwards. buffer may not overlap request.
+//
+//     Return Value                      Meaning
+//
+//     0                                 bufferSize is smaller than MAX_RESPONSE_SIZE; nothing was executed
+//     n                                 the size of the response in buffer
+//
+LIB_EXPORT unsigned int
+ExecuteCommandToBuffer(
+    unsigned    int      requestSize,       //   IN: command buffer size
+    unsigned    char    *request,           //   IN: command buffer
+    unsigned    int      bufferSize,        //   IN: size of buffer
+    unsigned    char    *buffer             //   OUT: response buffer
+    )
+{
+    unsigned    int      responseSize;
+    if(bufferSize < MAX_RESPONSE_SIZE)
+        return 0;
+    ProcessCommandInBuffer(requestSize, request, buffer, &responseSize, FALSE);
+    return responseSize;
+}
+//
+//
+//           ExecuteCommandBatch()
+//
+//     This function executes commands in order and puts each response in buffer, after the previous one.
+//     It stops when buffer has no room for a response of MAX_RESPONSE_SIZE, so the caller can pass the
+//     remaining commands again. Compared to calling ExecuteCommand() for each command:
+//     a) NV availability and the time are read once, so all the commands see the time the batch started;
+//     b) NV is committed once, after the last command, with the clock and DA updates made when the batch
+//        starts; and
+//     c) each response is marshaled directly into buffer, as by ExecuteCommandToBuffer().
+//     Durability: the NV changes of the batch are committed together when the function returns, so none of
+//     the responses can be relied on before then. If the platform loses power during the batch, the NV
+//     changes of all its commands are lost. If the commit fails, or a command of the batch puts the TPM in
+//     failure mode, nothing is committed and the response of each command from the first one that changed
+//     NV is replaced by a TPM_RC_FAILURE response.
+//
+//     Return Value                      Meaning
+//
+//     n                                 the number of commands executed
+//
+LIB_EXPORT unsigned int
+ExecuteCommandBatch(
+    unsigned    int      count,             //   IN: number of commands
+    BATCH_COMMAND       *commands,          //   IN/OUT: the commands and their responses
+    unsigned    int      bufferSize,        //   IN: size of buffer
+    unsigned    char    *buffer             //   OUT: the responses
+    )
+{
+    unsigned    int      i;
+    unsigned    int      j;
+    unsigned    int      firstUpdate = count;   // first command that changed NV
+    unsigned    int      used = 0;
+    BOOL                 timeUpdated = FALSE;   // the clock or DA state changed NV
+    volatile BOOL        committed = TRUE;
+    TPM_ST               resTag = TPM_ST_NO_SESSIONS;
+    TPM_RC               result = TPM_RC_FAILURE;
+    BYTE                *marshal;
+    INT32                marshalSize;
+#ifdef TPM_COMMAND_PROFILE
+    TPM_CC               commandCode;
+    UINT64               profileMark;
+#endif
+    if(!g_inFailureMode)
+    {
+        NvCheckState();
+        TimeUpdateToCurrent();
+        // ProcessCommand() clears g_updateNV for each command
+        timeUpdated = g_updateNV;
+    }
+    for(i = 0; i < count && bufferSize - used >= MAX_RESPONSE_SIZE; i++)
+    {
+        commands[i].response = buffer + used;
+        if(ProcessCommandInBuffer(commands[i].requestSize, commands[i].request,
+                                  commands[i].response,
+                                  &commands[i].responseSize, TRUE)
+           && firstUpdate == count)
+            firstUpdate = i;
+        used += commands[i].responseSize;
+    }
+    if(firstUpdate < i || timeUpdated)
+    {
+        // As in ProcessCommand(), NV is not committed once a command of the
+        // batch has put the TPM in failure mode. The commands from the first
+        // one that changed NV then fail.
+        committed = FALSE;
+#ifndef EMBEDDED_MODE
+        if(setjmp(g_jumpBuffer) != 0)
+            g_inFailureMode = TRUE;
+        else
+#endif
+        if(!g_inFailureMode)
+        {
+#ifdef TPM_COMMAND_PROFILE
+            // The commit is counted for the first command that changed NV, if
+            // its request is long enough to hold a command code
+            commandCode = 0;
+            if(firstUpdate < i && commands[firstUpdate].requestSize >= 10)
+                commandCode = BYTE_ARRAY_TO_UINT32(commands[firstUpdate].request
+                                                   + 6);
+#endif
+            PROFILE_START();
+            committed = NvCommit();
+            if(!committed)
+                FAIL(FATAL_ERROR_INTERNAL);
+            PROFILE_MARK(PROFILE_NV_COMMIT);
+        }
+    }
+    if(!committed)
+    {
+        for(j = firstUpdate; j < i; j++)
+        {
+            // A response has at least a response header
+            commands[j].responseSize = sizeof(TPM_ST) + sizeof(UINT32)
+                                     + sizeof(TPM_RC);
+            marshal = commands[j].response;
+            marshalSize = commands[j].responseSize;
+            TPM_ST_Marshal(&resTag, &marshal, &marshalSize);
+            UINT32_Marshal((UINT32 *)&commands[j].responseSize, &marshal,
+                           &marshalSize);
+            TPM_RC_Marshal(&result, &marshal, &marshalSize);
+        }
+    }
+    return i;
+}
+//
+//
+//           ExecuteCommandGetProfile()
+//
+//     This function copies the profile of a command code, which holds the times of the phases of the
+//     commands with that code, and restarts it when reset is TRUE. The times are kept only when the TPM is
+//     built with TPM_COMMAND_PROFILE.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              profile holds the profile of commandCode
+//     FALSE                             no command with commandCode completed since the profile was
+//                                       started, or the TPM keeps no profile
+//
+LIB_EXPORT BOOL
+ExecuteCommandGetProfile(
+    unsigned    int      commandCode,       //   IN: command code
+    BOOL                 reset,             //   IN: restart the profile of commandCode
+    COMMAND_PROFILE     *profile            //   OUT: the profile
+    )
+{
+#ifdef TPM_COMMAND_PROFILE
+    COMMAND_PROFILE     *kept;
+    if(!CommandIsImplemented(commandCode))
+        return FALSE;
+    kept = &s_commandProfile[commandCode - TPM_CC_FIRST];
+    if(kept->phases[PROFILE_TOTAL].count == 0)
+        return FALSE;
+    MemoryCopy(profile, kept, sizeof(*profile), sizeof(*profile));
+    if(reset)
+        MemorySet(kept, 0, sizeof(*kept));
+    return TRUE;
+#else
+    UNREFERENCED(commandCode);
+    UNREFERENCED(reset);
+    UNREFERENCED(profile);
+    return FALSE;
+#endif
 }
@@ -13,12 +13,18 @@
 //
 //      These values are visible across multiple modules.
 //
-BOOL                      g_phEnable;
 const UINT16              g_rcIndex[15] = {TPM_RC_1,       TPM_RC_2,    TPM_RC_3, TPM_RC_4,
                                           TPM_RC_5,       TPM_RC_6,    TPM_RC_7, TPM_RC_8,
                                           TPM_RC_9,       TPM_RC_A,    TPM_RC_B, TPM_RC_C,
                                           TPM_RC_D,       TPM_RC_E,    TPM_RC_F
                                        };
+#ifdef TPM_MULTI_INSTANCE
+//
+//     The remaining values are kept in the instance selected by the calling thread.
+//
+THREAD_LOCAL struct tpm_instance *g_tpmInstance;
+#else
+BOOL                      g_phEnable;
 TPM_HANDLE              g_exclusiveAuditSession;
 UINT64                  g_time;
 BOOL                    g_pcrReConfig;
@@ -73,11 +79,16 @@ UINT32                  s_reservedAddr[NV_RESERVE_LAST];
 UINT32                  s_reservedSize[NV_RESERVE_LAST];
 UINT32                  s_ramIndexSize;
 BYTE                    s_ramIndex[RAM_INDEX_SPACE];
+NV_HANDLE_MAP_ENTRY     s_ramIndexMap[RAM_INDEX_MAP_SIZE];
 UINT32                  s_ramIndexSizeAddr;
 UINT32                  s_ramIndexAddr;
 UINT32                  s_maxCountAddr;
 UINT32                  s_evictNvStart;
 UINT32                  s_evictNvEnd;
+NV_HANDLE_MAP_ENTRY     s_nvHandleMap[NV_HANDLE_MAP_SIZE];
+UINT32                  s_evictNvTail;
+UINT32                  s_evictNvPersistentNum;
+NV_INDEX_CACHE_ENTRY    s_nvIndexCache[NV_INDEX_CACHE_SIZE];
 TPM_RC                  s_NvStatus;
 //
 //
@@ -121,7 +132,17 @@ UINT32   s_actionInputBuffer[1024];          // action input buffer
 UINT32   s_actionOutputBuffer[1024];         // action output buffer
 #endif  // EMBEDDED_MODE   ^^^ not defined
 BYTE     s_responseBuffer[MAX_RESPONSE_SIZE];// response buffer
+BYTE    *s_responseTarget = NULL;            // response buffer of the caller
 #endif  // __IGNORE_STATE__   ^^^ not defined
+#ifdef TPM_COMMAND_PROFILE
+//
+//
+//         ExecCommand.c
+//
+//     The times of the phases of the commands. They are not TPM state and survive _TPM_Init().
+//
+COMMAND_PROFILE s_commandProfile[TPM_CC_LAST - TPM_CC_FIRST + 1];
+#endif
 //
 //
 //         SelfTest.c
@@ -144,3 +165,4 @@ BOOL                      g_inFailureMode;
 UINT32                    s_failFunction;
 UINT32                    s_failLine;
 UINT32                    s_failCode;
+#endif // TPM_MULTI_INSTANCE
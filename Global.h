@@ -15,6 +15,9 @@
 #ifndef EMBEDDED_MODE
 #include        <setjmp.h>
 #endif
+#ifdef TPM_COMMAND_PROFILE
+#include        "ExecCommand_fp.h"
+#endif
 //
 //
 //
@@ -96,6 +99,17 @@ typedef struct
 //
 typedef BYTE        AUTH_VALUE[sizeof(TPMU_HA)];
 //
+//     An HMAC_CACHE keeps the hash states of an HMAC after the block of its key XOR iPad and after the block
+//     of its key XOR oPad. The key itself is not kept: the iPad state is a one-way function of the key and of
+//     the hash algorithm, so an HMAC whose iPad state is the same as that of the cache has the same key and
+//     does not hash the oPad block again. oPadState.type is HASH_STATE_EMPTY when the cache is empty.
+//
+typedef struct
+{
+   CPRI_HASH_STATE           iPadState;               // state after the key XOR iPad
+   HASH_STATE                oPadState;               // state after the key XOR oPad
+} HMAC_CACHE;
+//
 //     A TIME_INFO is a BYTE array that can contain a TPMS_TIME_INFO
 //
 typedef BYTE        TIME_INFO[sizeof(TPMS_TIME_INFO)];
@@ -950,7 +964,7 @@ extern STATE_RESET_DATA gr;
 //
 //         Private data
 //
-#if defined SESSION_PROCESS_C || defined GLOBAL_C || defined MANUFACTURE_C
+#if defined SESSION_PROCESS_C || defined GLOBAL_C || defined MANUFACTURE_C || defined TPM_MULTI_INSTANCE
 //
 //      From SessionProcess.c
 //      The following arrays are used to save command sessions information so that the command
@@ -1013,7 +1027,7 @@ extern UINT32                 s_sessionNum;
 //
 extern BOOL             s_DAPendingOnNV;
 #endif // SESSION_PROCESS_C
-#if defined DA_C || defined GLOBAL_C || defined MANUFACTURE_C
+#if defined DA_C || defined GLOBAL_C || defined MANUFACTURE_C || defined TPM_MULTI_INSTANCE
 //
 //      From DA.c
 //
@@ -1026,7 +1040,7 @@ extern UINT64            s_selfHealTimer;
 //
 extern UINT64       s_lockoutTimer;
 #endif // DA_C
-#if defined NV_C || defined GLOBAL_C
+#if defined NV_C || defined GLOBAL_C || defined TPM_MULTI_INSTANCE
 //
 //      From NV.c
 //      List of pre-defined address of reserved data
@@ -1067,12 +1081,52 @@ extern UINT32       s_evictNvStart;
 //
 extern UINT32       s_evictNvEnd;
 //
+//      Hash table that maps the handle of each NV Index and persistent object to the NV offset of its entry. The
+//      table is open addressed with linear probing; a slot with an addr of 0 is unused. It is rebuilt from the NV
+//      linked list when NV is initialized and is kept current by NvAdd() and NvDelete() so that looking up an
+//      entity does not require a walk of the list.
+//
+typedef struct
+{
+   TPM_HANDLE      handle;
+   UINT32          addr;
+} NV_HANDLE_MAP_ENTRY;
+extern NV_HANDLE_MAP_ENTRY    s_nvHandleMap[NV_HANDLE_MAP_SIZE];
+//
+//      Map from the handle of each NV Index in s_ramIndex to the offset of its data in s_ramIndex. It is rebuilt
+//      when s_ramIndex is restored from NV and is kept current by NvAddRAM() and NvDeleteRAM().
+//
+extern NV_HANDLE_MAP_ENTRY    s_ramIndexMap[RAM_INDEX_MAP_SIZE];
+//
+//      Offset of the end of the NV linked list, i.e. the value that NvGetEnd() would return. It is set when the
+//      handle map is rebuilt and is kept current by NvAdd() and NvDelete().
+//
+extern UINT32       s_evictNvTail;
+//
+//      Number of persistent objects in NV. Like s_evictNvTail, it is kept current by NvAdd() and NvDelete() so
+//      that NvTestSpace() does not have to count them.
+//
+extern UINT32       s_evictNvPersistentNum;
+//
+//      Cache of the NV_INDEX headers of recently used NV Indices and their Names, indexed by the low bits of the
+//      handle. An entry with a handle of 0 is unused and a nameSize of 0 means that the Name has not been
+//      computed. An entry is invalidated when the header of its Index is written or the Index is deleted.
+//
+typedef struct
+{
+   TPM_HANDLE      handle;
+   UINT16          nameSize;
+   NV_INDEX        nvIndex;
+   NAME            name;
+} NV_INDEX_CACHE_ENTRY;
+extern NV_INDEX_CACHE_ENTRY   s_nvIndexCache[NV_INDEX_CACHE_SIZE];
+//
 //      NV availability is sampled as the start of each command and stored here so that its value remains
 //      consistent during the command execution
 //
 extern TPM_RC   s_NvStatus;
 #endif
-#if defined OBJECT_C || defined GLOBAL_C
+#if defined OBJECT_C || defined GLOBAL_C || defined TPM_MULTI_INSTANCE
 //
 //      From Object.c
 //
@@ -1088,7 +1142,7 @@ typedef struct
 //
 extern OBJECT_SLOT     s_objects[MAX_LOADED_OBJECTS];
 #endif // OBJECT_C
-#if defined PCR_C || defined GLOBAL_C
+#if defined PCR_C || defined GLOBAL_C || defined TPM_MULTI_INSTANCE
 //
 //      From PCR.c
 //
@@ -1126,7 +1180,7 @@ typedef struct
 } PCR_Attributes;
 extern PCR          s_pcrs[IMPLEMENTATION_PCR];
 #endif // PCR_C
-#if defined SESSION_C || defined GLOBAL_C
+#if defined SESSION_C || defined GLOBAL_C || defined TPM_MULTI_INSTANCE
 //
 //      From Session.c
 //      Container for HMAC or policy session tracking information
@@ -1135,6 +1189,9 @@ typedef struct
 {
    BOOL                      occupied;
    SESSION                   session;          // session structure
+   HMAC_CACHE                hmacCache;        // HMAC states of the last key used
+                                               // for the session HMACs. They are
+                                               // not saved with the session context
 } SESSION_SLOT;
 extern SESSION_SLOT           s_sessions[MAX_LOADED_SESSIONS];
 //
@@ -1156,7 +1213,7 @@ extern int                     s_freeSessionSlots;
 //      From Manufacture.c
 //
 extern BOOL              g_manufactured;
-#if defined POWER_C || defined GLOBAL_C
+#if defined POWER_C || defined GLOBAL_C || defined TPM_MULTI_INSTANCE
 //
 //      From Power.c
 //      This value indicates if a TPM2_Startup() commands has been receive since the power on event. This
@@ -1165,7 +1222,7 @@ extern BOOL              g_manufactured;
 //
 extern BOOL              s_initialized;
 #endif // POWER_C
-#if defined MEMORY_LIB_C || defined GLOBAL_C
+#if defined MEMORY_LIB_C || defined GLOBAL_C || defined TPM_MULTI_INSTANCE
 //
 //      The s_actionOutputBuffer should not be modifiable by the host system until the TPM has returned a
 //      response code. The s_actionOutputBuffer should not be accessible until response parameter encryption,
@@ -1175,6 +1232,23 @@ extern   UINT32   s_actionInputBuffer[1024];          // action input buffer
 extern   UINT32   s_actionOutputBuffer[1024];         // action output buffer
 extern   BYTE     s_responseBuffer[MAX_RESPONSE_SIZE];// response buffer
 #endif   // MEMORY_LIB_C
+#if defined MEMORY_LIB_C || defined EXEC_COMMAND_C || defined GLOBAL_C || defined TPM_MULTI_INSTANCE
+//
+//      When not NULL, s_responseTarget is a buffer of the caller of ExecuteCommandToBuffer() that holds at
+//      least MAX_RESPONSE_SIZE bytes, and the response is marshaled there instead of in s_responseBuffer.
+//
+extern   BYTE    *s_responseTarget;
+#endif   // MEMORY_LIB_C || EXEC_COMMAND_C
+#ifdef TPM_COMMAND_PROFILE
+#if defined EXEC_COMMAND_C || defined GLOBAL_C || defined TPM_MULTI_INSTANCE
+//
+//      From ExecCommand.c
+//      s_commandProfile holds the times of the phases of the commands, indexed by command code -
+//      TPM_CC_FIRST.
+//
+extern   COMMAND_PROFILE s_commandProfile[TPM_CC_LAST - TPM_CC_FIRST + 1];
+#endif   // EXEC_COMMAND_C
+#endif   // TPM_COMMAND_PROFILE
 //
 //      From TPMFail.c
 //      This value holds the address of the string containing the name of the function in which the failure
@@ -1192,4 +1266,166 @@ extern UINT32    s_failLine;            //           the line in the file at whi
                                        //           the error was signaled
 extern UINT32    s_failCode;            //           the error code used
 #endif // TPM_FAIL_C
+#ifdef TPM_MULTI_INSTANCE
+//
+//
+//          Multiple Instances
+//
+//     With TPM_MULTI_INSTANCE, the values above are not globals. Each TPM created by TpmInstanceCreate()
+//     has its own copy in a struct tpm_instance and the names refer to the copy in the instance that the calling
+//     thread selected with TpmInstanceSelect(). g_rcIndex is constant and is shared by all instances.
+//
+struct tpm_instance
+{
+    BOOL                    g_phEnable;
+    TPM_HANDLE              g_exclusiveAuditSession;
+    UINT64                  g_time;
+    BOOL                    g_pcrReConfig;
+    TPMI_DH_OBJECT          g_DRTMHandle;
+    BOOL                    g_DrtmPreStartup;
+    BOOL                    g_StartupLocality3;
+    BOOL                    g_clearOrderly;
+    TPM_SU                  g_prevOrderlyState;
+    BOOL                    g_updateNV;
+    BOOL                    g_nvOk;
+    TPM2B_AUTH              g_platformUniqueDetails;
+    STATE_CLEAR_DATA        gc;
+    STATE_RESET_DATA        gr;
+    PERSISTENT_DATA         gp;
+    ORDERLY_DATA            go;
+    TPM_HANDLE              s_sessionHandles[MAX_SESSION_NUM];
+    TPMA_SESSION            s_attributes[MAX_SESSION_NUM];
+    TPM_HANDLE              s_associatedHandles[MAX_SESSION_NUM];
+    TPM2B_NONCE             s_nonceCaller[MAX_SESSION_NUM];
+    TPM2B_AUTH              s_inputAuthValues[MAX_SESSION_NUM];
+    UINT32                  s_encryptSessionIndex;
+    UINT32                  s_decryptSessionIndex;
+    UINT32                  s_auditSessionIndex;
+    TPM2B_DIGEST            s_cpHashForAudit;
+    UINT32                  s_sessionNum;
+    BOOL                    s_DAPendingOnNV;
+#ifdef TPM_CC_GetCommandAuditDigest
+    TPM2B_DIGEST            s_cpHashForCommandAudit;
+#endif
+    UINT64                  s_selfHealTimer;
+    UINT64                  s_lockoutTimer;
+    UINT32                  s_reservedAddr[NV_RESERVE_LAST];
+    UINT32                  s_reservedSize[NV_RESERVE_LAST];
+    UINT32                  s_ramIndexSize;
+    BYTE                    s_ramIndex[RAM_INDEX_SPACE];
+    NV_HANDLE_MAP_ENTRY     s_ramIndexMap[RAM_INDEX_MAP_SIZE];
+    UINT32                  s_ramIndexSizeAddr;
+    UINT32                  s_ramIndexAddr;
+    UINT32                  s_maxCountAddr;
+    UINT32                  s_evictNvStart;
+    UINT32                  s_evictNvEnd;
+    NV_HANDLE_MAP_ENTRY     s_nvHandleMap[NV_HANDLE_MAP_SIZE];
+    UINT32                  s_evictNvTail;
+    UINT32                  s_evictNvPersistentNum;
+    NV_INDEX_CACHE_ENTRY    s_nvIndexCache[NV_INDEX_CACHE_SIZE];
+    TPM_RC                  s_NvStatus;
+    OBJECT_SLOT             s_objects[MAX_LOADED_OBJECTS];
+    PCR                     s_pcrs[IMPLEMENTATION_PCR];
+    SESSION_SLOT            s_sessions[MAX_LOADED_SESSIONS];
+    UINT32                  s_oldestSavedSession;
+    int                     s_freeSessionSlots;
+    BOOL                    g_manufactured;
+    BOOL                    s_initialized;
+#ifndef EMBEDDED_MODE
+    UINT32                  s_actionInputBuffer[1024];
+    UINT32                  s_actionOutputBuffer[1024];
+#endif
+    BYTE                    s_responseBuffer[MAX_RESPONSE_SIZE];
+    BYTE                   *s_responseTarget;
+#ifdef TPM_COMMAND_PROFILE
+    COMMAND_PROFILE         s_commandProfile[TPM_CC_LAST - TPM_CC_FIRST + 1];
+#endif
+    ALGORITHM_VECTOR        g_implementedAlgorithms;
+    ALGORITHM_VECTOR        g_toTest;
+#ifndef EMBEDDED_MODE
+    jmp_buf                 g_jumpBuffer;
+#endif
+    BOOL                    g_forceFailureMode;
+    BOOL                    g_inFailureMode;
+    UINT32                  s_failFunction;
+    UINT32                  s_failLine;
+    UINT32                  s_failCode;
+    struct platform_instance   *platform;      // the platform state, see PlatformData.h
+    struct cpri_instance       *cpri;          // the crypto engine state
+};
+extern THREAD_LOCAL struct tpm_instance *g_tpmInstance;
+#define g_phEnable                  (g_tpmInstance->g_phEnable)
+#define g_exclusiveAuditSession     (g_tpmInstance->g_exclusiveAuditSession)
+#define g_time                      (g_tpmInstance->g_time)
+#define g_pcrReConfig               (g_tpmInstance->g_pcrReConfig)
+#define g_DRTMHandle                (g_tpmInstance->g_DRTMHandle)
+#define g_DrtmPreStartup            (g_tpmInstance->g_DrtmPreStartup)
+#define g_StartupLocality3          (g_tpmInstance->g_StartupLocality3)
+#define g_clearOrderly              (g_tpmInstance->g_clearOrderly)
+#define g_prevOrderlyState          (g_tpmInstance->g_prevOrderlyState)
+#define g_updateNV                  (g_tpmInstance->g_updateNV)
+#define g_nvOk                      (g_tpmInstance->g_nvOk)
+#define g_platformUniqueDetails     (g_tpmInstance->g_platformUniqueDetails)
+#define gc                          (g_tpmInstance->gc)
+#define gr                          (g_tpmInstance->gr)
+#define gp                          (g_tpmInstance->gp)
+#define go                          (g_tpmInstance->go)
+#define s_sessionHandles            (g_tpmInstance->s_sessionHandles)
+#define s_attributes                (g_tpmInstance->s_attributes)
+#define s_associatedHandles         (g_tpmInstance->s_associatedHandles)
+#define s_nonceCaller               (g_tpmInstance->s_nonceCaller)
+#define s_inputAuthValues           (g_tpmInstance->s_inputAuthValues)
+#define s_encryptSessionIndex       (g_tpmInstance->s_encryptSessionIndex)
+#define s_decryptSessionIndex       (g_tpmInstance->s_decryptSessionIndex)
+#define s_auditSessionIndex         (g_tpmInstance->s_auditSessionIndex)
+#define s_cpHashForAudit            (g_tpmInstance->s_cpHashForAudit)
+#define s_sessionNum                (g_tpmInstance->s_sessionNum)
+#define s_DAPendingOnNV             (g_tpmInstance->s_DAPendingOnNV)
+#ifdef TPM_CC_GetCommandAuditDigest
+#define s_cpHashForCommandAudit     (g_tpmInstance->s_cpHashForCommandAudit)
+#endif
+#define s_selfHealTimer             (g_tpmInstance->s_selfHealTimer)
+#define s_lockoutTimer              (g_tpmInstance->s_lockoutTimer)
+#define s_reservedAddr              (g_tpmInstance->s_reservedAddr)
+#define s_reservedSize              (g_tpmInstance->s_reservedSize)
+#define s_ramIndexSize              (g_tpmInstance->s_ramIndexSize)
+#define s_ramIndex                  (g_tpmInstance->s_ramIndex)
+#define s_ramIndexMap               (g_tpmInstance->s_ramIndexMap)
+#define s_ramIndexSizeAddr          (g_tpmInstance->s_ramIndexSizeAddr)
+#define s_ramIndexAddr              (g_tpmInstance->s_ramIndexAddr)
+#define s_maxCountAddr              (g_tpmInstance->s_maxCountAddr)
+#define s_evictNvStart              (g_tpmInstance->s_evictNvStart)
+#define s_evictNvEnd                (g_tpmInstance->s_evictNvEnd)
+#define s_nvHandleMap               (g_tpmInstance->s_nvHandleMap)
+#define s_evictNvTail               (g_tpmInstance->s_evictNvTail)
+#define s_evictNvPersistentNum      (g_tpmInstance->s_evictNvPersistentNum)
+#define s_nvIndexCache              (g_tpmInstance->s_nvIndexCache)
+#define s_NvStatus                  (g_tpmInstance->s_NvStatus)
+#define s_objects                   (g_tpmInstance->s_objects)
+#define s_pcrs                      (g_tpmInstance->s_pcrs)
+#define s_sessions                  (g_tpmInstance->s_sessions)
+#define s_oldestSavedSession        (g_tpmInstance->s_oldestSavedSession)
+#define s_freeSessionSlots          (g_tpmInstance->s_freeSessionSlots)
+#define g_manufactured              (g_tpmInstance->g_manufactured)
+#define s_initialized               (g_tpmInstance->s_initialized)
+#ifndef EMBEDDED_MODE
+#define s_actionInputBuffer         (g_tpmInstance->s_actionInputBuffer)
+#define s_actionOutputBuffer        (g_tpmInstance->s_actionOutputBuffer)
+#endif
+#define s_responseBuffer            (g_tpmInstance->s_responseBuffer)
+#define s_responseTarget            (g_tpmInstance->s_responseTarget)
+#ifdef TPM_COMMAND_PROFILE
+#define s_commandProfile            (g_tpmInstance->s_commandProfile)
+#endif
+#define g_implementedAlgorithms     (g_tpmInstance->g_implementedAlgorithms)
+#define g_toTest                    (g_tpmInstance->g_toTest)
+#ifndef EMBEDDED_MODE
+#define g_jumpBuffer                (g_tpmInstance->g_jumpBuffer)
+#endif
+#define g_forceFailureMode          (g_tpmInstance->g_forceFailureMode)
+#define g_inFailureMode             (g_tpmInstance->g_inFailureMode)
+#define s_failFunction              (g_tpmInstance->s_failFunction)
+#define s_failLine                  (g_tpmInstance->s_failLine)
+#define s_failCode                  (g_tpmInstance->s_failCode)
+#endif // TPM_MULTI_INSTANCE
 #endif // GLOBAL_H
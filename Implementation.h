@@ -280,7 +280,18 @@
 #define ALG_ID_LAST                       TPM_ALG_LAST
 #define MAX_SYM_DATA                      128
 #define MAX_RNG_ENTROPY_SIZE              64
+#ifndef RAM_INDEX_SPACE
 #define RAM_INDEX_SPACE                   512
+#endif
+#ifndef RAM_INDEX_MAP_SIZE
+#define RAM_INDEX_MAP_SIZE                128
+#endif
+#ifdef EMBEDDED_MODE
+#define NV_HANDLE_MAP_SIZE                128
+#else
+#define NV_HANDLE_MAP_SIZE                256
+#endif
+#define NV_INDEX_CACHE_SIZE               8
 #define RSA_DEFAULT_PUBLIC_EXPONENT       0x00010001
 #define ENABLE_PCR_NO_INCREMENT           YES
 #define CRT_FORMAT_RSA                    YES
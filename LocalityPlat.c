@@ -7,9 +7,6 @@
 
 #include "PlatformData.h"
 #include "TpmError.h"
-
-static BOOL s_RsaKeyCacheEnabled;
-
 //
 //
 //          Functions
@@ -234,7 +234,7 @@ MemoryGetActionOutputBuffer(
 //       MemoryGetResponseBuffer()
 //
 //      This function returns the address into which the command response is marshaled from values in the
-//      action output buffer.
+//      action output buffer. This is the buffer of the caller of ExecuteCommandToBuffer() during that call.
 //
 BYTE*
 MemoryGetResponseBuffer(
@@ -245,6 +245,8 @@ MemoryGetResponseBuffer(
       // Other implementation may apply additional optimization based on the command
       // code or other factors.
       command = 0;        // Unreferenced parameter
+      if(s_responseTarget != NULL)
+          return s_responseTarget;
       return s_responseBuffer;
 }
 //
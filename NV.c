@@ -117,6 +117,155 @@ NvWriteMaxCount(
 //     the data entry. A 0-valued offset value indicates the end of the list. If the data entry area of the last node
 //     happens to reach the end of the dynamic area without space left for an additional 4 byte end marker, the
 //     end address, s_evictNvEnd, should serve as the mark of list end
+//     When NV_KV_STORE is defined, the dynamic area is instead kept by the platform in a key/value store
+//     indexed by handle (see NVStore.c) and only the reserved data stays in NV memory. The functions
+//     NvNext(), NvGetFreeByte(), NvAdd(), NvDelete() and NvFindHandle() have a version for each
+//     organization, and every other function reaches entity data through NvEntityRead(), NvEntityWrite() and
+//     NvEntityIsDifferent(), so the rest of this file does not depend on the choice. In both organizations, an
+//     entity is referenced by a non-zero UINT32 that is its NV offset for the list and its handle for the store.
+//
+//           Handle Map Functions
+//
+//           Introduction
+//
+//      These functions maintain a RAM-resident hash table that maps a handle to an offset. The table is open
+//      addressed with linear probing, its size is a power of 2 and a slot with an addr of 0 is unused. Two maps
+//      are kept: s_nvHandleMap maps the handle of each entity in the NV dynamic area to its NV offset so that
+//      NvFindHandle() does not walk the linked list, and s_ramIndexMap maps the handle of each RAM-backed
+//      NV Index to the offset of its data in s_ramIndex.
+//
+//           NvHandleMapHash()
+//
+//      This function returns the slot in a map of mapSize slots at which the search for a handle starts.
+//
+static UINT32
+NvHandleMapHash(
+   TPM_HANDLE            handle,             // IN: handle to hash
+   UINT32                mapSize             // IN: number of slots in the map
+   )
+{
+   UINT32              hash = handle;
+   // Fold the handle type in the high-order byte into the low-order bits so
+   // that an NV Index and a persistent object with the same index do not
+   // always collide.
+   hash ^= hash >> 16;
+   hash *= 0x45D9F3B;
+   hash ^= hash >> 16;
+   return hash & (mapSize - 1);
+}
+//
+//
+//           NvHandleMapInsert()
+//
+//      This function records the offset associated with handle.
+//
+static void
+NvHandleMapInsert(
+   NV_HANDLE_MAP_ENTRY  *map,                // IN/OUT: the map
+   UINT32                mapSize,            // IN: number of slots in the map
+   TPM_HANDLE            handle,             // IN: handle of the entity
+   UINT32                addr                // IN: offset of the entity
+   )
+{
+   UINT32              slot = NvHandleMapHash(handle, mapSize);
+   UINT32              probes;
+   for(probes = 0; map[slot].addr != 0; probes++)
+   {
+       // The map sizes are chosen so that a map cannot fill up before the
+       // space that it indexes does.
+       pAssert(probes < mapSize - 1);
+       slot = (slot + 1) & (mapSize - 1);
+   }
+   map[slot].handle = handle;
+   map[slot].addr = addr;
+   return;
+}
+//
+//
+//           NvHandleMapFind()
+//
+//      This function returns the offset associated with handle, or 0 if handle is not in the map.
+//
+static UINT32
+NvHandleMapFind(
+   NV_HANDLE_MAP_ENTRY  *map,                // IN: the map
+   UINT32                mapSize,            // IN: number of slots in the map
+   TPM_HANDLE            handle              // IN: handle of the entity
+   )
+{
+   UINT32              slot = NvHandleMapHash(handle, mapSize);
+   UINT32              probes;
+   for(probes = 0; probes < mapSize && map[slot].addr != 0; probes++)
+   {
+       if(map[slot].handle == handle)
+           return map[slot].addr;
+       slot = (slot + 1) & (mapSize - 1);
+   }
+   return 0;
+}
+//
+//
+//           NvHandleMapRemove()
+//
+//      This function removes handle from a map. The entries that follow the removed one in its probe sequence
+//      are shifted back so that no tombstones are needed.
+//
+static void
+NvHandleMapRemove(
+   NV_HANDLE_MAP_ENTRY  *map,                // IN/OUT: the map
+   UINT32                mapSize,            // IN: number of slots in the map
+   TPM_HANDLE            handle              // IN: handle of the entity
+   )
+{
+   UINT32              slot = NvHandleMapHash(handle, mapSize);
+   UINT32              next;
+   UINT32              home;
+   while(map[slot].handle != handle || map[slot].addr == 0)
+   {
+       // The handle is required to be in the map
+       pAssert(map[slot].addr != 0);
+       slot = (slot + 1) & (mapSize - 1);
+   }
+   for(next = (slot + 1) & (mapSize - 1);
+       map[next].addr != 0;
+       next = (next + 1) & (mapSize - 1))
+   {
+       home = NvHandleMapHash(map[next].handle, mapSize);
+       // An entry may move into the vacated slot only if that does not put it
+       // ahead of its home slot.
+       if(((next - home) & (mapSize - 1)) >= ((next - slot) & (mapSize - 1)))
+       {
+           map[slot] = map[next];
+           slot = next;
+       }
+   }
+   map[slot].addr = 0;
+   return;
+}
+//
+//
+//           NvHandleMapRebase()
+//
+//      This function lowers by size every offset in a map that is above addr. It is used after the entries that
+//      followed a deleted one have been moved down.
+//
+static void
+NvHandleMapRebase(
+   NV_HANDLE_MAP_ENTRY  *map,                // IN/OUT: the map
+   UINT32                mapSize,            // IN: number of slots in the map
+   UINT32                addr,               // IN: offset of the deleted entry
+   UINT32                size                // IN: size of the deleted entry
+   )
+{
+   UINT32              i;
+   for(i = 0; i < mapSize; i++)
+   {
+       if(map[i].addr > addr)
+           map[i].addr -= size;
+   }
+   return;
+}
+#ifndef NV_KV_STORE
 //
 //          NvNext()
 //
@@ -154,7 +303,8 @@ NvNext(
 //
 //           NvGetEnd()
 //
-//      Function to find the end of the NV dynamic data list
+//      Function to find the end of the NV dynamic data list by walking it. The result is cached in s_evictNvTail
+//      by NvBuildHandleMap() so that other functions do not need to walk the list.
 //
 static UINT32
 NvGetEnd(
@@ -176,6 +326,33 @@ NvGetEnd(
 }
 //
 //
+//           NvBuildHandleMap()
+//
+//      This function rebuilds s_nvHandleMap, s_evictNvTail and s_evictNvPersistentNum from the NV linked list. It
+//      is called whenever the RAM copy of NV is (re)established.
+//
+static void
+NvBuildHandleMap(
+   void
+   )
+{
+   NV_ITER             iter = NV_ITER_INIT;
+   UINT32              addr;
+   MemorySet(s_nvHandleMap, 0, sizeof(s_nvHandleMap));
+   s_evictNvPersistentNum = 0;
+   while((addr = NvNext(&iter)) != 0)
+   {
+       TPM_HANDLE      handle;
+       _plat__NvMemoryRead(addr, sizeof(TPM_HANDLE), &handle);
+       NvHandleMapInsert(s_nvHandleMap, NV_HANDLE_MAP_SIZE, handle, addr);
+       if(HandleGetType(handle) == TPM_HT_PERSISTENT)
+           s_evictNvPersistentNum++;
+   }
+   s_evictNvTail = NvGetEnd();
+   return;
+}
+//
+//
 //           NvGetFreeByte
 //
 //      This function returns the number of free octets in NV space.
@@ -185,7 +362,165 @@ NvGetFreeByte(
    void
    )
 {
-   return s_evictNvEnd - NvGetEnd();
+#ifdef NV_DEBUG
+   pAssert(s_evictNvTail == NvGetEnd());
+#endif
+   return s_evictNvEnd - s_evictNvTail;
+}
+#else // NV_KV_STORE
+//
+//
+//           NvNext()
+//
+//      This function traverses every entity in the platform store. The iterator is initialized to NV_ITER_INIT and
+//      the return value is the handle of the next entity or 0 at the end of the traversal.
+//
+static UINT32
+NvNext(
+   NV_ITER             *iter
+   )
+{
+   if(*iter == NV_ITER_INIT)
+       *iter = 0;
+   return _plat__NvEntityNext(iter);
+}
+//
+//
+//           NvGetFreeByte
+//
+//      This function returns the number of free octets in the platform store.
+//
+static UINT32
+NvGetFreeByte(
+   void
+   )
+{
+   return _plat__NvEntityFreeSpace();
+}
+#endif // NV_KV_STORE
+//
+//
+//           NvIndexCacheInvalidate()
+//
+//      This function removes the entry for handle from s_nvIndexCache, if there is one.
+//
+static void
+NvIndexCacheInvalidate(
+   TPM_HANDLE            handle           // IN: handle of the entity
+   )
+{
+   NV_INDEX_CACHE_ENTRY *entry = &s_nvIndexCache[handle & (NV_INDEX_CACHE_SIZE - 1)];
+   if(entry->handle == handle)
+       entry->handle = 0;
+   return;
+}
+//
+//
+//           NvIndexCacheClear()
+//
+//      This function empties s_nvIndexCache. It is called whenever the RAM copy of NV is (re)established or
+//      entities are removed without NvDelete().
+//
+static void
+NvIndexCacheClear(
+   void
+   )
+{
+   MemorySet(s_nvIndexCache, 0, sizeof(s_nvIndexCache));
+   return;
+}
+//
+//
+//           NvEntityHandle()
+//
+//      This function returns the handle of the entity referenced by entityAddr.
+//
+static TPM_HANDLE
+NvEntityHandle(
+   UINT32                entityAddr       // IN: entity reference
+   )
+{
+#ifdef NV_KV_STORE
+   // The reference is the handle
+   return entityAddr;
+#else
+   TPM_HANDLE           handle;
+   _plat__NvMemoryRead(entityAddr, sizeof(TPM_HANDLE), &handle);
+   return handle;
+#endif
+}
+//
+//
+//           NvEntityRead()
+//
+//      This function reads size octets starting at offset within the entity referenced by entityAddr. The entity
+//      starts with its handle.
+//
+static void
+NvEntityRead(
+   UINT32                entityAddr,      // IN: entity reference
+   UINT32                offset,          // IN: offset within the entity
+   UINT32                size,            // IN: number of octets to read
+   void                 *data             // OUT: data buffer
+   )
+{
+#ifdef NV_KV_STORE
+   _plat__NvEntityRead(entityAddr, offset, size, data);
+#else
+   _plat__NvMemoryRead(entityAddr + offset, size, data);
+#endif
+   return;
+}
+//
+//
+//           NvEntityWrite()
+//
+//      This function writes size octets starting at offset within the entity referenced by entityAddr. The caller
+//      sets g_updateNV. A write that reaches the NV_INDEX header invalidates the cached copy of it.
+//
+static void
+NvEntityWrite(
+   UINT32                entityAddr,      // IN: entity reference
+   UINT32                offset,          // IN: offset within the entity
+   UINT32                size,            // IN: number of octets to write
+   void                 *data             // IN: data buffer
+   )
+{
+   if(offset < sizeof(TPM_HANDLE) + sizeof(NV_INDEX))
+       NvIndexCacheInvalidate(NvEntityHandle(entityAddr));
+#ifdef NV_KV_STORE
+   if(_plat__NvEntityWrite(entityAddr, offset, size, data) != 0)
+       FAIL(FATAL_ERROR_ALLOCATION);
+#else
+   _plat__NvMemoryWrite(entityAddr + offset, size, data);
+#endif
+   return;
+}
+//
+//
+//           NvEntityIsDifferent()
+//
+//      This function checks whether the indicated octets of an entity differ from data so that NV is not written if
+//      it would not change.
+//
+//      Return Value                      Meaning
+//
+//      TRUE                              the entity data is different from data
+//      FALSE                             the entity data is the same as data
+//
+static BOOL
+NvEntityIsDifferent(
+   UINT32                entityAddr,      // IN: entity reference
+   UINT32                offset,          // IN: offset within the entity
+   UINT32                size,            // IN: number of octets to compare
+   void                 *data             // IN: data buffer
+   )
+{
+#ifdef NV_KV_STORE
+   return _plat__NvEntityIsDifferent(entityAddr, offset, size, data);
+#else
+   return _plat__NvIsDifferent(entityAddr + offset, size, data);
+#endif
 }
 //
 //           NvGetEvictObjectSize
@@ -261,6 +596,7 @@ NvTestSpace(
    // memory because the end marker will not be written if it will not fit.
    return (size + sizeof(UINT32) <= remainByte);
 }
+#ifndef NV_KV_STORE
 //
 //
 //           NvAdd()
@@ -282,8 +618,9 @@ NvAdd(
    UINT32               endAddr;
    UINT32               nextAddr;
    UINT32               listEnd = 0;
+   TPM_HANDLE           handle;
    // Get the end of data list
-   endAddr = NvGetEnd();
+   endAddr = s_evictNvTail;
    // Calculate the value of next pointer, which is the size of a pointer +
    // the entity data size
    nextAddr = endAddr + sizeof(UINT32) + totalSize;
@@ -291,9 +628,19 @@ NvAdd(
    _plat__NvMemoryWrite(endAddr, sizeof(UINT32), &nextAddr);
    // Write entity data
    _plat__NvMemoryWrite(endAddr + sizeof(UINT32), bufferSize, entity);
+   // The entity data starts with its handle
+   memcpy(&handle, entity, sizeof(TPM_HANDLE));
+   NvHandleMapInsert(s_nvHandleMap, NV_HANDLE_MAP_SIZE, handle,
+                     endAddr + sizeof(UINT32));
+   if(HandleGetType(handle) == TPM_HT_PERSISTENT)
+       s_evictNvPersistentNum++;
    // Write the end of list if it is not going to exceed the NV space
    if(nextAddr + sizeof(UINT32) <= s_evictNvEnd)
        _plat__NvMemoryWrite(nextAddr, sizeof(UINT32), &listEnd);
+   s_evictNvTail = nextAddr;
+#ifdef NV_DEBUG
+   pAssert(s_evictNvTail == NvGetEnd());
+#endif
    // Set the flag so that NV changes are committed before the command completes.
    g_updateNV = TRUE;
 }
@@ -312,6 +659,13 @@ NvDelete(
    UINT32              entrySize;
    UINT32              entryAddr = entityAddr - sizeof(UINT32);
    UINT32              listEnd = 0;
+   TPM_HANDLE          handle;
+   // Remove the entity from the handle map
+   _plat__NvMemoryRead(entityAddr, sizeof(TPM_HANDLE), &handle);
+   NvHandleMapRemove(s_nvHandleMap, NV_HANDLE_MAP_SIZE, handle);
+   NvIndexCacheInvalidate(handle);
+   if(HandleGetType(handle) == TPM_HT_PERSISTENT)
+       s_evictNvPersistentNum--;
    // Get the offset of the next entry.
    _plat__NvMemoryRead(entryAddr, sizeof(UINT32), &next);
    // The size of this entry is the difference between the current entry and the
@@ -340,11 +694,64 @@ NvDelete(
    }
    // Mark the end of list
    _plat__NvMemoryWrite(next - entrySize, sizeof(UINT32), &listEnd);
+   s_evictNvTail = next - entrySize;
+#ifdef NV_DEBUG
+   pAssert(s_evictNvTail == NvGetEnd());
+#endif
+   // Every entity that followed the deleted one has moved down by entrySize
+   NvHandleMapRebase(s_nvHandleMap, NV_HANDLE_MAP_SIZE, entityAddr, entrySize);
+   // Set the flag so that NV changes are committed before the command completes.
+   g_updateNV = TRUE;
+}
+#else // NV_KV_STORE
+//
+//
+//           NvAdd()
+//
+//      This function adds a new entity to the platform store. The first bufferSize octets of the entity are taken
+//      from entity and the remaining octets are 0.
+//      This function requires that there is enough space to add a new entity (i.e., that NvTestSpace() has been
+//      called and the available space is at least as large as the required space).
+//
+static void
+NvAdd(
+   UINT32                totalSize,       // IN: total size needed for this entity
+   UINT32                bufferSize,      // IN: size of initial buffer
+   BYTE                 *entity           // IN: initial buffer
+   )
+{
+   TPM_HANDLE           handle;
+   // The entity data starts with its handle
+   memcpy(&handle, entity, sizeof(TPM_HANDLE));
+   if(_plat__NvEntityAdd(handle, totalSize, bufferSize, entity) != 0)
+       FAIL(FATAL_ERROR_ALLOCATION);
+   if(HandleGetType(handle) == TPM_HT_PERSISTENT)
+       s_evictNvPersistentNum++;
    // Set the flag so that NV changes are committed before the command completes.
    g_updateNV = TRUE;
 }
 //
 //
+//           NvDelete()
+//
+//      This function is used to delete an NV Index or persistent object from the platform store.
+//
+static void
+NvDelete(
+   UINT32                entityAddr       // IN: handle of entity to be deleted
+   )
+{
+   if(_plat__NvEntityDelete(entityAddr) != 0)
+       FAIL(FATAL_ERROR_ALLOCATION);
+   NvIndexCacheInvalidate(entityAddr);
+   if(HandleGetType(entityAddr) == TPM_HT_PERSISTENT)
+       s_evictNvPersistentNum--;
+   // Set the flag so that NV changes are committed before the command completes.
+   g_updateNV = TRUE;
+}
+#endif // NV_KV_STORE
+//
+//
 //           RAM-based NV Index Data Access Functions
 //
 //           Introduction
@@ -353,6 +760,14 @@ NvDelete(
 //      stored in RAM.
 //      NV storage is updated when a NV Index is added or deleted. We do NOT updated NV storage when the
 //      data is updated/
+//      The offset of the data of each NV Index is kept in s_ramIndexMap so that it is found without scanning the
+//      buffer. RAM_INDEX_SPACE and RAM_INDEX_MAP_SIZE may be set at build time; the map must have more
+//      slots than the number of NV Indices that fit in the buffer.
+//
+#if (RAM_INDEX_MAP_SIZE & (RAM_INDEX_MAP_SIZE - 1)) != 0                      \
+    || RAM_INDEX_MAP_SIZE * 9 <= RAM_INDEX_SPACE
+#error "RAM_INDEX_MAP_SIZE must be a power of 2 larger than RAM_INDEX_SPACE / 9"
+#endif
 //
 //           NvTestRAMSpace()
 //
@@ -389,23 +804,38 @@ NvGetRAMIndexOffset(
    TPMI_RH_NV_INDEX           handle               // IN: NV handle
    )
 {
-   UINT32         currAddr = 0;
-   while(currAddr < s_ramIndexSize)
+   UINT32         dataAddr;
+   dataAddr = NvHandleMapFind(s_ramIndexMap, RAM_INDEX_MAP_SIZE, handle);
+   // We assume the index data is existing in RAM space
+   pAssert(dataAddr != 0);
+   return dataAddr;
+}
+//
+//
+//           NvBuildRAMIndexMap()
+//
+//      This function rebuilds s_ramIndexMap from s_ramIndex.
+//
+static void
+NvBuildRAMIndexMap(
+   void
+   )
+{
+   UINT32         currAddr;
+   UINT32         currSize;
+   MemorySet(s_ramIndexMap, 0, sizeof(s_ramIndexMap));
+   for(currAddr = 0; currAddr < s_ramIndexSize;
+       currAddr += sizeof(UINT32) + currSize)
    {
        TPMI_RH_NV_INDEX    currHandle;
-       UINT32              currSize;
+       memcpy(&currSize, &s_ramIndex[currAddr], sizeof(currSize));
        memcpy(&currHandle, &s_ramIndex[currAddr + sizeof(UINT32)],
               sizeof(currHandle));
-         // Found a match
-         if(currHandle == handle)
-              // data buffer follows the handle and size field
-              break;
-         memcpy(&currSize, &s_ramIndex[currAddr], sizeof(currSize));
-         currAddr += sizeof(UINT32) + currSize;
+       // data buffer follows the handle and size field
+       NvHandleMapInsert(s_ramIndexMap, RAM_INDEX_MAP_SIZE, currHandle,
+                         currAddr + sizeof(UINT32) + sizeof(TPMI_RH_NV_INDEX));
    }
-   // We assume the index data is existing in RAM space
-   pAssert(currAddr < s_ramIndexSize);
-   return currAddr + sizeof(TPMI_RH_NV_INDEX) + sizeof(UINT32);
+   return;
 }
 //
 //
@@ -421,17 +851,19 @@ NvAddRAM(
    )
 {
    // Add data space at the end of reserved RAM buffer
+   UINT32 nodeOffset = s_ramIndexSize;
    UINT32 value = size + sizeof(TPMI_RH_NV_INDEX);
-   memcpy(&s_ramIndex[s_ramIndexSize], &value,
-          sizeof(s_ramIndex[s_ramIndexSize]));
-   memcpy(&s_ramIndex[s_ramIndexSize + sizeof(UINT32)], &handle,
-          sizeof(s_ramIndex[s_ramIndexSize + sizeof(UINT32)]));
+   memcpy(&s_ramIndex[nodeOffset], &value, sizeof(value));
+   memcpy(&s_ramIndex[nodeOffset + sizeof(UINT32)], &handle, sizeof(handle));
    s_ramIndexSize += sizeof(UINT32) + sizeof(TPMI_RH_NV_INDEX) + size;
    pAssert(s_ramIndexSize <= RAM_INDEX_SPACE);
+   NvHandleMapInsert(s_ramIndexMap, RAM_INDEX_MAP_SIZE, handle,
+                     nodeOffset + sizeof(UINT32) + sizeof(TPMI_RH_NV_INDEX));
    // Update NV version of s_ramIndexSize
    _plat__NvMemoryWrite(s_ramIndexSizeAddr, sizeof(UINT32), &s_ramIndexSize);
-   // Write reserved RAM space to NV to reflect the newly added NV Index
-   _plat__NvMemoryWrite(s_ramIndexAddr, RAM_INDEX_SPACE, s_ramIndex);
+   // Write the new node to the NV copy of the RAM space
+   _plat__NvMemoryWrite(s_ramIndexAddr + nodeOffset, s_ramIndexSize - nodeOffset,
+                        &s_ramIndex[nodeOffset]);
    return;
 }
 //
@@ -461,10 +893,15 @@ NvDeleteRAM(
               s_ramIndexSize - nextNode, s_ramIndexSize - nextNode);
    // Update RAM size
    s_ramIndexSize -= size + sizeof(UINT32);
+   // The data of every NV Index that followed has moved down
+   NvHandleMapRemove(s_ramIndexMap, RAM_INDEX_MAP_SIZE, handle);
+   NvHandleMapRebase(s_ramIndexMap, RAM_INDEX_MAP_SIZE, nodeOffset,
+                     size + sizeof(UINT32));
    // Update NV version of s_ramIndexSize
    _plat__NvMemoryWrite(s_ramIndexSizeAddr, sizeof(UINT32), &s_ramIndexSize);
-   // Write reserved RAM space to NV to reflect the newly delete NV Index
-   _plat__NvMemoryWrite(s_ramIndexAddr, RAM_INDEX_SPACE, s_ramIndex);
+   // Write the moved nodes to the NV copy of the RAM space
+   _plat__NvMemoryWrite(s_ramIndexAddr + nodeOffset, s_ramIndexSize - nodeOffset,
+                        &s_ramIndex[nodeOffset]);
    return;
 }
 //
@@ -557,12 +994,29 @@ NvInit(
     UINT64         zeroCounter = 0;
     // Initialize static variables
     NvInitStatic();
+    NvIndexCacheClear();
     // Initialize RAM index space as unused
     _plat__NvMemoryWrite(s_ramIndexSizeAddr, sizeof(UINT32), &nullPointer);
     // Initialize max counter value to 0
     _plat__NvMemoryWrite(s_maxCountAddr, sizeof(UINT64), &zeroCounter);
+#ifdef NV_KV_STORE
+    {
+        NV_ITER        iter = NV_ITER_INIT;
+        UINT32         entityAddr;
+        // Empty the platform store
+        while((entityAddr = NvNext(&iter)) != 0)
+        {
+            NvDelete(entityAddr);
+            iter = NV_ITER_INIT;
+        }
+        s_evictNvPersistentNum = 0;
+    }
+#else
     // Initialize the next offset of the first entry in evict/index list to 0
     _plat__NvMemoryWrite(s_evictNvStart, sizeof(TPM_HANDLE), &nullPointer);
+    // The list is empty so there is nothing in the handle map
+    NvBuildHandleMap();
+#endif
     return;
 }
 //
@@ -715,7 +1169,7 @@ NvNextIndex(
    while((addr = NvNext(iter)) != 0)
    {
        // Read handle
-       _plat__NvMemoryRead(addr, sizeof(TPM_HANDLE), &handle);
+       handle = NvEntityHandle(addr);
        if(HandleGetType(handle) == TPM_HT_NV_INDEX)
            return addr;
    }
@@ -739,7 +1193,7 @@ NvNextEvict(
    while((addr = NvNext(iter)) != 0)
    {
        // Read handle
-       _plat__NvMemoryRead(addr, sizeof(TPM_HANDLE), &handle);
+       handle = NvEntityHandle(addr);
        if(HandleGetType(handle) == TPM_HT_PERSISTENT)
            return addr;
    }
@@ -748,29 +1202,42 @@ NvNextEvict(
 }
 //
 //
+//           NvCountPersistent()
+//
+//      This function counts the persistent objects in NV by traversing every entity. It is used to establish
+//      s_evictNvPersistentNum and, with NV_DEBUG, to check it.
+//
+#if defined NV_KV_STORE || defined NV_DEBUG
+static UINT32
+NvCountPersistent(
+   void
+   )
+{
+   UINT32              num = 0;
+   NV_ITER             iter = NV_ITER_INIT;
+   while(NvNextEvict(&iter) != 0) num++;
+   return num;
+}
+#endif
+//
+//
 //          NvFindHandle()
 //
 //      this function returns the offset in NV memory of the entity associated with the input handle. A value of
 //      zero indicates that handle does not exist reference an existing persistent object or defined NV Index.
+//      The offset is found in s_nvHandleMap rather than by walking the NV linked list. With NV_KV_STORE, the
+//      reference returned is the handle itself.
 //
 static UINT32
 NvFindHandle(
    TPM_HANDLE            handle
    )
 {
-   UINT32              addr;
-   NV_ITER             iter = NV_ITER_INIT;
-   while((addr = NvNext(&iter)) != 0)
-   {
-       TPM_HANDLE          entityHandle;
-       // Read handle
-//
-          _plat__NvMemoryRead(addr, sizeof(TPM_HANDLE), &entityHandle);
-          if(entityHandle == handle)
-              return addr;
-    }
-    pAssert(addr == 0);
-    return addr;
+#ifdef NV_KV_STORE
+   return _plat__NvEntityExists(handle) ? handle : 0;
+#else
+   return NvHandleMapFind(s_nvHandleMap, NV_HANDLE_MAP_SIZE, handle);
+#endif
 }
 //
 //
@@ -797,6 +1264,12 @@ NvPowerOn(
         if((nvError = _plat__NVEnable(0)) < 0)
             FAIL(FATAL_ERROR_NV_UNRECOVERABLE);
           NvInitStatic();
+          NvIndexCacheClear();
+#ifndef NV_KV_STORE
+          NvBuildHandleMap();
+#else
+          s_evictNvPersistentNum = NvCountPersistent();
+#endif
     }
     return nvError == 0;
 }
@@ -811,10 +1284,23 @@ NvStateSave(
     void
     )
 {
+    UINT32         nodeOffset;
+    UINT32         nodeSize;
     // Write RAM backed NV Index info to NV
     // No need to save s_ramIndexSize because we save it to NV whenever it is
-    // updated.
-    _plat__NvMemoryWrite(s_ramIndexAddr, RAM_INDEX_SPACE, s_ramIndex);
+    // updated. Only the NV Indices whose data has changed are written, so that
+    // only the NV pages holding them need to be committed.
+    for(nodeOffset = 0; nodeOffset < s_ramIndexSize;
+        nodeOffset += sizeof(UINT32) + nodeSize)
+    {
+        memcpy(&nodeSize, &s_ramIndex[nodeOffset], sizeof(nodeSize));
+        if(_plat__NvIsDifferent(s_ramIndexAddr + nodeOffset,
+                                sizeof(UINT32) + nodeSize,
+                                &s_ramIndex[nodeOffset]))
+            _plat__NvMemoryWrite(s_ramIndexAddr + nodeOffset,
+                                 sizeof(UINT32) + nodeSize,
+                                 &s_ramIndex[nodeOffset]);
+    }
     // Set the flag so that an NV write happens before the command completes.
     g_updateNV = TRUE;
     return;
@@ -840,7 +1326,9 @@ NvEntityStartup(
     UINT32                    currentAddr;         // offset points to the current entity
     // Restore RAM index data
     _plat__NvMemoryRead(s_ramIndexSizeAddr, sizeof(UINT32), &s_ramIndexSize);
-    _plat__NvMemoryRead(s_ramIndexAddr, RAM_INDEX_SPACE, s_ramIndex);
+    pAssert(s_ramIndexSize <= RAM_INDEX_SPACE);
+    _plat__NvMemoryRead(s_ramIndexAddr, s_ramIndexSize, s_ramIndex);
+    NvBuildRAMIndexMap();
     // If recovering from state save, do nothing
     if(type == SU_RESUME)
         return;
@@ -848,13 +1336,12 @@ NvEntityStartup(
     while((currentAddr = NvNextIndex(&iter)) != 0)
     {
         NV_INDEX    nvIndex;
-        UINT32      indexAddr;              // NV address points to index info
         TPMA_NV     attributes;
         UINT32      attributesValue;
         UINT32      publicAreaAttributesValue;
-          indexAddr = currentAddr + sizeof(TPM_HANDLE);
           // Read NV Index info structure
-          _plat__NvMemoryRead(indexAddr, sizeof(NV_INDEX), &nvIndex);
+          NvEntityRead(currentAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX),
+                       &nvIndex);
           attributes = nvIndex.publicArea.attributes;
           // Clear read/write lock
           if(attributes.TPMA_NV_READLOCKED == SET)
@@ -886,7 +1373,8 @@ NvEntityStartup(
          if(attributesValue != publicAreaAttributesValue)
          {
              nvIndex.publicArea.attributes = attributes;
-             _plat__NvMemoryWrite(indexAddr, sizeof(NV_INDEX), &nvIndex);
+             NvEntityWrite(currentAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX),
+                           &nvIndex);
                  // Set the flag that a NV write happens
                  g_updateNV = TRUE;
          }
@@ -900,7 +1388,7 @@ NvEntityStartup(
                    TPMI_RH_NV_INDEX    nvHandle;
                    UINT64              counter;
                      // Read NV handle
-                     _plat__NvMemoryRead(currentAddr, sizeof(TPM_HANDLE), &nvHandle);
+                     nvHandle = NvEntityHandle(currentAddr);
                      // Read the counter value saved to NV upon the last roll over.
                      // Do not use RAM backed storage for this once.
                      nvIndex.publicArea.attributes.TPMA_NV_ORDERLY = CLEAR;
@@ -986,8 +1474,7 @@ NvIndexIsAccessible(
    if(entityAddr == 0)
        return TPM_RC_HANDLE;
    // Read NV Index info structure
-   _plat__NvMemoryRead(entityAddr + sizeof(TPM_HANDLE), sizeof(NV_INDEX),
-                           &nvIndex);
+   NvEntityRead(entityAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX), &nvIndex);
    if(gc.shEnable == FALSE || gc.phEnableNV == FALSE)
    {
        // if shEnable is CLEAR, an ownerCreate NV Index should not be
@@ -1076,9 +1563,7 @@ NvGetEvictObject(
         result = TPM_RC_HANDLE;
     else
         // Read evict object
-        _plat__NvMemoryRead(entityAddr + sizeof(TPM_HANDLE),
-                             sizeof(OBJECT),
-                             object);
+        NvEntityRead(entityAddr, sizeof(TPM_HANDLE), sizeof(OBJECT), object);
     // whether there is an error or not, make sure that the evict
     // status of the object is set so that the slot will get freed on exit
     object->attributes.evict = SET;
@@ -1101,14 +1586,25 @@ NvGetIndexInfo(
     )
 {
     UINT32                    entityAddr;          // offset points to the entity
+    NV_INDEX_CACHE_ENTRY     *entry;
     pAssert(HandleGetType(handle) == TPM_HT_NV_INDEX);
+    // Use the cached copy if there is one
+    entry = &s_nvIndexCache[handle & (NV_INDEX_CACHE_SIZE - 1)];
+    if(entry->handle == handle)
+    {
+        *nvIndex = entry->nvIndex;
+        return;
+    }
     // Find the address of NV index
     entityAddr = NvFindHandle(handle);
     pAssert(entityAddr != 0);
     // This implementation uses the default format so just
     // read the data in
-    _plat__NvMemoryRead(entityAddr + sizeof(TPM_HANDLE), sizeof(NV_INDEX),
-                        nvIndex);
+    NvEntityRead(entityAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX), nvIndex);
+    // Replace whatever the cache slot held
+    entry->handle = handle;
+    entry->nameSize = 0;
+    entry->nvIndex = *nvIndex;
     return;
 }
 //
@@ -1135,7 +1631,7 @@ NvInitialCounter(
         TPMI_RH_NV_INDEX    nvHandle;
         NV_INDEX            nvIndex;
          // Read NV handle
-         _plat__NvMemoryRead(currentAddr, sizeof(TPM_HANDLE), &nvHandle);
+         nvHandle = NvEntityHandle(currentAddr);
          // Get NV Index
          NvGetIndexInfo(nvHandle, &nvIndex);
          if(    nvIndex.publicArea.attributes.TPMA_NV_COUNTER == SET
@@ -1203,9 +1699,9 @@ NvGetIndexData(
               entityAddr = NvFindHandle(handle);
               // Get data from NV
               // Skip NV Index info, read data buffer
-              entityAddr += sizeof(TPM_HANDLE) + sizeof(NV_INDEX) + offset;
-              // Read the data
-              _plat__NvMemoryRead(entityAddr, size, data);
+              NvEntityRead(entityAddr,
+                           sizeof(TPM_HANDLE) + sizeof(NV_INDEX) + offset,
+                           size, data);
         }
     }
     return;
@@ -1245,9 +1741,8 @@ NvGetIntIndexData(
         entityAddr = NvFindHandle(handle);
           // Get data from NV
           // Skip NV Index info, read data buffer
-          _plat__NvMemoryRead(
-              entityAddr + sizeof(TPM_HANDLE) + sizeof(NV_INDEX),
-              sizeof(UINT64), data);
+          NvEntityRead(entityAddr, sizeof(TPM_HANDLE) + sizeof(NV_INDEX),
+                       sizeof(UINT64), data);
     }
     return;
 }
@@ -1274,16 +1769,16 @@ NvWriteIndexInfo(
     // Get the starting offset for the index in the RAM image of NV
     entryAddr = NvFindHandle(handle);
     pAssert(entryAddr != 0);
-    // Step over the link value
-    entryAddr = entryAddr + sizeof(TPM_HANDLE);
     // If the index data is actually changed, then a write to NV is required
-    if(_plat__NvIsDifferent(entryAddr, sizeof(NV_INDEX),nvIndex))
+    // The NV Index info follows the handle
+    if(NvEntityIsDifferent(entryAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX),
+                           nvIndex))
     {
         // Make sure that NV is available
         result = NvIsAvailable();
         if(result != TPM_RC_SUCCESS)
             return result;
-        _plat__NvMemoryWrite(entryAddr, sizeof(NV_INDEX), nvIndex);
+        NvEntityWrite(entryAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX), nvIndex);
         g_updateNV = TRUE;
     }
     return TPM_RC_SUCCESS;
@@ -1345,15 +1840,15 @@ NvWriteIndexData(
           pAssert(entryAddr != 0);
 //
           // Offset into the index to the first byte of the data to be written
-          entryAddr += sizeof(TPM_HANDLE) + sizeof(NV_INDEX) + offset;
+          offset += sizeof(TPM_HANDLE) + sizeof(NV_INDEX);
           // If the data is actually changed, then a write to NV is required
-          if(_plat__NvIsDifferent(entryAddr, size, data))
+          if(NvEntityIsDifferent(entryAddr, offset, size, data))
           {
               // Make sure that NV is available
               result = NvIsAvailable();
               if(result != TPM_RC_SUCCESS)
                   return result;
-              _plat__NvMemoryWrite(entryAddr, size, data);
+              NvEntityWrite(entryAddr, offset, size, data);
               g_updateNV = TRUE;
           }
     }
@@ -1367,6 +1862,8 @@ NvWriteIndexData(
 //       The name buffer receives the bytes of the Name and the return value is the number of octets in the
 //       Name.
 //       This function requires that the NV Index is defined.
+//       The Name is kept with the header of the Index in s_nvIndexCache so that it is only recomputed after the
+//       header changes.
 //
 UINT16
 NvGetName(
@@ -1380,8 +1877,15 @@ NvGetName(
     BYTE                     *buffer;
     INT32                     bufferSize;
     HASH_STATE                hashState;
-    // Get NV public info
+    NV_INDEX_CACHE_ENTRY     *entry;
+    // Get NV public info. This also makes the Index the one cached in its slot.
     NvGetIndexInfo(handle, &nvIndex);
+    entry = &s_nvIndexCache[handle & (NV_INDEX_CACHE_SIZE - 1)];
+    if(entry->nameSize != 0)
+    {
+        MemoryCopy(name, entry->name, entry->nameSize, sizeof(NAME));
+        return entry->nameSize;
+    }
     // Marshal public area
     buffer = marshalBuffer;
     bufferSize = sizeof(TPMS_NV_PUBLIC);
@@ -1393,6 +1897,8 @@ NvGetName(
     CryptCompleteHash(&hashState, digestSize, &((BYTE *)name)[2]);
     // Include the nameAlg
     UINT16_TO_BYTE_ARRAY(nvIndex.publicArea.nameAlg, (BYTE *)name);
+    MemoryCopy(entry->name, name, digestSize + 2, sizeof(entry->name));
+    entry->nameSize = digestSize + 2;
     return digestSize + 2;
 }
 //
@@ -1515,8 +2021,8 @@ NvDeleteEntity(
     {
         NV_INDEX    nvIndex;
           // Read the NV Index info
-          _plat__NvMemoryRead(entityAddr + sizeof(TPM_HANDLE), sizeof(NV_INDEX),
-                              &nvIndex);
+          NvEntityRead(entityAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX),
+                       &nvIndex);
           // If the entity to be deleted is a counter with the maximum counter
           // value, record it in NV memory
           if(nvIndex.publicArea.attributes.TPMA_NV_COUNTER == SET
@@ -1538,71 +2044,124 @@ NvDeleteEntity(
 }
 //
 //
+//            NvIsFlushedEntity()
+//
+//       This function determines whether the entity referenced by entityAddr is deleted when hierarchy is
+//       flushed. If it is an orderly NV Index, its RAM data is deleted here; the caller deletes the entity.
+//
+//       Return Value                      Meaning
+//
+//       TRUE                              the entity is flushed
+//       FALSE                             the entity is kept
+//
+static BOOL
+NvIsFlushedEntity(
+    TPMI_RH_HIERARCHY         hierarchy,         // IN: hierarchy being flushed
+    UINT32                    entityAddr         // IN: entity reference
+    )
+{
+    TPM_HANDLE          entityHandle;
+    // Read handle information.
+    entityHandle = NvEntityHandle(entityAddr);
+    if(HandleGetType(entityHandle) == TPM_HT_NV_INDEX)
+    {
+        // Handle NV Index
+        NV_INDEX    nvIndex;
+        // If flush endorsement or platform hierarchy, no NV Index would be
+        // flushed
+        if(hierarchy == TPM_RH_ENDORSEMENT || hierarchy == TPM_RH_PLATFORM)
+            return FALSE;
+        NvEntityRead(entityAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX), &nvIndex);
+        // For storage hierarchy, flush OwnerCreated index
+        if(nvIndex.publicArea.attributes.TPMA_NV_PLATFORMCREATE == SET)
+            return FALSE;
+        // If the NV Index is RAM back, delete the RAM data as well
+        if(nvIndex.publicArea.attributes.TPMA_NV_ORDERLY == SET)
+            NvDeleteRAM(entityHandle);
+        return TRUE;
+    }
+    else if(HandleGetType(entityHandle) == TPM_HT_PERSISTENT)
+    {
+        OBJECT          object;
+        // Get evict object
+        NvGetEvictObject(entityHandle, &object);
+        // Flush the evict object if it belongs to the hierarchy
+        return (   (    hierarchy == TPM_RH_PLATFORM
+                    && object.attributes.ppsHierarchy == SET)
+                || (    hierarchy == TPM_RH_OWNER
+                    && object.attributes.spsHierarchy == SET)
+                || (    hierarchy == TPM_RH_ENDORSEMENT
+                    && object.attributes.epsHierarchy == SET)
+               );
+    }
+    pAssert(FALSE);
+    return FALSE;
+}
+//
+//
 //            NvFlushHierarchy()
 //
 //       This function will delete persistent objects belonging to the indicated If the storage hierarchy is selected,
 //       the function will also delete any NV Index define using ownerAuth.
+//       The NV list is compacted in a single pass: each entry that is kept is moved down over the entries deleted
+//       before it, so every entry is moved at most once no matter how many are deleted.
 //
 void
 NvFlushHierarchy(
     TPMI_RH_HIERARCHY         hierarchy          // IN: hierarchy to be flushed.
     )
 {
+#ifndef NV_KV_STORE
+    UINT32              currentAddr = s_evictNvStart;   // entry being examined
+    UINT32              keepAddr = s_evictNvStart;      // where the next kept entry goes
+    UINT32              nextAddr;
+    UINT32              entrySize;
+    UINT32              listEnd = 0;
+    // The loop condition checks for the end of NV and the loop body for the
+    // end marker, as in NvDelete().
+    while(currentAddr + sizeof(UINT32) <= s_evictNvEnd)
+    {
+        _plat__NvMemoryRead(currentAddr, sizeof(UINT32), &nextAddr);
+        if(nextAddr == 0)
+            break;
+        entrySize = nextAddr - currentAddr;
+        // Entries are only moved to lower offsets, so the entry being examined
+        // is still in place and the handle map still locates it.
+        if(!NvIsFlushedEntity(hierarchy, currentAddr + sizeof(UINT32)))
+        {
+            if(keepAddr != currentAddr)
+            {
+                UINT32      newAddr = keepAddr + entrySize;
+                // Move entry and update its forward link
+                _plat__NvMemoryMove(currentAddr, keepAddr, entrySize);
+                _plat__NvMemoryWrite(keepAddr, sizeof(UINT32), &newAddr);
+            }
+            keepAddr += entrySize;
+        }
+        currentAddr = nextAddr;
+    }
+    if(keepAddr != currentAddr)
+    {
+        // Mark the end of list and rebuild the RAM state that refers to it
+        _plat__NvMemoryWrite(keepAddr, sizeof(UINT32), &listEnd);
+        NvBuildHandleMap();
+        NvIndexCacheClear();
+        // Set the flag so that NV changes are committed before the command
+        // completes.
+        g_updateNV = TRUE;
+    }
+#else
     NV_ITER             iter = NV_ITER_INIT;
     UINT32              currentAddr;
+    // The platform store allows the entity just returned by the traversal to be
+    // deleted without restarting it.
     while((currentAddr = NvNext(&iter)) != 0)
     {
-        TPM_HANDLE      entityHandle;
-          // Read handle information.
-          _plat__NvMemoryRead(currentAddr, sizeof(TPM_HANDLE), &entityHandle);
-          if(HandleGetType(entityHandle) == TPM_HT_NV_INDEX)
-          {
-              // Handle NV Index
-              NV_INDEX    nvIndex;
-              // If flush endorsement or platform hierarchy, no NV Index would be
-              // flushed
-              if(hierarchy == TPM_RH_ENDORSEMENT || hierarchy == TPM_RH_PLATFORM)
-                  continue;
-              _plat__NvMemoryRead(currentAddr + sizeof(TPM_HANDLE),
-                                  sizeof(NV_INDEX), &nvIndex);
-              // For storage hierarchy, flush OwnerCreated index
-               if(    nvIndex.publicArea.attributes.TPMA_NV_PLATFORMCREATE == CLEAR)
-               {
-                     // Delete the NV Index
-                     NvDelete(currentAddr);
-                     // Re-iterate from beginning after a delete
-                     iter = NV_ITER_INIT;
-                     // If the NV Index is RAM back, delete the RAM data as well
-                     if(nvIndex.publicArea.attributes.TPMA_NV_ORDERLY == SET)
-                         NvDeleteRAM(entityHandle);
-              }
-          }
-          else if(HandleGetType(entityHandle) == TPM_HT_PERSISTENT)
-          {
-              OBJECT          object;
-               // Get evict object
-               NvGetEvictObject(entityHandle, &object);
-               // If the evict object belongs to the hierarchy to be flushed
-               if(     (    hierarchy == TPM_RH_PLATFORM
-                        && object.attributes.ppsHierarchy == SET)
-                   || (     hierarchy == TPM_RH_OWNER
-                        && object.attributes.spsHierarchy == SET)
-                   || (     hierarchy == TPM_RH_ENDORSEMENT
-                        && object.attributes.epsHierarchy == SET)
-                   )
-               {
-                     // Delete the evict object
-                     NvDelete(currentAddr);
-                     // Re-iterate from beginning after a delete
-                     iter = NV_ITER_INIT;
-               }
-          }
-          else
-          {
-               pAssert(FALSE);
-          }
-   }
-   return;
+        if(NvIsFlushedEntity(hierarchy, currentAddr))
+            NvDelete(currentAddr);
+    }
+#endif
+    return;
 }
 //
 //
@@ -1623,15 +2182,15 @@ NvSetGlobalLock(
    {
        NV_INDEX    nvIndex;
           // Read the index data
-          _plat__NvMemoryRead(currentAddr + sizeof(TPM_HANDLE),
-                              sizeof(NV_INDEX), &nvIndex);
+          NvEntityRead(currentAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX),
+                       &nvIndex);
           // See if it should be locked
           if(nvIndex.publicArea.attributes.TPMA_NV_GLOBALLOCK == SET)
           {
                 // if so, lock it
                 nvIndex.publicArea.attributes.TPMA_NV_WRITELOCKED = SET;
-                _plat__NvMemoryWrite(currentAddr + sizeof(TPM_HANDLE),
-                                     sizeof(NV_INDEX), &nvIndex);
+                NvEntityWrite(currentAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX),
+                              &nvIndex);
                 // Set the flag that a NV write happens
                 g_updateNV = TRUE;
           }
@@ -1716,7 +2275,7 @@ NvCapGetPersistent(
      {
          TPM_HANDLE      entityHandle;
           // Read handle information.
-          _plat__NvMemoryRead(currentAddr, sizeof(TPM_HANDLE), &entityHandle);
+          entityHandle = NvEntityHandle(currentAddr);
           // Ignore persistent handles that have values less than the input handle
           if(entityHandle < handle)
               continue;
@@ -1766,7 +2325,7 @@ NvCapGetIndex(
      {
          TPM_HANDLE      entityHandle;
           // Read handle information.
-          _plat__NvMemoryRead(currentAddr, sizeof(TPM_HANDLE), &entityHandle);
+          entityHandle = NvEntityHandle(currentAddr);
           // Ignore index handles that have values less than the 'handle'
           if(entityHandle < handle)
               continue;
@@ -1812,10 +2371,10 @@ NvCapGetPersistentNumber(
    void
    )
 {
-   UINT32              num = 0;
-   NV_ITER             iter = NV_ITER_INIT;
-   while(NvNextEvict(&iter) != 0) num++;
-   return num;
+#ifdef NV_DEBUG
+   pAssert(s_evictNvPersistentNum == NvCountPersistent());
+#endif
+   return s_evictNvPersistentNum;
 }
 //
 //
@@ -1856,8 +2415,8 @@ NvCapGetCounterNumber(
    {
        NV_INDEX    nvIndex;
           // Get NV Index info
-          _plat__NvMemoryRead(currentAddr + sizeof(TPM_HANDLE),
-                               sizeof(NV_INDEX), &nvIndex);
+          NvEntityRead(currentAddr, sizeof(TPM_HANDLE), sizeof(NV_INDEX),
+                       &nvIndex);
           if(nvIndex.publicArea.attributes.TPMA_NV_COUNTER == SET) num++;
    }
    return num;
@@ -7,23 +7,614 @@
 
 #include     <memory.h>
 #include     <stdio.h>
+#include     <stdlib.h>
 #include     <string.h>
 
 #include     "PlatformData.h"
+#include     "Platform.h"
 #include     "TpmError.h"
 #include     "assert.h"
 
 #ifndef EMBEDDED_MODE
 #define FILE_BACKED_NV
+#if !defined MMAP_BACKED_NV && !defined NV_KV_STORE
+#define NV_JOURNAL
+#endif
+#endif
+//
+//     MMAP_BACKED_NV is a variant of FILE_BACKED_NV in which the RAM image is a shared mapping of
+//     NVChip. Reads and writes go directly to the page cache, so the image is not read at _plat__NVEnable()
+//     and _plat__NvCommit() only has to msync() the dirty pages. Because modified pages may reach NVChip
+//     before the commit, the mode does not provide the crash atomicity of NV_JOURNAL.
+//
+#if defined MMAP_BACKED_NV && !defined FILE_BACKED_NV
+#define FILE_BACKED_NV
+#endif
+#if defined MMAP_BACKED_NV && defined NV_JOURNAL
+#error "NV_JOURNAL is not supported with MMAP_BACKED_NV"
+#endif
+//
+//     With NV_KV_STORE, NV Indices and persistent objects are kept in the store implemented in NVStore.c.
+//     Each commit writes the modified runs of the NVChip image to the store log in the same transaction as the
+//     entities, which makes the commit atomic the way NV_JOURNAL does.
+//
+#if defined NV_KV_STORE && !defined FILE_BACKED_NV
+#define FILE_BACKED_NV
+#endif
+#if defined NV_KV_STORE && (defined NV_JOURNAL || defined MMAP_BACKED_NV)
+#error "NV_KV_STORE is not supported with NV_JOURNAL or MMAP_BACKED_NV"
 #endif
 
 #if defined FILE_BACKED_NV
+#include     <unistd.h>
+#if defined NV_JOURNAL
+#include     <time.h>
+#endif
+#if defined MMAP_BACKED_NV
+#include     <fcntl.h>
+#include     <sys/mman.h>
+#include     <sys/stat.h>
+#endif
+//
+//     The NV image is tracked in pages of NV_DIRTY_PAGE_SIZE bytes. _plat__NvCommit() only writes the
+//     pages that have been modified since the previous commit.
+//
+#ifndef NV_DIRTY_PAGE_SIZE
+#define NV_DIRTY_PAGE_SIZE      256
+#endif
+#define NV_DIRTY_PAGES          ((NV_MEMORY_SIZE + NV_DIRTY_PAGE_SIZE - 1) / NV_DIRTY_PAGE_SIZE)
+#ifndef TPM_MULTI_INSTANCE
+#if defined MMAP_BACKED_NV
+static   int                    s_NVFd = -1;
+#else
 static   FILE*                  s_NVFile;
 #endif
+static   unsigned char          s_NVDirty[NV_DIRTY_PAGES];
+static   int                    s_NVSyncPolicy = NV_SYNC_NONE;
+static   NV_COMMIT_STATS        s_NVCommitStats;
+#endif // TPM_MULTI_INSTANCE
+#endif
+#if defined NV_JOURNAL
+//
+//     Every commit is first written to the NVChip.journal file as a single record and is only then applied to
+//     NVChip, so a commit interrupted at any point is either discarded or replayed as a whole by
+//     _plat__NVEnable(). A record is an NV_JOURNAL_HEADER followed by size bytes of runs. Each run is an
+//     unsigned int NV offset, an unsigned int length and length bytes of NV data. A record with a bad magic
+//     value, size or checksum is a torn write and is ignored.
+//     In group commit mode, set by _plat__NvSetGroupCommit(), records are appended and the runs are only
+//     written to NVChip once NV_GROUP_COMMIT_BATCH records have been appended (a checkpoint). A commit
+//     then costs one journal append, and consecutive commits that update the same pages, such as the
+//     increments of a counter, are coalesced into a single NVChip write. _plat__NVEnable() replays the records in
+//     order and stops at the first torn one, so recovery always ends at the state after some commit.
+//
+#ifndef NV_GROUP_COMMIT_BATCH
+#define NV_GROUP_COMMIT_BATCH   0               // group commit is off by default
+#endif
+#ifndef NV_GROUP_COMMIT_WINDOW
+#define NV_GROUP_COMMIT_WINDOW  0               // milliseconds
+#endif
+#define NV_GROUP_COMMIT_MAX_LOG (64 * 1024)     // checkpoint once the journal is this large
+#define NV_JOURNAL_MAGIC        0x4E564A31      // "NVJ1"
+typedef struct
+{
+    unsigned int        magic;
+    unsigned int        checksum;           // NvJournalChecksum() of size and the runs
+    unsigned int        size;               // number of bytes of runs in the record
+} NV_JOURNAL_HEADER;
+#define NV_JOURNAL_MAX_SIZE     (  sizeof(NV_JOURNAL_HEADER)                      \
+                                 + NV_DIRTY_PAGES * 2 * sizeof(unsigned int)      \
+                                 + NV_MEMORY_SIZE)
+#ifndef TPM_MULTI_INSTANCE
+static   FILE*                  s_NVJournalFile;
+static   unsigned char          s_NVJournal[NV_JOURNAL_MAX_SIZE];
+static   long                   s_NVJournalSize;    // bytes of records in the journal
+static   unsigned int           s_NVJournalRecords;
+static   BOOL                   s_NVJournalSynced = TRUE;
+static   unsigned long long     s_NVJournalSyncTime;   // milliseconds
+static   unsigned char          s_NVPending[NV_DIRTY_PAGES];   // journaled, not
+                                                                // in NVChip
+static   unsigned int           s_NVGroupBatch = NV_GROUP_COMMIT_BATCH;
+static   unsigned int           s_NVGroupWindow = NV_GROUP_COMMIT_WINDOW;
+#endif // TPM_MULTI_INSTANCE
+#endif
+#ifndef TPM_MULTI_INSTANCE
+#if defined MMAP_BACKED_NV
+static   unsigned char         *s_NV;
+#else
 static   unsigned char          s_NV[NV_MEMORY_SIZE];
+#endif
 static   BOOL                   s_NvIsAvailable;
 static   BOOL                   s_NV_unrecoverable;
 static   BOOL                   s_NV_recoverable;
+#else
+//
+//     With TPM_MULTI_INSTANCE, the values above are kept in the nv_state of the platform instance selected
+//     by the calling thread. NvInstanceCreate() gives them the initial values of the single instance build.
+//
+struct nv_state
+{
+#if defined FILE_BACKED_NV
+#if defined MMAP_BACKED_NV
+    int                         s_NVFd;
+#else
+    FILE*                       s_NVFile;
+#endif
+    unsigned char               s_NVDirty[NV_DIRTY_PAGES];
+    int                         s_NVSyncPolicy;
+    NV_COMMIT_STATS             s_NVCommitStats;
+#endif
+#if defined NV_JOURNAL
+    FILE*                       s_NVJournalFile;
+    unsigned char               s_NVJournal[NV_JOURNAL_MAX_SIZE];
+    long                        s_NVJournalSize;
+    unsigned int                s_NVJournalRecords;
+    BOOL                        s_NVJournalSynced;
+    unsigned long long          s_NVJournalSyncTime;
+    unsigned char               s_NVPending[NV_DIRTY_PAGES];
+    unsigned int                s_NVGroupBatch;
+    unsigned int                s_NVGroupWindow;
+#endif
+#if defined MMAP_BACKED_NV
+    unsigned char              *s_NV;
+#else
+    unsigned char               s_NV[NV_MEMORY_SIZE];
+#endif
+    BOOL                        s_NvIsAvailable;
+    BOOL                        s_NV_unrecoverable;
+    BOOL                        s_NV_recoverable;
+};
+//
+//
+//          NvInstanceCreate()
+//
+//     This function allocates the NV state of a platform instance.
+//
+//     Return Value                      Meaning
+//
+//     NULL                              out of memory
+//     not NULL                          the NV state
+//
+struct nv_state *
+NvInstanceCreate(
+     void
+     )
+{
+     struct nv_state     *nv = calloc(1, sizeof(struct nv_state));
+     if(nv == NULL)
+         return NULL;
+#if defined MMAP_BACKED_NV
+     nv->s_NVFd = -1;
+#endif
+#if defined FILE_BACKED_NV
+     nv->s_NVSyncPolicy = NV_SYNC_NONE;
+#endif
+#if defined NV_JOURNAL
+     nv->s_NVJournalSynced = TRUE;
+     nv->s_NVGroupBatch = NV_GROUP_COMMIT_BATCH;
+     nv->s_NVGroupWindow = NV_GROUP_COMMIT_WINDOW;
+#endif
+     return nv;
+}
+//
+//
+//          NvInstanceDestroy()
+//
+//     This function frees the NV state of a platform instance.
+//
+void
+NvInstanceDestroy(
+     struct nv_state     *nv
+     )
+{
+     free(nv);
+}
+#define s_NVFd                  (g_platformInstance->nv->s_NVFd)
+#define s_NVFile                (g_platformInstance->nv->s_NVFile)
+#define s_NVDirty               (g_platformInstance->nv->s_NVDirty)
+#define s_NVSyncPolicy          (g_platformInstance->nv->s_NVSyncPolicy)
+#define s_NVCommitStats         (g_platformInstance->nv->s_NVCommitStats)
+#define s_NVJournalFile         (g_platformInstance->nv->s_NVJournalFile)
+#define s_NVJournal             (g_platformInstance->nv->s_NVJournal)
+#define s_NVJournalSize         (g_platformInstance->nv->s_NVJournalSize)
+#define s_NVJournalRecords      (g_platformInstance->nv->s_NVJournalRecords)
+#define s_NVJournalSynced       (g_platformInstance->nv->s_NVJournalSynced)
+#define s_NVJournalSyncTime     (g_platformInstance->nv->s_NVJournalSyncTime)
+#define s_NVPending             (g_platformInstance->nv->s_NVPending)
+#define s_NVGroupBatch          (g_platformInstance->nv->s_NVGroupBatch)
+#define s_NVGroupWindow         (g_platformInstance->nv->s_NVGroupWindow)
+#define s_NV                    (g_platformInstance->nv->s_NV)
+#define s_NvIsAvailable         (g_platformInstance->nv->s_NvIsAvailable)
+#define s_NV_unrecoverable      (g_platformInstance->nv->s_NV_unrecoverable)
+#define s_NV_recoverable        (g_platformInstance->nv->s_NV_recoverable)
+#endif // TPM_MULTI_INSTANCE
+#if defined FILE_BACKED_NV
+//
+//
+//          NvMarkDirty()
+//
+//     This function records that the NV image bytes in [startOffset, startOffset + size) have been modified and
+//     need to be written by the next _plat__NvCommit().
+//
+static void
+NvMarkDirty(
+     unsigned int         startOffset,       // IN: first modified byte
+     unsigned int         size               // IN: number of modified bytes
+     )
+{
+     unsigned int         page;
+     if(size == 0)
+         return;
+     for(page = startOffset / NV_DIRTY_PAGE_SIZE;
+         page <= (startOffset + size - 1) / NV_DIRTY_PAGE_SIZE;
+         page++)
+         s_NVDirty[page] = TRUE;
+}
+//
+//
+//          NvCollectRuns()
+//
+//     This function converts the pages marked in pages into runs of contiguous NV bytes and clears the marks.
+//     The return value is the number of runs.
+//
+static unsigned int
+NvCollectRuns(
+     unsigned char       *pages,             // IN/OUT: page marks
+     unsigned int        *runStart,          // OUT: NV offset of each run
+     unsigned int        *runSize            // OUT: length of each run
+     )
+{
+     unsigned int         page;
+     unsigned int         runCount = 0;
+     for(page = 0; page < NV_DIRTY_PAGES; page++)
+     {
+         if(!pages[page])
+             continue;
+         runStart[runCount] = page * NV_DIRTY_PAGE_SIZE;
+         while(page < NV_DIRTY_PAGES && pages[page])
+             pages[page++] = FALSE;
+         runSize[runCount] = page * NV_DIRTY_PAGE_SIZE;
+         if(runSize[runCount] > NV_MEMORY_SIZE)
+             runSize[runCount] = NV_MEMORY_SIZE;
+         runSize[runCount] -= runStart[runCount];
+         runCount++;
+     }
+     return runCount;
+}
+#if !defined MMAP_BACKED_NV
+//
+//
+//          NvSyncFile()
+//
+//     This function pushes the buffered writes of an NV file to the operating system and, depending on the
+//     policy set by _plat__NvSetSyncPolicy(), to the storage device.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             the flush or sync failed
+//
+static int
+NvSyncFile(
+     FILE                *file               // IN: file to synchronize
+     )
+{
+     if(fflush(file) != 0)
+         return 1;
+     if(   (s_NVSyncPolicy == NV_SYNC_DATA && fdatasync(fileno(file)) != 0)
+        || (s_NVSyncPolicy == NV_SYNC_FULL && fsync(fileno(file)) != 0))
+         return 1;
+     if(s_NVSyncPolicy != NV_SYNC_NONE)
+         s_NVCommitStats.syncs++;
+     return 0;
+}
+#endif
+#if defined MMAP_BACKED_NV
+//
+//
+//          NvMapFile()
+//
+//     This function opens NVChip, creating it filled with zeros if it does not exist, and maps it as the RAM
+//     image.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             NVChip could not be opened, sized or mapped
+//
+static int
+NvMapFile(
+     void
+     )
+{
+     struct stat          st;
+     void                *image;
+     char                 name[NV_FILE_NAME_SIZE];
+     s_NVFd = open(NvFileName(name, "NVChip"), O_RDWR | O_CREAT, 0666);
+     if(s_NVFd < 0)
+         return 1;
+     if(fstat(s_NVFd, &st) != 0)
+         goto Error;
+     // A new or empty file is extended with zeros
+     if(st.st_size == 0 && ftruncate(s_NVFd, NV_MEMORY_SIZE) != 0)
+         goto Error;
+     else if(st.st_size != 0)
+         // If NVChip file exist, assume the size is correct
+         assert(st.st_size == NV_MEMORY_SIZE);
+     image = mmap(NULL, NV_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  s_NVFd, 0);
+     if(image == MAP_FAILED)
+         goto Error;
+     s_NV = image;
+     return 0;
+Error:
+     close(s_NVFd);
+     s_NVFd = -1;
+     return 1;
+}
+//
+//
+//          NvSyncMapping()
+//
+//     This function makes the indicated runs of the mapped image durable according to the policy set by
+//     _plat__NvSetSyncPolicy(). With NV_SYNC_NONE, the runs are already in the page cache and nothing
+//     needs to be done.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             the sync failed
+//
+static int
+NvSyncMapping(
+     unsigned int         runCount,          // IN: number of runs
+     const unsigned int  *runStart,          // IN: NV offset of each run
+     const unsigned int  *runSize            // IN: length of each run
+     )
+{
+     unsigned int         pageMask = (unsigned int)sysconf(_SC_PAGESIZE) - 1;
+     unsigned int         start;
+     unsigned int         i;
+     if(s_NVSyncPolicy == NV_SYNC_NONE)
+         return 0;
+     for(i = 0; i < runCount; i++)
+     {
+         // msync() needs an address aligned to the system page size
+         start = runStart[i] & ~pageMask;
+         if(msync(s_NV + start, runStart[i] + runSize[i] - start, MS_SYNC) != 0)
+             return 1;
+     }
+     // msync() writes the data; the file metadata needs an fsync()
+     if(s_NVSyncPolicy == NV_SYNC_FULL && fsync(s_NVFd) != 0)
+         return 1;
+     s_NVCommitStats.syncs++;
+     return 0;
+}
+#endif
+#endif
+#if defined NV_JOURNAL
+//
+//
+//          NvJournalChecksum()
+//
+//     This function computes the FNV-1a hash of the record size followed by the runs of a journal record.
+//
+static unsigned int
+NvJournalChecksum(
+     unsigned int         size,              // IN: size of the runs
+     const unsigned char *runs               // IN: the runs
+     )
+{
+     unsigned int         hash = 0x811C9DC5;
+     unsigned int         i;
+     for(i = 0; i < sizeof(size); i++)
+         hash = (hash ^ ((size >> (8 * i)) & 0xFF)) * 0x01000193;
+     for(i = 0; i < size; i++)
+         hash = (hash ^ runs[i]) * 0x01000193;
+     return hash;
+}
+//
+//
+//          NvJournalNow()
+//
+//     This function returns a monotonic time in milliseconds for the group commit window.
+//
+static unsigned long long
+NvJournalNow(
+     void
+     )
+{
+     struct timespec      now;
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+//
+//
+//          NvJournalSync()
+//
+//     This function makes the appended journal records durable.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             the sync failed
+//
+static int
+NvJournalSync(
+     void
+     )
+{
+     if(NvSyncFile(s_NVJournalFile) != 0)
+         return 1;
+     s_NVJournalSynced = TRUE;
+     s_NVJournalSyncTime = NvJournalNow();
+     return 0;
+}
+//
+//
+//          NvJournalWrite()
+//
+//     This function appends one journal record holding the indicated runs of the RAM image. Unless sync is
+//     FALSE, the record is made durable before the function returns.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             the record could not be written
+//
+static int
+NvJournalWrite(
+     unsigned int         runCount,          // IN: number of runs
+     const unsigned int  *runStart,          // IN: NV offset of each run
+     const unsigned int  *runSize,           // IN: length of each run
+     BOOL                 sync               // IN: make the record durable
+     )
+{
+     NV_JOURNAL_HEADER    header;
+     unsigned char       *runs = s_NVJournal + sizeof(header);
+     unsigned char       *p = runs;
+     unsigned int         i;
+     for(i = 0; i < runCount; i++)
+     {
+         memcpy(p, &runStart[i], sizeof(unsigned int));
+         p += sizeof(unsigned int);
+         memcpy(p, &runSize[i], sizeof(unsigned int));
+         p += sizeof(unsigned int);
+         memcpy(p, &s_NV[runStart[i]], runSize[i]);
+         p += runSize[i];
+     }
+     header.magic = NV_JOURNAL_MAGIC;
+     header.size = (unsigned int)(p - runs);
+     header.checksum = NvJournalChecksum(header.size, runs);
+     memcpy(s_NVJournal, &header, sizeof(header));
+     if(   fseek(s_NVJournalFile, s_NVJournalSize, SEEK_SET) != 0
+        || fwrite(s_NVJournal, 1, p - s_NVJournal, s_NVJournalFile)
+           != (size_t)(p - s_NVJournal))
+         return 1;
+     s_NVJournalSize += (long)(p - s_NVJournal);
+     s_NVJournalRecords++;
+     s_NVJournalSynced = FALSE;
+     if(sync)
+         return NvJournalSync();
+     return 0;
+}
+//
+//
+//          NvJournalClear()
+//
+//     This function discards the journal records once NVChip holds the committed data. The truncation does not
+//     need to be durable because replaying the records again would write the same data.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             the journal could not be truncated
+//
+static int
+NvJournalClear(
+     void
+     )
+{
+     if(fflush(s_NVJournalFile) != 0)
+         return 1;
+     s_NVJournalSize = 0;
+     s_NVJournalRecords = 0;
+     s_NVJournalSynced = TRUE;
+     memset(s_NVPending, 0, sizeof(s_NVPending));
+     return ftruncate(fileno(s_NVJournalFile), 0);
+}
+//
+//
+//          NvJournalReplay()
+//
+//     This function applies the complete journal records, if there are any, to the RAM image in the order in
+//     which they were written. It stops at the first record that is torn.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              a record was applied and the RAM image differs from NVChip
+//     FALSE                             there was no complete record
+//
+static BOOL
+NvJournalReplay(
+     void
+     )
+{
+     NV_JOURNAL_HEADER    header;
+     unsigned char       *runs = s_NVJournal + sizeof(header);
+     unsigned char       *p;
+     unsigned int         offset;
+     unsigned int         size;
+     int                  pass;
+     BOOL                 applied = FALSE;
+     fseek(s_NVJournalFile, 0, SEEK_SET);
+     for(;;)
+     {
+         if(   fread(&header, sizeof(header), 1, s_NVJournalFile) != 1
+            || header.magic != NV_JOURNAL_MAGIC
+            || header.size > NV_JOURNAL_MAX_SIZE - sizeof(header)
+            || fread(runs, 1, header.size, s_NVJournalFile) != header.size
+            || header.checksum != NvJournalChecksum(header.size, runs))
+             return applied;
+         // The first pass validates every run so that nothing is applied from a
+         // malformed record; the second pass applies them.
+         for(pass = 0; pass < 2; pass++)
+         {
+             for(p = runs; p < runs + header.size; p += size)
+             {
+                 if(runs + header.size - p < 2 * sizeof(unsigned int))
+                     return applied;
+                 memcpy(&offset, p, sizeof(unsigned int));
+                 p += sizeof(unsigned int);
+                 memcpy(&size, p, sizeof(unsigned int));
+                 p += sizeof(unsigned int);
+                 if(   size > (unsigned int)(runs + header.size - p)
+                    || offset > NV_MEMORY_SIZE
+                    || size > NV_MEMORY_SIZE - offset)
+                     return applied;
+                 if(pass == 1)
+                     memcpy(&s_NV[offset], p, size);
+             }
+         }
+         applied = TRUE;
+     }
+}
+//
+//
+//          NvJournalCheckpoint()
+//
+//     This function writes the runs of every journaled page to NVChip and then discards the journal records.
+//     The records are made durable first so that a checkpoint interrupted while writing NVChip can be replayed.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             NVChip or the journal could not be written
+//
+static int
+NvJournalCheckpoint(
+     void
+     )
+{
+     unsigned int         runStart[NV_DIRTY_PAGES];
+     unsigned int         runSize[NV_DIRTY_PAGES];
+     unsigned int         runCount;
+     unsigned int         i;
+     if(!s_NVJournalSynced && NvJournalSync() != 0)
+         return 1;
+     runCount = NvCollectRuns(s_NVPending, runStart, runSize);
+     for(i = 0; i < runCount; i++)
+     {
+         if(   fseek(s_NVFile, runStart[i], SEEK_SET) != 0
+            ||    fwrite(&s_NV[runStart[i]], 1, runSize[i], s_NVFile)
+               != runSize[i])
+             return 1;
+         s_NVCommitStats.bytesWritten += runSize[i];
+     }
+     if(NvSyncFile(s_NVFile) != 0)
+         return 1;
+     return NvJournalClear();
+}
+#endif
 //
 //
 //          Functions
@@ -65,13 +656,22 @@ _plat__NVEnable(
      void                *platParameter       // IN: platform specific parameter
      )
 {
+#if defined FILE_BACKED_NV && !defined MMAP_BACKED_NV
+   char                 name[NV_FILE_NAME_SIZE];
+#endif
      // Start assuming everything is OK
    s_NV_unrecoverable = FALSE;
    s_NV_recoverable = FALSE;
-#ifdef FILE_BACKED_NV
+#if defined MMAP_BACKED_NV
+   if(s_NV != NULL) return 0;
+   if(NvMapFile() != 0)
+       s_NV_unrecoverable = TRUE;
+   // The file and the RAM image are the same pages
+   memset(s_NVDirty, 0, sizeof(s_NVDirty));
+#elif defined FILE_BACKED_NV
    if(s_NVFile != NULL) return 0;
    // Try to open an exist NVChip file for read/write
-   s_NVFile = fopen("NVChip", "r+b");
+   s_NVFile = fopen(NvFileName(name, "NVChip"), "r+b");
    if(NULL != s_NVFile)
    {
        // See if the NVChip file is empty
@@ -84,11 +684,21 @@ _plat__NVEnable(
        // Initialize all the byte in the new file to 0
        memset(s_NV, 0, NV_MEMORY_SIZE);
           // If NVChip file does not exist, try to create it for read/write
-          s_NVFile = fopen("NVChip", "w+b");
+          s_NVFile = fopen(NvFileName(name, "NVChip"), "w+b");
           // Start initialize at the end of new file
           fseek(s_NVFile, 0, SEEK_END);
           // Write 0s to NVChip file
           fwrite(s_NV, 1, NV_MEMORY_SIZE, s_NVFile);
+          fflush(s_NVFile);
+#ifdef NV_JOURNAL
+          // Any journal left behind belongs to a previous NVChip
+          s_NVJournalFile = fopen(NvFileName(name, "NVChip.journal"), "w+b");
+#endif
+#ifdef NV_KV_STORE
+          // So does any entity store
+          if(NvStoreEnable(TRUE, s_NV) < 0)
+              s_NV_unrecoverable = TRUE;
+#endif
    }
    else
    {
@@ -98,7 +708,45 @@ _plat__NVEnable(
        // read NV file data to memory
        fseek(s_NVFile, 0, SEEK_SET);
        assert(1 == fread(s_NV, NV_MEMORY_SIZE, 1, s_NVFile));
+#ifdef NV_JOURNAL
+       s_NVJournalFile = fopen(NvFileName(name, "NVChip.journal"), "r+b");
+       if(s_NVJournalFile == NULL)
+           s_NVJournalFile = fopen(name, "w+b");
+       // Finish a commit that was interrupted after its journal record was
+       // written
+       else if(NvJournalReplay())
+       {
+           fseek(s_NVFile, 0, SEEK_SET);
+           if(   fwrite(s_NV, 1, NV_MEMORY_SIZE, s_NVFile) != NV_MEMORY_SIZE
+              || NvSyncFile(s_NVFile) != 0)
+               s_NV_unrecoverable = TRUE;
+       }
+#endif
+#ifdef NV_KV_STORE
+       switch(NvStoreEnable(FALSE, s_NV))
+       {
+           case 0:
+               break;
+           case 1:
+               // Finish a commit that was interrupted after its transaction was
+               // written to the store
+               fseek(s_NVFile, 0, SEEK_SET);
+               if(   fwrite(s_NV, 1, NV_MEMORY_SIZE, s_NVFile) == NV_MEMORY_SIZE
+                  && NvSyncFile(s_NVFile) == 0)
+                   break;
+               // fall through
+           default:
+               s_NV_unrecoverable = TRUE;
+               break;
+       }
+#endif
    }
+#ifdef NV_JOURNAL
+   if(s_NVJournalFile == NULL || NvJournalClear() != 0)
+       s_NV_unrecoverable = TRUE;
+#endif
+   // The file and the RAM image now match
+   memset(s_NVDirty, 0, sizeof(s_NVDirty));
 #endif
    // NV contents have been read and the error checks have been performed. For
    // simulation purposes, use the signaling interface to indicate if an error is
@@ -118,13 +766,40 @@ _plat__NVDisable(
    void
    )
 {
-#ifdef     FILE_BACKED_NV
+#if defined MMAP_BACKED_NV
+   assert(s_NV != NULL);
+   // Unmap and close NV file. Modified pages are written back by the operating
+   // system.
+   munmap(s_NV, NV_MEMORY_SIZE);
+   close(s_NVFd);
+   s_NV = NULL;
+   s_NVFd = -1;
+#elif defined FILE_BACKED_NV
    assert(s_NVFile != NULL);
+#ifdef NV_JOURNAL
+   // Bring NVChip up to date if every change has been committed. Otherwise,
+   // _plat__NVEnable() replays the journal.
+   if(s_NVJournalFile != NULL && s_NVJournalRecords != 0)
+   {
+       if(memchr(s_NVDirty, TRUE, sizeof(s_NVDirty)) == NULL)
+           NvJournalCheckpoint();
+       else if(!s_NVJournalSynced)
+           NvJournalSync();
+   }
+#endif
    // Close NV file
    fclose(s_NVFile);
    // Set file handle to NULL
 //
     s_NVFile = NULL;
+#endif
+#ifdef     NV_JOURNAL
+    if(s_NVJournalFile != NULL)
+        fclose(s_NVJournalFile);
+    s_NVJournalFile = NULL;
+#endif
+#ifdef     NV_KV_STORE
+    NvStoreDisable();
 #endif
     return;
 }
@@ -148,7 +823,10 @@ _plat__IsNvAvailable(
     // NV is not available if the TPM is in failure mode
     if(!s_NvIsAvailable)
         return 1;
-#ifdef FILE_BACKED_NV
+#if defined MMAP_BACKED_NV
+   if(s_NV == NULL)
+       return 1;
+#elif defined FILE_BACKED_NV
    if(s_NVFile == NULL)
        return 1;
 #endif
@@ -213,6 +891,9 @@ _plat__NvMemoryWrite(
    assert(startOffset + size <= NV_MEMORY_SIZE);
    // Copy the data to the NV image
    memcpy(&s_NV[startOffset], data, size);
+#ifdef FILE_BACKED_NV
+   NvMarkDirty(startOffset, size);
+#endif
 }
 //
 //
@@ -232,6 +913,9 @@ _plat__NvMemoryMove(
    assert(destOffset + size <= NV_MEMORY_SIZE);
    // Move data in RAM
    memmove(&s_NV[destOffset], &s_NV[sourceOffset], size);
+#ifdef FILE_BACKED_NV
+   NvMarkDirty(destOffset, size);
+#endif
    return;
 }
 //
@@ -239,8 +923,11 @@ _plat__NvMemoryMove(
 //         _plat__NvCommit()
 //
 //      Update NV chip
-//
-//
+//      Only the runs of pages that were modified since the last commit are written. After the writes, the file is
+//      flushed and, depending on the policy set by _plat__NvSetSyncPolicy(), synchronized to the storage device.
+//      With MMAP_BACKED_NV the runs are already in the mapped file and are only synchronized.
+//      When NV_JOURNAL is defined, the runs are first written to the journal as one record so that the commit is
+//      atomic: after a crash, _plat__NVEnable() either replays the whole record or finds NVChip unchanged.
 //
 //      Return Value                      Meaning
 //
@@ -253,19 +940,162 @@ _plat__NvCommit(
    )
 {
 #ifdef FILE_BACKED_NV
+   unsigned int         runStart[NV_DIRTY_PAGES];
+   unsigned int         runSize[NV_DIRTY_PAGES];
+   unsigned int         runCount;
+   unsigned int         written = 0;
+   unsigned int         i;
    // If NV file is not available, return failure
+#if defined MMAP_BACKED_NV
+   if(s_NV == NULL)
+       return 1;
+#else
    if(s_NVFile == NULL)
        return 1;
-   // Write RAM data to NV
-   fseek(s_NVFile, 0, SEEK_SET);
-   fwrite(s_NV, 1, NV_MEMORY_SIZE, s_NVFile);
+#endif
+#ifdef NV_JOURNAL
+   // In group commit mode, the dirty pages are also pending for the next
+   // checkpoint
+   if(s_NVGroupBatch != 0)
+   {
+       for(i = 0; i < NV_DIRTY_PAGES; i++)
+           s_NVPending[i] |= s_NVDirty[i];
+   }
+#endif
+   // Collect each run of contiguous dirty pages of RAM data
+   runCount = NvCollectRuns(s_NVDirty, runStart, runSize);
+   for(i = 0; i < runCount; i++)
+       written += runSize[i];
+   s_NVCommitStats.commits++;
+   s_NVCommitStats.lastCommitBytes = written;
+#ifdef NV_KV_STORE
+   {
+       unsigned int     storeWritten;
+       // The store has to be committed even if NVChip did not change
+       if(NvStoreCommit(runCount, runStart, runSize, s_NV, s_NVSyncPolicy,
+                        &storeWritten) != 0)
+           return 1;
+       s_NVCommitStats.lastCommitBytes += storeWritten;
+       s_NVCommitStats.bytesWritten += storeWritten;
+       if(storeWritten != 0 && s_NVSyncPolicy != NV_SYNC_NONE)
+           s_NVCommitStats.syncs++;
+   }
+#endif
+   if(written == 0)
+       return 0;
+#if defined MMAP_BACKED_NV
+   // The runs were written through the mapping
+   s_NVCommitStats.bytesWritten += written;
+   return NvSyncMapping(runCount, runStart, runSize);
+#else
+#ifdef NV_JOURNAL
+   if(s_NVGroupBatch != 0)
+   {
+       // Acknowledge the commit once its record is in the journal. The record
+       // is synchronized unless the previous sync is within the window.
+       if(NvJournalWrite(runCount, runStart, runSize,
+                         NvJournalNow() - s_NVJournalSyncTime
+                         >= s_NVGroupWindow) != 0)
+           return 1;
+       if(   s_NVJournalRecords >= s_NVGroupBatch
+          || s_NVJournalSize >= NV_GROUP_COMMIT_MAX_LOG)
+           return NvJournalCheckpoint();
+       return 0;
+   }
+   if(NvJournalWrite(runCount, runStart, runSize, TRUE) != 0)
+       return 1;
+#endif
+   // Write the runs to NV
+   for(i = 0; i < runCount; i++)
+   {
+       if(   fseek(s_NVFile, runStart[i], SEEK_SET) != 0
+          ||    fwrite(&s_NV[runStart[i]], 1, runSize[i], s_NVFile)
+             != runSize[i])
+           return 1;
+   }
+   s_NVCommitStats.bytesWritten += written;
+   if(NvSyncFile(s_NVFile) != 0)
+       return 1;
+#ifdef NV_JOURNAL
+   if(NvJournalClear() != 0)
+       return 1;
+#endif
    return 0;
+#endif
 #else
    return 0;
 #endif
 }
 //
 //
+//       _plat__NvSetSyncPolicy()
+//
+//      Select how _plat__NvCommit() makes written data durable. NV_SYNC_NONE only flushes the stdio buffers
+//      to the operating system, NV_SYNC_DATA adds an fdatasync() and NV_SYNC_FULL adds an fsync(). With
+//      MMAP_BACKED_NV, NV_SYNC_DATA and NV_SYNC_FULL msync() the dirty pages and NV_SYNC_FULL adds an
+//      fsync().
+//
+LIB_EXPORT void
+_plat__NvSetSyncPolicy(
+   int                  policy             // IN: NV_SYNC_NONE, NV_SYNC_DATA or
+                                           //     NV_SYNC_FULL
+   )
+{
+#ifdef FILE_BACKED_NV
+   s_NVSyncPolicy = policy;
+#endif
+   return;
+}
+//
+//
+//       _plat__NvSetGroupCommit()
+//
+//      Select group commit mode. With a batch of 0, every commit is written to NVChip before _plat__NvCommit()
+//      returns. Otherwise, a commit is acknowledged once its record is appended to the journal, and NVChip is
+//      updated once batch records have been appended. A record is synchronized according to the sync policy
+//      unless the journal was synchronized less than window milliseconds before, so a crash can lose the
+//      commits of the last window but never part of a commit. The window is only checked by a commit or by
+//      _plat__NVDisable(). Group commit requires NV_JOURNAL; otherwise this function has no effect.
+//
+LIB_EXPORT void
+_plat__NvSetGroupCommit(
+   unsigned int         batch,             // IN: records per checkpoint, 0 to
+                                           //     disable
+   unsigned int         window             // IN: durability window in
+                                           //     milliseconds
+   )
+{
+#ifdef NV_JOURNAL
+   // Leave nothing pending in the journal when leaving group commit mode. If
+   // that fails, stay in group commit mode so that the records are not lost.
+   if(   batch == 0 && s_NVJournalRecords != 0
+      && NvJournalCheckpoint() != 0)
+       return;
+   s_NVGroupBatch = batch;
+   s_NVGroupWindow = window;
+#endif
+   return;
+}
+//
+//
+//       _plat__NvGetCommitStats()
+//
+//      Report the number of commits and the number of bytes they have written to the NV file.
+//
+LIB_EXPORT void
+_plat__NvGetCommitStats(
+   NV_COMMIT_STATS     *stats              // OUT: commit counters
+   )
+{
+#ifdef FILE_BACKED_NV
+   *stats = s_NVCommitStats;
+#else
+   memset(stats, 0, sizeof(*stats));
+#endif
+   return;
+}
+//
+//
 //       _plat__SetNvAvail()
 //
 //      Set the current NV state to available. This function is for testing purpose only. It is not part of the
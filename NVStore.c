@@ -0,0 +1,1031 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include     <stdio.h>
+#include     <limits.h>
+#include     <stdlib.h>
+#include     <string.h>
+#include     <fcntl.h>
+#include     <unistd.h>
+
+#include     "PlatformData.h"
+#include     "Platform.h"
+#include     "assert.h"
+
+#ifdef NV_KV_STORE
+//
+//     NV Indices and persistent objects are kept in NVStore, a log of records indexed in RAM by handle. Only
+//     the index is kept in RAM; entity data is read from the log when it is needed. An entity that is modified is
+//     copied to a RAM buffer and is appended to the log as a new record at the next commit.
+//     A commit appends one transaction: the NV_KV_DELETE and NV_KV_PUT records for the entities that
+//     changed, an NV_KV_CHIP record holding the modified runs of the NVChip image and an
+//     NV_KV_COMMIT record. A transaction that is not terminated by an NV_KV_COMMIT record, or that has a
+//     record with a bad checksum, is discarded when the log is loaded. Because the NVChip runs are written to
+//     NVChip only after the transaction is in the log, NvStoreEnable() can finish an interrupted commit by
+//     reapplying the NV_KV_CHIP record of the last transaction, so NVChip and the entities always change
+//     together.
+//     The log is compacted after a commit when more than half of it is superseded data. The live records are
+//     written to a new file that then replaces NVStore.
+//
+#ifndef NV_KV_STORE_SIZE
+#define NV_KV_STORE_SIZE        (64 * 1024 * 1024)  // octets available to entities
+#endif
+#ifndef NV_KV_COMPACT_MIN
+#define NV_KV_COMPACT_MIN       (64 * 1024)         // smallest log that is compacted
+#endif
+#define NV_KV_MAX_RECORD        (16 * 1024 * 1024)
+#define NV_KV_RECORD_MAGIC      0x4E564B31          // "NVK1"
+#define NV_KV_PUT               1
+#define NV_KV_DELETE            2
+#define NV_KV_CHIP              3
+#define NV_KV_COMMIT            4
+typedef struct
+{
+    unsigned int        magic;
+    unsigned int        type;               // one of the NV_KV_ record types
+    unsigned int        handle;             // entity handle for NV_KV_PUT and
+                                            // NV_KV_DELETE
+    unsigned int        size;               // octets of data following the header
+    unsigned int        checksum;           // NvKvChecksum() of the record
+} NV_KV_RECORD;
+typedef struct
+{
+    unsigned int        handle;             // 0 for an empty slot
+    unsigned int        size;               // entity size
+    off_t               offset;             // log offset of the committed data or
+                                            // -1 if the entity was never committed
+    off_t               queued;             // log offset of the data in the
+                                            // commit being written, or -1
+    unsigned char      *pending;            // data modified since the last commit
+} NV_KV_ENTRY;
+typedef struct
+{
+    unsigned int       *handle;
+    unsigned int        count;
+    unsigned int        max;
+} NV_KV_LIST;
+#ifndef TPM_MULTI_INSTANCE
+static   int                    s_kvFd = -1;
+static   off_t                  s_kvLogSize;        // end of the last transaction
+static   off_t                  s_kvGarbage;        // superseded octets in the log
+static   off_t                  s_kvPendingGarbage; // octets superseded at the next
+                                                    // commit by deletes
+static   NV_KV_ENTRY           *s_kvTable;
+static   unsigned int           s_kvTableSize;      // a power of 2
+static   unsigned int           s_kvCount;
+static   unsigned int           s_kvEntityBytes;
+static   unsigned int           s_kvRemovedSlot = UINT_MAX; // see _plat__NvEntityNext()
+static   NV_KV_LIST             s_kvModified;       // entities with pending data
+static   NV_KV_LIST             s_kvDeleted;        // committed entities deleted
+static   unsigned char         *s_kvBuffer;
+static   size_t                 s_kvBufferSize;
+#else
+//
+//     With TPM_MULTI_INSTANCE, the values above are kept in the nv_store_state of the platform instance
+//     selected by the calling thread.
+//
+struct nv_store_state
+{
+    int                         s_kvFd;
+    off_t                       s_kvLogSize;
+    off_t                       s_kvGarbage;
+    off_t                       s_kvPendingGarbage;
+    NV_KV_ENTRY                *s_kvTable;
+    unsigned int                s_kvTableSize;
+    unsigned int                s_kvCount;
+    unsigned int                s_kvEntityBytes;
+    unsigned int                s_kvRemovedSlot;
+    NV_KV_LIST                  s_kvModified;
+    NV_KV_LIST                  s_kvDeleted;
+    unsigned char              *s_kvBuffer;
+    size_t                      s_kvBufferSize;
+};
+//
+//
+//          NvStoreInstanceCreate()
+//
+//     This function allocates the entity store state of a platform instance.
+//
+//     Return Value                      Meaning
+//
+//     NULL                              out of memory
+//     not NULL                          the entity store state
+//
+struct nv_store_state *
+NvStoreInstanceCreate(
+     void
+     )
+{
+     struct nv_store_state *store = calloc(1, sizeof(struct nv_store_state));
+     if(store == NULL)
+         return NULL;
+     store->s_kvFd = -1;
+     store->s_kvRemovedSlot = UINT_MAX;
+     return store;
+}
+//
+//
+//          NvStoreInstanceDestroy()
+//
+//     This function frees the entity store state of a platform instance. NvStoreDisable() has already freed the
+//     RAM index.
+//
+void
+NvStoreInstanceDestroy(
+     struct nv_store_state *store
+     )
+{
+     if(store == NULL)
+         return;
+     free(store->s_kvModified.handle);
+     free(store->s_kvDeleted.handle);
+     free(store->s_kvBuffer);
+     free(store);
+}
+#define s_kvFd                  (g_platformInstance->store->s_kvFd)
+#define s_kvLogSize             (g_platformInstance->store->s_kvLogSize)
+#define s_kvGarbage             (g_platformInstance->store->s_kvGarbage)
+#define s_kvPendingGarbage      (g_platformInstance->store->s_kvPendingGarbage)
+#define s_kvTable               (g_platformInstance->store->s_kvTable)
+#define s_kvTableSize           (g_platformInstance->store->s_kvTableSize)
+#define s_kvCount               (g_platformInstance->store->s_kvCount)
+#define s_kvEntityBytes         (g_platformInstance->store->s_kvEntityBytes)
+#define s_kvRemovedSlot         (g_platformInstance->store->s_kvRemovedSlot)
+#define s_kvModified            (g_platformInstance->store->s_kvModified)
+#define s_kvDeleted             (g_platformInstance->store->s_kvDeleted)
+#define s_kvBuffer              (g_platformInstance->store->s_kvBuffer)
+#define s_kvBufferSize          (g_platformInstance->store->s_kvBufferSize)
+#endif // TPM_MULTI_INSTANCE
+//
+//
+//          NvKvHash()
+//
+//     This function returns the slot of s_kvTable at which the search for a handle starts.
+//
+static unsigned int
+NvKvHash(
+     unsigned int         handle             // IN: handle to hash
+     )
+{
+     handle ^= handle >> 16;
+     handle *= 0x45D9F3B;
+     handle ^= handle >> 16;
+     return handle & (s_kvTableSize - 1);
+}
+//
+//
+//          NvKvFind()
+//
+//     This function returns the index entry of an entity or NULL if there is no entity with that handle.
+//
+static NV_KV_ENTRY *
+NvKvFind(
+     unsigned int         handle             // IN: entity handle
+     )
+{
+     unsigned int         slot;
+     if(s_kvTableSize == 0)
+         return NULL;
+     for(slot = NvKvHash(handle);
+         s_kvTable[slot].handle != 0;
+         slot = (slot + 1) & (s_kvTableSize - 1))
+     {
+         if(s_kvTable[slot].handle == handle)
+             return &s_kvTable[slot];
+     }
+     return NULL;
+}
+//
+//
+//          NvKvInsert()
+//
+//     This function adds an index entry for a handle that is not in the table. The table is doubled when it
+//     becomes half full.
+//
+//     Return Value                      Meaning
+//
+//     non-NULL                          the new entry
+//     NULL                              out of memory
+//
+static NV_KV_ENTRY *
+NvKvInsert(
+     unsigned int         handle             // IN: entity handle
+     )
+{
+     unsigned int         slot;
+     if(2 * (s_kvCount + 1) > s_kvTableSize)
+     {
+         NV_KV_ENTRY     *old = s_kvTable;
+         unsigned int     oldSize = s_kvTableSize;
+         unsigned int     i;
+         unsigned int     newSize = oldSize == 0 ? 256 : 2 * oldSize;
+         s_kvTable = calloc(newSize, sizeof(NV_KV_ENTRY));
+         if(s_kvTable == NULL)
+         {
+             s_kvTable = old;
+             return NULL;
+         }
+         s_kvTableSize = newSize;
+         for(i = 0; i < oldSize; i++)
+         {
+             if(old[i].handle == 0)
+                 continue;
+             for(slot = NvKvHash(old[i].handle);
+                 s_kvTable[slot].handle != 0;
+                 slot = (slot + 1) & (s_kvTableSize - 1));
+             s_kvTable[slot] = old[i];
+         }
+         free(old);
+         s_kvRemovedSlot = UINT_MAX;
+     }
+     for(slot = NvKvHash(handle);
+         s_kvTable[slot].handle != 0;
+         slot = (slot + 1) & (s_kvTableSize - 1));
+     s_kvTable[slot].handle = handle;
+     s_kvTable[slot].size = 0;
+     s_kvTable[slot].offset = -1;
+     s_kvTable[slot].queued = -1;
+     s_kvTable[slot].pending = NULL;
+     s_kvCount++;
+     return &s_kvTable[slot];
+}
+//
+//
+//          NvKvRemove()
+//
+//     This function removes an index entry. The entries that follow it in its probe sequence are shifted back so
+//     that no tombstones are needed.
+//
+static void
+NvKvRemove(
+     NV_KV_ENTRY         *entry              // IN: entry to remove
+     )
+{
+     unsigned int         mask = s_kvTableSize - 1;
+     unsigned int         slot = (unsigned int)(entry - s_kvTable);
+     unsigned int         next;
+     unsigned int         home;
+     s_kvRemovedSlot = slot;
+     for(next = (slot + 1) & mask;
+         s_kvTable[next].handle != 0;
+         next = (next + 1) & mask)
+     {
+         home = NvKvHash(s_kvTable[next].handle);
+         // An entry may move into the vacated slot only if that does not put it
+         // ahead of its home slot.
+         if(((next - home) & mask) >= ((next - slot) & mask))
+         {
+             s_kvTable[slot] = s_kvTable[next];
+             slot = next;
+         }
+     }
+     s_kvTable[slot].handle = 0;
+     s_kvTable[slot].pending = NULL;
+     s_kvCount--;
+     return;
+}
+//
+//
+//          NvKvListAppend()
+//
+//     This function appends a handle to a list of handles.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             out of memory
+//
+static int
+NvKvListAppend(
+     NV_KV_LIST          *list,              // IN/OUT: the list
+     unsigned int         handle             // IN: handle to append
+     )
+{
+     if(list->count == list->max)
+     {
+         unsigned int     max = list->max == 0 ? 64 : 2 * list->max;
+         unsigned int    *handles = realloc(list->handle, max * sizeof(unsigned int));
+         if(handles == NULL)
+             return 1;
+         list->handle = handles;
+         list->max = max;
+     }
+     list->handle[list->count++] = handle;
+     return 0;
+}
+//
+//
+//          NvKvReserve()
+//
+//     This function makes s_kvBuffer at least size octets long.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             out of memory
+//
+static int
+NvKvReserve(
+     size_t               size               // IN: required size
+     )
+{
+     unsigned char       *buffer;
+     if(size <= s_kvBufferSize)
+         return 0;
+     buffer = realloc(s_kvBuffer, size);
+     if(buffer == NULL)
+         return 1;
+     s_kvBuffer = buffer;
+     s_kvBufferSize = size;
+     return 0;
+}
+//
+//
+//          NvKvChecksum()
+//
+//     This function computes the FNV-1a hash of the type, handle and size of a record followed by its data.
+//
+static unsigned int
+NvKvChecksum(
+     const NV_KV_RECORD  *record,            // IN: record header
+     const unsigned char *data               // IN: record data
+     )
+{
+     unsigned int         hash = 0x811C9DC5;
+     unsigned int         fields[3];
+     const unsigned char *p = (const unsigned char *)fields;
+     unsigned int         i;
+     fields[0] = record->type;
+     fields[1] = record->handle;
+     fields[2] = record->size;
+     for(i = 0; i < sizeof(fields); i++)
+         hash = (hash ^ p[i]) * 0x01000193;
+     for(i = 0; i < record->size; i++)
+         hash = (hash ^ data[i]) * 0x01000193;
+     return hash;
+}
+//
+//
+//          NvKvAppend()
+//
+//     This function appends a record to s_kvBuffer at offset used and returns the new number of octets used. If
+//     data is NULL, the record data is expected to be in the buffer already.
+//
+//     Return Value                      Meaning
+//
+//     > 0                               the octets used after the record
+//     0                                 out of memory
+//
+static size_t
+NvKvAppend(
+     size_t               used,              // IN: octets of s_kvBuffer in use
+     unsigned int         type,              // IN: record type
+     unsigned int         handle,            // IN: entity handle
+     unsigned int         size,              // IN: data size
+     const void          *data               // IN: record data
+     )
+{
+     NV_KV_RECORD         record;
+     if(NvKvReserve(used + sizeof(record) + size) != 0)
+         return 0;
+     if(data != NULL)
+         memcpy(s_kvBuffer + used + sizeof(record), data, size);
+     record.magic = NV_KV_RECORD_MAGIC;
+     record.type = type;
+     record.handle = handle;
+     record.size = size;
+     record.checksum = NvKvChecksum(&record, s_kvBuffer + used + sizeof(record));
+     memcpy(s_kvBuffer + used, &record, sizeof(record));
+     return used + sizeof(record) + size;
+}
+//
+//
+//          NvKvAppendChip()
+//
+//     This function appends an NV_KV_CHIP record holding the indicated runs of the NV image to s_kvBuffer at
+//     offset used. Each run is an unsigned int NV offset, an unsigned int length and length octets of NV data.
+//
+//     Return Value                      Meaning
+//
+//     > 0                               the octets used after the record
+//     0                                 out of memory
+//
+static size_t
+NvKvAppendChip(
+     size_t               used,              // IN: octets of s_kvBuffer in use
+     unsigned int         runCount,          // IN: number of NV image runs
+     const unsigned int  *runStart,          // IN: NV offset of each run
+     const unsigned int  *runSize,           // IN: length of each run
+     const unsigned char *image              // IN: NV image
+     )
+{
+     // The runs are built in place after the header of the record
+     size_t               chip = used + sizeof(NV_KV_RECORD);
+     unsigned int         i;
+     for(i = 0; i < runCount; i++)
+     {
+         if(NvKvReserve(chip + 2 * sizeof(unsigned int) + runSize[i]) != 0)
+             return 0;
+         memcpy(s_kvBuffer + chip, &runStart[i], sizeof(unsigned int));
+         chip += sizeof(unsigned int);
+         memcpy(s_kvBuffer + chip, &runSize[i], sizeof(unsigned int));
+         chip += sizeof(unsigned int);
+         memcpy(s_kvBuffer + chip, &image[runStart[i]], runSize[i]);
+         chip += runSize[i];
+     }
+     return NvKvAppend(used, NV_KV_CHIP, 0,
+                       (unsigned int)(chip - used - sizeof(NV_KV_RECORD)), NULL);
+}
+//
+//
+//          NvKvReadRecord()
+//
+//     This function reads and validates the record at offset in the log. The record data is left in s_kvBuffer.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              the record is complete
+//     FALSE                             the log ends before or inside the record, or the record is damaged
+//
+static BOOL
+NvKvReadRecord(
+     off_t                offset,            // IN: log offset of the record
+     NV_KV_RECORD        *record             // OUT: record header
+     )
+{
+     if(   pread(s_kvFd, record, sizeof(*record), offset) != sizeof(*record)
+        || record->magic != NV_KV_RECORD_MAGIC
+        || record->type < NV_KV_PUT
+        || record->type > NV_KV_COMMIT
+        || record->size > NV_KV_MAX_RECORD
+        || NvKvReserve(record->size) != 0
+        || pread(s_kvFd, s_kvBuffer, record->size, offset + sizeof(*record))
+           != (ssize_t)record->size)
+         return FALSE;
+     return record->checksum == NvKvChecksum(record, s_kvBuffer);
+}
+//
+//
+//          NvKvApplyChip()
+//
+//     This function applies the runs of an NV_KV_CHIP record in s_kvBuffer to the NV image. Each run is an
+//     unsigned int NV offset, an unsigned int length and length octets of NV data.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              the runs were applied
+//     FALSE                             the record is malformed
+//
+static BOOL
+NvKvApplyChip(
+     unsigned int         size,              // IN: size of the runs
+     unsigned char       *image              // IN/OUT: NV image
+     )
+{
+     unsigned char       *p;
+     unsigned int         offset;
+     unsigned int         length;
+     int                  pass;
+     // The first pass validates every run so that nothing is applied from a
+     // malformed record; the second pass applies them.
+     for(pass = 0; pass < 2; pass++)
+     {
+         for(p = s_kvBuffer; p < s_kvBuffer + size; p += length)
+         {
+             if(s_kvBuffer + size - p < 2 * sizeof(unsigned int))
+                 return FALSE;
+             memcpy(&offset, p, sizeof(unsigned int));
+             p += sizeof(unsigned int);
+             memcpy(&length, p, sizeof(unsigned int));
+             p += sizeof(unsigned int);
+             if(   length > (unsigned int)(s_kvBuffer + size - p)
+                || offset > NV_MEMORY_SIZE
+                || length > NV_MEMORY_SIZE - offset)
+                 return FALSE;
+             if(pass == 1)
+                 memcpy(&image[offset], p, length);
+         }
+     }
+     return TRUE;
+}
+//
+//
+//          NvKvSync()
+//
+//     This function makes the log durable according to the NV sync policy.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             the sync failed
+//
+static int
+NvKvSync(
+     int                  fd,                // IN: file to synchronize
+     int                  syncPolicy         // IN: NV_SYNC_ value
+     )
+{
+     if(syncPolicy == NV_SYNC_DATA)
+         return fdatasync(fd);
+     if(syncPolicy == NV_SYNC_FULL)
+         return fsync(fd);
+     return 0;
+}
+//
+//
+//          NvKvCompact()
+//
+//     This function writes the data of every entity to a new log and replaces NVStore with it. It is called right
+//     after a commit, when nothing is pending, and carries the NVChip runs of that commit over to the new log
+//     because they may not be in NVChip yet. If the new log cannot be written, the old one is kept.
+//
+static void
+NvKvCompact(
+     unsigned int         runCount,          // IN: number of NV image runs
+     const unsigned int  *runStart,          // IN: NV offset of each run
+     const unsigned int  *runSize,           // IN: length of each run
+     const unsigned char *image,             // IN: NV image
+     int                  syncPolicy         // IN: NV_SYNC_ value
+     )
+{
+     off_t                tail;
+     int                  fd;
+     off_t                size = 0;
+     unsigned int         i;
+     size_t               used;
+     NV_KV_RECORD         record;
+     char                 tmpName[NV_FILE_NAME_SIZE];
+     char                 name[NV_FILE_NAME_SIZE];
+     fd = open(NvFileName(tmpName, "NVStore.tmp"), O_RDWR | O_CREAT | O_TRUNC, 0666);
+     if(fd < 0)
+         return;
+     for(i = 0; i < s_kvTableSize; i++)
+     {
+         NV_KV_ENTRY     *entry = &s_kvTable[i];
+         if(entry->handle == 0)
+             continue;
+         if(   NvKvReserve(sizeof(record) + entry->size) != 0
+            || pread(s_kvFd, s_kvBuffer + sizeof(record), entry->size, entry->offset)
+               != (ssize_t)entry->size)
+             goto Error;
+         used = NvKvAppend(0, NV_KV_PUT, entry->handle, entry->size, NULL);
+         if(used == 0 || pwrite(fd, s_kvBuffer, used, size) != (ssize_t)used)
+             goto Error;
+         size += used;
+     }
+     used = runCount == 0 ? 0 : NvKvAppendChip(0, runCount, runStart, runSize, image);
+     if(runCount != 0 && used == 0)
+         goto Error;
+     used = NvKvAppend(used, NV_KV_COMMIT, 0, 0, NULL);
+     tail = used;
+     if(   used == 0
+        || pwrite(fd, s_kvBuffer, used, size) != (ssize_t)used
+        || NvKvSync(fd, syncPolicy) != 0
+        || rename(tmpName, NvFileName(name, "NVStore")) != 0)
+         goto Error;
+     // The new log is in place; point the index at it
+     size = 0;
+     for(i = 0; i < s_kvTableSize; i++)
+     {
+         NV_KV_ENTRY     *entry = &s_kvTable[i];
+         if(entry->handle == 0)
+             continue;
+         entry->offset = size + sizeof(record);
+         size += sizeof(record) + entry->size;
+     }
+     close(s_kvFd);
+     s_kvFd = fd;
+     s_kvLogSize = size + tail;
+     s_kvGarbage = tail;
+     return;
+Error:
+     close(fd);
+     unlink(tmpName);
+     return;
+}
+//
+//
+//          NvStoreEnable()
+//
+//     This function opens NVStore and builds the RAM index from the complete transactions in it. The
+//     NV_KV_CHIP record of the last transaction is applied to image in case the commit that wrote it was
+//     interrupted before NVChip was updated. If create is TRUE, the store belongs to a new NVChip and any
+//     existing content is discarded.
+//
+//     Return Value                      Meaning
+//
+//     > 0                               image was modified and must be written to NVChip
+//     0                                 success
+//     < 0                               NVStore could not be opened or read
+//
+int
+NvStoreEnable(
+     BOOL                 create,            // IN: NVChip was just created
+     unsigned char       *image              // IN/OUT: NV image
+     )
+{
+     NV_KV_RECORD         record;
+     NV_KV_ENTRY         *entry;
+     off_t                offset;
+     off_t                lastStart = 0;     // start of the last transaction
+     off_t                start = 0;
+     off_t                live = 0;
+     BOOL                 replayed = FALSE;
+     unsigned int         i;
+     char                 name[NV_FILE_NAME_SIZE];
+     // A compaction that did not complete left the previous log in place
+     unlink(NvFileName(name, "NVStore.tmp"));
+     s_kvFd = open(NvFileName(name, "NVStore"), O_RDWR | O_CREAT | (create ? O_TRUNC : 0), 0666);
+     if(s_kvFd < 0)
+         return -1;
+     // Find the end of the last complete transaction
+     s_kvLogSize = 0;
+     for(offset = 0; NvKvReadRecord(offset, &record);)
+     {
+         offset += sizeof(record) + record.size;
+         if(record.type == NV_KV_COMMIT)
+         {
+             lastStart = start;
+             s_kvLogSize = offset;
+             start = offset;
+         }
+     }
+     // Apply the complete transactions
+     for(offset = 0; offset < s_kvLogSize; offset += sizeof(record) + record.size)
+     {
+         if(!NvKvReadRecord(offset, &record))
+             return -1;
+         if(record.type == NV_KV_PUT)
+         {
+             entry = NvKvFind(record.handle);
+             if(entry == NULL && (entry = NvKvInsert(record.handle)) == NULL)
+                 return -1;
+             entry->size = record.size;
+             entry->offset = offset + sizeof(record);
+         }
+         else if(record.type == NV_KV_DELETE)
+         {
+             entry = NvKvFind(record.handle);
+             if(entry != NULL)
+                 NvKvRemove(entry);
+         }
+         else if(record.type == NV_KV_CHIP && offset >= lastStart)
+         {
+             if(!NvKvApplyChip(record.size, image))
+                 return -1;
+             replayed = TRUE;
+         }
+     }
+     // Drop an incomplete transaction
+     if(ftruncate(s_kvFd, s_kvLogSize) != 0)
+         return -1;
+     s_kvEntityBytes = 0;
+     for(i = 0; i < s_kvTableSize; i++)
+     {
+         if(s_kvTable[i].handle == 0)
+             continue;
+         s_kvEntityBytes += s_kvTable[i].size;
+         live += sizeof(record) + s_kvTable[i].size;
+     }
+     s_kvGarbage = s_kvLogSize - live;
+     s_kvPendingGarbage = 0;
+     return replayed ? 1 : 0;
+}
+//
+//
+//          NvStoreDisable()
+//
+//     This function closes NVStore and discards the RAM index and any changes that were not committed.
+//
+void
+NvStoreDisable(
+     void
+     )
+{
+     unsigned int         i;
+     for(i = 0; i < s_kvTableSize; i++)
+         free(s_kvTable[i].pending);
+     free(s_kvTable);
+     s_kvTable = NULL;
+     s_kvTableSize = 0;
+     s_kvCount = 0;
+     s_kvModified.count = 0;
+     s_kvDeleted.count = 0;
+     if(s_kvFd >= 0)
+         close(s_kvFd);
+     s_kvFd = -1;
+     return;
+}
+//
+//
+//          NvStoreCommit()
+//
+//     This function appends one transaction holding the entities changed since the last commit and the
+//     indicated runs of the NV image to the log, and makes it durable according to syncPolicy. The caller writes
+//     the runs to NVChip after this function succeeds.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             the transaction could not be written
+//
+int
+NvStoreCommit(
+     unsigned int         runCount,          // IN: number of NV image runs
+     const unsigned int  *runStart,          // IN: NV offset of each run
+     const unsigned int  *runSize,           // IN: length of each run
+     const unsigned char *image,             // IN: NV image
+     int                  syncPolicy,        // IN: NV_SYNC_ value
+     unsigned int        *written            // OUT: octets appended to the log
+     )
+{
+     size_t               used = 0;
+     unsigned int         i;
+     NV_KV_ENTRY         *entry;
+     *written = 0;
+     if(runCount == 0 && s_kvModified.count == 0 && s_kvDeleted.count == 0)
+         return 0;
+     for(i = 0; i < s_kvDeleted.count; i++)
+     {
+         used = NvKvAppend(used, NV_KV_DELETE, s_kvDeleted.handle[i], 0, NULL);
+         if(used == 0)
+             return 1;
+     }
+     for(i = 0; i < s_kvModified.count; i++)
+     {
+         // An entity that was deleted may be listed even though it is gone, and
+         // one that was deleted and added again is listed twice
+         entry = NvKvFind(s_kvModified.handle[i]);
+         if(entry == NULL || entry->pending == NULL || entry->queued >= 0)
+             continue;
+         entry->queued = s_kvLogSize + used + sizeof(NV_KV_RECORD);
+         used = NvKvAppend(used, NV_KV_PUT, entry->handle, entry->size,
+                           entry->pending);
+         if(used == 0)
+             goto Error;
+     }
+     if(runCount > 0)
+     {
+         used = NvKvAppendChip(used, runCount, runStart, runSize, image);
+         if(used == 0)
+             goto Error;
+     }
+     used = NvKvAppend(used, NV_KV_COMMIT, 0, 0, NULL);
+     if(   used == 0
+        || pwrite(s_kvFd, s_kvBuffer, used, s_kvLogSize) != (ssize_t)used
+        || NvKvSync(s_kvFd, syncPolicy) != 0)
+         goto Error;
+     // The transaction is durable. Point the index at the new data and release
+     // the pending copies. Everything else in the transaction, as well as the
+     // data it supersedes, is garbage.
+     s_kvGarbage += used + s_kvPendingGarbage;
+     for(i = 0; i < s_kvModified.count; i++)
+     {
+         entry = NvKvFind(s_kvModified.handle[i]);
+         if(entry == NULL || entry->queued < 0)
+             continue;
+         if(entry->offset >= 0)
+             s_kvGarbage += sizeof(NV_KV_RECORD) + entry->size;
+         s_kvGarbage -= sizeof(NV_KV_RECORD) + entry->size;
+         entry->offset = entry->queued;
+         entry->queued = -1;
+         free(entry->pending);
+         entry->pending = NULL;
+     }
+     s_kvModified.count = 0;
+     s_kvDeleted.count = 0;
+     s_kvPendingGarbage = 0;
+     s_kvLogSize += used;
+     *written = (unsigned int)used;
+     if(s_kvLogSize >= NV_KV_COMPACT_MIN && s_kvGarbage > s_kvLogSize / 2)
+         NvKvCompact(runCount, runStart, runSize, image, syncPolicy);
+     return 0;
+Error:
+     // Leave everything pending for the next commit
+     for(i = 0; i < s_kvModified.count; i++)
+     {
+         entry = NvKvFind(s_kvModified.handle[i]);
+         if(entry != NULL)
+             entry->queued = -1;
+     }
+     return 1;
+}
+//
+//
+//          _plat__NvEntityNext()
+//
+//     Return the handle of the next entity in the store, or 0 when there are no more
+//
+//     iter is one past the slot of the entity last returned. If that entity has since been deleted, NvKvRemove()
+//     may have shifted an entity that is not yet traversed back into its slot, so the traversal resumes at that
+//     slot. An entity shifted back across the end of the table may be returned a second time, but none is
+//     skipped.
+//
+LIB_EXPORT unsigned int
+_plat__NvEntityNext(
+     unsigned int        *iter               // IN/OUT: traversal position
+     )
+{
+     if(*iter != 0 && *iter - 1 == s_kvRemovedSlot)
+         (*iter)--;
+     s_kvRemovedSlot = UINT_MAX;
+     while(*iter < s_kvTableSize)
+     {
+         unsigned int     handle = s_kvTable[(*iter)++].handle;
+         if(handle != 0)
+             return handle;
+     }
+     return 0;
+}
+//
+//
+//          _plat__NvEntityExists()
+//
+//     Check whether an entity with the given handle is in the store
+//
+LIB_EXPORT BOOL
+_plat__NvEntityExists(
+     unsigned int         handle             // IN: entity handle
+     )
+{
+     return NvKvFind(handle) != NULL;
+}
+//
+//
+//          _plat__NvEntityFreeSpace()
+//
+//     Return the number of octets that can still be allocated to entities
+//
+LIB_EXPORT unsigned int
+_plat__NvEntityFreeSpace(
+     void
+     )
+{
+     if(s_kvEntityBytes >= NV_KV_STORE_SIZE)
+         return 0;
+     return NV_KV_STORE_SIZE - s_kvEntityBytes;
+}
+//
+//
+//          _plat__NvEntityAdd()
+//
+//     Add an entity of size octets. The first initSize octets are copied from data and the rest are 0.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             out of memory
+//
+LIB_EXPORT int
+_plat__NvEntityAdd(
+     unsigned int         handle,            // IN: entity handle
+     unsigned int         size,              // IN: entity size
+     unsigned int         initSize,          // IN: size of data
+     void                *data               // IN: initial data
+     )
+{
+     NV_KV_ENTRY         *entry;
+     unsigned char       *pending;
+     assert(handle != 0 && initSize <= size && NvKvFind(handle) == NULL);
+     pending = calloc(1, size);
+     if(pending == NULL || NvKvListAppend(&s_kvModified, handle) != 0)
+         goto Error;
+     entry = NvKvInsert(handle);
+     if(entry == NULL)
+     {
+         s_kvModified.count--;
+         goto Error;
+     }
+     memcpy(pending, data, initSize);
+     entry->size = size;
+     entry->pending = pending;
+     s_kvEntityBytes += size;
+     return 0;
+Error:
+     free(pending);
+     return 1;
+}
+//
+//
+//          _plat__NvEntityDelete()
+//
+//     Remove an entity from the store
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             out of memory
+//
+LIB_EXPORT int
+_plat__NvEntityDelete(
+     unsigned int         handle             // IN: entity handle
+     )
+{
+     NV_KV_ENTRY         *entry = NvKvFind(handle);
+     assert(entry != NULL);
+     // Only an entity that is in the log needs a delete record
+     if(entry->offset >= 0)
+     {
+         if(NvKvListAppend(&s_kvDeleted, handle) != 0)
+             return 1;
+         s_kvPendingGarbage += sizeof(NV_KV_RECORD) + entry->size;
+     }
+     free(entry->pending);
+     s_kvEntityBytes -= entry->size;
+     NvKvRemove(entry);
+     return 0;
+}
+//
+//
+//          _plat__NvEntityRead()
+//
+//     Read a chunk of an entity
+//
+LIB_EXPORT void
+_plat__NvEntityRead(
+     unsigned int         handle,            // IN: entity handle
+     unsigned int         offset,            // IN: read start
+     unsigned int         size,              // IN: size of bytes to read
+     void                *data               // OUT: data buffer
+     )
+{
+     NV_KV_ENTRY         *entry = NvKvFind(handle);
+     ssize_t              got;
+     assert(entry != NULL && offset + size <= entry->size);
+     if(entry->pending != NULL)
+         memcpy(data, entry->pending + offset, size);
+     else
+     {
+         got = pread(s_kvFd, data, size, entry->offset + offset);
+         assert(got == (ssize_t)size);
+         UNREFERENCED(got);
+     }
+     return;
+}
+//
+//
+//          _plat__NvEntityIsDifferent()
+//
+//     Check whether a chunk of an entity is different from the test value
+//
+LIB_EXPORT BOOL
+_plat__NvEntityIsDifferent(
+     unsigned int         handle,            // IN: entity handle
+     unsigned int         offset,            // IN: compare start
+     unsigned int         size,              // IN: size of bytes to compare
+     void                *data               // IN: data buffer
+     )
+{
+     NV_KV_ENTRY         *entry = NvKvFind(handle);
+     unsigned char        chunk[256];
+     unsigned int         done;
+     unsigned int         length;
+     assert(entry != NULL && offset + size <= entry->size);
+     if(entry->pending != NULL)
+         return memcmp(entry->pending + offset, data, size) != 0;
+     for(done = 0; done < size; done += length)
+     {
+         length = size - done < sizeof(chunk) ? size - done : sizeof(chunk);
+         _plat__NvEntityRead(handle, offset + done, length, chunk);
+         if(memcmp(chunk, (unsigned char *)data + done, length) != 0)
+             return TRUE;
+     }
+     return FALSE;
+}
+//
+//
+//          _plat__NvEntityWrite()
+//
+//     Write a chunk of an entity. The first write after a commit copies the entity to RAM.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             out of memory
+//
+LIB_EXPORT int
+_plat__NvEntityWrite(
+     unsigned int         handle,            // IN: entity handle
+     unsigned int         offset,            // IN: write start
+     unsigned int         size,              // IN: size of bytes to write
+     void                *data               // IN: data buffer
+     )
+{
+     NV_KV_ENTRY         *entry = NvKvFind(handle);
+     assert(entry != NULL && offset + size <= entry->size);
+     if(entry->pending == NULL)
+     {
+         unsigned char   *pending = malloc(entry->size);
+         if(pending == NULL || NvKvListAppend(&s_kvModified, handle) != 0)
+         {
+             free(pending);
+             return 1;
+         }
+         _plat__NvEntityRead(handle, 0, entry->size, pending);
+         entry->pending = pending;
+     }
+     memcpy(entry->pending + offset, data, size);
+     return 0;
+}
+#endif // NV_KV_STORE
@@ -63,14 +63,31 @@ struct env_md_st {
 //
 //     This is a structure to hold the parameters for the version of KDFa() used by the CryptoEngine(). This
 //     structure allows the state to be passed between multiple functions that use the same pseudo-random
-//     sequence.
+//     sequence. The HMAC states keyed with the seed are those of a KDFa_STREAM.
 //
 typedef struct {
-   CPRI_HASH_STATE          iPadCtx;
-   CPRI_HASH_STATE          oPadCtx;
+   KDFa_STREAM              kdf;
    TPM2B                   *extra;
    UINT32                  *outer;
-   TPM_ALG_ID               hashAlg;
    UINT16                   keySizeInBits;
 } KDFa_CONTEXT;
+#ifdef TPM_MULTI_INSTANCE
+//
+//     With TPM_MULTI_INSTANCE, the state of the crypto engine is kept in the cpri_instance selected by the
+//     calling thread with _cpri__InstanceSelect(). The OpenSSL random number generator is shared by all
+//     instances; each instance adds its entropy to it.
+//
+struct cpri_instance
+{
+   int                      s_entropyFailure;
+   struct sym_state        *sym;
+};
+extern THREAD_LOCAL struct cpri_instance *g_cpriInstance;
+#define s_entropyFailure        (g_cpriInstance->s_entropyFailure)
+//
+//     From CpriSym.c
+//
+struct sym_state *SymInstanceCreate(void);
+void SymInstanceDestroy(struct sym_state *sym);
+#endif // TPM_MULTI_INSTANCE
 #endif // _OSSL_CRYPTO_ENGINE_H
@@ -331,7 +331,7 @@ GetPcrPointer (
    UINT32                pcrNumber           // IN: PCR number
    )
 {
-   static BYTE          *pcr = NULL;
+   BYTE                 *pcr = NULL;
    if(!PcrIsAllocated(pcrNumber, alg))
        return NULL;
    switch(alg)
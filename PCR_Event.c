@@ -21,7 +21,7 @@ TPM2_PCR_Event(
    )
 {
    TPM_RC                result;
-   HASH_STATE            hashState;
+   HASH_STATE            hashStates[HASH_COUNT];
    UINT32                i;
    UINT16                size;
 
@@ -48,14 +48,19 @@ TPM2_PCR_Event(
 
    out->digests.count = HASH_COUNT;
 
+   // Hash the event with all the supported PCR bank algorithms
+   for(i = 0; i < HASH_COUNT; i++)
+       CryptStartHash(CryptGetHashAlgByIndex(i), &hashStates[i]);
+   CryptUpdateDigests(HASH_COUNT, hashStates, (1 << HASH_COUNT) - 1,
+                      in->eventData.t.size, in->eventData.t.buffer);
+
    // Iterate supported PCR bank algorithms to extend
    for(i = 0; i < HASH_COUNT; i++)
    {
        TPM_ALG_ID hash = CryptGetHashAlgByIndex(i);
        out->digests.digests[i].hashAlg = hash;
-       size = CryptStartHash(hash, &hashState);
-       CryptUpdateDigest2B(&hashState, &in->eventData.b);
-       CryptCompleteHash(&hashState, size,
+       size = CryptGetHashDigestSize(hash);
+       CryptCompleteHash(&hashStates[i], size,
                          (BYTE *) &out->digests.digests[i].digest);
        if(in->pcrHandle != TPM_RH_NULL)
            PCRExtend(in->pcrHandle, hash, size,
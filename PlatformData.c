@@ -5,9 +5,18 @@
 // Level 00 Revision 01.16
 // October 30, 2014
 
+#include        <stdio.h>
+#include        <stdlib.h>
+#include        <string.h>
 #include        "Implementation.h"
 #include        "Platform.h"
 #include        "PlatformData.h"
+#ifdef TPM_MULTI_INSTANCE
+//
+//     The platform values are kept in the instance selected by the calling thread.
+//
+THREAD_LOCAL PLATFORM_INSTANCE *g_platformInstance;
+#else
 //
 //     From Cancel.c
 //
@@ -21,6 +30,7 @@ unsigned int              s_adjustRate;
 //     From LocalityPlat.c
 //
 unsigned char             s_locality;
+BOOL                      s_RsaKeyCacheEnabled;
 //
 //     From Power.c
 //
@@ -34,3 +44,105 @@ int                       firstValue;
 //     From PPPlat.c
 //
 BOOL   s_physicalPresence;
+#endif // TPM_MULTI_INSTANCE
+//
+//
+//          NvFileName()
+//
+//     This function builds the name of an NV file in buffer, which has NV_FILE_NAME_SIZE bytes, and returns
+//     buffer. With TPM_MULTI_INSTANCE, the name is prefixed with the directory of the selected instance.
+//
+const char *
+NvFileName(
+    char                *buffer,            // OUT: the file name
+    const char          *name               // IN: the name in the directory
+    )
+{
+#ifdef TPM_MULTI_INSTANCE
+    // _plat__InstanceCreate() checked that the longest name fits
+    if(snprintf(buffer, NV_FILE_NAME_SIZE, "%s/%s", g_platformInstance->directory,
+                name) >= NV_FILE_NAME_SIZE)
+        return name;
+    return buffer;
+#else
+    // The names of the NV files are shorter than NV_FILE_NAME_SIZE
+    memcpy(buffer, name, strlen(name) + 1);
+    return buffer;
+#endif
+}
+#ifdef TPM_MULTI_INSTANCE
+//
+//
+//          _plat__InstanceCreate()
+//
+//     This function creates a platform instance with NV files in directory.
+//
+//     Return Value                      Meaning
+//
+//     NULL                              out of memory or directory is too long
+//     not NULL                          the instance
+//
+LIB_EXPORT PLATFORM_INSTANCE *
+_plat__InstanceCreate(
+    const char          *directory          // IN: directory of the NV files
+    )
+{
+    PLATFORM_INSTANCE       *instance;
+    // Leave room for the '/' and the longest file name
+    if(strlen(directory) + sizeof("/NVStore.tmp") > NV_FILE_NAME_SIZE)
+        return NULL;
+    instance = calloc(1, sizeof(PLATFORM_INSTANCE));
+    if(instance == NULL)
+        return NULL;
+    strcpy(instance->directory, directory);
+    instance->nv = NvInstanceCreate();
+    if(instance->nv == NULL)
+    {
+        _plat__InstanceDestroy(instance);
+        return NULL;
+    }
+#ifdef NV_KV_STORE
+    instance->store = NvStoreInstanceCreate();
+    if(instance->store == NULL)
+    {
+        _plat__InstanceDestroy(instance);
+        return NULL;
+    }
+#endif
+    return instance;
+}
+//
+//
+//          _plat__InstanceDestroy()
+//
+//     This function frees a platform instance.
+//
+LIB_EXPORT void
+_plat__InstanceDestroy(
+    PLATFORM_INSTANCE   *instance
+    )
+{
+    if(instance == NULL)
+        return;
+    if(g_platformInstance == instance)
+        g_platformInstance = NULL;
+    NvInstanceDestroy(instance->nv);
+#ifdef NV_KV_STORE
+    NvStoreInstanceDestroy(instance->store);
+#endif
+    free(instance);
+}
+//
+//
+//          _plat__InstanceSelect()
+//
+//     This function selects the platform instance of the calling thread.
+//
+LIB_EXPORT void
+_plat__InstanceSelect(
+    PLATFORM_INSTANCE   *instance
+    )
+{
+    g_platformInstance = instance;
+}
+#endif // TPM_MULTI_INSTANCE
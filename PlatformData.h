@@ -25,6 +25,10 @@ extern unsigned int                s_adjustRate;
 //
 extern unsigned char s_locality;
 //
+//     From LocalityPlat.c Whether the RSA key cache is used. It is initialized to FALSE
+//
+extern BOOL         s_RsaKeyCacheEnabled;
+//
 //     From PPPlat.c Physical presence. It is initialized to FALSE
 //
 extern BOOL         s_physicalPresence;
@@ -37,4 +41,67 @@ extern BOOL             s_powerLost;
 //
 extern uint32_t        lastEntropy;
 extern int             firstValue;
+#ifdef NV_KV_STORE
+//
+//     From NVStore.c The entity store is opened, closed and committed together with NVChip by NVMem.c
+//
+int NvStoreEnable(BOOL create, unsigned char *image);
+void NvStoreDisable(void);
+int NvStoreCommit(unsigned int runCount, const unsigned int *runStart,
+                  const unsigned int *runSize, const unsigned char *image,
+                  int syncPolicy, unsigned int *written);
+#endif
+//
+//     From PlatformData.c The name of a file of the NV image. With TPM_MULTI_INSTANCE, the files of an
+//     instance are kept in the directory given to _plat__InstanceCreate() and the name is built in buffer.
+//
+#define NV_FILE_NAME_SIZE       256
+const char *NvFileName(char *buffer, const char *name);
+#ifdef TPM_MULTI_INSTANCE
+//
+//     With TPM_MULTI_INSTANCE, the values above are kept in the platform instance selected by the calling
+//     thread. The state of NVMem.c and NVStore.c is allocated with the instance by NvInstanceCreate() and
+//     NvStoreInstanceCreate().
+//
+struct platform_instance
+{
+    BOOL                        s_isCanceled;
+    unsigned long long          s_initClock;
+    unsigned int                s_adjustRate;
+    unsigned char               s_locality;
+    BOOL                        s_RsaKeyCacheEnabled;
+    BOOL                        s_physicalPresence;
+    BOOL                        s_powerLost;
+    uint32_t                    lastEntropy;
+    int                         firstValue;
+    char                        directory[NV_FILE_NAME_SIZE];
+    struct nv_state            *nv;
+#ifdef NV_KV_STORE
+    struct nv_store_state      *store;
+#endif
+};
+extern THREAD_LOCAL struct platform_instance *g_platformInstance;
+#define s_isCanceled            (g_platformInstance->s_isCanceled)
+#define s_initClock             (g_platformInstance->s_initClock)
+#define s_adjustRate            (g_platformInstance->s_adjustRate)
+#define s_locality              (g_platformInstance->s_locality)
+#define s_RsaKeyCacheEnabled    (g_platformInstance->s_RsaKeyCacheEnabled)
+#define s_physicalPresence      (g_platformInstance->s_physicalPresence)
+#define s_powerLost             (g_platformInstance->s_powerLost)
+#define lastEntropy             (g_platformInstance->lastEntropy)
+#define firstValue              (g_platformInstance->firstValue)
+//
+//     From NVMem.c. An embedder that builds without NVMem.c and NVStore.c provides these functions for its
+//     own NV state.
+//
+struct nv_state *NvInstanceCreate(void);
+void NvInstanceDestroy(struct nv_state *nv);
+#ifdef NV_KV_STORE
+//
+//     From NVStore.c
+//
+struct nv_store_state *NvStoreInstanceCreate(void);
+void NvStoreInstanceDestroy(struct nv_store_state *store);
+#endif
+#endif // TPM_MULTI_INSTANCE
 #endif // _PLATFORM_DATA_H_
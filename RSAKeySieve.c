@@ -156,7 +156,7 @@ RandomForRsa(
     UINT16                          fill;
     BYTE                            *pb;
     UINT16                          lLen = 0;
-    UINT16                          digestSize = _cpri__GetDigestSize(ktx->hashAlg);
+    UINT16                          digestSize = ktx->kdf.digestSize;
     CPRI_HASH_STATE                 h;      // the working hash context
     if(label != NULL)
         for(lLen = 0; label[lLen++];);
@@ -168,7 +168,7 @@ RandomForRsa(
     {
         inner++;
          // Initialize the HMAC with saved state
-         _cpri__CopyHashState(&h, &(ktx->iPadCtx));
+         _cpri__CopyHashState(&h, &(ktx->kdf.iPadState));
          // Hash the inner counter (the one that changes on each HMAC iteration)
          UINT32_TO_BYTE_ARRAY(inner, swapped);
          _cpri__UpdateHash(&h, 4, swapped);
@@ -186,7 +186,7 @@ RandomForRsa(
             fill = i;
         _cpri__CompleteHash(&h, fill, pb);
         // Restart the oPad hash
-        _cpri__CopyHashState(&h, &(ktx->oPadCtx));
+        _cpri__CopyHashState(&h, &(ktx->kdf.oPadState));
         // Add the last hashed data
         _cpri__UpdateHash(&h, fill, pb);
         // gives a completed HMAC
@@ -723,18 +723,15 @@ KDFaContextStart(
     UINT16               keySizeInBit
     )
 {
-    UINT16                     digestSize = _cpri__GetDigestSize(hashAlg);
-    TPM2B_HASH_BLOCK           oPadKey;
+    UINT16                     digestSize;
     if(seed == NULL)
         return NULL;
-    pAssert(ktx != NULL && outer != NULL && digestSize != 0);
-   // Start the hash using the seed and get the intermediate hash value
-   _cpri__StartHMAC(hashAlg, FALSE, &(ktx->iPadCtx), seed->size, seed->buffer,
-                    &oPadKey.b);
-   _cpri__StartHash(hashAlg, FALSE, &(ktx->oPadCtx));
-   _cpri__UpdateHash(&(ktx->oPadCtx), oPadKey.b.size, oPadKey.b.buffer);
+    pAssert(ktx != NULL && outer != NULL);
+   // Key the HMAC with the seed. RandomForRsa() hashes its own data after the
+   // keyed states, so only the key of the stream is used.
+   digestSize = _cpri__KDFaStart(&ktx->kdf, hashAlg, seed, NULL, NULL, NULL, 0);
+   pAssert(digestSize != 0);
    ktx->extra = extra;
-   ktx->hashAlg = hashAlg;
    ktx->outer = outer;
    ktx->keySizeInBits = keySizeInBits;
    return ktx;
@@ -747,8 +744,7 @@ KDFaContextEnd(
     if(ktx != NULL)
     {
         // Close out the hash sessions
-        _cpri__CompleteHash(&(ktx->iPadCtx), 0, NULL);
-        _cpri__CompleteHash(&(ktx->oPadCtx), 0, NULL);
+        _cpri__KDFaEnd(&ktx->kdf);
     }
 }
 //%#endif
@@ -35,13 +35,9 @@ TPM2_SequenceUpdate(
    if(object->attributes.eventSeq == SET)
    {
        // Update event sequence object
-       UINT32           i;
        HASH_OBJECT     *hashObject = (HASH_OBJECT *)object;
-       for(i = 0; i < HASH_COUNT; i++)
-       {
-           // Update sequence object
-           CryptUpdateDigest2B(&hashObject->state.hashState[i], &in->buffer.b);
-       }
+       CryptUpdateDigests(HASH_COUNT, hashObject->state.hashState,
+                          (1 << HASH_COUNT) - 1, in->buffer.t.size, in->buffer.t.buffer);
    }
    else
    {
@@ -71,7 +71,10 @@ SessionStartup(
    // Initialize session slots. At startup, all the in-memory session slots
    // are cleared and marked as not occupied
    for(i = 0; i < MAX_LOADED_SESSIONS; i++)
+   {
        s_sessions[i].occupied = FALSE;   // session slot is not occupied
+       MemorySet(&s_sessions[i].hmacCache, 0, sizeof(HMAC_CACHE));
+   }
    // The free session slots the number of maximum allowed loaded sessions
    s_freeSessionSlots = MAX_LOADED_SESSIONS;
    // Initialize context ID data. On a ST_SAVE or hibernate sequence, it             will
@@ -228,6 +231,24 @@ SessionGet(
 }
 //
 //
+//           SessionGetHmacCache()
+//
+//      This function returns a pointer to the HMAC states cached for a session handle. The function requires
+//      that the session is loaded.
+//
+HMAC_CACHE *
+SessionGetHmacCache(
+    TPM_HANDLE           handle              // IN: session handle
+    )
+{
+    CONTEXT_SLOT        sessionIndex;
+    pAssert((handle & HR_HANDLE_MASK) < MAX_ACTIVE_SESSIONS);
+    sessionIndex = gr.contextArray[handle & HR_HANDLE_MASK] - 1;
+    pAssert(sessionIndex < MAX_LOADED_SESSIONS);
+    return &s_sessions[sessionIndex].hmacCache;
+}
+//
+//
 //           Utility Functions
 //
 //             ContextIdSessionCreate()
@@ -467,8 +488,9 @@ SessionContextSave (
    // If no other sessions are saved, this is now the oldest.
    if(s_oldestSavedSession >= MAX_ACTIVE_SESSIONS)
        s_oldestSavedSession = contextIndex;
-   // Mark the session slot as unoccupied
+   // Mark the session slot as unoccupied and clear the HMAC states of the session
    s_sessions[slotIndex].occupied = FALSE;
+   MemorySet(&s_sessions[slotIndex].hmacCache, 0, sizeof(HMAC_CACHE));
    // and indicate that there is an additional open slot
    s_freeSessionSlots++;
    return TPM_RC_SUCCESS;
@@ -575,6 +597,7 @@ SessionFlush(
         slotIndex -= 1;
          // Free session array index
          s_sessions[slotIndex].occupied = FALSE;
+         MemorySet(&s_sessions[slotIndex].hmacCache, 0, sizeof(HMAC_CACHE));
          s_freeSessionSlots++;
     }
     return;
@@ -566,6 +566,7 @@ ComputeCommandHMAC(
    INT32               bufferSize;
    UINT32              marshalSize;
    HMAC_STATE          hmacState;
+   HMAC_CACHE         *hmacCache;
    TPM2B_NONCE        *nonceDecrypt;
    TPM2B_NONCE        *nonceEncrypt;
    SESSION            *session;
@@ -638,8 +639,10 @@ ComputeCommandHMAC(
         hmac->t.size = 0;
         return;
     }
-   // Start HMAC
-   hmac->t.size = CryptStartHMAC2B(session->authHashAlg, &key.b, &hmacState);
+   // Start HMAC from the states cached in the session slot for this key
+   hmacCache = SessionGetHmacCache(s_sessionHandles[sessionIndex]);
+   hmac->t.size = CryptStartHMACCached2B(session->authHashAlg, &key.b,
+                                         hmacCache, &hmacState);
    // Add cpHash
    CryptUpdateDigest2B(&hmacState, &cpHash->b);
    // Add nonceCaller
@@ -659,7 +662,7 @@ ComputeCommandHMAC(
                                        &buffer, &bufferSize);
     CryptUpdateDigest(&hmacState, marshalSize, marshalBuffer);
     // Complete the HMAC computation
-    CryptCompleteHMAC2B(&hmacState, &hmac->b);
+    CryptCompleteHMACCached2B(hmacCache, &hmacState, &hmac->b);
     return;
 }
 //
@@ -1687,6 +1690,7 @@ ComputeResponseHMAC(
    INT32            bufferSize;
    UINT32           marshalSize;
    HMAC_STATE       hmacState;
+   HMAC_CACHE      *hmacCache;
    TPM2B_DIGEST     rp_hash;
 //
    // Compute rpHash.
@@ -1717,8 +1721,10 @@ ComputeResponseHMAC(
        hmac->t.size = 0;
        return;
    }
-   // Start HMAC computation.
-   hmac->t.size = CryptStartHMAC2B(session->authHashAlg, &key.b, &hmacState);
+   // Start HMAC computation from the states cached in the session slot.
+   hmacCache = SessionGetHmacCache(s_sessionHandles[sessionIndex]);
+   hmac->t.size = CryptStartHMACCached2B(session->authHashAlg, &key.b,
+                                         hmacCache, &hmacState);
    // Add hash components.
    CryptUpdateDigest2B(&hmacState, &rp_hash.b);
    CryptUpdateDigest2B(&hmacState, &nonceTPM->b);
@@ -1729,7 +1735,7 @@ ComputeResponseHMAC(
    marshalSize = TPMA_SESSION_Marshal(&s_attributes[sessionIndex], &buffer, &bufferSize);
    CryptUpdateDigest(&hmacState, marshalSize, marshalBuffer);
    // Finalize HMAC.
-   CryptCompleteHMAC2B(&hmacState, &hmac->b);
+   CryptCompleteHMACCached2B(hmacCache, &hmacState, &hmac->b);
    return;
 }
 //
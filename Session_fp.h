@@ -42,6 +42,8 @@ void SessionFlush(TPM_HANDLE handle  // IN: loaded or saved session handle
                   );
 SESSION *SessionGet(TPM_HANDLE handle  // IN: session handle
                     );
+HMAC_CACHE *SessionGetHmacCache(TPM_HANDLE handle  // IN: session handle
+                                );
 void SessionInitPolicyData(SESSION *session  // IN: session handle
                            );
 BOOL SessionIsLoaded(TPM_HANDLE handle  // IN: session handle
@@ -16,9 +16,11 @@
 #include "DRTM_fp.h"
 #include "_TPM_Init_fp.h"
 #include "TpmFail_fp.h"
+#include "Implementation.h"
 #include <windows.h>
 #include "TpmTcpProtocol.h"
 static BOOL     s_isPowerOn = FALSE;
+static NV_COMMIT_STATS s_profileNvStart;        // NV counters when the profile started
 //
 //
 //          Functions
@@ -181,9 +183,17 @@ _rpc__Send_Command(
    }
    // Set the locality of the command so that it doesn't change during the command
    _plat__LocalitySet(locality);
-   // Do implementation-specific command dispatch
-   ExecuteCommand(request.BufferSize, request.Buffer,
-                          &response->BufferSize, &response->Buffer);
+   // Do implementation-specific command dispatch. A caller that supplies a
+   // buffer of response->BufferSize bytes gets the response marshaled there;
+   // otherwise the response is left in the response buffer of the TPM.
+   if(response->Buffer != NULL)
+       response->BufferSize = ExecuteCommandToBuffer(request.BufferSize,
+                                                     request.Buffer,
+                                                     response->BufferSize,
+                                                     response->Buffer);
+   else
+       ExecuteCommand(request.BufferSize, request.Buffer,
+                              &response->BufferSize, &response->Buffer);
    return;
 }
 //
@@ -258,6 +268,54 @@ _rpc__Signal_NvOff(
 }
 //
 //
+//       _rpc__Get_CommandProfile()
+//
+//      This function copies the command profile of the TPM and the NV commit counters to profile->Buffer and
+//      restarts them when reset is TRUE. The records of the commands that do not fit in profile->BufferSize are
+//      left out, and profile->BufferSize is set to the size of the profile.
+//
+void
+_rpc__Get_CommandProfile(
+   BOOL                 reset,
+   _OUT_BUFFER         *profile
+   )
+{
+   TPM_PROFILE_HEADER  *header = (TPM_PROFILE_HEADER *)profile->Buffer;
+   TPM_PROFILE_RECORD  *record = (TPM_PROFILE_RECORD *)(header + 1);
+   NV_COMMIT_STATS      nvStats;
+   UINT32               commandCode;
+   UINT32               size = sizeof(TPM_PROFILE_HEADER);
+   if(profile->BufferSize < size)
+   {
+       profile->BufferSize = 0;
+       return;
+   }
+   _plat__NvGetCommitStats(&nvStats);
+   header->nvCommits = nvStats.commits - s_profileNvStart.commits;
+   header->nvBytesWritten = nvStats.bytesWritten - s_profileNvStart.bytesWritten;
+   header->nvSyncs = nvStats.syncs - s_profileNvStart.syncs;
+   header->commandCount = 0;
+   header->reserved = 0;
+   if(reset)
+       s_profileNvStart = nvStats;
+   for(commandCode = TPM_CC_FIRST; commandCode <= TPM_CC_LAST; commandCode++)
+   {
+       if(profile->BufferSize - size < sizeof(TPM_PROFILE_RECORD))
+           break;
+       if(ExecuteCommandGetProfile(commandCode, reset, &record->profile))
+       {
+           record->commandCode = commandCode;
+           record->reserved = 0;
+           record++;
+           header->commandCount++;
+           size += sizeof(TPM_PROFILE_RECORD);
+       }
+   }
+   profile->BufferSize = size;
+   return;
+}
+//
+//
 //       _rpc__Shutdown()
 //
 //      This function is used to stop the TPM simulator.
@@ -5,29 +5,177 @@
 // Level 00 Revision 01.16
 // October 30, 2014
 
+#ifdef __linux__
+#define _GNU_SOURCE                     // memfd_create()
+#endif
 #include <stdio.h>
+#ifdef _WIN32
+#define FD_SETSIZE 1024
 #include <windows.h>
 #include <winsock.h>
+typedef int socklen_t;
+#define SOCKET_EINTR                    WSAEINTR
+#define SOCKET_ETIMEDOUT                WSAETIMEDOUT
+#else
+//
+//     On POSIX systems the server uses BSD sockets and pthreads through the same names as the Windows
+//     version.
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#endif
+#include "bool.h"
+#include "BaseTypes.h"
+typedef int                             SOCKET;
+typedef long                            LONG;
+typedef pthread_mutex_t                 CRITICAL_SECTION;
+typedef pthread_cond_t                  CONDITION_VARIABLE;
+#define INVALID_SOCKET                  (-1)
+#define SOCKET_ERROR                    (-1)
+#define closesocket(s)                  close(s)
+#define WSAGetLastError()               errno
+#define InitializeCriticalSection(l)    pthread_mutex_init((l), NULL)
+#define EnterCriticalSection(l)         pthread_mutex_lock(l)
+#define LeaveCriticalSection(l)         pthread_mutex_unlock(l)
+#define InitializeConditionVariable(c)  pthread_cond_init((c), NULL)
+#define SleepConditionVariableCS(c, l, t) pthread_cond_wait((c), (l))
+#define WakeConditionVariable(c)        pthread_cond_signal(c)
+#define WakeAllConditionVariable(c)     pthread_cond_broadcast(c)
+#define InterlockedIncrement(p)         __sync_add_and_fetch((p), 1)
+#define InterlockedDecrement(p)         __sync_sub_and_fetch((p), 1)
+#define InterlockedExchange(p, v)       __sync_lock_test_and_set((p), (v))
+#define ZeroMemory(p, n)                memset((p), 0, (n))
+#define INFINITE                        0
+#define SOCKET_EINTR                    EINTR
+#define SOCKET_ETIMEDOUT                EWOULDBLOCK     // SO_SNDTIMEO expired
+#endif
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS                      MSG_NOSIGNAL    // report EPIPE instead of SIGPIPE
+#else
+#define SEND_FLAGS                      0
+#endif
 #include "string.h"
 #include <stdlib.h>
 #include <stdint.h>
+#include "Implementation.h"              // MAX_RESPONSE_SIZE
+#include "ExecCommand_fp.h"
 #include "TpmTcpProtocol.h"
-BOOL ReadBytes(SOCKET s, char* buffer, int NumBytes);
-BOOL ReadVarBytes(SOCKET s, char* buffer, UINT32* BytesReceived, int MaxLen);
-BOOL WriteVarBytes(SOCKET s, char *buffer, int BytesToSend);
-BOOL WriteBytes(SOCKET s, char* buffer, int NumBytes);
-BOOL WriteUINT32(SOCKET s, UINT32 val);
 #ifndef __IGNORE_STATE__
 static UINT32 ServerVersion = 1;
 #define MAX_BUFFER 1048576
-char InputBuffer[MAX_BUFFER];        //The input data buffer for the simulator.
-char OutputBuffer[MAX_BUFFER];       //The output data buffer for the simulator.
 struct {
    UINT32      largestCommandSize;
    UINT32      largestCommand;
    UINT32      largestResponseSize;
    UINT32      largestResponse;
 } CommandResponseSizes = {0};
+//
+//     The server runs an event loop on the thread that calls StartTcpServer(). The loop waits for both listening
+//     sockets and for every connection with a poller (epoll on Linux, select() elsewhere), accepts connections
+//     and reads requests into the receive buffer of the connection. A connection is not polled while a request is
+//     being processed. Once a whole request has been received, the connection is queued in s_connections and
+//     a thread of a pool of TCP_SERVER_WORKERS processes the requests that are in its buffer, writes each
+//     response with one send() and has the connection polled again. So a client waiting on a long command
+//     does not keep other clients from connecting. The TPM itself is serialized by s_tpmLock, which is held while
+//     a command or a signal is processed. A send() that cannot complete within TCP_SERVER_SEND_TIMEOUT ms,
+//     because the client does not read its responses, closes the connection, so that such a client cannot hold
+//     a worker.
+//
+#ifndef TCP_SERVER_WORKERS
+#define TCP_SERVER_WORKERS          8
+#endif
+#ifndef TCP_SERVER_SEND_TIMEOUT
+#define TCP_SERVER_SEND_TIMEOUT     5000
+#endif
+#define TCP_SERVER_QUEUE_SIZE       1024
+#define TCP_BUFFER_SIZE             4096        // initial size of the connection buffers
+#define TCP_REQUEST_TOO_LARGE       ((UINT32)-1)
+typedef enum
+{
+   TCP_COMMAND_LISTENER,
+   TCP_PLATFORM_LISTENER,
+   TCP_COMMAND_CONNECTION,
+   TCP_PLATFORM_CONNECTION
+} TCP_ENDPOINT_KIND;
+typedef enum
+{
+   SERVE_CONTINUE,                 // keep the connection
+   SERVE_CLOSE,                    // close the connection
+   SERVE_STOP                      // stop the server
+} SERVE_RESULT;
+#ifdef __linux__
+//
+//     A connection on a local socket can move its requests and responses to a TPM_SHARED_RING (see
+//     TpmTcpProtocol.h). Each ring is mapped twice in a row, so a request or a response is always contiguous.
+//     A response is marshaled where it is. The client can still write to a request while it is processed, so
+//     each request is copied to a private buffer and its size checked again before it is parsed. The socket is
+//     then only used to notice that the client is gone.
+//
+#define TCP_RING_RESPONSE_MAX       (MAX_BUFFER + 16)   // room kept for the next response
+typedef struct
+{
+   TPM_SHARED_RING     *shared;
+   char                *requests;
+   char                *responses;
+   UINT32               requestTail;    // requests processed but not yet released to the client
+   char                *request;        // copy of the request being processed
+   UINT32               requestMax;
+   int                  serverBell;     // rung by the client
+   int                  clientBell;     // rung by the server
+   int                  poll;           // epoll of serverBell and the socket
+} TCP_RING;
+#endif
+typedef struct
+{
+   TCP_ENDPOINT_KIND    kind;
+   SOCKET               s;
+   BOOL                 local;          // a local socket, which can pass descriptors
+   char                *in;             // received bytes not yet processed
+   UINT32               inSize;
+   UINT32               inMax;
+   char                *out;            // the responses to send
+   UINT32               outSize;
+   UINT32               outMax;
+#ifdef __linux__
+   TCP_RING            *ring;           // not NULL once TPM_MAP_SHARED_RING succeeded
+#endif
+} TCP_CONNECTION;
+static CRITICAL_SECTION     s_tpmLock;
+static CRITICAL_SECTION     s_connectionLock;
+static CONDITION_VARIABLE   s_connectionReady;
+static TCP_CONNECTION      *s_connections[TCP_SERVER_QUEUE_SIZE];
+static UINT32               s_connectionFirst;
+static UINT32               s_connectionCount;
+static volatile LONG        s_stopServer;
+static volatile LONG        s_commandsWaiting;
+TCP_SERVER_STATS            ServerStats = {0};
+#ifdef __linux__
+static int                  s_epoll;
+static int                  s_wakeEvent;
+#else
+//
+//     Without epoll, the poller keeps the polled endpoints in s_polled and the event loop builds the fd_set from
+//     it. s_wakeSocket is a UDP socket connected to itself; PollerArm() sends a datagram to it so that select()
+//     returns and picks up the change.
+//
+static CRITICAL_SECTION     s_pollLock;
+static TCP_CONNECTION      *s_polled[FD_SETSIZE - 1];
+static UINT32               s_polledCount;
+static SOCKET               s_wakeSocket;
+#endif
 #endif // __IGNORE_STATE___
 //
 //
@@ -43,9 +191,10 @@ CreateSocket(
      SOCKET                  *listenSocket
      )
 {
-     WSADATA                  wsaData;
      struct                   sockaddr_in MyAddress;
      int res;
+#ifdef _WIN32
+     WSADATA                  wsaData;
      // Initialize Winsock
      res = WSAStartup(MAKEWORD(2,2), &wsaData);
      if (res != 0)
@@ -53,6 +202,7 @@ CreateSocket(
          printf("WSAStartup failed with error: %d\n", res);
          return -1;
      }
+#endif
      // create listening socket
      *listenSocket = socket(PF_INET, SOCK_STREAM, 0);
 //
@@ -73,7 +223,7 @@ CreateSocket(
        return -1;
    };
    // listen/wait for server connections
-   res= listen(*listenSocket,3);
+   res= listen(*listenSocket,SOMAXCONN);
    if(res==SOCKET_ERROR)
    {
        printf("Listen error. Error is 0x%x\n", WSAGetLastError());
@@ -81,272 +231,466 @@ CreateSocket(
    };
    return 0;
 }
+#ifndef _WIN32
 //
 //
-//         PlatformServer()
+//          CreateLocalSocket()
 //
-//      This function processes incoming platform requests.
+//     This function creates a local socket listening on path. A file left at path by an earlier run is removed.
 //
-BOOL
-PlatformServer(
-   SOCKET               s
-   )
+static int
+CreateLocalSocket(
+     const char              *path,
+     SOCKET                  *listenSocket
+     )
 {
-   BOOL                      ok = TRUE;
-   UINT32                    length = 0;
-   UINT32                    Command;
-   for(;;)
-   {
-       ok = ReadBytes(s, (char*) &Command, 4);
-       // client disconnected (or other error). We stop processing this client
-       // and return to our caller who can stop the server or listen for another
-       // connection.
-       if(!ok) return TRUE;
-       Command = ntohl(Command);
-       switch(Command)
-       {
-           case TPM_SIGNAL_POWER_ON:
-               _rpc__Signal_PowerOn(FALSE);
-               break;
-             case TPM_SIGNAL_POWER_OFF:
-                 _rpc__Signal_PowerOff();
-                 break;
-             case TPM_SIGNAL_RESET:
-                 _rpc__Signal_PowerOn(TRUE);
-                 break;
-//
-              case TPM_SIGNAL_PHYS_PRES_ON:
-                  _rpc__Signal_PhysicalPresenceOn();
-                  break;
-              case TPM_SIGNAL_PHYS_PRES_OFF:
-                  _rpc__Signal_PhysicalPresenceOff();
-                  break;
-              case TPM_SIGNAL_CANCEL_ON:
-                  _rpc__Signal_CancelOn();
-                  break;
-              case TPM_SIGNAL_CANCEL_OFF:
-                  _rpc__Signal_CancelOff();
-                  break;
-              case TPM_SIGNAL_NV_ON:
-                  _rpc__Signal_NvOn();
-                  break;
-              case TPM_SIGNAL_NV_OFF:
-                  _rpc__Signal_NvOff();
-                  break;
-              case TPM_SESSION_END:
-                  // Client signaled end-of-session
-                  return TRUE;
-              case TPM_STOP:
-                  // Client requested the simulator to exit
-                  return FALSE;
-              case TPM_TEST_FAILURE_MODE:
-                  _rpc__ForceFailureMode();
-                  break;
-              case TPM_GET_COMMAND_RESPONSE_SIZES:
-                  ok = WriteVarBytes(s, (char *)&CommandResponseSizes,
-                                     sizeof(CommandResponseSizes));
-                  memset(&CommandResponseSizes, 0, sizeof(CommandResponseSizes));
-                  if(!ok)
-                      return TRUE;
-                  break;
-              default:
-                  printf("Unrecognized platform interface command %d\n", Command);
-                  WriteUINT32(s, 1);
-                  return TRUE;
-          }
-          WriteUINT32(s,0);
-    }
-    return FALSE;
+     struct sockaddr_un       address;
+     if(strlen(path) >= sizeof(address.sun_path))
+     {
+         printf("Socket path too long: %s\n", path);
+         return -1;
+     }
+     *listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+     if(*listenSocket == INVALID_SOCKET)
+     {
+         printf("Cannot create server listen socket.         Error is 0x%x\n",
+                 errno);
+         return -1;
+     }
+     ZeroMemory(&address, sizeof(address));
+     address.sun_family = AF_UNIX;
+     strcpy(address.sun_path, path);
+     unlink(path);
+     if(   bind(*listenSocket, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(*listenSocket, SOMAXCONN) != 0)
+     {
+         printf("Bind error. Error is 0x%x\n", errno);
+         return -1;
+     }
+     return 0;
 }
+#endif
 //
 //
-//          PlatformSvcRoutine()
+//          SetBlocking()
 //
-//      This function is called to set up the socket interfaces to listen for commands.
+//     This function makes the operations on a socket block or return at once.
 //
-DWORD WINAPI
-PlatformSvcRoutine(
-    LPVOID               port
-    )
+static int
+SetBlocking(
+     SOCKET                   s,
+     BOOL                     blocking
+     )
 {
+#ifdef _WIN32
+     u_long                   nonBlocking = !blocking;
+     return ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+     int                      flags = fcntl(s, F_GETFL, 0);
+     if(flags < 0)
+         return -1;
+     flags = blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK;
+     return fcntl(s, F_SETFL, flags);
+#endif
+}
 //
-   int                      PortNumber = (int)(INT_PTR) port;
-   SOCKET                   listenSocket, serverSocket;
-   struct                   sockaddr_in HerAddress;
-   int                      res;
-   int                      length;
-   BOOL                     continueServing;
-   res = CreateSocket(PortNumber, &listenSocket);
-   if(res != 0)
-   {
-       printf("Create platform service socket fail\n");
-       return res;
-   }
-   // Loop accepting connections one-by-one until we are killed or asked to stop
-   // Note the platform service is single-threaded so we don't listen for a new
-   // connection until the prior connection drops.
-   do
-   {
-       printf("Platform server listening on port %d\n", PortNumber);
-          // blocking accept
-          length = sizeof(HerAddress);
-          serverSocket = accept(listenSocket,
-                                (struct sockaddr*) &HerAddress,
-                                &length);
-          if(serverSocket == SOCKET_ERROR)
-          {
-              printf("Accept error. Error is 0x%x\n", WSAGetLastError());
-              return -1;
-          };
-          printf("Client accepted\n");
-          // normal behavior on client disconnection is to wait for a new client
-          // to connect
-          continueServing = PlatformServer(serverSocket);
-          closesocket(serverSocket);
-   }
-   while(continueServing);
-   return 0;
+//
+//          SetSendTimeout()
+//
+//     This function limits the time that a send() on a socket may wait for the client to TCP_SERVER_SEND_TIMEOUT
+//     ms.
+//
+static int
+SetSendTimeout(
+     SOCKET                   s
+     )
+{
+#ifdef _WIN32
+     DWORD                    timeout = TCP_SERVER_SEND_TIMEOUT;
+#else
+     struct timeval           timeout;
+     timeout.tv_sec = TCP_SERVER_SEND_TIMEOUT / 1000;
+     timeout.tv_usec = (TCP_SERVER_SEND_TIMEOUT % 1000) * 1000;
+#endif
+     return setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,
+                       sizeof(timeout));
 }
 //
 //
-//          PlatformSignalService()
+//          StartThread()
 //
-//      This function starts a new thread waiting for platform signals. Platform signals are processed one at a
-//      time in the order in which they are received.
+//     This function starts a detached thread running routine.
 //
-int
-PlatformSignalService(
-   int                 PortNumber
-   )
+#ifdef _WIN32
+typedef DWORD WINAPI THREAD_ROUTINE(LPVOID parameter);
+#else
+typedef void *THREAD_ROUTINE(void *parameter);
+#endif
+static int
+StartThread(
+     THREAD_ROUTINE          *routine
+     )
 {
-   HANDLE                   hPlatformSvc;
-   int                      ThreadId;
-   int                      port = PortNumber;
-   // Create service thread for platform signals
-   hPlatformSvc = CreateThread(NULL, 0,
-                               (LPTHREAD_START_ROUTINE)PlatformSvcRoutine,
-                               (LPVOID) (INT_PTR) port, 0, (LPDWORD)&ThreadId);
-   if(hPlatformSvc == NULL)
-   {
-       printf("Thread Creation failed\n");
-          return -1;
-   }
-   return 0;
+#ifdef _WIN32
+     HANDLE                   hThread;
+     hThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)routine, NULL, 0,
+                            NULL);
+     if(hThread == NULL)
+         return -1;
+     CloseHandle(hThread);
+     return 0;
+#else
+     pthread_t                thread;
+     if(pthread_create(&thread, NULL, routine, NULL) != 0)
+         return -1;
+     pthread_detach(thread);
+     return 0;
+#endif
 }
 //
 //
-//          RegularCommandService()
+//          PollerCreate()
 //
-//      This funciton services regular commands.
+//     This function creates the poller of the event loop.
 //
-int
-RegularCommandService(
-   int                 PortNumber
-   )
+static int
+PollerCreate(
+     void
+     )
 {
-   SOCKET                     listenSocket;
-   SOCKET                     serverSocket;
-   struct                     sockaddr_in HerAddress;
-   int res, length;
-   BOOL continueServing;
-   res = CreateSocket(PortNumber, &listenSocket);
-   if(res != 0)
-   {
-       printf("Create platform service socket fail\n");
-       return res;
-   }
-   // Loop accepting connections one-by-one until we are killed or asked to stop
-   // Note the TPM command service is single-threaded so we don't listen for
-   // a new connection until the prior connection drops.
-   do
-   {
-       printf("TPM command server listening on port %d\n", PortNumber);
-          // blocking accept
-          length = sizeof(HerAddress);
-          serverSocket = accept(listenSocket,
-                                (struct sockaddr*) &HerAddress,
-                                &length);
-          if(serverSocket ==SOCKET_ERROR)
-          {
-              printf("Accept error. Error is 0x%x\n", WSAGetLastError());
-              return -1;
-          };
-          printf("Client accepted\n");
-          // normal behavior on client disconnection is to wait for a new client
-          // to connect
-          continueServing = TpmServer(serverSocket);
-          closesocket(serverSocket);
-   }
-   while(continueServing);
-   return 0;
+#ifdef __linux__
+     struct epoll_event       event;
+     s_epoll = epoll_create1(0);
+     s_wakeEvent = eventfd(0, EFD_NONBLOCK);
+     if(s_epoll < 0 || s_wakeEvent < 0)
+         return -1;
+     event.events = EPOLLIN;
+     event.data.ptr = NULL;
+     return epoll_ctl(s_epoll, EPOLL_CTL_ADD, s_wakeEvent, &event);
+#else
+     struct sockaddr_in       address;
+     socklen_t                length = sizeof(address);
+     InitializeCriticalSection(&s_pollLock);
+     s_wakeSocket = socket(PF_INET, SOCK_DGRAM, 0);
+     if(s_wakeSocket == INVALID_SOCKET)
+         return -1;
+     ZeroMemory(&address, sizeof(address));
+     address.sin_family = AF_INET;
+     address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+     if(   bind(s_wakeSocket, (struct sockaddr *)&address, sizeof(address)) != 0
+        || getsockname(s_wakeSocket, (struct sockaddr *)&address, &length) != 0
+        || connect(s_wakeSocket, (struct sockaddr *)&address, length) != 0)
+         return -1;
+     return SetBlocking(s_wakeSocket, FALSE);
+#endif
 }
 //
 //
-//          StartTcpServer()
+//          PollerArm()
 //
-//      Main entry-point to the TCP server. The server listens on port specified. Note that there is no way to
-//      specify the network interface in this implementation.
+//     This function has the event loop wait for the next request of a connection, or the next connection of a
+//     listening socket. The endpoint is reported once and is then not polled until it is armed again.
 //
-int
-StartTcpServer(
-   int                  PortNumber
-   )
+static int
+PollerArm(
+     TCP_CONNECTION          *connection
+     )
 {
-   int                       res;
-   // Start Platform Signal Processing Service
-   res = PlatformSignalService(PortNumber+1);
-   if (res != 0)
-   {
-       printf("PlatformSignalService failed\n");
-       return res;
-   }
-   // Start Regular/DRTM TPM command service
-   res = RegularCommandService(PortNumber);
-   if (res != 0)
-   {
-       printf("RegularCommandService failed\n");
-       return res;
-   }
-   return 0;
+#ifdef __linux__
+     struct epoll_event       event;
+     int                      fd = connection->ring != NULL ? connection->ring->poll
+                                                            : connection->s;
+     event.events = EPOLLIN | EPOLLONESHOT;
+     event.data.ptr = connection;
+     if(epoll_ctl(s_epoll, EPOLL_CTL_MOD, fd, &event) == 0)
+         return 0;
+     // An endpoint is added the first time it is armed
+     if(errno != ENOENT)
+         return -1;
+     return epoll_ctl(s_epoll, EPOLL_CTL_ADD, fd, &event);
+#else
+     char                     wake = 0;
+     int                      result = 0;
+     EnterCriticalSection(&s_pollLock);
+     if(s_polledCount < sizeof(s_polled) / sizeof(s_polled[0]))
+         s_polled[s_polledCount++] = connection;
+     else
+         result = -1;
+     LeaveCriticalSection(&s_pollLock);
+     send(s_wakeSocket, &wake, 1, 0);
+     return result;
+#endif
 }
 //
 //
-//         ReadBytes()
+//          PollerRemove()
 //
-//      This function reads the indicated number of bytes (NumBytes) into buffer from the indicated socket.
+//     This function stops polling a connection before it is closed. The connection is not armed.
 //
-BOOL
-ReadBytes(
-   SOCKET               s,
-   char                *buffer,
-   int                  NumBytes
-   )
+static void
+PollerRemove(
+     TCP_CONNECTION          *connection
+     )
 {
-   int                       res;
-   int                       numGot = 0;
-   while(numGot<NumBytes)
-   {
-       res = recv(s, buffer+numGot, NumBytes-numGot, 0);
-       if(res == -1)
-       {
-           printf("Receive error. Error is 0x%x\n", WSAGetLastError());
-           return FALSE;
-       }
-       if(res==0)
-       {
-           return FALSE;
-       }
-       numGot+=res;
-   }
-   return TRUE;
+#ifdef __linux__
+     epoll_ctl(s_epoll, EPOLL_CTL_DEL,
+               connection->ring != NULL ? connection->ring->poll : connection->s,
+               NULL);
+#else
+     UNREFERENCED_PARAMETER(connection);
+#endif
+}
+//
+//
+//          PollerWake()
+//
+//     This function makes PollerWait() return so that the event loop can see that the server is stopping.
+//
+static void
+PollerWake(
+     void
+     )
+{
+#ifdef __linux__
+     uint64_t                 one = 1;
+     if(write(s_wakeEvent, &one, sizeof(one)) < 0)
+         return;
+#else
+     char                     wake = 0;
+     send(s_wakeSocket, &wake, 1, 0);
+#endif
+}
+//
+//
+//          PollerWait()
+//
+//     This function waits until at least one armed endpoint is ready and returns up to max of them in ready.
+//
+//     Return Value                      Meaning
+//
+//     >= 0                              the number of endpoints in ready
+//     <0                                the poller failed
+//
+static int
+PollerWait(
+     TCP_CONNECTION         **ready,
+     int                      max
+     )
+{
+#ifdef __linux__
+     struct epoll_event       events[64];
+     int                      count;
+     int                      i;
+     int                      n = 0;
+     uint64_t                 value;
+     if(max > 64)
+         max = 64;
+     count = epoll_wait(s_epoll, events, max, -1);
+     if(count < 0)
+         return errno == EINTR ? 0 : -1;
+     for(i = 0; i < count; i++)
+     {
+         if(events[i].data.ptr == NULL)
+         {
+             if(read(s_wakeEvent, &value, sizeof(value)) < 0)
+                 continue;
+         }
+         else
+             ready[n++] = events[i].data.ptr;
+     }
+     return n;
+#else
+     fd_set                   readSet;
+     SOCKET                   maxSocket = s_wakeSocket;
+     UINT32                   i;
+     int                      n = 0;
+     char                     wake[16];
+     FD_ZERO(&readSet);
+     FD_SET(s_wakeSocket, &readSet);
+     EnterCriticalSection(&s_pollLock);
+     for(i = 0; i < s_polledCount; i++)
+     {
+         FD_SET(s_polled[i]->s, &readSet);
+         if(s_polled[i]->s > maxSocket)
+             maxSocket = s_polled[i]->s;
+     }
+     LeaveCriticalSection(&s_pollLock);
+     if(select((int)maxSocket + 1, &readSet, NULL, NULL, NULL) < 0)
+         return WSAGetLastError() == SOCKET_EINTR ? 0 : -1;
+     while(recv(s_wakeSocket, wake, sizeof(wake), 0) > 0);
+     // Report the ready endpoints and disarm them
+     EnterCriticalSection(&s_pollLock);
+     for(i = 0; i < s_polledCount && n < max;)
+     {
+         if(FD_ISSET(s_polled[i]->s, &readSet))
+         {
+             ready[n++] = s_polled[i];
+             s_polled[i] = s_polled[--s_polledCount];
+         }
+         else
+             i++;
+     }
+     LeaveCriticalSection(&s_pollLock);
+     return n;
+#endif
+}
+//
+//
+//          TpmLock()
+//
+//     This function waits until no other thread is using the TPM. The number of threads waiting is kept for
+//     TPM_GET_SERVER_STATS.
+//
+static void
+TpmLock(
+     void
+     )
+{
+     LONG                     waiting;
+     waiting = InterlockedIncrement(&s_commandsWaiting);
+     EnterCriticalSection(&s_tpmLock);
+     InterlockedDecrement(&s_commandsWaiting);
+     if((UINT32)waiting > ServerStats.maxCommandsWaiting)
+         ServerStats.maxCommandsWaiting = (UINT32)waiting;
+}
+//
+//
+//          TpmUnlock()
+//
+//     This function lets the next waiting thread use the TPM.
+//
+static void
+TpmUnlock(
+     void
+     )
+{
+     LeaveCriticalSection(&s_tpmLock);
+}
+//
+//
+//          ReadUINT32()
+//
+//     This function returns the network byte order UINT32 at buffer.
+//
+static UINT32
+ReadUINT32(
+     const char              *buffer
+     )
+{
+     UINT32                   netVal;
+     memcpy(&netVal, buffer, sizeof(netVal));
+     return ntohl(netVal);
+}
+//
+//
+//          ReserveBuffer()
+//
+//     This function makes a connection buffer at least size bytes long.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             out of memory
+//
+static BOOL
+ReserveBuffer(
+     char                   **buffer,
+     UINT32                  *bufferMax,
+     UINT32                   size
+     )
+{
+     char                    *grown;
+     if(size <= *bufferMax)
+         return TRUE;
+     grown = realloc(*buffer, size);
+     if(grown == NULL)
+         return FALSE;
+     *buffer = grown;
+     *bufferMax = size;
+     return TRUE;
+}
+//
+//
+//          ReserveResponse()
+//
+//     This function makes room for size more bytes of responses.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             out of memory
+//
+static BOOL
+ReserveResponse(
+     TCP_CONNECTION          *connection,
+     UINT32                   size
+     )
+{
+#ifdef __linux__
+     // RingReserve() has made room for a whole response
+     if(connection->ring != NULL)
+         return connection->outSize + size <= connection->outMax;
+#endif
+     return ReserveBuffer(&connection->out, &connection->outMax,
+                          connection->outSize + size);
+}
+//
+//
+//          ResponseUINT32()
+//
+//     This function appends val in network byte order to the responses of a connection.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             out of memory
+//
+static BOOL
+ResponseUINT32(
+     TCP_CONNECTION          *connection,
+     UINT32                   val
+     )
+{
+     UINT32                   netVal = htonl(val);
+     if(!ReserveResponse(connection, 4))
+         return FALSE;
+     memcpy(connection->out + connection->outSize, &netVal, 4);
+     connection->outSize += 4;
+     return TRUE;
+}
+//
+//
+//          ResponseVarBytes()
+//
+//     This function appends a UINT32-length-prepended binary array to the responses of a connection.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             out of memory
+//
+static BOOL
+ResponseVarBytes(
+     TCP_CONNECTION          *connection,
+     const void              *buffer,
+     UINT32                   size
+     )
+{
+     if(!ReserveResponse(connection, 4 + size))
+         return FALSE;
+     ResponseUINT32(connection, size);
+     memcpy(connection->out + connection->outSize, buffer, size);
+     connection->outSize += size;
+     return TRUE;
 }
 //
 //
 //         WriteBytes()
 //
-//      This function will send the indicated number of bytes (NumBytes) to the indicated socket
+//      This function will send the indicated number of bytes (NumBytes) to the indicated socket. It fails when
+//      the send timeout of the socket expires.
 //
-BOOL
+static BOOL
 WriteBytes(
    SOCKET              s,
    char               *buffer,
@@ -357,10 +701,21 @@ WriteBytes(
    int                   numSent = 0;
    while(numSent<NumBytes)
    {
-       res = send(s, buffer+numSent, NumBytes-numSent, 0);
+       res = send(s, buffer+numSent, NumBytes-numSent, SEND_FLAGS);
        if(res == -1)
        {
+           if(WSAGetLastError() == SOCKET_EINTR)
+               continue;
+           if(WSAGetLastError() == SOCKET_ETIMEDOUT)
+           {
+               printf("Client is not reading its responses\n");
+               return FALSE;
+           }
+#ifdef _WIN32
            if(WSAGetLastError() == 0x2745)
+#else
+           if(errno == EPIPE || errno == ECONNRESET)
+#endif
            {
                printf("Client disconnected\n");
            }
@@ -374,184 +729,1179 @@ WriteBytes(
    }
    return TRUE;
 }
+#ifdef __linux__
 //
 //
-//         WriteUINT32()
+//          RingHungUp()
 //
-//      Send 4 bytes containing hton(1)
+//     This function tells if the client of a shared ring is gone. Nothing may be sent on the socket after
+//     TPM_MAP_SHARED_RING, so the socket is readable only once the client has closed it or has broken the
+//     protocol, and the connection is closed either way.
 //
-BOOL
-WriteUINT32(
-   SOCKET              s,
-   UINT32              val
-   )
+static BOOL
+RingHungUp(
+     TCP_CONNECTION          *connection
+     )
 {
-   UINT32 netVal = htonl(val);
-   return WriteBytes(s, (char*) &netVal, 4);
+     char                     byte;
+     return   recv(connection->s, &byte, 1, MSG_PEEK | MSG_DONTWAIT) >= 0
+           || (errno != EAGAIN && errno != EWOULDBLOCK);
 }
 //
 //
-//       ReadVarBytes()
+//          RingClose()
 //
-//      Get a UINT32-length-prepended binary array. Note that the 4-byte length is in network byte order (big-
-//      endian).
+//     This function unmaps a shared ring and closes its descriptors.
 //
-BOOL
-ReadVarBytes(
-   SOCKET              s,
-   char               *buffer,
-   UINT32             *BytesReceived,
-   int                 MaxLen
-   )
+static void
+RingClose(
+     TCP_RING                *ring
+     )
 {
-   int                       length;
-   BOOL                      res;
-   res = ReadBytes(s, (char*) &length, 4);
-   if(!res) return res;
-   length = ntohl(length);
-   *BytesReceived = length;
-   if(length>MaxLen)
-   {
-        printf("Buffer too big.       Client says %d\n", length);
-        return FALSE;
-   }
-   if(length==0) return TRUE;
-   res = ReadBytes(s, buffer, length);
-   if(!res) return res;
-   return TRUE;
+     if(ring->shared != NULL)
+         munmap(ring->shared, TPM_SHARED_RING_DATA + 4 * TPM_SHARED_RING_SIZE);
+     if(ring->serverBell >= 0)
+         close(ring->serverBell);
+     if(ring->clientBell >= 0)
+         close(ring->clientBell);
+     if(ring->poll >= 0)
+         close(ring->poll);
+     free(ring->request);
+     free(ring);
 }
 //
 //
-//       WriteVarBytes()
+//          RingMap()
 //
-//      Send a UINT32-length-prepended binary array. Note that the 4-byte length is in network byte order (big-
-//      endian).
+//     This function maps the memory file of a shared ring. The header is followed by each ring twice.
 //
-BOOL
-WriteVarBytes(
-   SOCKET              s,
-   char               *buffer,
-   int                 BytesToSend
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             out of address space
+//
+static BOOL
+RingMap(
+     TCP_RING                *ring,
+     int                      memory
+     )
+{
+     char                    *base;
+     int                      i;
+     base = mmap(NULL, TPM_SHARED_RING_DATA + 4 * TPM_SHARED_RING_SIZE, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+     if(base == MAP_FAILED)
+         return FALSE;
+     ring->shared = (TPM_SHARED_RING *)base;
+     if(mmap(base, TPM_SHARED_RING_DATA, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, memory, 0) == MAP_FAILED)
+         return FALSE;
+     for(i = 0; i < 4; i++)
+     {
+         if(mmap(base + TPM_SHARED_RING_DATA + i * TPM_SHARED_RING_SIZE,
+                 TPM_SHARED_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                 memory, TPM_SHARED_RING_DATA + (i / 2) * TPM_SHARED_RING_SIZE)
+            == MAP_FAILED)
+             return FALSE;
+     }
+     ring->requests = base + TPM_SHARED_RING_DATA;
+     ring->responses = ring->requests + 2 * TPM_SHARED_RING_SIZE;
+     return TRUE;
+}
+//
+//
+//          MapSharedRing()
+//
+//     This function processes TPM_MAP_SHARED_RING. It creates the shared ring and its bells and passes
+//     them to the client with the response. The next requests of the connection are taken from the ring.
+//
+static SERVE_RESULT
+MapSharedRing(
+     TCP_CONNECTION          *connection
+     )
+{
+     TCP_RING                *ring;
+     int                      memory;
+     BOOL                     ok;
+     UINT32                   reply[2];
+     struct epoll_event       event;
+     struct iovec             data;
+     struct msghdr            message;
+     struct cmsghdr          *control;
+     union
+     {
+         struct cmsghdr       header;
+         char                 buffer[CMSG_SPACE(3 * sizeof(int))];
+     }                        controlBuffer;
+     if(!connection->local || connection->ring != NULL)
+     {
+         printf("Shared ring not available on this connection\n");
+         return SERVE_CLOSE;
+     }
+     // The responses to the earlier requests go on the socket
+     if(   connection->outSize > 0
+        && !WriteBytes(connection->s, connection->out, connection->outSize))
+         return SERVE_CLOSE;
+     connection->outSize = 0;
+     ring = calloc(1, sizeof(TCP_RING));
+     if(ring == NULL)
+         return SERVE_CLOSE;
+     ring->serverBell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+     ring->clientBell = eventfd(0, EFD_CLOEXEC);
+     ring->poll = epoll_create1(EPOLL_CLOEXEC);
+     memory = memfd_create("tpm-shared-ring", MFD_CLOEXEC);
+     ok =    ring->serverBell >= 0 && ring->clientBell >= 0 && ring->poll >= 0
+          && memory >= 0
+          && ftruncate(memory, TPM_SHARED_RING_DATA + 2 * TPM_SHARED_RING_SIZE) == 0
+          && RingMap(ring, memory);
+     if(ok)
+     {
+         event.events = EPOLLIN;
+         event.data.ptr = connection;
+         ok =    epoll_ctl(ring->poll, EPOLL_CTL_ADD, ring->serverBell, &event) == 0
+              && epoll_ctl(ring->poll, EPOLL_CTL_ADD, connection->s, &event) == 0;
+     }
+     if(ok)
+     {
+         // {UINT32 RingSize, UINT32 0} with the memory file and the bells
+         reply[0] = htonl(TPM_SHARED_RING_SIZE);
+         reply[1] = 0;
+         data.iov_base = reply;
+         data.iov_len = sizeof(reply);
+         ZeroMemory(&message, sizeof(message));
+         message.msg_iov = &data;
+         message.msg_iovlen = 1;
+         message.msg_control = controlBuffer.buffer;
+         message.msg_controllen = sizeof(controlBuffer.buffer);
+         control = CMSG_FIRSTHDR(&message);
+         control->cmsg_level = SOL_SOCKET;
+         control->cmsg_type = SCM_RIGHTS;
+         control->cmsg_len = CMSG_LEN(3 * sizeof(int));
+         memcpy(CMSG_DATA(control), &memory, sizeof(int));
+         memcpy(CMSG_DATA(control) + sizeof(int), &ring->serverBell, sizeof(int));
+         memcpy(CMSG_DATA(control) + 2 * sizeof(int), &ring->clientBell, sizeof(int));
+         ok = sendmsg(connection->s, &message, SEND_FLAGS) == sizeof(reply);
+     }
+     if(memory >= 0)
+         close(memory);
+     if(!ok)
+     {
+         RingClose(ring);
+         return SERVE_CLOSE;
+     }
+     // The event loop polls ring->poll from now on
+     PollerRemove(connection);
+     connection->ring = ring;
+     return SERVE_CONTINUE;
+}
+//
+//
+//          RingPublish()
+//
+//     This function hands the responses added so far and the space of the requests processed so far back to
+//     the client, and rings clientBell.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             the bell could not be rung
+//
+static BOOL
+RingPublish(
+     TCP_CONNECTION          *connection
+     )
+{
+     TCP_RING                *ring = connection->ring;
+     TPM_SHARED_RING         *shared = ring->shared;
+     UINT32                   head = shared->responseHead + connection->outSize;
+     UINT64                   one = 1;
+     if(connection->outSize == 0 && shared->requestTail == ring->requestTail)
+         return TRUE;
+     __atomic_store_n(&shared->requestTail, ring->requestTail, __ATOMIC_RELEASE);
+     __atomic_store_n(&shared->responseHead, head, __ATOMIC_RELEASE);
+     connection->out = ring->responses + head % TPM_SHARED_RING_SIZE;
+     connection->outMax -= connection->outSize;
+     connection->outSize = 0;
+     return write(ring->clientBell, &one, sizeof(one)) == sizeof(one);
+}
+//
+//
+//          RingReserve()
+//
+//     This function waits until the response ring has room for the largest response. The client rings
+//     serverBell when it takes responses.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             the client is gone or broke the ring
+//
+static BOOL
+RingReserve(
+     TCP_CONNECTION          *connection
+     )
+{
+     TCP_RING                *ring = connection->ring;
+     TPM_SHARED_RING         *shared = ring->shared;
+     struct pollfd            wait[2];
+     UINT32                   used;
+     UINT64                   bell;
+     for(;;)
+     {
+         used = shared->responseHead
+              - __atomic_load_n(&shared->responseTail, __ATOMIC_ACQUIRE);
+         if(used > TPM_SHARED_RING_SIZE)
+             return FALSE;
+         connection->outMax = TPM_SHARED_RING_SIZE - used;
+         if(connection->outMax - connection->outSize >= TCP_RING_RESPONSE_MAX)
+             return TRUE;
+         if(!RingPublish(connection))
+             return FALSE;
+         wait[0].fd = ring->serverBell;
+         wait[0].events = POLLIN;
+         wait[1].fd = connection->s;
+         wait[1].events = POLLIN;
+         if(poll(wait, 2, -1) < 0 && errno != EINTR)
+             return FALSE;
+         if(   RingHungUp(connection)
+            || (read(ring->serverBell, &bell, sizeof(bell)) < 0 && errno != EAGAIN))
+             return FALSE;
+     }
+}
+#endif
+//
+//
+//          RequestSize()
+//
+//     This function returns the size of the request at the start of the receive buffer of a connection. The
+//     request is a UINT32 command in network byte order followed by the parameters that the command
+//     takes, as described in TpmTcpProtocol.h.
+//
+//     Return Value                      Meaning
+//
+//     0                                 more bytes are needed to know the size
+//     TCP_REQUEST_TOO_LARGE             the request has more than MAX_BUFFER bytes of data
+//     other                             the size of the request, which may be more than have been received
+//
+static UINT32
+RequestSize(
+     TCP_CONNECTION          *connection
+     )
+{
+     UINT32                   header;
+     UINT32                   length;
+     if(connection->inSize < 4)
+         return 0;
+     // All the platform requests but TPM_GET_COMMAND_PROFILE are only a command
+     if(connection->kind == TCP_PLATFORM_CONNECTION)
+         return ReadUINT32(connection->in) == TPM_GET_COMMAND_PROFILE ? 8 : 4;
+     switch(ReadUINT32(connection->in))
+     {
+         case TPM_SEND_COMMAND:
+             // {BYTE Locality, UINT32 InBufferSize, BYTE[InBufferSize] InBuffer}
+             header = 9;
+             break;
+         case TPM_SEND_TAGGED_COMMAND:
+             // {UINT32 Tag, BYTE Locality, UINT32 InBufferSize, BYTE[InBufferSize] InBuffer}
+             header = 13;
+             break;
+         case TPM_SIGNAL_HASH_DATA:
+             header = 8;
+             break;
+         case TPM_REMOTE_HANDSHAKE:
+         case TPM_SET_ALTERNATIVE_RESULT:
+             return 8;
+         default:
+             return 4;
+     }
+     if(connection->inSize < header)
+         return 0;
+     length = ReadUINT32(connection->in + header - 4);
+     if(length > MAX_BUFFER)
+         return TCP_REQUEST_TOO_LARGE;
+     return header + length;
+}
+//
+//
+//          GetServerStats()
+//
+//     This function appends the TCP_SERVER_STATS of the server to the responses of a connection.
+//
+static BOOL
+GetServerStats(
+     TCP_CONNECTION          *connection
+     )
+{
+     TCP_SERVER_STATS         stats;
+     EnterCriticalSection(&s_connectionLock);
+     stats = ServerStats;
+     stats.connectionsQueued = s_connectionCount;
+     LeaveCriticalSection(&s_connectionLock);
+     stats.commandsWaiting = (UINT32)s_commandsWaiting;
+     return ResponseVarBytes(connection, &stats, sizeof(stats));
+}
+//
+//     The size of a profile with a record for each command code
+//
+#define TCP_PROFILE_SIZE    (sizeof(TPM_PROFILE_HEADER)                               \
+                             + (TPM_CC_LAST - TPM_CC_FIRST + 1) * sizeof(TPM_PROFILE_RECORD))
+#define TCP_PROFILE_LINE    160
+static const char *const    s_profilePhases[PROFILE_PHASES] =
+{
+     "header", "handles", "sessions", "dispatch", "response-session", "nv-commit", "total"
+};
+//
+//
+//          ProfileQuantile()
+//
+//     This function returns an upper bound of the time below which permille thousandths of the times of a
+//     histogram are: the end of the bucket that holds that time, or the largest time if it is smaller.
+//
+static UINT64
+ProfileQuantile(
+     const PROFILE_HISTOGRAM *histogram,
+     UINT32                   permille
+     )
+{
+     UINT64                   rank = ((UINT64)histogram->count * permille + 999) / 1000;
+     UINT64                   seen = 0;
+     UINT64                   end;
+     UINT32                   bucket;
+     for(bucket = 0; bucket < PROFILE_BUCKETS - 1; bucket++)
+     {
+         seen += histogram->buckets[bucket];
+         if(seen >= rank)
+             break;
+     }
+     if(bucket < 4)
+         end = bucket;
+     else
+         end = ((UINT64)(5 + bucket % 4) << (bucket / 4 - 1)) - 1;
+     return end < histogram->maxNs ? end : histogram->maxNs;
+}
+//
+//
+//          ResponseProfileText()
+//
+//     This function appends the profile as a table, with the times in nanoseconds, to the responses of a
+//     connection.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             out of memory
+//
+static BOOL
+ResponseProfileText(
+     TCP_CONNECTION          *connection,
+     const BYTE              *profile
+     )
+{
+     const TPM_PROFILE_HEADER *header = (const TPM_PROFILE_HEADER *)profile;
+     const TPM_PROFILE_RECORD *record = (const TPM_PROFILE_RECORD *)(header + 1);
+     const PROFILE_HISTOGRAM  *histogram;
+     UINT32                   start;
+     UINT32                   size;
+     UINT32                   i;
+     UINT32                   phase;
+     // The size is set once the table is complete. Each line takes less than
+     // TCP_PROFILE_LINE bytes.
+     if(!ResponseUINT32(connection, 0) || !ReserveResponse(connection, 2 * TCP_PROFILE_LINE))
+         return FALSE;
+     start = connection->outSize;
+     connection->outSize += sprintf(connection->out + connection->outSize,
+                                    "nv commits %llu bytes written %llu syncs %llu\n"
+                                    "%-10s %-16s %10s %12s %12s %12s %12s %12s\n",
+                                    (unsigned long long)header->nvCommits,
+                                    (unsigned long long)header->nvBytesWritten,
+                                    (unsigned long long)header->nvSyncs,
+                                    "command", "phase", "count", "mean_ns", "p50_ns",
+                                    "p90_ns", "p99_ns", "max_ns");
+     for(i = 0; i < header->commandCount; i++)
+     {
+         if(!ReserveResponse(connection, PROFILE_PHASES * TCP_PROFILE_LINE))
+             return FALSE;
+         for(phase = 0; phase < PROFILE_PHASES; phase++)
+         {
+             histogram = &record[i].profile.phases[phase];
+             if(histogram->count == 0)
+                 continue;
+             connection->outSize += sprintf(connection->out + connection->outSize,
+                 "0x%08x %-16s %10u %12llu %12llu %12llu %12llu %12llu\n",
+                 record[i].commandCode, s_profilePhases[phase], histogram->count,
+                 histogram->totalNs / histogram->count,
+                 (unsigned long long)ProfileQuantile(histogram, 500),
+                 (unsigned long long)ProfileQuantile(histogram, 900),
+                 (unsigned long long)ProfileQuantile(histogram, 990),
+                 histogram->maxNs);
+         }
+     }
+     size = htonl(connection->outSize - start);
+     memcpy(connection->out + start - 4, &size, 4);
+     return TRUE;
+}
+//
+//
+//          GetCommandProfile()
+//
+//     This function appends the command profile of the TPM to the responses of a connection, as described for
+//     TPM_GET_COMMAND_PROFILE.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             out of memory
+//
+static BOOL
+GetCommandProfile(
+     TCP_CONNECTION          *connection,
+     UINT32                   flags
+     )
+{
+     _OUT_BUFFER              profile;
+     BOOL                     result;
+     profile.BufferSize = TCP_PROFILE_SIZE;
+     profile.Buffer = malloc(TCP_PROFILE_SIZE);
+     if(profile.Buffer == NULL)
+         return FALSE;
+     TpmLock();
+     _rpc__Get_CommandProfile((flags & TPM_PROFILE_RESET) != 0, &profile);
+     TpmUnlock();
+     if(flags & TPM_PROFILE_TEXT)
+         result = ResponseProfileText(connection, profile.Buffer);
+     else
+         result = ResponseVarBytes(connection, profile.Buffer, profile.BufferSize);
+     free(profile.Buffer);
+     return result;
+}
+//
+//
+//          SendCommand()
+//
+//     This function has the TPM execute a command and appends the response to the responses of a
+//     connection.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              success
+//     FALSE                             out of memory
+//
+static BOOL
+SendCommand(
+     TCP_CONNECTION          *connection,
+     BYTE                     locality,
+     char                    *command,
+     UINT32                   length
+     )
+{
+     _IN_BUFFER               InBuffer;
+     _OUT_BUFFER              OutBuffer;
+     InBuffer.Buffer = (BYTE*) command;
+     InBuffer.BufferSize = length;
+     // The TPM marshals the response directly after its size in the responses
+     // of the connection
+     if(!ReserveResponse(connection, 4 + MAX_RESPONSE_SIZE))
+         return FALSE;
+     OutBuffer.BufferSize = MAX_RESPONSE_SIZE;
+     OutBuffer.Buffer = (BYTE*) connection->out + connection->outSize + 4;
+     TpmLock();
+     // record the number of bytes in the command if it is the largest
+     // we have seen so far.
+     if(   InBuffer.BufferSize > CommandResponseSizes.largestCommandSize
+        && InBuffer.BufferSize >= 10)
+     {
+         CommandResponseSizes.largestCommandSize = InBuffer.BufferSize;
+         memcpy(&CommandResponseSizes.largestCommand,
+                &InBuffer.Buffer[6], sizeof(UINT32));
+     }
+     _rpc__Send_Command(locality, InBuffer, &OutBuffer);
+     ServerStats.commandsExecuted++;
+     // record the number of bytes in the response if it is the largest
+     // we have seen so far.
+     if(OutBuffer.BufferSize > CommandResponseSizes.largestResponseSize)
+     {
+         CommandResponseSizes.largestResponseSize = OutBuffer.BufferSize;
+         memcpy(&CommandResponseSizes.largestResponse,
+                &OutBuffer.Buffer[6], sizeof(UINT32));
+     }
+     TpmUnlock();
+     ResponseUINT32(connection, OutBuffer.BufferSize);
+     connection->outSize += OutBuffer.BufferSize;
+     return TRUE;
+}
+//
+//
+//         PlatformRequest()
+//
+//      This function processes one platform request and appends its response to the responses of the
+//      connection.
+//
+static SERVE_RESULT
+PlatformRequest(
+   TCP_CONNECTION      *connection
    )
 {
-   UINT32                   netLength = htonl(BytesToSend);
-   BOOL res;
-   res = WriteBytes(s, (char*) &netLength, 4);
-   if(!res) return res;
-   res = WriteBytes(s, buffer, BytesToSend);
-   if(!res) return res;
-   return TRUE;
+   UINT32                    Command;
+   Command = ReadUINT32(connection->in);
+   switch(Command)
+   {
+       case TPM_SIGNAL_POWER_ON:
+           TpmLock();
+           _rpc__Signal_PowerOn(FALSE);
+           TpmUnlock();
+           break;
+         case TPM_SIGNAL_POWER_OFF:
+             TpmLock();
+             _rpc__Signal_PowerOff();
+             TpmUnlock();
+             break;
+         case TPM_SIGNAL_RESET:
+             TpmLock();
+             _rpc__Signal_PowerOn(TRUE);
+             TpmUnlock();
+             break;
+//
+          case TPM_SIGNAL_PHYS_PRES_ON:
+              TpmLock();
+              _rpc__Signal_PhysicalPresenceOn();
+              TpmUnlock();
+              break;
+          case TPM_SIGNAL_PHYS_PRES_OFF:
+              TpmLock();
+              _rpc__Signal_PhysicalPresenceOff();
+              TpmUnlock();
+              break;
+          // Cancel is meant to reach a command that is running, so it does not
+          // wait for the TPM
+          case TPM_SIGNAL_CANCEL_ON:
+              _rpc__Signal_CancelOn();
+              break;
+          case TPM_SIGNAL_CANCEL_OFF:
+              _rpc__Signal_CancelOff();
+              break;
+          case TPM_SIGNAL_NV_ON:
+              TpmLock();
+              _rpc__Signal_NvOn();
+              TpmUnlock();
+              break;
+          case TPM_SIGNAL_NV_OFF:
+              TpmLock();
+              _rpc__Signal_NvOff();
+              TpmUnlock();
+              break;
+          case TPM_SESSION_END:
+              // Client signaled end-of-session
+              return SERVE_CLOSE;
+          case TPM_STOP:
+              // Client requested the simulator to exit
+              return SERVE_STOP;
+          case TPM_TEST_FAILURE_MODE:
+              TpmLock();
+              _rpc__ForceFailureMode();
+              TpmUnlock();
+              break;
+          case TPM_GET_COMMAND_RESPONSE_SIZES:
+              TpmLock();
+              if(!ResponseVarBytes(connection, &CommandResponseSizes,
+                                   sizeof(CommandResponseSizes)))
+              {
+                  TpmUnlock();
+                  return SERVE_CLOSE;
+              }
+              memset(&CommandResponseSizes, 0, sizeof(CommandResponseSizes));
+              TpmUnlock();
+              break;
+          case TPM_GET_SERVER_STATS:
+              if(!GetServerStats(connection))
+                  return SERVE_CLOSE;
+              break;
+          case TPM_GET_COMMAND_PROFILE:
+              if(!GetCommandProfile(connection, ReadUINT32(connection->in + 4)))
+                  return SERVE_CLOSE;
+              break;
+#ifdef __linux__
+          case TPM_MAP_SHARED_RING:
+              return MapSharedRing(connection);
+#endif
+          default:
+              printf("Unrecognized platform interface command %d\n", Command);
+              ResponseUINT32(connection, 1);
+              return SERVE_CLOSE;
+   }
+   return ResponseUINT32(connection, 0) ? SERVE_CONTINUE : SERVE_CLOSE;
 }
 //
 //
-//       TpmServer()
+//       TpmRequest()
 //
-//      Processing incoming TPM command requests using the protocol / interface defined above.
+//      This function processes one TPM request using the protocol / interface defined above and appends its
+//      response to the responses of the connection. The request is complete in the receive buffer of the
+//      connection.
 //
-BOOL
-TpmServer(
-   SOCKET              s
+static SERVE_RESULT
+TpmRequest(
+   TCP_CONNECTION      *connection
    )
 {
+   char                    *request = connection->in;
    UINT32                   length;
    UINT32                   Command;
-   BYTE                     locality;
-   BOOL                     ok;
-   int                      result;
    int                      clientVersion;
    _IN_BUFFER               InBuffer;
-   _OUT_BUFFER              OutBuffer;
-   for(;;)
+   Command = ReadUINT32(request);
+   switch(Command)
    {
-       ok = ReadBytes(s, (char*) &Command, 4);
-       // client disconnected (or other error). We stop processing this client
-       // and return to our caller who can stop the server or listen for another
-       // connection.
-       if(!ok)
-           return TRUE;
-       Command = ntohl(Command);
-       switch(Command)
-       {
-           case TPM_SIGNAL_HASH_START:
-               _rpc__Signal_Hash_Start();
-               break;
-              case TPM_SIGNAL_HASH_END:
-                  _rpc__Signal_HashEnd();
-                  break;
-              case TPM_SIGNAL_HASH_DATA:
-                  ok = ReadVarBytes(s, InputBuffer, &length, MAX_BUFFER);
-                  if(!ok) return TRUE;
-                  InBuffer.Buffer = (BYTE*) InputBuffer;
-                  InBuffer.BufferSize = length;
-                  _rpc__Signal_Hash_Data(InBuffer);
-                  break;
-              case TPM_SEND_COMMAND:
-                  ok = ReadBytes(s, (char*) &locality, 1);
-                  if(!ok)
-                      return TRUE;
-                  ok = ReadVarBytes(s, InputBuffer, &length, MAX_BUFFER);
-                  if(!ok)
-                      return TRUE;
-                  InBuffer.Buffer = (BYTE*) InputBuffer;
-                  InBuffer.BufferSize = length;
-                  OutBuffer.BufferSize = MAX_BUFFER;
-                  OutBuffer.Buffer = (_OUTPUT_BUFFER) OutputBuffer;
-                  // record the number of bytes in the command if it is the largest
-                  // we have seen so far.
-                  if(InBuffer.BufferSize > CommandResponseSizes.largestCommandSize)
-                  {
-                      CommandResponseSizes.largestCommandSize = InBuffer.BufferSize;
-                      memcpy(&CommandResponseSizes.largestCommand,
-                             &InputBuffer[6], sizeof(UINT32));
-                  }
-                  _rpc__Send_Command(locality, InBuffer, &OutBuffer);
-                  // record the number of bytes in the response if it is the largest
-                  // we have seen so far.
-                  if(OutBuffer.BufferSize > CommandResponseSizes.largestResponseSize)
-                  {
-                      CommandResponseSizes.largestResponseSize
-                          = OutBuffer.BufferSize;
-                      memcpy(&CommandResponseSizes.largestResponse,
-                             &OutputBuffer[6], sizeof(UINT32));
-                  }
-                  ok = WriteVarBytes(s,
-                                     (char*) OutBuffer.Buffer,
-                                     OutBuffer.BufferSize);
-                  if(!ok)
-                      return TRUE;
-                  break;
-              case TPM_REMOTE_HANDSHAKE:
-                  ok = ReadBytes(s, (char*)&clientVersion, 4);
-                  if(!ok)
-                      return TRUE;
-                  if( clientVersion == 0 )
-                  {
-                      printf("Unsupported client version (0).\n");
-                      return TRUE;
-                  }
-                  ok &= WriteUINT32(s, ServerVersion);
-                  ok &= WriteUINT32(s,
-                                 tpmInRawMode | tpmPlatformAvailable | tpmSupportsPP);
-                  break;
-              case TPM_SET_ALTERNATIVE_RESULT:
-                  ok = ReadBytes(s, (char*)&result, 4);
-                  if(!ok)
-                      return TRUE;
-                  // Alternative result is not applicable to the simulator.
-                  break;
-             case TPM_SESSION_END:
-                 // Client signaled end-of-session
-                 return TRUE;
-             case TPM_STOP:
-                 // Client requested the simulator to exit
-                 return FALSE;
-             default:
-                 printf("Unrecognized TPM interface command %d\n", Command);
-                 return TRUE;
+       case TPM_SIGNAL_HASH_START:
+           TpmLock();
+           _rpc__Signal_Hash_Start();
+           TpmUnlock();
+           break;
+          case TPM_SIGNAL_HASH_END:
+              TpmLock();
+              _rpc__Signal_HashEnd();
+              TpmUnlock();
+              break;
+          case TPM_SIGNAL_HASH_DATA:
+              length = ReadUINT32(request + 4);
+              InBuffer.Buffer = (BYTE*) request + 8;
+              InBuffer.BufferSize = length;
+              TpmLock();
+              _rpc__Signal_Hash_Data(InBuffer);
+              TpmUnlock();
+              break;
+          case TPM_SEND_COMMAND:
+              if(!SendCommand(connection, (BYTE) request[4], request + 9,
+                              ReadUINT32(request + 5)))
+                  return SERVE_CLOSE;
+              break;
+          case TPM_SEND_TAGGED_COMMAND:
+              // The tag goes back as it came, ahead of the response
+              if(   !ResponseUINT32(connection, ReadUINT32(request + 4))
+                 || !SendCommand(connection, (BYTE) request[8], request + 13,
+                                 ReadUINT32(request + 9)))
+                  return SERVE_CLOSE;
+              break;
+          case TPM_REMOTE_HANDSHAKE:
+              memcpy(&clientVersion, request + 4, sizeof(clientVersion));
+              if( clientVersion == 0 )
+              {
+                  printf("Unsupported client version (0).\n");
+                  return SERVE_CLOSE;
+              }
+              if(   !ResponseUINT32(connection, ServerVersion)
+                 || !ResponseUINT32(connection,
+                         tpmInRawMode | tpmPlatformAvailable | tpmSupportsPP
+                       | tpmSupportsTaggedCommands))
+                  return SERVE_CLOSE;
+              break;
+          case TPM_SET_ALTERNATIVE_RESULT:
+              // Alternative result is not applicable to the simulator.
+              break;
+#ifdef __linux__
+          case TPM_MAP_SHARED_RING:
+              return MapSharedRing(connection);
+#endif
+         case TPM_SESSION_END:
+             // Client signaled end-of-session
+             return SERVE_CLOSE;
+         case TPM_STOP:
+             // Client requested the simulator to exit
+             return SERVE_STOP;
+         default:
+             printf("Unrecognized TPM interface command %d\n", Command);
+             return SERVE_CLOSE;
+    }
+    return ResponseUINT32(connection, 0) ? SERVE_CONTINUE : SERVE_CLOSE;
+}
+#ifdef __linux__
+//
+//
+//          ServeRingRequests()
+//
+//     This function is ServeRequests() for a connection that uses a shared ring. It processes the requests
+//     in the ring until there is no complete one and puts the responses in the response ring.
+//
+static SERVE_RESULT
+ServeRingRequests(
+     TCP_CONNECTION          *connection
+     )
+{
+     TCP_RING                *ring = connection->ring;
+     SERVE_RESULT             result = SERVE_CONTINUE;
+     UINT32                   size;
+     connection->out = ring->responses
+                     + ring->shared->responseHead % TPM_SHARED_RING_SIZE;
+     connection->outSize = 0;
+     for(;;)
+     {
+         connection->in = ring->requests + ring->requestTail % TPM_SHARED_RING_SIZE;
+         connection->inSize = __atomic_load_n(&ring->shared->requestHead,
+                                              __ATOMIC_ACQUIRE)
+                            - ring->requestTail;
+         size = RequestSize(connection);
+         if(connection->inSize > TPM_SHARED_RING_SIZE || size == TCP_REQUEST_TOO_LARGE)
+         {
+             result = SERVE_CLOSE;
+             break;
+         }
+         if(size == 0 || size > connection->inSize)
+             break;
+         // The size was read from the ring, which the client may have changed
+         // since; it must still match the copy that is parsed
+         if(!ReserveBuffer(&ring->request, &ring->requestMax, size))
+         {
+             result = SERVE_CLOSE;
+             break;
+         }
+         memcpy(ring->request, connection->in, size);
+         connection->in = ring->request;
+         connection->inSize = size;
+         if(RequestSize(connection) != size || !RingReserve(connection))
+         {
+             result = SERVE_CLOSE;
+             break;
+         }
+         if(connection->kind == TCP_PLATFORM_CONNECTION)
+             result = PlatformRequest(connection);
+         else
+             result = TpmRequest(connection);
+         ring->requestTail += size;
+         if(result != SERVE_CONTINUE)
+             break;
+     }
+     if(!RingPublish(connection) && result == SERVE_CONTINUE)
+         result = SERVE_CLOSE;
+     return result;
+}
+#endif
+//
+//
+//          ServeRequests()
+//
+//     This function processes the complete requests in the receive buffer of a connection in order, and then
+//     sends all their responses at once. A client that sends several requests without waiting for the responses
+//     gets them in one segment.
+//
+static SERVE_RESULT
+ServeRequests(
+     TCP_CONNECTION          *connection
+     )
+{
+     SERVE_RESULT             result = SERVE_CONTINUE;
+     UINT32                   size;
+     UINT32                   consumed = 0;
+     char                    *in = connection->in;
+     UINT32                   inSize = connection->inSize;
+#ifdef __linux__
+     if(connection->ring != NULL)
+         return ServeRingRequests(connection);
+#endif
+     for(;;)
+     {
+         size = RequestSize(connection);
+         if(size == 0 || size == TCP_REQUEST_TOO_LARGE || size > connection->inSize)
+             break;
+         if(connection->kind == TCP_PLATFORM_CONNECTION)
+             result = PlatformRequest(connection);
+         else
+             result = TpmRequest(connection);
+         // Step over the request
+         connection->in += size;
+         connection->inSize -= size;
+         consumed += size;
+         if(result != SERVE_CONTINUE)
+             break;
+#ifdef __linux__
+         if(connection->ring != NULL)
+         {
+             // TPM_MAP_SHARED_RING has answered. As RingHungUp() does for what
+             // arrives later, anything sent after it on the socket closes the
+             // connection.
+             result = connection->inSize == 0 ? SERVE_CONTINUE : SERVE_CLOSE;
+             free(in);
+             free(connection->out);
+             connection->in = connection->out = NULL;
+             connection->inSize = connection->outSize = 0;
+             return result;
+         }
+#endif
+     }
+     if(   connection->outSize > 0
+        && !WriteBytes(connection->s, connection->out, connection->outSize)
+        && result == SERVE_CONTINUE)
+         result = SERVE_CLOSE;
+     connection->outSize = 0;
+     connection->in = in;
+     connection->inSize = inSize - consumed;
+     memmove(in, in + consumed, connection->inSize);
+     return result;
+}
+//
+//
+//          CloseConnection()
+//
+//     This function closes a connection and frees its buffers.
+//
+static void
+CloseConnection(
+     TCP_CONNECTION          *connection
+     )
+{
+     PollerRemove(connection);
+     closesocket(connection->s);
+#ifdef __linux__
+     if(connection->ring != NULL)
+         RingClose(connection->ring);
+     else
+#endif
+     {
+         free(connection->in);
+         free(connection->out);
+     }
+     free(connection);
+}
+//
+//
+//          StopServer()
+//
+//     This function has the event loop and the worker threads return.
+//
+static void
+StopServer(
+     void
+     )
+{
+     InterlockedExchange(&s_stopServer, TRUE);
+     EnterCriticalSection(&s_connectionLock);
+     WakeAllConditionVariable(&s_connectionReady);
+     LeaveCriticalSection(&s_connectionLock);
+     PollerWake();
+}
+//
+//
+//          WorkerRoutine()
+//
+//      This function is run by each worker thread. It processes the requests of the connections in
+//      s_connections one connection at a time until the server is stopped.
+//
+#ifdef _WIN32
+static DWORD WINAPI
+#else
+static void *
+#endif
+WorkerRoutine(
+    void                *parameter
+    )
+{
+    TCP_CONNECTION          *connection;
+    SERVE_RESULT             result;
+    UNREFERENCED_PARAMETER(parameter);
+    for(;;)
+    {
+        EnterCriticalSection(&s_connectionLock);
+        while(s_connectionCount == 0 && !s_stopServer)
+            SleepConditionVariableCS(&s_connectionReady, &s_connectionLock,
+                                     INFINITE);
+        if(s_stopServer)
+        {
+            LeaveCriticalSection(&s_connectionLock);
+            return 0;
         }
-        ok = WriteUINT32(s,0);
-        if(!ok)
-            return TRUE;
+        connection = s_connections[s_connectionFirst];
+        s_connectionFirst = (s_connectionFirst + 1) % TCP_SERVER_QUEUE_SIZE;
+        s_connectionCount--;
+        ServerStats.connectionsActive++;
+        LeaveCriticalSection(&s_connectionLock);
+        result = ServeRequests(connection);
+        EnterCriticalSection(&s_connectionLock);
+        ServerStats.connectionsActive--;
+        LeaveCriticalSection(&s_connectionLock);
+        if(result == SERVE_CONTINUE && PollerArm(connection) == 0)
+            continue;
+        CloseConnection(connection);
+        if(result == SERVE_STOP)
+            StopServer();
+    }
+}
+//
+//
+//          AcceptConnections()
+//
+//     This function accepts the pending connections of a listening socket and has the event loop poll them.
+//
+static void
+AcceptConnections(
+     TCP_CONNECTION          *listener
+     )
+{
+     TCP_CONNECTION          *connection;
+     SOCKET                   serverSocket;
+     int                      noDelay = 1;
+     for(;;)
+     {
+         serverSocket = accept(listener->s, NULL, NULL);
+         if(serverSocket == INVALID_SOCKET)
+             return;
+         connection = calloc(1, sizeof(TCP_CONNECTION));
+         if(   connection == NULL
+            || SetBlocking(serverSocket, TRUE) != 0
+            || SetSendTimeout(serverSocket) != 0
+            || !ReserveBuffer(&connection->in, &connection->inMax, TCP_BUFFER_SIZE)
+            || !ReserveBuffer(&connection->out, &connection->outMax, TCP_BUFFER_SIZE))
+         {
+             closesocket(serverSocket);
+             if(connection != NULL)
+             {
+                 free(connection->in);
+                 free(connection->out);
+             }
+             free(connection);
+             continue;
+         }
+         // The responses are sent whole, so do not hold them back for an ACK
+         if(!listener->local)
+             setsockopt(serverSocket, IPPROTO_TCP, TCP_NODELAY, (char *)&noDelay,
+                        sizeof(noDelay));
+         connection->s = serverSocket;
+         connection->local = listener->local;
+         connection->kind = listener->kind == TCP_COMMAND_LISTENER
+                          ? TCP_COMMAND_CONNECTION : TCP_PLATFORM_CONNECTION;
+         if(listener->kind == TCP_COMMAND_LISTENER)
+         {
+             EnterCriticalSection(&s_connectionLock);
+             ServerStats.connectionsAccepted++;
+             LeaveCriticalSection(&s_connectionLock);
+         }
+         if(PollerArm(connection) != 0)
+         {
+             printf("Cannot poll the connection\n");
+             closesocket(serverSocket);
+             free(connection->in);
+             free(connection->out);
+             free(connection);
+         }
+     }
+}
+//
+//
+//          QueueConnection()
+//
+//     This function has a worker process the requests of a connection.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              the connection is queued
+//     FALSE                             too many connections are queued
+//
+static BOOL
+QueueConnection(
+     TCP_CONNECTION          *connection
+     )
+{
+     EnterCriticalSection(&s_connectionLock);
+     if(s_connectionCount == TCP_SERVER_QUEUE_SIZE)
+     {
+         LeaveCriticalSection(&s_connectionLock);
+         return FALSE;
+     }
+     s_connections[(s_connectionFirst + s_connectionCount)
+                   % TCP_SERVER_QUEUE_SIZE] = connection;
+     s_connectionCount++;
+     if(s_connectionCount > ServerStats.maxConnectionsQueued)
+         ServerStats.maxConnectionsQueued = s_connectionCount;
+     WakeConditionVariable(&s_connectionReady);
+     LeaveCriticalSection(&s_connectionLock);
+     return TRUE;
+}
+#ifdef __linux__
+//
+//
+//          RingReceive()
+//
+//     This function is ReceiveRequests() for a connection that uses a shared ring. The client rings serverBell
+//     after it adds requests.
+//
+static BOOL
+RingReceive(
+     TCP_CONNECTION          *connection
+     )
+{
+     TCP_RING                *ring = connection->ring;
+     UINT64                   bell;
+     UINT32                   size;
+     if(RingHungUp(connection))
+         return FALSE;
+     if(read(ring->serverBell, &bell, sizeof(bell)) < 0 && errno != EAGAIN)
+         return FALSE;
+     connection->in = ring->requests + ring->requestTail % TPM_SHARED_RING_SIZE;
+     connection->inSize = __atomic_load_n(&ring->shared->requestHead, __ATOMIC_ACQUIRE)
+                        - ring->requestTail;
+     size = RequestSize(connection);
+     if(connection->inSize > TPM_SHARED_RING_SIZE || size == TCP_REQUEST_TOO_LARGE)
+         return FALSE;
+     if(size == 0 || size > connection->inSize)
+         return PollerArm(connection) == 0;
+     return QueueConnection(connection);
+}
+#endif
+//
+//
+//          ReceiveRequests()
+//
+//     This function receives what a connection has sent. When the receive buffer holds a complete request,
+//     the connection is queued for the workers. Otherwise, it is polled again.
+//
+//     Return Value                      Meaning
+//
+//     TRUE                              the connection is queued or polled
+//     FALSE                             the connection is closed
+//
+static BOOL
+ReceiveRequests(
+     TCP_CONNECTION          *connection
+     )
+{
+     int                      received;
+     UINT32                   size;
+#ifdef __linux__
+     if(connection->ring != NULL)
+         return RingReceive(connection);
+#endif
+     received = recv(connection->s, connection->in + connection->inSize,
+                     connection->inMax - connection->inSize, 0);
+     // client disconnected (or other error). We stop processing this client.
+     if(received <= 0)
+         return FALSE;
+     connection->inSize += received;
+     size = RequestSize(connection);
+     if(size == TCP_REQUEST_TOO_LARGE)
+     {
+         printf("Buffer too big.\n");
+         return FALSE;
+     }
+     if(size == 0 || size > connection->inSize)
+     {
+         // Make room for the whole request
+         if(   size > connection->inMax
+            && !ReserveBuffer(&connection->in, &connection->inMax, size))
+             return FALSE;
+         return PollerArm(connection) == 0;
+     }
+     return QueueConnection(connection);
+}
+//
+//
+//          RunServer()
+//
+//     This function serves the connections to the two listening sockets until a client sends TPM_STOP.
+//
+static int
+RunServer(
+     TCP_CONNECTION          *commandListener,
+     TCP_CONNECTION          *platformListener
+     )
+{
+     TCP_CONNECTION          *ready[64];
+     int                      count;
+     int                      i;
+     InitializeCriticalSection(&s_tpmLock);
+     InitializeCriticalSection(&s_connectionLock);
+     InitializeConditionVariable(&s_connectionReady);
+     if(PollerCreate() != 0)
+     {
+         printf("Cannot create the poller\n");
+         return -1;
+     }
+     if(   SetBlocking(commandListener->s, FALSE) != 0
+        || SetBlocking(platformListener->s, FALSE) != 0
+        || PollerArm(commandListener) != 0
+        || PollerArm(platformListener) != 0)
+     {
+         printf("Create service socket fail\n");
+         return -1;
+     }
+     for(i = 0; i < TCP_SERVER_WORKERS; i++)
+     {
+         if(StartThread(WorkerRoutine) != 0)
+         {
+             printf("Thread Creation failed\n");
+             return -1;
+         }
+     }
+     while(!s_stopServer)
+     {
+         count = PollerWait(ready, sizeof(ready) / sizeof(ready[0]));
+         if(count < 0)
+         {
+             printf("Poll error. Error is 0x%x\n", WSAGetLastError());
+             return -1;
+         }
+         for(i = 0; i < count; i++)
+         {
+             if(   ready[i]->kind == TCP_COMMAND_LISTENER
+                || ready[i]->kind == TCP_PLATFORM_LISTENER)
+             {
+                 AcceptConnections(ready[i]);
+                 PollerArm(ready[i]);
+             }
+             else if(!ReceiveRequests(ready[i]))
+                 CloseConnection(ready[i]);
+         }
+     }
+     closesocket(commandListener->s);
+     closesocket(platformListener->s);
+     return 0;
+}
+//
+//
+//          StartTcpServer()
+//
+//      Main entry-point to the TCP server. The server listens on port specified for TPM commands and on the
+//      next port for platform signals, and returns when a client sends TPM_STOP. Note that there is no way to
+//      specify the network interface in this implementation.
+//
+int
+StartTcpServer(
+   int                  PortNumber
+   )
+{
+   TCP_CONNECTION            commandListener = {TCP_COMMAND_LISTENER, INVALID_SOCKET};
+   TCP_CONNECTION            platformListener = {TCP_PLATFORM_LISTENER, INVALID_SOCKET};
+   if(   CreateSocket(PortNumber, &commandListener.s) != 0
+      || CreateSocket(PortNumber + 1, &platformListener.s) != 0)
+   {
+       printf("Create service socket fail\n");
+       return -1;
+   }
+   printf("TPM command server listening on port %d\n", PortNumber);
+   printf("Platform server listening on port %d\n", PortNumber + 1);
+   return RunServer(&commandListener, &platformListener);
+}
+#ifndef _WIN32
+//
+//
+//          StartLocalServer()
+//
+//      This function is like StartTcpServer() but listens on local (AF_UNIX) sockets, which saves the TCP/IP
+//      processing when the clients run on the same host as the simulator. The requests are the same, and on
+//      Linux, a client can also ask for a shared ring with TPM_MAP_SHARED_RING.
+//
+int
+StartLocalServer(
+   const char          *commandPath,
+   const char          *platformPath
+   )
+{
+   TCP_CONNECTION            commandListener = {TCP_COMMAND_LISTENER, INVALID_SOCKET, TRUE};
+   TCP_CONNECTION            platformListener = {TCP_PLATFORM_LISTENER, INVALID_SOCKET, TRUE};
+   if(   CreateLocalSocket(commandPath, &commandListener.s) != 0
+      || CreateLocalSocket(platformPath, &platformListener.s) != 0)
+   {
+       printf("Create service socket fail\n");
+       return -1;
    }
-   return FALSE;
+   printf("TPM command server listening on %s\n", commandPath);
+   printf("Platform server listening on %s\n", platformPath);
+   return RunServer(&commandListener, &platformListener);
 }
+#endif
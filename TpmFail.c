@@ -65,9 +65,10 @@ typedef union {
 //     NOTE:           This is not in Global.c because of the specialized data definitions above. Since the data contained in this
 //                     structure is not relevant outside of the execution of a single command (when the TPM is in failure mode. There
 //                     is no compelling reason to move all the typedefs to Global.h and this structure to Global.c.
+//                     With TPM_MULTI_INSTANCE, each thread has its own buffer.
 //
 #ifndef __IGNORE_STATE__ // Don't define this value
-static BYTE response[sizeof(RESPONSES)];
+static THREAD_LOCAL BYTE response[sizeof(RESPONSES)];
 #endif
 //
 //
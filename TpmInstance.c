@@ -0,0 +1,84 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+
+#include "InternalRoutines.h"
+#include "Platform.h"
+#include "TpmInstance_fp.h"
+
+#ifdef TPM_MULTI_INSTANCE
+//
+//     With TPM_MULTI_INSTANCE, the TPM, platform and crypto engine state described in Global.h,
+//     PlatformData.h and OsslCryptoEngine.h is kept in instances rather than in globals. An instance is as if the
+//     simulator process had just started: it is not manufactured, it is powered off and its NV is not enabled.
+//     Before calling any TPM, platform or crypto engine function, a thread selects the instance with
+//     TpmInstanceSelect(). An instance may be used by one thread at a time
+//     and may move between threads.
+//
+//
+//          TpmInstanceCreate()
+//
+//     This function creates a TPM instance whose NV files are kept in nvDirectory.
+//
+//     Return Value                      Meaning
+//
+//     NULL                              out of memory or nvDirectory is too long
+//     not NULL                          the instance
+//
+TPM_INSTANCE *
+TpmInstanceCreate(
+    const char          *nvDirectory        // IN: directory of the NV files
+    )
+{
+    TPM_INSTANCE        *instance = calloc(1, sizeof(TPM_INSTANCE));
+    if(instance == NULL)
+        return NULL;
+    instance->platform = _plat__InstanceCreate(nvDirectory);
+    instance->cpri = _cpri__InstanceCreate();
+    if(instance->platform == NULL || instance->cpri == NULL)
+    {
+        _plat__InstanceDestroy(instance->platform);
+        _cpri__InstanceDestroy(instance->cpri);
+        free(instance);
+        return NULL;
+    }
+    return instance;
+}
+//
+//
+//          TpmInstanceDestroy()
+//
+//     This function frees a TPM instance. The NV of the instance must have been disabled with
+//     _plat__NVDisable().
+//
+void
+TpmInstanceDestroy(
+    TPM_INSTANCE        *instance           // IN: instance to free
+    )
+{
+    if(instance == NULL)
+        return;
+    if(g_tpmInstance == instance)
+        TpmInstanceSelect(NULL);
+    _plat__InstanceDestroy(instance->platform);
+    _cpri__InstanceDestroy(instance->cpri);
+    free(instance);
+}
+//
+//
+//          TpmInstanceSelect()
+//
+//     This function selects the TPM instance, and its platform instance, used by the calling thread.
+//
+void
+TpmInstanceSelect(
+    TPM_INSTANCE        *instance           // IN: instance used by this thread
+    )
+{
+    g_tpmInstance = instance;
+    _plat__InstanceSelect(instance == NULL ? NULL : instance->platform);
+    _cpri__InstanceSelect(instance == NULL ? NULL : instance->cpri);
+}
+#endif // TPM_MULTI_INSTANCE
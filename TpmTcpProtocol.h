@@ -34,13 +34,32 @@
 #define    TPM_SESSION_END             20
 #define    TPM_STOP                    21
 #define    TPM_GET_COMMAND_RESPONSE_SIZES 25
+#define    TPM_GET_SERVER_STATS       26
+          // platform port only -> {UINT32 Size, TCP_SERVER_STATS Stats}
+#define    TPM_SEND_TAGGED_COMMAND    27
+          // {UINT32 Tag, BYTE Locality, UINT32 InBufferSize, BYTE[InBufferSize] InBuffer} ->
+          //     {UINT32 Tag, UINT32 OutBufferSize, BYTE[OutBufferSize] OutBuffer}
+          // A client may send any number of requests without waiting for the responses, as long
+          // as it keeps reading them. The commands are executed one at a time and answered in
+          // the order they were sent; the tag is echoed so that the client can match them.
+          // Servers that take this request report tpmSupportsTaggedCommands in the handshake.
+#define    TPM_MAP_SHARED_RING        28
+          // local socket, Linux only -> {UINT32 RingSize} with a memory file, serverBell and
+          //     clientBell attached (SCM_RIGHTS); see TPM_SHARED_RING
+#define    TPM_GET_COMMAND_PROFILE    29
+          // platform port only {UINT32 Flags} -> {UINT32 Size, BYTE[Size] Profile}
+          // Profile is a TPM_PROFILE_HEADER followed by the TPM_PROFILE_RECORDs, in host byte order,
+          // or with TPM_PROFILE_TEXT a table of the same values. With TPM_PROFILE_RESET, the profile
+          // restarts after it is read. The TPM keeps the times only when it is built with
+          // TPM_COMMAND_PROFILE.
 #define    TPM_TEST_FAILURE_MODE      30
 enum TpmEndPointInfo
 {
    tpmPlatformAvailable = 0x01,
    tpmUsesTbs = 0x02,
    tpmInRawMode = 0x04,
-   tpmSupportsPP = 0x08
+   tpmSupportsPP = 0x08,
+   tpmSupportsTaggedCommands = 0x10
 };
 // Existing RPC interface type definitions retained so that the implementation
 // can be re-used
@@ -66,6 +85,8 @@ void _rpc__Signal_Hash_Data(
    _IN_BUFFER input
 );
 void _rpc__Signal_HashEnd();
+// When response->Buffer is not NULL, the response is marshaled into it and response->BufferSize must be
+// at least MAX_RESPONSE_SIZE; otherwise response->Buffer is set to the response buffer of the TPM.
 void _rpc__Send_Command(
    unsigned char   locality,
    _IN_BUFFER       request,
@@ -79,9 +100,77 @@ BOOL _rpc__InjectEPS(
    const char* seed,
    int seedSize
 );
+// Copies the TPM_PROFILE_HEADER and the TPM_PROFILE_RECORDs that fit in profile->BufferSize bytes to
+// profile->Buffer and sets profile->BufferSize to their size.
+void _rpc__Get_CommandProfile(
+   BOOL             reset,
+   _OUT_BUFFER      *profile
+);
+//
+//     Counters of the TPM command service returned by TPM_GET_SERVER_STATS, in host byte order.
+//     connectionsQueued connections have received a request and wait for a worker thread, and
+//     commandsWaiting commands and signals wait for the TPM, which runs one at a time.
+//
+typedef struct
+{
+   uint32_t             connectionsAccepted;
+   uint32_t             connectionsActive;
+   uint32_t             connectionsQueued;
+   uint32_t             maxConnectionsQueued;
+   uint32_t             commandsExecuted;
+   uint32_t             commandsWaiting;
+   uint32_t             maxCommandsWaiting;
+} TCP_SERVER_STATS;
+//
+//     The profile returned by TPM_GET_COMMAND_PROFILE. The NV counters are those of _plat__NvGetCommitStats()
+//     since the profile started, and a record follows for each command code that was executed since then.
+//
+#define    TPM_PROFILE_TEXT           0x01
+#define    TPM_PROFILE_RESET          0x02
+typedef struct
+{
+   uint64_t             nvCommits;
+   uint64_t             nvBytesWritten;
+   uint64_t             nvSyncs;
+   uint32_t             commandCount;       // number of TPM_PROFILE_RECORDs
+   uint32_t             reserved;
+} TPM_PROFILE_HEADER;
+typedef struct
+{
+   uint32_t             commandCode;
+   uint32_t             reserved;
+   COMMAND_PROFILE      profile;            // see ExecCommand_fp.h
+} TPM_PROFILE_RECORD;
+//
+//     After TPM_MAP_SHARED_RING, the requests and the responses of the connection go through two rings in
+//     the memory file instead of the socket, with the same framing. The file holds a TPM_SHARED_RING, then
+//     the request ring at TPM_SHARED_RING_DATA and the response ring right after it, each
+//     TPM_SHARED_RING_SIZE bytes. A head or a tail counts the bytes written to or taken from a ring, and
+//     byte n of a ring is at offset n % TPM_SHARED_RING_SIZE. The client rings serverBell, an eventfd, after
+//     it moves requestHead or responseTail; the server rings clientBell after it moves requestTail or
+//     responseHead. Nothing may be sent on the socket after TPM_MAP_SHARED_RING: the server closes the
+//     connection as soon as the socket is readable, whether the client has closed it or sent more bytes.
+//
+#define    TPM_SHARED_RING_SIZE       0x200000
+#define    TPM_SHARED_RING_DATA       4096
+typedef struct
+{
+   volatile uint32_t    requestHead;        // written by the client
+   uint8_t              reserved0[60];      // keeps each index in its own cache line
+   volatile uint32_t    requestTail;        // written by the server
+   uint8_t              reserved1[60];
+   volatile uint32_t    responseHead;       // written by the server
+   uint8_t              reserved2[60];
+   volatile uint32_t    responseTail;       // written by the client
+} TPM_SHARED_RING;
+//
+//     Serve TPM commands on PortNumber and platform signals on PortNumber + 1 until a client sends
+//     TPM_STOP. One thread waits for requests on all the connections; worker threads process them, and the
+//     TPM processes one command at a time.
+//
+int StartTcpServer(int PortNumber);
 //
-//     start the TPM server on the indicated socket. The TPM is single-threaded and will accept connections
-//     first-come-first-served. Once a connection is dropped another client can connect.
+//     Serve the same requests on local sockets bound to commandPath and platformPath.
 //
-BOOL TpmServer(SOCKET ServerSocket);
+int StartLocalServer(const char *commandPath, const char *platformPath);
 #endif
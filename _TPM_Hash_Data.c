@@ -18,6 +18,7 @@ _TPM_Hash_Data(
    )
 {
    UINT32             i;
+   UINT32             banks = 0;
    HASH_OBJECT       *hashObject;
    TPMI_DH_PCR        pcrHandle = TPMIsStarted()
                                  ? PCR_FIRST + DRTM_PCR : PCR_FIRST + HCRTM_PCR;
@@ -38,9 +39,10 @@ _TPM_Hash_Data(
        // make sure that the PCR is implemented for this algorithm
        if(PcrIsAllocated(pcrHandle,
                            hashObject->state.hashState[i].state.hashAlg))
-           // Update sequence object
-           CryptUpdateDigest(&hashObject->state.hashState[i], dataSize, data);
+           banks |= 1 << i;
    }
+   // Update sequence object
+   CryptUpdateDigests(HASH_COUNT, hashObject->state.hashState, banks, dataSize, data);
 
    return;
 }
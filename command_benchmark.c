@@ -0,0 +1,1360 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//
+//     In-process command benchmark. The program manufactures a TPM, starts it and runs canned command
+//     streams through ExecuteCommand(). For each command of each stream it prints one JSON object per line
+//     with the number of commands, the commands per second and the 50th and 99th percentile latencies, so
+//     that runs can be compared by scripts. The NV files of the TPM are created in the current directory.
+//
+//     Usage: command_benchmark [-n iterations] [stream...]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "InternalRoutines.h"
+#include "Platform.h"
+#include "ExecCommand_fp.h"
+#include "Manufacture_fp.h"
+#include "TpmInstance_fp.h"
+#include "_TPM_Init_fp.h"
+#include "GetCommandCodeString_fp.h"
+//
+//     The latencies of one command of a stream. A sample is one call of ExecuteCommand(), or of
+//     ExecuteCommandBatch() for batch commands.
+//
+typedef struct
+{
+    const char          *stream;
+    TPM_CC               commandCode;
+    UINT32               batch;             // commands per sample
+    UINT32               dataSize;          // bytes of data in each command, for throughput
+    UINT32               count;             // number of samples
+    UINT32               size;              // room in times
+    UINT32               errors;            // responses other than TPM_RC_SUCCESS
+    TPM_RC               firstError;
+    UINT64              *times;             // latency of each sample in ns
+} BENCH_RESULT;
+#define MAX_BENCH_RESULTS       128
+static BENCH_RESULT      s_results[MAX_BENCH_RESULTS];
+static UINT32            s_resultCount;
+static const char       *s_stream;          // the stream being run, NULL for setup
+static UINT32            s_dataSize;        // dataSize of the commands being run
+//
+//     A session for CommandExecute(): a password session with an empty password when handle is TPM_RS_PW,
+//     or an unbound and unsalted HMAC session started by StartHmacSession(). An HMAC session with XOR
+//     parameter encryption encrypts the first parameter of the commands, which must be a TPM2B.
+//
+typedef struct
+{
+    TPM_HANDLE           handle;
+    TPM2B_NONCE          nonceCaller;
+    TPM2B_NONCE          nonceTPM;
+    BOOL                 decrypt;
+} BENCH_SESSION;
+static BENCH_SESSION     s_password = {TPM_RS_PW};
+static BYTE              s_command[MAX_COMMAND_SIZE];
+static BYTE              s_encrypted[MAX_COMMAND_SIZE];
+//
+//     The objects and values that the streams share
+//
+#define BENCH_NV_INDEX          0x01500000
+#define BENCH_NV_SIZE           64
+#define BENCH_COUNTER_INDEX     0x01500001
+#define BENCH_BITS_INDEX        0x01500002
+#define BENCH_GROUP_BATCH       64
+#define BENCH_BATCH             16
+#define BENCH_PARAM_SIZE        1024
+static TPM_HANDLE        s_rsaParent;
+static TPM_HANDLE        s_eccParent;
+static BYTE              s_digest[SHA256_DIGEST_SIZE];
+//
+//
+//          Now()
+//
+//     This function returns a monotonic time in nanoseconds.
+//
+static UINT64
+Now(
+    void
+    )
+{
+    struct timespec      now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+//
+//
+//          Record()
+//
+//     This function adds a sample to the result of a command in the current stream. Nothing is recorded while
+//     s_stream is NULL, which a stream uses for the commands that set it up.
+//
+static void
+Record(
+    TPM_CC               commandCode,       // IN: command code
+    UINT32               batch,             // IN: commands in the sample
+    UINT64               time,              // IN: latency in ns
+    TPM_RC               rc                 // IN: response code, of the last command of a batch
+    )
+{
+    BENCH_RESULT        *result;
+    UINT32               i;
+    if(s_stream == NULL)
+        return;
+    for(i = 0; i < s_resultCount; i++)
+    {
+        result = &s_results[i];
+        if(   result->stream == s_stream && result->commandCode == commandCode
+           && result->batch == batch)
+            break;
+    }
+    if(i == s_resultCount)
+    {
+        if(s_resultCount == MAX_BENCH_RESULTS)
+            return;
+        result = &s_results[s_resultCount++];
+        result->stream = s_stream;
+        result->commandCode = commandCode;
+        result->batch = batch;
+        result->dataSize = s_dataSize;
+    }
+    if(result->count == result->size)
+    {
+        result->size = result->size == 0 ? 1024 : 2 * result->size;
+        result->times = realloc(result->times, result->size * sizeof(UINT64));
+        if(result->times == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    result->times[result->count++] = time;
+    if(rc != TPM_RC_SUCCESS && result->errors++ == 0)
+        result->firstError = rc;
+}
+//
+//
+//          SessionHmac()
+//
+//     This function computes the HMAC of an HMAC session for a command. The name of each handle is the handle,
+//     so the command may only have permanent and PCR handles, and their authValue must be empty.
+//
+static void
+SessionHmac(
+    BENCH_SESSION       *session,           // IN: the session
+    TPM_CC               commandCode,       // IN: command code
+    UINT32               handleCount,       // IN: number of handles
+    TPM_HANDLE          *handles,           // IN: the handles
+    BYTE                *params,            // IN: the parameters
+    UINT32               paramSize,         // IN: size of params
+    TPMA_SESSION         attributes,        // IN: session attributes
+    TPM2B_AUTH          *hmac               // OUT: the HMAC
+    )
+{
+    HASH_STATE           hashState;
+    HMAC_STATE           hmacState;
+    TPM2B_AUTH           key = {{0}};
+    BYTE                 cpHash[SHA256_DIGEST_SIZE];
+    BYTE                 marshaled[4];
+    BYTE                *buffer;
+    INT32                size;
+    UINT32               i;
+    // cpHash = H(commandCode || names || parameters)
+    CryptStartHash(TPM_ALG_SHA256, &hashState);
+    buffer = marshaled;
+    size = sizeof(marshaled);
+    TPM_CC_Marshal(&commandCode, &buffer, &size);
+    CryptUpdateDigest(&hashState, sizeof(marshaled), marshaled);
+    for(i = 0; i < handleCount; i++)
+    {
+        buffer = marshaled;
+        size = sizeof(marshaled);
+        TPM_HANDLE_Marshal(&handles[i], &buffer, &size);
+        CryptUpdateDigest(&hashState, sizeof(marshaled), marshaled);
+    }
+    CryptUpdateDigest(&hashState, paramSize, params);
+    CryptCompleteHash(&hashState, sizeof(cpHash), cpHash);
+    // HMAC(sessionKey || authValue, cpHash || nonceCaller || nonceTPM || attributes), with an empty key
+    CryptStartHMAC2B(TPM_ALG_SHA256, &key.b, &hmacState);
+    CryptUpdateDigest(&hmacState, sizeof(cpHash), cpHash);
+    CryptUpdateDigest2B(&hmacState, &session->nonceCaller.b);
+    CryptUpdateDigest2B(&hmacState, &session->nonceTPM.b);
+    CryptUpdateDigest(&hmacState, 1, (BYTE *)&attributes);
+    hmac->t.size = SHA256_DIGEST_SIZE;
+    CryptCompleteHMAC2B(&hmacState, &hmac->b);
+}
+//
+//
+//          CommandExecute()
+//
+//     This function marshals a command, executes it with ExecuteCommand() and records its latency. For an
+//     HMAC session, the nonce of the TPM is taken from the response, which may not have response handles.
+//     The first parameter is encrypted outside of the measured time.
+//
+//     Return Value                      Meaning
+//
+//     TPM_RC_SUCCESS                    the command succeeded
+//     other                             the response code of the command
+//
+static TPM_RC
+CommandExecute(
+    BENCH_SESSION       *session,           // IN/OUT: the session, or NULL for none
+    TPM_CC               commandCode,       // IN: command code
+    UINT32               handleCount,       // IN: number of handles
+    TPM_HANDLE          *handles,           // IN: the handles
+    BYTE                *params,            // IN: the parameters
+    UINT32               paramSize,         // IN: size of params
+    BYTE               **response,          // OUT: the response
+    UINT32              *responseSize       // OUT: size of the response
+    )
+{
+    TPM_ST               tag = session == NULL ? TPM_ST_NO_SESSIONS : TPM_ST_SESSIONS;
+    UINT32               commandSize = 0;
+    UINT32               authSize;
+    TPMA_SESSION         attributes = {0};
+    TPM2B_AUTH           hmac;
+    TPM2B_AUTH           key = {{0}};
+    BYTE                *buffer = s_command;
+    BYTE                *authSizeAt;
+    BYTE                *sessionAt;
+    INT32                size = sizeof(s_command);
+    INT32                fieldSize = sizeof(UINT32);
+    UINT64               start;
+    TPM_RC               rc;
+    UINT32               i;
+    TPM_ST_Marshal(&tag, &buffer, &size);
+    UINT32_Marshal(&commandSize, &buffer, &size);
+    TPM_CC_Marshal(&commandCode, &buffer, &size);
+    for(i = 0; i < handleCount; i++)
+        TPM_HANDLE_Marshal(&handles[i], &buffer, &size);
+    if(session != NULL)
+    {
+        hmac.t.size = 0;
+        if(session->handle != TPM_RS_PW)
+        {
+            attributes.continueSession = SET;
+            // A new nonce for each command
+            (*(UINT32 *)session->nonceCaller.t.buffer)++;
+            if(session->decrypt)
+            {
+                // XOR(parameter, SHA256, sessionKey || authValue, nonceCaller, nonceTPM),
+                // where both keys are empty
+                attributes.decrypt = SET;
+                MemoryCopy(s_encrypted, params, paramSize, sizeof(s_encrypted));
+                params = s_encrypted;
+                CryptXORObfuscation(TPM_ALG_SHA256, &key.b, &session->nonceCaller.b,
+                                    &session->nonceTPM.b, BYTE_ARRAY_TO_UINT16(params),
+                                    params + sizeof(UINT16));
+            }
+            SessionHmac(session, commandCode, handleCount, handles, params, paramSize,
+                        attributes, &hmac);
+        }
+        authSizeAt = buffer;
+        buffer += sizeof(UINT32);
+        size -= sizeof(UINT32);
+        authSize = TPM_HANDLE_Marshal(&session->handle, &buffer, &size);
+        authSize += TPM2B_NONCE_Marshal(&session->nonceCaller, &buffer, &size);
+        authSize += TPMA_SESSION_Marshal(&attributes, &buffer, &size);
+        authSize += TPM2B_AUTH_Marshal(&hmac, &buffer, &size);
+        UINT32_Marshal(&authSize, &authSizeAt, &fieldSize);
+    }
+    if(paramSize > 0)
+        MemoryCopy(buffer, params, paramSize, size);
+    buffer += paramSize;
+    commandSize = (UINT32)(buffer - s_command);
+    buffer = s_command + sizeof(TPM_ST);
+    fieldSize = sizeof(UINT32);
+    UINT32_Marshal(&commandSize, &buffer, &fieldSize);
+    start = Now();
+    ExecuteCommand(commandSize, s_command, responseSize, response);
+    rc = BYTE_ARRAY_TO_UINT32(*response + 6);
+    Record(commandCode, 1, Now() - start, rc);
+    if(rc == TPM_RC_SUCCESS && session != NULL && session->handle != TPM_RS_PW)
+    {
+        // header, parameterSize, parameters, then the nonce of the TPM
+        sessionAt = *response + 14 + BYTE_ARRAY_TO_UINT32(*response + 10);
+        size = *responseSize - (INT32)(sessionAt - *response);
+        TPM2B_NONCE_Unmarshal(&session->nonceTPM, &sessionAt, &size);
+    }
+    return rc;
+}
+//
+//
+//          StartHmacSession()
+//
+//     This function starts an unbound and unsalted HMAC session that uses SHA256, with XOR parameter
+//     encryption when decrypt is TRUE.
+//
+static TPM_RC
+StartHmacSession(
+    BENCH_SESSION       *session,           // OUT: the session
+    BOOL                 decrypt            // IN: TRUE to encrypt the first parameter
+    )
+{
+    TPM_HANDLE           handles[2] = {TPM_RH_NULL, TPM_RH_NULL};
+    TPM2B_ENCRYPTED_SECRET salt = {{0}};
+    TPM_SE               sessionType = TPM_SE_HMAC;
+    TPMT_SYM_DEF         symmetric = {TPM_ALG_NULL};
+    TPM_ALG_ID           authHash = TPM_ALG_SHA256;
+    BYTE                 params[BENCH_PARAM_SIZE];
+    BYTE                *buffer = params;
+    BYTE                *response;
+    UINT32               responseSize;
+    INT32                size = sizeof(params);
+    TPM_RC               rc;
+    MemorySet(session, 0, sizeof(*session));
+    session->nonceCaller.t.size = SHA256_DIGEST_SIZE;
+    if(decrypt)
+    {
+        symmetric.algorithm = TPM_ALG_XOR;
+        symmetric.keyBits.xor_ = TPM_ALG_SHA256;
+    }
+    TPM2B_NONCE_Marshal(&session->nonceCaller, &buffer, &size);
+    TPM2B_ENCRYPTED_SECRET_Marshal(&salt, &buffer, &size);
+    TPM_SE_Marshal(&sessionType, &buffer, &size);
+    TPMT_SYM_DEF_Marshal(&symmetric, &buffer, &size);
+    TPM_ALG_ID_Marshal(&authHash, &buffer, &size);
+    rc = CommandExecute(NULL, TPM_CC_StartAuthSession, 2, handles, params,
+                        (UINT32)(buffer - params), &response, &responseSize);
+    if(rc != TPM_RC_SUCCESS)
+        return rc;
+    session->handle = BYTE_ARRAY_TO_UINT32(response + 10);
+    buffer = response + 14;
+    size = responseSize - 14;
+    session->decrypt = decrypt;
+    return TPM2B_NONCE_Unmarshal(&session->nonceTPM, &buffer, &size);
+}
+//
+//
+//          FlushContext()
+//
+//     This function flushes a loaded object or session.
+//
+static TPM_RC
+FlushContext(
+    TPM_HANDLE           handle             // IN: the object or session
+    )
+{
+    BYTE                 params[4];
+    BYTE                *buffer = params;
+    INT32                size = sizeof(params);
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_HANDLE_Marshal(&handle, &buffer, &size);
+    return CommandExecute(NULL, TPM_CC_FlushContext, 0, NULL, params, sizeof(params),
+                          &response, &responseSize);
+}
+//
+//
+//          KeyTemplate()
+//
+//     This function fills the public area of a key: a restricted decryption key with AES128 CFB when
+//     storage is TRUE, or else a signing key with RSASSA or ECDSA and SHA256. A TPM_ALG_SYMCIPHER key is
+//     an AES128 CFB key that is not restricted, so that TPM2_EncryptDecrypt() may use it in any mode.
+//
+static void
+KeyTemplate(
+    TPM_ALG_ID           type,              // IN: TPM_ALG_RSA, TPM_ALG_ECC or TPM_ALG_SYMCIPHER
+    BOOL                 storage,           // IN: storage or signing key
+    TPM2B_PUBLIC        *key                // OUT: the public area
+    )
+{
+    TPMT_PUBLIC         *area = &key->t.publicArea;
+    TPMT_SYM_DEF_OBJECT  symmetric = {TPM_ALG_NULL};
+    MemorySet(key, 0, sizeof(*key));
+    area->type = type;
+    area->nameAlg = TPM_ALG_SHA256;
+    area->objectAttributes.fixedTPM = SET;
+    area->objectAttributes.fixedParent = SET;
+    area->objectAttributes.sensitiveDataOrigin = SET;
+    area->objectAttributes.userWithAuth = SET;
+    area->objectAttributes.noDA = SET;
+    if(storage)
+    {
+        area->objectAttributes.restricted = SET;
+        area->objectAttributes.decrypt = SET;
+        symmetric.algorithm = TPM_ALG_AES;
+        symmetric.keyBits.aes = 128;
+        symmetric.mode.aes = TPM_ALG_CFB;
+    }
+    else
+        area->objectAttributes.sign = SET;
+    if(type == TPM_ALG_SYMCIPHER)
+    {
+        // A symmetric key decrypts and may not sign
+        area->objectAttributes.sign = CLEAR;
+        area->objectAttributes.decrypt = SET;
+        area->parameters.symDetail.sym.algorithm = TPM_ALG_AES;
+        area->parameters.symDetail.sym.keyBits.aes = 128;
+        area->parameters.symDetail.sym.mode.aes = TPM_ALG_CFB;
+    }
+    else if(type == TPM_ALG_RSA)
+    {
+        area->parameters.rsaDetail.symmetric = symmetric;
+        area->parameters.rsaDetail.scheme.scheme = storage ? TPM_ALG_NULL : TPM_ALG_RSASSA;
+        area->parameters.rsaDetail.scheme.details.rsassa.hashAlg = TPM_ALG_SHA256;
+        area->parameters.rsaDetail.keyBits = 2048;
+    }
+    else
+    {
+        area->parameters.eccDetail.symmetric = symmetric;
+        area->parameters.eccDetail.scheme.scheme = storage ? TPM_ALG_NULL : TPM_ALG_ECDSA;
+        area->parameters.eccDetail.scheme.details.ecdsa.hashAlg = TPM_ALG_SHA256;
+        area->parameters.eccDetail.curveID = TPM_ECC_NIST_P256;
+        area->parameters.eccDetail.kdf.scheme = TPM_ALG_NULL;
+    }
+}
+//
+//
+//          CreateParams()
+//
+//     This function marshals the parameters shared by TPM2_CreatePrimary() and TPM2_Create(): an empty
+//     sensitive area, the public area of the key, no outside info and no creation PCR.
+//
+static UINT32
+CreateParams(
+    TPM_ALG_ID           type,              // IN: TPM_ALG_RSA, TPM_ALG_ECC or TPM_ALG_SYMCIPHER
+    BOOL                 storage,           // IN: storage or signing key
+    BYTE                *params             // OUT: the parameters, BENCH_PARAM_SIZE bytes
+    )
+{
+    TPM2B_SENSITIVE_CREATE sensitive;
+    TPM2B_PUBLIC         key;
+    TPM2B_DATA           outsideInfo = {{0}};
+    TPML_PCR_SELECTION   creationPCR = {0};
+    BYTE                *buffer = params;
+    INT32                size = BENCH_PARAM_SIZE;
+    MemorySet(&sensitive, 0, sizeof(sensitive));
+    KeyTemplate(type, storage, &key);
+    TPM2B_SENSITIVE_CREATE_Marshal(&sensitive, &buffer, &size);
+    TPM2B_PUBLIC_Marshal(&key, &buffer, &size);
+    TPM2B_DATA_Marshal(&outsideInfo, &buffer, &size);
+    TPML_PCR_SELECTION_Marshal(&creationPCR, &buffer, &size);
+    return (UINT32)(buffer - params);
+}
+//
+//
+//          CreatePrimary()
+//
+//     This function creates a primary storage key in the owner hierarchy.
+//
+static TPM_RC
+CreatePrimary(
+    TPM_ALG_ID           type,              // IN: TPM_ALG_RSA or TPM_ALG_ECC
+    TPM_HANDLE          *handle             // OUT: the key
+    )
+{
+    TPM_HANDLE           hierarchy = TPM_RH_OWNER;
+    BYTE                 params[BENCH_PARAM_SIZE];
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    rc = CommandExecute(&s_password, TPM_CC_CreatePrimary, 1, &hierarchy, params,
+                        CreateParams(type, TRUE, params), &response, &responseSize);
+    if(rc == TPM_RC_SUCCESS)
+        *handle = BYTE_ARRAY_TO_UINT32(response + 10);
+    return rc;
+}
+//
+//
+//          PcrExtendParams()
+//
+//     This function marshals the parameters of TPM2_PCR_Extend() with a SHA256 digest.
+//
+static UINT32
+PcrExtendParams(
+    BYTE                *params             // OUT: the parameters, BENCH_PARAM_SIZE bytes
+    )
+{
+    TPML_DIGEST_VALUES   digests;
+    BYTE                *buffer = params;
+    INT32                size = BENCH_PARAM_SIZE;
+    digests.count = 1;
+    digests.digests[0].hashAlg = TPM_ALG_SHA256;
+    MemoryCopy(digests.digests[0].digest.sha256, s_digest, sizeof(s_digest),
+               sizeof(digests.digests[0].digest.sha256));
+    TPML_DIGEST_VALUES_Marshal(&digests, &buffer, &size);
+    return (UINT32)(buffer - params);
+}
+//
+//
+//          Streams
+//
+//     Each stream runs its commands iterations times. The commands that a stream needs to set up are
+//     recorded with it.
+//
+static TPM_RC
+StreamPcrExtend(
+    UINT32               iterations
+    )
+{
+    TPM_HANDLE           pcr = 16;
+    BYTE                 params[BENCH_PARAM_SIZE];
+    UINT32               paramSize = PcrExtendParams(params);
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc = TPM_RC_SUCCESS;
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+        rc = CommandExecute(&s_password, TPM_CC_PCR_Extend, 1, &pcr, params, paramSize,
+                            &response, &responseSize);
+    return rc;
+}
+static TPM_RC
+StreamGetRandom(
+    UINT32               iterations
+    )
+{
+    BYTE                 params[2] = {0, SHA256_DIGEST_SIZE};
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc = TPM_RC_SUCCESS;
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+        rc = CommandExecute(NULL, TPM_CC_GetRandom, 0, NULL, params, sizeof(params),
+                            &response, &responseSize);
+    return rc;
+}
+static TPM_RC
+StreamHmacSession(
+    UINT32               iterations
+    )
+{
+    BENCH_SESSION        session;
+    TPM_HANDLE           pcr = 16;
+    BYTE                 params[BENCH_PARAM_SIZE];
+    UINT32               paramSize = PcrExtendParams(params);
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    rc = StartHmacSession(&session, FALSE);
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+        rc = CommandExecute(&session, TPM_CC_PCR_Extend, 1, &pcr, params, paramSize,
+                            &response, &responseSize);
+    if(session.handle != 0)
+        FlushContext(session.handle);
+    return rc;
+}
+static TPM_RC
+StreamParamXor(
+    UINT32               iterations
+    )
+{
+    BENCH_SESSION        session;
+    TPM_HANDLE           pcr = 16;
+    TPM2B_EVENT          event;
+    BYTE                 params[BENCH_PARAM_SIZE + sizeof(event)];
+    BYTE                *buffer = params;
+    INT32                size = sizeof(params);
+    UINT32               paramSize;
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    // PCR_Event with an event of 1 KB, which the TPM decrypts with the XOR mask
+    event.t.size = sizeof(event.t.buffer);
+    MemorySet(event.t.buffer, 0x5a, event.t.size);
+    paramSize = TPM2B_EVENT_Marshal(&event, &buffer, &size);
+    rc = StartHmacSession(&session, TRUE);
+    s_dataSize = event.t.size;
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+        rc = CommandExecute(&session, TPM_CC_PCR_Event, 1, &pcr, params, paramSize,
+                            &response, &responseSize);
+    s_dataSize = 0;
+    if(session.handle != 0)
+        FlushContext(session.handle);
+    return rc;
+}
+//
+//     NvDefine() defines an index of the NV streams with an empty authValue. attributes gives the type of the
+//     index; the authorization attributes are added.
+//
+static TPM_RC
+NvDefine(
+    TPM_HANDLE           nvIndex,
+    TPMA_NV              attributes,
+    UINT16               dataSize
+    )
+{
+    TPM_HANDLE           hierarchy = TPM_RH_OWNER;
+    TPM2B_AUTH           auth = {{0}};
+    TPM2B_NV_PUBLIC      nvPublic;
+    BYTE                 params[BENCH_PARAM_SIZE];
+    BYTE                *buffer = params;
+    INT32                size = sizeof(params);
+    BYTE                *response;
+    UINT32               responseSize;
+    MemorySet(&nvPublic, 0, sizeof(nvPublic));
+    nvPublic.t.nvPublic.nvIndex = nvIndex;
+    nvPublic.t.nvPublic.nameAlg = TPM_ALG_SHA256;
+    nvPublic.t.nvPublic.attributes = attributes;
+    nvPublic.t.nvPublic.attributes.TPMA_NV_AUTHWRITE = SET;
+    nvPublic.t.nvPublic.attributes.TPMA_NV_AUTHREAD = SET;
+    nvPublic.t.nvPublic.attributes.TPMA_NV_NO_DA = SET;
+    nvPublic.t.nvPublic.dataSize = dataSize;
+    TPM2B_AUTH_Marshal(&auth, &buffer, &size);
+    TPM2B_NV_PUBLIC_Marshal(&nvPublic, &buffer, &size);
+    return CommandExecute(&s_password, TPM_CC_NV_DefineSpace, 1, &hierarchy, params,
+                          (UINT32)(buffer - params), &response, &responseSize);
+}
+static TPM_RC
+NvUndefine(
+    TPM_HANDLE           nvIndex
+    )
+{
+    TPM_HANDLE           handles[2] = {TPM_RH_OWNER, nvIndex};
+    BYTE                *response;
+    UINT32               responseSize;
+    return CommandExecute(&s_password, TPM_CC_NV_UndefineSpace, 2, handles, NULL, 0,
+                          &response, &responseSize);
+}
+//
+//     NvWriteParams() marshals the parameters of TPM2_NV_Write() for dataSize bytes at offset 0.
+//
+static UINT32
+NvWriteParams(
+    UINT32               iteration,
+    UINT16               dataSize,
+    BYTE                *params
+    )
+{
+    TPM2B_MAX_NV_BUFFER  data;
+    UINT16               offset = 0;
+    BYTE                *buffer = params;
+    INT32                size = BENCH_PARAM_SIZE;
+    data.t.size = dataSize;
+    MemorySet(data.t.buffer, (BYTE)iteration, data.t.size);
+    TPM2B_MAX_NV_BUFFER_Marshal(&data, &buffer, &size);
+    UINT16_Marshal(&offset, &buffer, &size);
+    return (UINT32)(buffer - params);
+}
+static TPM_RC
+StreamNv(
+    UINT32               iterations
+    )
+{
+    TPM_HANDLE           handles[2] = {BENCH_NV_INDEX, BENCH_NV_INDEX};
+    BYTE                 params[BENCH_PARAM_SIZE];
+    UINT32               paramSize;
+    BYTE                 readParams[4] = {0, BENCH_NV_SIZE / 2, 0, 0};
+    BYTE                *response;
+    UINT32               responseSize;
+    TPMA_NV              attributes = {0};
+    TPM_RC               rc;
+    rc = NvDefine(BENCH_NV_INDEX, attributes, BENCH_NV_SIZE);
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+    {
+        paramSize = NvWriteParams(iterations, BENCH_NV_SIZE / 2, params);
+        rc = CommandExecute(&s_password, TPM_CC_NV_Write, 2, handles, params, paramSize,
+                            &response, &responseSize);
+        if(rc == TPM_RC_SUCCESS)
+            rc = CommandExecute(&s_password, TPM_CC_NV_Read, 2, handles, readParams,
+                                sizeof(readParams), &response, &responseSize);
+    }
+    NvUndefine(BENCH_NV_INDEX);
+    return rc;
+}
+static TPM_RC
+StreamNvDefine(
+    UINT32               iterations
+    )
+{
+    TPMA_NV              attributes = {0};
+    TPM_RC               rc = TPM_RC_SUCCESS;
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+    {
+        rc = NvDefine(BENCH_NV_INDEX, attributes, BENCH_NV_SIZE);
+        if(rc == TPM_RC_SUCCESS)
+            rc = NvUndefine(BENCH_NV_INDEX);
+    }
+    return rc;
+}
+//
+//     StreamNvBatch() writes the index with ExecuteCommandBatch(), BENCH_BATCH commands at a time, and
+//     records each batch as one sample.
+//
+static TPM_RC
+StreamNvBatch(
+    UINT32               iterations
+    )
+{
+    static BYTE          commands[BENCH_BATCH][256];
+    static BYTE          responses[BENCH_BATCH * MAX_RESPONSE_SIZE];
+    BATCH_COMMAND        batch[BENCH_BATCH];
+    TPM_HANDLE           handles[2] = {BENCH_NV_INDEX, BENCH_NV_INDEX};
+    BYTE                 params[BENCH_PARAM_SIZE];
+    BYTE                *response;
+    UINT32               responseSize;
+    UINT64               start;
+    TPMA_NV              attributes = {0};
+    TPM_RC               rc;
+    UINT32               i;
+    rc = NvDefine(BENCH_NV_INDEX, attributes, BENCH_NV_SIZE);
+    for(i = 0; i < BENCH_BATCH && rc == TPM_RC_SUCCESS; i++)
+    {
+        // Marshal each command once, through CommandExecute(), and keep it
+        rc = CommandExecute(&s_password, TPM_CC_NV_Write, 2, handles, params,
+                            NvWriteParams(i, BENCH_NV_SIZE / 2, params), &response,
+                            &responseSize);
+        batch[i].requestSize = BYTE_ARRAY_TO_UINT32(s_command + 2);
+        batch[i].request = commands[i];
+        MemoryCopy(commands[i], s_command, batch[i].requestSize, sizeof(commands[i]));
+    }
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+    {
+        start = Now();
+        ExecuteCommandBatch(BENCH_BATCH, batch, sizeof(responses), responses);
+        rc = BYTE_ARRAY_TO_UINT32(batch[BENCH_BATCH - 1].response + 6);
+        Record(TPM_CC_NV_Write, BENCH_BATCH, Now() - start, rc);
+    }
+    NvUndefine(BENCH_NV_INDEX);
+    return rc;
+}
+//
+//     The NV sweeps define up to BENCH_SWEEP_COUNT indices of BENCH_SWEEP_SIZE bytes, as many as fit in NV.
+//
+#define BENCH_SWEEP_INDEX       0x01510000
+#define BENCH_SWEEP_SIZE        8
+#define BENCH_SWEEP_COUNT       1024
+//
+//     NvDefineSweep() defines the sweep indices from defined up to count without recording the commands. It
+//     returns the number of indices then defined, which is less than count when NV is full.
+//
+static UINT32
+NvDefineSweep(
+    UINT32               defined,
+    UINT32               count
+    )
+{
+    const char          *stream = s_stream;
+    TPMA_NV              attributes = {0};
+    s_stream = NULL;
+    for(; defined < count; defined++)
+    {
+        if(NvDefine(BENCH_SWEEP_INDEX + defined, attributes, BENCH_SWEEP_SIZE)
+           != TPM_RC_SUCCESS)
+            break;
+    }
+    s_stream = stream;
+    return defined;
+}
+static void
+NvUndefineSweep(
+    UINT32               defined
+    )
+{
+    const char          *stream = s_stream;
+    s_stream = NULL;
+    while(defined-- > 0)
+        NvUndefine(BENCH_SWEEP_INDEX + defined);
+    s_stream = stream;
+}
+//
+//     StreamNvLookup() defines more and more sweep indices and, at each step, reads the index defined last.
+//     The reads of a step are recorded as stream nv_lookup_<indices>, so that the latency of TPM2_NV_Read()
+//     can be compared against the number of defined indices. The sweep ends when NV is full.
+//
+static TPM_RC
+StreamNvLookup(
+    UINT32               iterations
+    )
+{
+    static const UINT32  counts[] = {1, 16, 64, 256, BENCH_SWEEP_COUNT};
+    static char          names[sizeof(counts) / sizeof(counts[0])][32];
+    const char          *stream = s_stream;
+    TPM_HANDLE           handles[2];
+    BYTE                 params[BENCH_PARAM_SIZE];
+    BYTE                 readParams[4] = {0, BENCH_SWEEP_SIZE, 0, 0};
+    BYTE                *response;
+    UINT32               responseSize;
+    UINT32               defined = 0;
+    UINT32               count;
+    UINT32               step;
+    UINT32               i;
+    TPM_RC               rc = TPM_RC_SUCCESS;
+    for(step = 0; step < sizeof(counts) / sizeof(counts[0]); step++)
+    {
+        count = NvDefineSweep(defined, counts[step]);
+        if(count == defined)
+            break;
+        defined = count;
+        handles[0] = handles[1] = BENCH_SWEEP_INDEX + defined - 1;
+        // The index has to be written before it can be read
+        s_stream = NULL;
+        rc = CommandExecute(&s_password, TPM_CC_NV_Write, 2, handles, params,
+                            NvWriteParams(step, BENCH_SWEEP_SIZE, params), &response,
+                            &responseSize);
+        snprintf(names[step], sizeof(names[step]), "%s_%u", stream, defined);
+        s_stream = names[step];
+        for(i = 0; i < iterations && rc == TPM_RC_SUCCESS; i++)
+            rc = CommandExecute(&s_password, TPM_CC_NV_Read, 2, handles, readParams,
+                                sizeof(readParams), &response, &responseSize);
+        s_stream = stream;
+        if(rc != TPM_RC_SUCCESS || defined < counts[step])
+            break;
+    }
+    NvUndefineSweep(defined);
+    return rc;
+}
+//
+//     StreamNvClear() defines as many sweep indices as fit in NV and removes them all with TPM2_Clear(), which
+//     flushes the owner hierarchy from NV in one pass. Each TPM2_Clear() is recorded as stream
+//     nv_clear_<indices>. TPM2_Clear() also flushes the primary keys of the key streams, so they are created
+//     again.
+//
+static TPM_RC
+StreamNvClear(
+    UINT32               iterations
+    )
+{
+    static char          name[32];
+    const char          *stream = s_stream;
+    TPM_HANDLE           lockout = TPM_RH_LOCKOUT;
+    BYTE                *response;
+    UINT32               responseSize;
+    UINT32               defined;
+    TPM_RC               rc = TPM_RC_SUCCESS;
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+    {
+        defined = NvDefineSweep(0, BENCH_SWEEP_COUNT);
+        snprintf(name, sizeof(name), "%s_%u", stream, defined);
+        s_stream = name;
+        rc = CommandExecute(&s_password, TPM_CC_Clear, 1, &lockout, NULL, 0,
+                            &response, &responseSize);
+        s_stream = stream;
+    }
+    s_stream = NULL;
+    if(rc == TPM_RC_SUCCESS)
+        rc = CreatePrimary(TPM_ALG_RSA, &s_rsaParent);
+    if(rc == TPM_RC_SUCCESS)
+        rc = CreatePrimary(TPM_ALG_ECC, &s_eccParent);
+    s_stream = stream;
+    return rc;
+}
+//
+//     StreamNvCounter() runs TPM2_NV_Increment() on a counter index and TPM2_NV_SetBits() on a bit field
+//     index. Neither index is orderly, so each command commits NV. Each TPM2_NV_SetBits() sets a new bit;
+//     the bit field is defined again once all of its bits are set.
+//
+static TPM_RC
+StreamNvCounter(
+    UINT32               iterations
+    )
+{
+    TPM_HANDLE           counter[2] = {BENCH_COUNTER_INDEX, BENCH_COUNTER_INDEX};
+    TPM_HANDLE           bits[2] = {BENCH_BITS_INDEX, BENCH_BITS_INDEX};
+    const char          *stream = s_stream;
+    TPMA_NV              attributes = {0};
+    BYTE                 params[sizeof(UINT64)];
+    BYTE                *buffer;
+    INT32                size;
+    UINT64               value;
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    UINT32               i;
+    attributes.TPMA_NV_COUNTER = SET;
+    rc = NvDefine(BENCH_COUNTER_INDEX, attributes, sizeof(UINT64));
+    attributes.TPMA_NV_COUNTER = CLEAR;
+    attributes.TPMA_NV_BITS = SET;
+    if(rc == TPM_RC_SUCCESS)
+        rc = NvDefine(BENCH_BITS_INDEX, attributes, sizeof(UINT64));
+    for(i = 0; i < iterations && rc == TPM_RC_SUCCESS; i++)
+    {
+        rc = CommandExecute(&s_password, TPM_CC_NV_Increment, 2, counter, NULL, 0,
+                            &response, &responseSize);
+        if(i % 64 == 0 && i != 0 && rc == TPM_RC_SUCCESS)
+        {
+            s_stream = NULL;
+            NvUndefine(BENCH_BITS_INDEX);
+            rc = NvDefine(BENCH_BITS_INDEX, attributes, sizeof(UINT64));
+            s_stream = stream;
+        }
+        value = (UINT64)1 << (i % 64);
+        buffer = params;
+        size = sizeof(params);
+        UINT64_Marshal(&value, &buffer, &size);
+        if(rc == TPM_RC_SUCCESS)
+            rc = CommandExecute(&s_password, TPM_CC_NV_SetBits, 2, bits, params,
+                                sizeof(params), &response, &responseSize);
+    }
+    NvUndefine(BENCH_BITS_INDEX);
+    NvUndefine(BENCH_COUNTER_INDEX);
+    return rc;
+}
+#ifndef EMBEDDED_MODE
+//
+//     StreamNvCounterGroup() runs StreamNvCounter() in the group commit mode of the NV journal, with a
+//     checkpoint every BENCH_GROUP_BATCH commits and no durability window, to compare with the nv_counter
+//     stream.
+//
+static TPM_RC
+StreamNvCounterGroup(
+    UINT32               iterations
+    )
+{
+    TPM_RC               rc;
+    _plat__NvSetGroupCommit(BENCH_GROUP_BATCH, 0);
+    rc = StreamNvCounter(iterations);
+    _plat__NvSetGroupCommit(0, 0);
+    return rc;
+}
+#endif
+//
+//     StreamKey() creates a signing key under parent, then loads it, signs a digest with it and flushes it.
+//
+static TPM_RC
+StreamKey(
+    TPM_ALG_ID           type,
+    TPM_HANDLE           parent,
+    UINT32               iterations
+    )
+{
+    static BYTE          blobs[2 * sizeof(TPM2B_PUBLIC) + sizeof(TPM2B_PRIVATE)];
+    UINT32               blobSize;
+    TPM_HANDLE           key;
+    TPMT_SIG_SCHEME      scheme = {TPM_ALG_NULL};
+    TPMT_TK_HASHCHECK    validation = {TPM_ST_HASHCHECK, TPM_RH_NULL};
+    TPM2B_DIGEST         digest;
+    BYTE                 params[BENCH_PARAM_SIZE];
+    BYTE                *buffer;
+    INT32                size;
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc = TPM_RC_SUCCESS;
+    digest.t.size = sizeof(s_digest);
+    MemoryCopy(digest.t.buffer, s_digest, sizeof(s_digest), sizeof(digest.t.buffer));
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+    {
+        rc = CommandExecute(&s_password, TPM_CC_Create, 1, &parent, params,
+                            CreateParams(type, FALSE, params), &response, &responseSize);
+        if(rc != TPM_RC_SUCCESS)
+            break;
+        // outPrivate and outPublic follow the parameter size
+        blobSize = 2 + BYTE_ARRAY_TO_UINT16(response + 14);
+        blobSize += 2 + BYTE_ARRAY_TO_UINT16(response + 14 + blobSize);
+        MemoryCopy(blobs, response + 14, blobSize, sizeof(blobs));
+        rc = CommandExecute(&s_password, TPM_CC_Load, 1, &parent, blobs, blobSize,
+                            &response, &responseSize);
+        if(rc != TPM_RC_SUCCESS)
+            break;
+        key = BYTE_ARRAY_TO_UINT32(response + 10);
+        buffer = params;
+        size = sizeof(params);
+        TPM2B_DIGEST_Marshal(&digest, &buffer, &size);
+        TPMT_SIG_SCHEME_Marshal(&scheme, &buffer, &size);
+        TPMT_TK_HASHCHECK_Marshal(&validation, &buffer, &size);
+        rc = CommandExecute(&s_password, TPM_CC_Sign, 1, &key, params,
+                            (UINT32)(buffer - params), &response, &responseSize);
+        FlushContext(key);
+    }
+    return rc;
+}
+static TPM_RC
+StreamRsa(
+    UINT32               iterations
+    )
+{
+    return StreamKey(TPM_ALG_RSA, s_rsaParent, iterations);
+}
+static TPM_RC
+StreamEcc(
+    UINT32               iterations
+    )
+{
+    return StreamKey(TPM_ALG_ECC, s_eccParent, iterations);
+}
+//
+//     StreamContext() saves the ECC storage key and loads the saved context, then flushes the copy.
+//
+static TPM_RC
+StreamContext(
+    UINT32               iterations
+    )
+{
+    static BYTE          context[sizeof(TPMS_CONTEXT)];
+    UINT32               contextSize;
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc = TPM_RC_SUCCESS;
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+    {
+        rc = CommandExecute(NULL, TPM_CC_ContextSave, 1, &s_eccParent, NULL, 0,
+                            &response, &responseSize);
+        if(rc != TPM_RC_SUCCESS)
+            break;
+        contextSize = responseSize - 10;
+        MemoryCopy(context, response + 10, contextSize, sizeof(context));
+        rc = CommandExecute(NULL, TPM_CC_ContextLoad, 0, NULL, context, contextSize,
+                            &response, &responseSize);
+        if(rc == TPM_RC_SUCCESS)
+            FlushContext(BYTE_ARRAY_TO_UINT32(response + 10));
+    }
+    return rc;
+}
+//
+//     StreamSymmetric() creates and loads an AES128 key under the RSA storage key and encrypts or decrypts
+//     MAX_DIGEST_BUFFER bytes with it in mode, iterations times, so that the EncryptDecrypt() results give
+//     the throughput of the mode.
+//
+static TPM_RC
+StreamSymmetric(
+    TPMI_ALG_SYM_MODE    mode,
+    TPMI_YES_NO          decrypt,
+    UINT32               iterations
+    )
+{
+    static TPM2B_MAX_BUFFER data;
+    static BYTE          blobs[2 * sizeof(TPM2B_PUBLIC) + sizeof(TPM2B_PRIVATE)];
+    UINT32               blobSize;
+    TPM_HANDLE           key;
+    TPM2B_IV             iv = {{0}};
+    BYTE                 params[BENCH_PARAM_SIZE + sizeof(data)];
+    BYTE                *buffer;
+    INT32                size;
+    UINT32               paramSize;
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    rc = CommandExecute(&s_password, TPM_CC_Create, 1, &s_rsaParent, params,
+                        CreateParams(TPM_ALG_SYMCIPHER, FALSE, params), &response,
+                        &responseSize);
+    if(rc != TPM_RC_SUCCESS)
+        return rc;
+    // outPrivate and outPublic follow the parameter size
+    blobSize = 2 + BYTE_ARRAY_TO_UINT16(response + 14);
+    blobSize += 2 + BYTE_ARRAY_TO_UINT16(response + 14 + blobSize);
+    MemoryCopy(blobs, response + 14, blobSize, sizeof(blobs));
+    rc = CommandExecute(&s_password, TPM_CC_Load, 1, &s_rsaParent, blobs, blobSize,
+                        &response, &responseSize);
+    if(rc != TPM_RC_SUCCESS)
+        return rc;
+    key = BYTE_ARRAY_TO_UINT32(response + 10);
+    // ECB takes no IV
+    if(mode != TPM_ALG_ECB)
+        iv.t.size = 16;
+    data.t.size = MAX_DIGEST_BUFFER;
+    MemorySet(data.t.buffer, 0x5a, data.t.size);
+    buffer = params;
+    size = sizeof(params);
+    paramSize = TPMI_YES_NO_Marshal(&decrypt, &buffer, &size);
+    paramSize += TPMI_ALG_SYM_MODE_Marshal(&mode, &buffer, &size);
+    paramSize += TPM2B_IV_Marshal(&iv, &buffer, &size);
+    paramSize += TPM2B_MAX_BUFFER_Marshal(&data, &buffer, &size);
+    s_dataSize = data.t.size;
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+        rc = CommandExecute(&s_password, TPM_CC_EncryptDecrypt, 1, &key, params, paramSize,
+                            &response, &responseSize);
+    s_dataSize = 0;
+    FlushContext(key);
+    return rc;
+}
+static TPM_RC
+StreamAesCfb(
+    UINT32               iterations
+    )
+{
+    return StreamSymmetric(TPM_ALG_CFB, NO, iterations);
+}
+static TPM_RC
+StreamAesCtr(
+    UINT32               iterations
+    )
+{
+    return StreamSymmetric(TPM_ALG_CTR, NO, iterations);
+}
+static TPM_RC
+StreamAesOfb(
+    UINT32               iterations
+    )
+{
+    return StreamSymmetric(TPM_ALG_OFB, NO, iterations);
+}
+static TPM_RC
+StreamAesCbc(
+    UINT32               iterations
+    )
+{
+    return StreamSymmetric(TPM_ALG_CBC, NO, iterations);
+}
+static TPM_RC
+StreamAesCbcDecrypt(
+    UINT32               iterations
+    )
+{
+    return StreamSymmetric(TPM_ALG_CBC, YES, iterations);
+}
+static TPM_RC
+StreamAesEcb(
+    UINT32               iterations
+    )
+{
+    return StreamSymmetric(TPM_ALG_ECB, NO, iterations);
+}
+//
+//     StreamHash() hashes iterations blocks of MAX_DIGEST_BUFFER bytes in a hash sequence, so that the
+//     SequenceUpdate() results give the throughput of the hash. With TPM_ALG_NULL, the sequence is an event
+//     sequence that hashes the data in every bank; it is flushed rather than completed.
+//
+static TPM_RC
+StreamHash(
+    TPM_ALG_ID           hashAlg,
+    UINT32               iterations
+    )
+{
+    static TPM2B_MAX_BUFFER data;
+    TPM2B_AUTH           auth = {{0}};
+    TPM2B_MAX_BUFFER     last = {{0}};
+    TPMI_RH_HIERARCHY    hierarchy = TPM_RH_NULL;
+    TPM_HANDLE           sequence;
+    BYTE                 params[BENCH_PARAM_SIZE + sizeof(data)];
+    BYTE                *buffer = params;
+    INT32                size = sizeof(params);
+    UINT32               paramSize;
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    TPM2B_AUTH_Marshal(&auth, &buffer, &size);
+    TPM_ALG_ID_Marshal(&hashAlg, &buffer, &size);
+    rc = CommandExecute(NULL, TPM_CC_HashSequenceStart, 0, NULL, params,
+                        (UINT32)(buffer - params), &response, &responseSize);
+    if(rc != TPM_RC_SUCCESS)
+        return rc;
+    sequence = BYTE_ARRAY_TO_UINT32(response + 10);
+    data.t.size = MAX_DIGEST_BUFFER;
+    MemorySet(data.t.buffer, 0x5a, data.t.size);
+    buffer = params;
+    size = sizeof(params);
+    paramSize = TPM2B_MAX_BUFFER_Marshal(&data, &buffer, &size);
+    s_dataSize = data.t.size;
+    while(iterations-- > 0 && rc == TPM_RC_SUCCESS)
+        rc = CommandExecute(&s_password, TPM_CC_SequenceUpdate, 1, &sequence, params, paramSize,
+                            &response, &responseSize);
+    s_dataSize = 0;
+    buffer = params;
+    size = sizeof(params);
+    TPM2B_MAX_BUFFER_Marshal(&last, &buffer, &size);
+    TPMI_RH_HIERARCHY_Marshal(&hierarchy, &buffer, &size);
+    if(rc == TPM_RC_SUCCESS && hashAlg != TPM_ALG_NULL)
+        rc = CommandExecute(&s_password, TPM_CC_SequenceComplete, 1, &sequence, params,
+                            (UINT32)(buffer - params), &response, &responseSize);
+    else
+        FlushContext(sequence);
+    return rc;
+}
+static TPM_RC
+StreamHashSha1(
+    UINT32               iterations
+    )
+{
+    return StreamHash(TPM_ALG_SHA1, iterations);
+}
+static TPM_RC
+StreamHashSha256(
+    UINT32               iterations
+    )
+{
+    return StreamHash(TPM_ALG_SHA256, iterations);
+}
+#ifdef TPM_ALG_SHA384
+static TPM_RC
+StreamHashSha384(
+    UINT32               iterations
+    )
+{
+    return StreamHash(TPM_ALG_SHA384, iterations);
+}
+#endif
+static TPM_RC
+StreamEventSequence(
+    UINT32               iterations
+    )
+{
+    return StreamHash(TPM_ALG_NULL, iterations);
+}
+#ifdef TPM_ALG_SHA512
+static TPM_RC
+StreamHashSha512(
+    UINT32               iterations
+    )
+{
+    return StreamHash(TPM_ALG_SHA512, iterations);
+}
+#endif
+//
+//     The streams and their default number of iterations
+//
+typedef struct
+{
+    const char          *name;
+    TPM_RC             (*run)(UINT32 iterations);
+    UINT32               iterations;
+} BENCH_STREAM;
+static const BENCH_STREAM s_streams[] =
+{
+    {"pcr_extend",      StreamPcrExtend,    10000},
+    {"get_random",      StreamGetRandom,    10000},
+    {"hmac_session",    StreamHmacSession,  10000},
+    {"param_xor",       StreamParamXor,     10000},
+    {"nv",              StreamNv,           1000},
+    {"nv_define",       StreamNvDefine,     1000},
+    {"nv_batch",        StreamNvBatch,      100},
+    {"nv_lookup",       StreamNvLookup,     1000},
+    {"nv_clear",        StreamNvClear,      10},
+    {"nv_counter",      StreamNvCounter,    1000},
+#ifndef EMBEDDED_MODE
+    {"nv_counter_group", StreamNvCounterGroup, 1000},
+#endif
+    {"rsa",             StreamRsa,          10},
+    {"ecc",             StreamEcc,          100},
+    {"context",         StreamContext,      1000},
+    {"hash_sha1",       StreamHashSha1,     10000},
+    {"hash_sha256",     StreamHashSha256,   10000},
+#ifdef TPM_ALG_SHA384
+    {"hash_sha384",     StreamHashSha384,   10000},
+#endif
+#ifdef TPM_ALG_SHA512
+    {"hash_sha512",     StreamHashSha512,   10000},
+#endif
+    {"event_sequence",  StreamEventSequence, 10000},
+    {"aes_cfb",         StreamAesCfb,       10000},
+    {"aes_ctr",         StreamAesCtr,       10000},
+    {"aes_ofb",         StreamAesOfb,       10000},
+    {"aes_cbc",         StreamAesCbc,       10000},
+    {"aes_cbc_decrypt", StreamAesCbcDecrypt, 10000},
+    {"aes_ecb",         StreamAesEcb,       10000},
+};
+#define STREAM_COUNT    (sizeof(s_streams) / sizeof(s_streams[0]))
+//
+//
+//          CompareTimes()
+//
+//     qsort() comparison of two latencies
+//
+static int
+CompareTimes(
+    const void          *a,
+    const void          *b
+    )
+{
+    UINT64               x = *(const UINT64 *)a;
+    UINT64               y = *(const UINT64 *)b;
+    return x < y ? -1 : x > y;
+}
+//
+//
+//          PrintResults()
+//
+//     This function prints a JSON object for each command of each stream. ops_per_sec counts commands, so a
+//     batch sample counts for batch commands; the percentiles are those of the samples. mb_per_sec is the
+//     throughput of the commands that carry data_size bytes of data each.
+//
+static void
+PrintResults(
+    void
+    )
+{
+    BENCH_RESULT        *result;
+    UINT64               total;
+    UINT32               i;
+    UINT32               j;
+    for(i = 0; i < s_resultCount; i++)
+    {
+        result = &s_results[i];
+        qsort(result->times, result->count, sizeof(UINT64), CompareTimes);
+        for(total = 0, j = 0; j < result->count; j++)
+            total += result->times[j];
+        printf("{\"stream\": \"%s\", \"command\": \"%s\", \"batch\": %u, \"count\": %u, "
+               "\"ops_per_sec\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+               "\"data_size\": %u, \"mb_per_sec\": %.1f, "
+               "\"errors\": %u, \"first_error\": %u}\n",
+               result->stream, GetCommandCodeString(result->commandCode), result->batch,
+               result->count,
+               total == 0 ? 0.0 : 1e9 * result->count * result->batch / total,
+               (unsigned long long)result->times[(result->count - 1) / 2],
+               (unsigned long long)result->times[(result->count - 1) * 99 / 100],
+               result->dataSize,
+               total == 0 ? 0.0 : 1e3 * result->count * result->batch * result->dataSize / total,
+               result->errors, result->firstError);
+    }
+}
+//
+//
+//          StartTpm()
+//
+//     This function manufactures the TPM, powers it on, starts it with TPM2_Startup(TPM_SU_CLEAR) and
+//     creates the storage keys that the key streams use.
+//
+static TPM_RC
+StartTpm(
+    void
+    )
+{
+    BYTE                 params[2] = {0, TPM_SU_CLEAR};
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+#ifdef TPM_MULTI_INSTANCE
+    TpmInstanceSelect(TpmInstanceCreate("."));
+#endif
+    _plat__Signal_PowerOn();
+    if(_plat__NVEnable(NULL) < 0)
+        return TPM_RC_FAILURE;
+    _plat__SetNvAvail();
+    if(TPM_Manufacture(TRUE) != 0)
+        return TPM_RC_FAILURE;
+    _TPM_Init();
+    rc = CommandExecute(NULL, TPM_CC_Startup, 0, NULL, params, sizeof(params),
+                        &response, &responseSize);
+    if(rc == TPM_RC_SUCCESS)
+        rc = CreatePrimary(TPM_ALG_RSA, &s_rsaParent);
+    if(rc == TPM_RC_SUCCESS)
+        rc = CreatePrimary(TPM_ALG_ECC, &s_eccParent);
+    return rc;
+}
+int
+main(
+    int                  argc,
+    char                *argv[]
+    )
+{
+    UINT32               iterations = 0;
+    BOOL                 selected;
+    TPM_RC               rc;
+    UINT32               i;
+    int                  arg;
+    int                  first = 1;
+    int                  status = 0;
+    if(argc > 2 && strcmp(argv[1], "-n") == 0)
+    {
+        iterations = (UINT32)atoi(argv[2]);
+        first = 3;
+    }
+    for(i = 0; i < sizeof(s_digest); i++)
+        s_digest[i] = (BYTE)i;
+    s_stream = "setup";
+    rc = StartTpm();
+    if(rc != TPM_RC_SUCCESS)
+    {
+        fprintf(stderr, "setup failed: 0x%03x\n", rc);
+        PrintResults();
+        return 1;
+    }
+    for(i = 0; i < STREAM_COUNT; i++)
+    {
+        selected = first == argc;
+        for(arg = first; arg < argc; arg++)
+            selected |= strcmp(argv[arg], s_streams[i].name) == 0;
+        if(!selected)
+            continue;
+        s_stream = s_streams[i].name;
+        rc = s_streams[i].run(iterations != 0 ? iterations : s_streams[i].iterations);
+        if(rc != TPM_RC_SUCCESS)
+        {
+            fprintf(stderr, "%s failed: 0x%03x\n", s_stream, rc);
+            status = 1;
+        }
+    }
+    PrintResults();
+    return status;
+}
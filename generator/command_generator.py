@@ -7,7 +7,9 @@
 The command generator takes as input a list of command objects generated by
 parsing the TCG specification and outputs valid C code to marshal command
 input and output structures, and also generates functions ParseHandleBuffer
-and CommandDispatcher defined by the TCG TPM2.0 Library Specification.
+and CommandDispatcher defined by the TCG TPM2.0 Library Specification. Both
+functions look the command up in one table of command descriptors indexed by
+the command code.
 
 """
 
@@ -37,7 +39,41 @@ _COMMAND_DISPATCHER_INCLUDES = '#include "%(command_name)s_fp.h"\n'
 _COMMAND_DISPATCHER_START = """
 #include "Implementation.h"
 #include "CommandDispatcher_fp.h"
-
+"""
+_COMMAND_DISPATCHER_HANDLE_GUARD = 'defined(%(command_code)s)'
+_COMMAND_DISPATCHER_HANDLE_UNMARSHAL = """
+#if %(guard)s
+static TPM_RC Unmarshal_%(handle_type)s(TPM_HANDLE *handle,
+    BYTE **buffer,
+    INT32 *size,
+    BOOL allow_null) {
+  (void)allow_null;
+  return %(handle_type)s_Unmarshal((%(handle_type)s*)handle, buffer, size);
+}
+#endif
+"""
+_COMMAND_DISPATCHER_HANDLE_UNMARSHAL_FLAG = """
+#if %(guard)s
+static TPM_RC Unmarshal_%(handle_type)s(TPM_HANDLE *handle,
+    BYTE **buffer,
+    INT32 *size,
+    BOOL allow_null) {
+  return %(handle_type)s_Unmarshal((%(handle_type)s*)handle, buffer, size,
+      allow_null);
+}
+#endif
+"""
+_COMMAND_DISPATCHER_TABLE_START = """
+const COMMAND_DESCRIPTOR g_commandDescriptors[TPM_CC_LAST - TPM_CC_FIRST + 1] = {"""
+_COMMAND_DISPATCHER_TABLE_ENTRY = """
+#ifdef %(command_code)s
+    [%(command_code)s - TPM_CC_FIRST] = {Exec_%(command_name)s%(handles)s},
+#endif"""
+_COMMAND_DISPATCHER_TABLE_HANDLE = '{Unmarshal_%(handle_type)s, %(flag_val)s}'
+_COMMAND_DISPATCHER_TABLE_END = """
+};
+"""
+_COMMAND_DISPATCHER_FUNCTION = """
 TPM_RC CommandDispatcher(
     TPMI_ST_COMMAND_TAG tag,
     TPM_CC command_code,
@@ -47,24 +83,24 @@ TPM_RC CommandDispatcher(
     UINT32 *response_handle_buffer_size,
     UINT32 *response_parameter_buffer_size) {
   BYTE *request_parameter_buffer = request_parameter_buffer_start;
-  switch(command_code) {"""
-_COMMAND_DISPATCHER_CASE = """
-#ifdef %(command_code)s
-    case %(command_code)s:
-      return Exec_%(command_name)s(tag, &request_parameter_buffer,
-          request_parameter_buffer_size, request_handles,
-          response_handle_buffer_size, response_parameter_buffer_size);
-#endif"""
-_COMMAND_DISPATCHER_END = """
-    default:
-      return TPM_RC_COMMAND_CODE;
+  const COMMAND_DESCRIPTOR *descriptor;
+  if (command_code < TPM_CC_FIRST || command_code > TPM_CC_LAST) {
+    return TPM_RC_COMMAND_CODE;
   }
+  descriptor = &g_commandDescriptors[command_code - TPM_CC_FIRST];
+  if (descriptor->exec == NULL) {
+    return TPM_RC_COMMAND_CODE;
+  }
+  return descriptor->exec(tag, &request_parameter_buffer,
+      request_parameter_buffer_size, request_handles,
+      response_handle_buffer_size, response_parameter_buffer_size);
 }"""
-_HANDLE_PROCESS_START = """
+_HANDLE_PROCESS = """
 #include "tpm_generated.h"
 #include "HandleProcess_fp.h"
 #include "Implementation.h"
 #include "TPM_Types.h"
+#include "CommandDispatcher_fp.h"
 
 TPM_RC ParseHandleBuffer(
     TPM_CC command_code,
@@ -73,35 +109,26 @@ TPM_RC ParseHandleBuffer(
     TPM_HANDLE request_handles[],
     UINT32 *num_request_handles) {
   TPM_RC result = TPM_RC_SUCCESS;
+  const COMMAND_DESCRIPTOR *descriptor;
+  UINT32 i;
   *num_request_handles = 0;
-  switch(command_code) {
-"""
-_HANDLE_PROCESS_CASE_START = """
-#ifdef %(command_code)s
-    case %(command_code)s:"""
-_HANDLE_PROCESS_CASE_UNMARSHAL = """
-      result = %(handle_type)s_Unmarshal(
-          (%(handle_type)s*)&request_handles[*num_request_handles],
-          request_handle_buffer_start,
-          request_buffer_remaining_size);"""
-_HANDLE_PROCESS_CASE_UNMARSHAL_FLAG = """
-      result = %(handle_type)s_Unmarshal(
-          (%(handle_type)s*)&request_handles[*num_request_handles],
-          request_handle_buffer_start,
-          request_buffer_remaining_size,
-          %(flag_val)s);"""
-_HANDLE_PROCESS_CASE_CHECK = """
-      if (result != TPM_RC_SUCCESS) {
-        return result;
-      }
-      ++(*num_request_handles);"""
-_HANDLE_PROCESS_CASE_END = """
-      return TPM_RC_SUCCESS;
-#endif"""
-_HANDLE_PROCESS_END = """
-    default:
-      return TPM_RC_COMMAND_CODE;
+  if (command_code < TPM_CC_FIRST || command_code > TPM_CC_LAST) {
+    return TPM_RC_COMMAND_CODE;
+  }
+  descriptor = &g_commandDescriptors[command_code - TPM_CC_FIRST];
+  if (descriptor->exec == NULL) {
+    return TPM_RC_COMMAND_CODE;
+  }
+  for (i = 0; i < MAX_HANDLE_NUM && descriptor->handles[i].unmarshal; ++i) {
+    result = descriptor->handles[i].unmarshal(&request_handles[i],
+        request_handle_buffer_start, request_buffer_remaining_size,
+        descriptor->handles[i].allow_null);
+    if (result != TPM_RC_SUCCESS) {
+      break;
+    }
   }
+  *num_request_handles = i;
+  return result;
 }"""
 _GET_COMMAND_CODE_STRING_HEADER = """
 #ifndef TPM2_GET_COMMAND_CODE_STRING_FP_H_
@@ -564,53 +591,71 @@ UINT16 %(command_name)s_Out_Marshal(
     return handles, parameters
 
 
-def _OutputCommandDispatcher(commands):
-  """Generates implementation file for CommandDispatcher function.
+def _OutputCommandDispatcher(commands, typemap):
+  """Generates the command descriptor table and the CommandDispatcher function.
+
+  The table has an entry for each command code from TPM_CC_FIRST to
+  TPM_CC_LAST, so that a command is found with one indexed load. An entry
+  holds the Exec_ function of the command and a function to unmarshal each of
+  its request handles; it is all zero if the command is not implemented.
 
   Args:
     commands: A list of Command objects.
+    typemap: A dict mapping type names to the corresponding object.
+        Generated by structure_generator.
   """
+  # The commands that use each handle type, so that the unmarshaling function
+  # of a type is only compiled when one of them is implemented.
+  handle_users = {}
+  for command in commands:
+    for handle in command.GetRequestHandles():
+      users = handle_users.setdefault(handle['type'], [])
+      if command.MethodName() not in users:
+        users.append(command.MethodName())
   with open('CommandDispatcher.c', 'w') as out_file:
     out_file.write(COPYRIGHT_HEADER)
     for command in commands:
       out_file.write(_COMMAND_DISPATCHER_INCLUDES %
                      {'command_name': command.MethodName()})
     out_file.write(_COMMAND_DISPATCHER_START)
+    for handle_type in sorted(handle_users):
+      guard = ' || '.join(_COMMAND_DISPATCHER_HANDLE_GUARD %
+                          {'command_code': 'TPM_CC_' + name}
+                          for name in handle_users[handle_type])
+      if typemap[handle_type].HasConditional():
+        template = _COMMAND_DISPATCHER_HANDLE_UNMARSHAL_FLAG
+      else:
+        template = _COMMAND_DISPATCHER_HANDLE_UNMARSHAL
+      out_file.write(template % {'guard': guard, 'handle_type': handle_type})
+    out_file.write(_COMMAND_DISPATCHER_TABLE_START)
     for command in commands:
-      command_code = 'TPM_CC_' + command.MethodName()
-      out_file.write(_COMMAND_DISPATCHER_CASE %
-                     {'command_code': command_code,
-                      'command_name': command.MethodName()})
-    out_file.write(_COMMAND_DISPATCHER_END)
+      handles = []
+      for handle in command.GetRequestHandles():
+        if typemap[handle['type']].HasConditional():
+          flag_val = handle['has_conditional']
+        else:
+          flag_val = 'FALSE'
+        handles.append(_COMMAND_DISPATCHER_TABLE_HANDLE %
+                       {'handle_type': handle['type'], 'flag_val': flag_val})
+      out_file.write(_COMMAND_DISPATCHER_TABLE_ENTRY %
+                     {'command_code': 'TPM_CC_' + command.MethodName(),
+                      'command_name': command.MethodName(),
+                      'handles': (', {' + ', '.join(handles) + '}'
+                                  if handles else '')})
+    out_file.write(_COMMAND_DISPATCHER_TABLE_END)
+    out_file.write(_COMMAND_DISPATCHER_FUNCTION)
   call(['clang-format', '-i', '-style=Chromium', 'CommandDispatcher.c'])
 
 
-def _OutputHandleProcess(commands, typemap):
+def _OutputHandleProcess():
   """Generates implementation file for ParseHandleBuffer function.
 
-  Args:
-    commands: A list of Command objects.
-    typemap: A dict mapping type names to the corresponding object.
-        Generated by structure_generator.
+  The handles of each command are described in the command descriptor table
+  generated by _OutputCommandDispatcher().
   """
   with open('HandleProcess.c', 'w') as out_file:
     out_file.write(COPYRIGHT_HEADER)
-    out_file.write(_HANDLE_PROCESS_START)
-    for command in commands:
-      command_code = 'TPM_CC_' + command.MethodName()
-      out_file.write(_HANDLE_PROCESS_CASE_START %
-                     {'command_code': command_code})
-      for handle in command.GetRequestHandles():
-        if typemap[handle['type']].HasConditional():
-          out_file.write(_HANDLE_PROCESS_CASE_UNMARSHAL_FLAG %
-                         {'handle_type': handle['type'],
-                          'flag_val': handle['has_conditional']})
-        else:
-          out_file.write(_HANDLE_PROCESS_CASE_UNMARSHAL %
-                         {'handle_type': handle['type']})
-        out_file.write(_HANDLE_PROCESS_CASE_CHECK)
-      out_file.write(_HANDLE_PROCESS_CASE_END)
-    out_file.write(_HANDLE_PROCESS_END)
+    out_file.write(_HANDLE_PROCESS)
   call(['clang-format', '-i', '-style=Chromium', 'HandleProcess.c'])
 
 
@@ -671,6 +716,6 @@ def GenerateImplementation(commands, typemap):
       command.OutputUnmarshalFunction(out_file, typemap)
       command.OutputExecFunction(out_file)
     call(['clang-format', '-i', '-style=Chromium', marshal_command_file])
-  _OutputHandleProcess(commands, typemap)
-  _OutputCommandDispatcher(commands)
+  _OutputHandleProcess()
+  _OutputCommandDispatcher(commands, typemap)
   _OutputGetCommandCodeString(commands)
@@ -5,6 +5,8 @@
 #ifndef _TPM2_EXECCOMMAND_FP_H_
 #define _TPM2_EXECCOMMAND_FP_H_
 
+#include "bool.h"
+
 void ExecuteCommand(
     unsigned    int      requestSize,       //   IN: command buffer size
     unsigned    char    *request,           //   IN: command buffer
@@ -12,4 +14,62 @@ void ExecuteCommand(
     unsigned    char    **response          //   OUT: response buffer
     );
 
+unsigned int ExecuteCommandToBuffer(
+    unsigned    int      requestSize,       //   IN: command buffer size
+    unsigned    char    *request,           //   IN: command buffer
+    unsigned    int      bufferSize,        //   IN: size of buffer
+    unsigned    char    *buffer             //   OUT: response buffer
+    );
+
+// A command of ExecuteCommandBatch() and its response.
+typedef struct {
+  unsigned int requestSize;     // IN: command buffer size
+  unsigned char *request;       // IN: command buffer
+  unsigned int responseSize;    // OUT: response size
+  unsigned char *response;      // OUT: response, in the buffer of the batch
+} BATCH_COMMAND;
+
+unsigned int ExecuteCommandBatch(
+    unsigned    int      count,             //   IN: number of commands
+    BATCH_COMMAND       *commands,          //   IN/OUT: the commands and their responses
+    unsigned    int      bufferSize,        //   IN: size of buffer
+    unsigned    char    *buffer             //   OUT: the responses
+    );
+
+// The phases of a command that a TPM built with TPM_COMMAND_PROFILE times.
+#define PROFILE_HEADER              0   // NV and time checks, header unmarshal
+#define PROFILE_HANDLES             1   // ParseHandleBuffer() and the handle checks
+#define PROFILE_SESSIONS            2   // ParseSessionBuffer() or CheckAuthNoSession()
+#define PROFILE_DISPATCH            3   // CommandDispatcher()
+#define PROFILE_RESPONSE_SESSION    4   // BuildResponseSession()
+#define PROFILE_NV_COMMIT           5   // NvCommit()
+#define PROFILE_TOTAL               6   // the whole command
+#define PROFILE_PHASES              7
+
+// A histogram of times in nanoseconds. Bucket b < 4 counts the times of b ns.
+// Above, each power of two is split in 4: bucket 4 * (n - 1) + s counts the
+// times from (4 + s) << (n - 2) ns to the start of the next bucket. The last
+// bucket also counts the times of 2^33 ns and more.
+#define PROFILE_BUCKETS             128
+typedef struct {
+  unsigned long long totalNs;   // sum of the times
+  unsigned long long maxNs;     // largest time
+  unsigned int count;           // number of times
+  unsigned int buckets[PROFILE_BUCKETS];
+} PROFILE_HISTOGRAM;
+
+// The times of the commands with a command code, by phase. A phase is counted
+// when it completes, so a command that fails only counts the phases before the
+// failure and PROFILE_TOTAL. In a batch, the NV commit is counted for the
+// first command that changed NV.
+typedef struct {
+  PROFILE_HISTOGRAM phases[PROFILE_PHASES];
+} COMMAND_PROFILE;
+
+BOOL ExecuteCommandGetProfile(
+    unsigned    int      commandCode,       //   IN: command code
+    BOOL                 reset,             //   IN: restart the profile of commandCode
+    COMMAND_PROFILE     *profile            //   OUT: the profile
+    );
+
 #endif  // _TPM2_EXECCOMMAND_FP_H_
@@ -187,6 +187,47 @@ LIB_EXPORT int
 _plat__NvCommit(void);
 //
 //
+//         _plat__NvSetSyncPolicy()
+//
+//     Select how _plat__NvCommit() makes the written data durable
+//
+#define        NV_SYNC_NONE                 0    // flush to the OS only
+#define        NV_SYNC_DATA                 1    // fdatasync() after each commit
+#define        NV_SYNC_FULL                 2    // fsync() after each commit
+LIB_EXPORT void
+_plat__NvSetSyncPolicy(
+    int                  policy             // IN: one of the NV_SYNC_ values
+    );
+//
+//
+//         _plat__NvSetGroupCommit()
+//
+//     Acknowledge commits once they are in the journal and write them to NVChip in batches
+//
+LIB_EXPORT void
+_plat__NvSetGroupCommit(
+    unsigned int         batch,             // IN: records per checkpoint, 0 to disable
+    unsigned int         window             // IN: durability window in milliseconds
+    );
+//
+//
+//         _plat__NvGetCommitStats()
+//
+//     Report the number of commits and the number of bytes they have written to NV
+//
+typedef struct
+{
+    unsigned long long   commits;           // number of calls to _plat__NvCommit()
+    unsigned long long   bytesWritten;      // total bytes written by all commits
+    unsigned long long   syncs;             // number of fsync()/fdatasync() calls
+    unsigned int         lastCommitBytes;   // bytes written by the latest commit
+} NV_COMMIT_STATS;
+LIB_EXPORT void
+_plat__NvGetCommitStats(
+    NV_COMMIT_STATS     *stats              // OUT: commit counters
+    );
+//
+//
 //         _plat__NvMemoryRead()
 //
 //     Read a chunk of NV memory
@@ -240,6 +281,121 @@ _plat__NvMemoryMove(
     unsigned int              destOffset,                   // IN: destination offset
     unsigned int              size                          // IN: size of data being moved
 );
+#ifdef NV_KV_STORE
+//
+//
+//          NV entity store functions
+//
+//     When NV_KV_STORE is defined, NV Indices and persistent objects are kept in a key/value store indexed
+//     by handle instead of in the NV memory image. Changes become durable at the next _plat__NvCommit().
+//
+//         _plat__NvEntityNext()
+//
+//     Return the handle of the next entity in the store, or 0 when there are no more. iter is set to 0 to start a
+//     traversal. The entity just returned may be deleted without restarting the traversal; it continues
+//     without skipping an entity, though one may be returned twice. Any other change to the store
+//     invalidates the traversal.
+//
+LIB_EXPORT unsigned int
+_plat__NvEntityNext(
+    unsigned int             *iter                          // IN/OUT: traversal position
+);
+//
+//
+//         _plat__NvEntityExists()
+//
+//     Check whether an entity with the given handle is in the store
+//
+LIB_EXPORT BOOL
+_plat__NvEntityExists(
+    unsigned int              handle                        // IN: entity handle
+);
+//
+//
+//         _plat__NvEntityFreeSpace()
+//
+//     Return the number of octets that can still be allocated to entities
+//
+LIB_EXPORT unsigned int
+_plat__NvEntityFreeSpace(void);
+//
+//
+//         _plat__NvEntityAdd()
+//
+//     Add an entity of size octets. The first initSize octets are copied from data and the rest are 0.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             out of memory
+//
+LIB_EXPORT int
+_plat__NvEntityAdd(
+    unsigned int              handle,                       // IN: entity handle
+    unsigned int              size,                         // IN: entity size
+    unsigned int              initSize,                     // IN: size of data
+    void                      *data                         // IN: initial data
+);
+//
+//
+//         _plat__NvEntityDelete()
+//
+//     Remove an entity from the store
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             out of memory
+//
+LIB_EXPORT int
+_plat__NvEntityDelete(
+    unsigned int              handle                        // IN: entity handle
+);
+//
+//
+//         _plat__NvEntityRead()
+//
+//     Read a chunk of an entity
+//
+LIB_EXPORT void
+_plat__NvEntityRead(
+    unsigned int              handle,                       // IN: entity handle
+    unsigned int              offset,                       // IN: read start
+    unsigned int              size,                         // IN: size of bytes to read
+    void                      *data                         // OUT: data buffer
+);
+//
+//
+//         _plat__NvEntityIsDifferent()
+//
+//     Check whether a chunk of an entity is different from the test value
+//
+LIB_EXPORT BOOL
+_plat__NvEntityIsDifferent(
+    unsigned int              handle,                       // IN: entity handle
+    unsigned int              offset,                       // IN: compare start
+    unsigned int              size,                         // IN: size of bytes to compare
+    void                      *data                         // IN: data buffer
+);
+//
+//
+//         _plat__NvEntityWrite()
+//
+//     Write a chunk of an entity
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             out of memory
+//
+LIB_EXPORT int
+_plat__NvEntityWrite(
+    unsigned int              handle,                       // IN: entity handle
+    unsigned int              offset,                       // IN: write start
+    unsigned int              size,                         // IN: size of bytes to write
+    void                      *data                         // IN: data buffer
+);
+#endif
 //
 //
 //      _plat__SetNvAvail()
@@ -344,6 +500,15 @@ LIB_EXPORT unsigned long long
 _plat__ClockTimeElapsed(void);
 //
 //
+//         _plat__ClockNanoseconds()
+//
+//     Function returns a monotonic time in nanoseconds. The time is not adjusted by _plat__ClockAdjustRate() and
+//     only the difference between two calls is meaningful.
+//
+LIB_EXPORT unsigned long long
+_plat__ClockNanoseconds(void);
+//
+//
 //         _plat__ClockAdjustRate()
 //
 //     Adjust the clock rate
@@ -374,6 +539,53 @@ _plat__GetEntropy(
       unsigned char          *entropy,                  // output buffer
       uint32_t                amount                    // amount requested
 );
+#ifdef TPM_MULTI_INSTANCE
+//
+//
+//           Platform Instances
+//
+//      With TPM_MULTI_INSTANCE, each TPM has its own platform state: the cancel flag, clock, locality,
+//      RSA key cache setting, physical presence, power and entropy state and the NV image. The platform functions use the instance
+//      selected by the calling thread.
+//
+typedef struct platform_instance PLATFORM_INSTANCE;
+//
+//
+//           _plat__InstanceCreate()
+//
+//      This function creates a platform instance. The NV files of the instance are kept in directory, which must
+//      exist. The instance is powered off and its NV is not enabled.
+//
+//      Return Value                     Meaning
+//
+//      NULL                             out of memory or directory is too long
+//      not NULL                         the instance
+//
+LIB_EXPORT PLATFORM_INSTANCE *
+_plat__InstanceCreate(
+      const char             *directory              // IN: directory of the NV files
+);
+//
+//
+//           _plat__InstanceDestroy()
+//
+//      This function frees a platform instance. _plat__NVDisable() must have been called for the instance.
+//
+LIB_EXPORT void
+_plat__InstanceDestroy(
+      PLATFORM_INSTANCE      *instance
+);
+//
+//
+//           _plat__InstanceSelect()
+//
+//      This function selects the platform instance used by the platform functions called from this thread.
+//
+LIB_EXPORT void
+_plat__InstanceSelect(
+      PLATFORM_INSTANCE      *instance
+);
+#endif // TPM_MULTI_INSTANCE
 
 int uart_printf(const char *format, ...);
 #define ecprintf(format, args...) uart_printf(format, ## args);
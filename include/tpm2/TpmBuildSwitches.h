@@ -77,4 +77,25 @@
 #   undef TPM_RNG_FOR_DEBUG
 #endif // SIMULATION
 #define INLINE __inline
+//
+//     TPM_MULTI_INSTANCE allows one process to run several independent TPMs. The TPM and platform state is
+//     kept in instances created with TpmInstanceCreate() and each thread selects the instance it works on with
+//     TpmInstanceSelect(). THREAD_LOCAL marks the variables that hold the selection.
+//
+// #define TPM_MULTI_INSTANCE
+#ifdef TPM_MULTI_INSTANCE
+#   ifdef __GNUC__
+#       define THREAD_LOCAL __thread
+#   else
+#       define THREAD_LOCAL __declspec(thread)
+#   endif
+#else
+#   define THREAD_LOCAL
+#endif
+//
+//     TPM_COMMAND_PROFILE has ExecuteCommand() time the phases of each command with the nanosecond clock of
+//     the platform and keep a histogram of the times per command code and phase. The profile is read with
+//     ExecuteCommandGetProfile().
+//
+// #define TPM_COMMAND_PROFILE
 #endif // _TPM_BUILD_SWITCHES_H
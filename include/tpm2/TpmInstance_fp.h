@@ -0,0 +1,24 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef _TPM2_TPMINSTANCE_FP_H_
+#define _TPM2_TPMINSTANCE_FP_H_
+
+#ifdef TPM_MULTI_INSTANCE
+typedef struct tpm_instance TPM_INSTANCE;
+
+TPM_INSTANCE *TpmInstanceCreate(
+    const char          *nvDirectory        //   IN: directory of the NV files
+    );
+
+void TpmInstanceDestroy(
+    TPM_INSTANCE        *instance           //   IN: instance to free
+    );
+
+void TpmInstanceSelect(
+    TPM_INSTANCE        *instance           //   IN: instance used by this thread
+    );
+#endif  // TPM_MULTI_INSTANCE
+
+#endif  // _TPM2_TPMINSTANCE_FP_H_
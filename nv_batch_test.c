@@ -0,0 +1,134 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//
+//     NV batch test. It checks that ExecuteCommandBatch() commits the NV changes that the TPM makes for
+//     itself when a batch starts, even when none of the commands of the batch writes NV. The test gives the
+//     TPM a failed authorization to forget, with a recovery time of 0, and runs a batch of TPM2_GetRandom()
+//     commands. The self healing of the dictionary attack logic at the start of the batch clears the failed
+//     authorization in NV. NV is then disabled, which drops the changes that have not been committed, and
+//     enabled again, and the failed authorization must still be cleared. The NV files are created in the
+//     current directory.
+//
+//     Usage: nv_batch_test
+//
+#include <stdio.h>
+#include "InternalRoutines.h"
+#include "Platform.h"
+#include "ExecCommand_fp.h"
+#include "Manufacture_fp.h"
+#include "TpmInstance_fp.h"
+#include "_TPM_Init_fp.h"
+//
+//     The commands of the test, with tag, commandSize and commandCode
+//
+#define BATCH_TEST_COUNT        4
+static BYTE              s_startup[] =
+{
+    0x80, 0x01, 0x00, 0x00, 0x00, 0x0C, 0x00, 0x00, 0x01, 0x44,
+    0x00, 0x00                              // TPM_SU_CLEAR
+};
+static BYTE              s_getRandom[] =
+{
+    0x80, 0x01, 0x00, 0x00, 0x00, 0x0C, 0x00, 0x00, 0x01, 0x7B,
+    0x00, 0x10                              // bytesRequested
+};
+static BYTE              s_responses[BATCH_TEST_COUNT * MAX_RESPONSE_SIZE];
+//
+//
+//          StartTpm()
+//
+//     This function manufactures the TPM, powers it on and starts it with TPM2_Startup(TPM_SU_CLEAR).
+//
+//     Return Value                      Meaning
+//
+//     TPM_RC_SUCCESS                    the TPM is started
+//     other                             the response code of TPM2_Startup(), or TPM_RC_FAILURE
+//
+static TPM_RC
+StartTpm(
+    void
+    )
+{
+    BYTE                *response;
+    unsigned int         responseSize;
+#ifdef TPM_MULTI_INSTANCE
+    TpmInstanceSelect(TpmInstanceCreate("."));
+#endif
+    _plat__Signal_PowerOn();
+    if(_plat__NVEnable(NULL) < 0)
+        return TPM_RC_FAILURE;
+    _plat__SetNvAvail();
+    if(TPM_Manufacture(TRUE) != 0)
+        return TPM_RC_FAILURE;
+    _TPM_Init();
+    ExecuteCommand(sizeof(s_startup), s_startup, &responseSize, &response);
+    return BYTE_ARRAY_TO_UINT32(response + 6);
+}
+int
+main(
+    void
+    )
+{
+    BATCH_COMMAND        batch[BATCH_TEST_COUNT];
+    UINT32               failedTries;
+    TPM_RC               rc;
+    UINT32               i;
+    rc = StartTpm();
+    if(rc != TPM_RC_SUCCESS)
+    {
+        fprintf(stderr, "setup failed: 0x%03x\n", rc);
+        return 1;
+    }
+    // A committed failed authorization that the next command forgets
+    gp.recoveryTime = 0;
+    gp.failedTries = 1;
+    NvWriteReserved(NV_FAILED_TRIES, &gp.failedTries);
+    if(!NvCommit())
+    {
+        fprintf(stderr, "NV could not be committed\n");
+        return 1;
+    }
+    for(i = 0; i < BATCH_TEST_COUNT; i++)
+    {
+        batch[i].requestSize = sizeof(s_getRandom);
+        batch[i].request = s_getRandom;
+    }
+    if(ExecuteCommandBatch(BATCH_TEST_COUNT, batch, sizeof(s_responses), s_responses)
+       != BATCH_TEST_COUNT)
+    {
+        fprintf(stderr, "the batch was not executed\n");
+        return 1;
+    }
+    for(i = 0; i < BATCH_TEST_COUNT; i++)
+    {
+        rc = BYTE_ARRAY_TO_UINT32(batch[i].response + 6);
+        if(rc != TPM_RC_SUCCESS)
+        {
+            fprintf(stderr, "command %u of the batch failed: 0x%03x\n", i, rc);
+            return 1;
+        }
+    }
+    if(gp.failedTries != 0)
+    {
+        fprintf(stderr, "the failed authorization was not forgotten\n");
+        return 1;
+    }
+    // Keep only what was committed
+    _plat__NVDisable();
+    if(_plat__NVEnable(NULL) < 0)
+    {
+        fprintf(stderr, "NV could not be enabled\n");
+        return 1;
+    }
+    NvReadReserved(NV_FAILED_TRIES, &failedTries);
+    if(failedTries != 0)
+    {
+        fprintf(stderr, "the batch did not commit the self healing: %u failed "
+                "tries in NV\n", failedTries);
+        return 1;
+    }
+    printf("the batch committed the self healing\n");
+    return 0;
+}
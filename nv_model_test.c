@@ -0,0 +1,460 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//
+//     Randomized NV model test. The program manufactures and starts a TPM and runs random TPM2_NV_DefineSpace(),
+//     TPM2_NV_UndefineSpace(), TPM2_NV_Write() and TPM2_NV_Read() commands on a set of indices, interleaved with
+//     power cycles, some of them without TPM2_Shutdown(). It keeps a model of what each index should hold and
+//     checks every read, and the list of indices returned by TPM2_GetCapability(), against the model. It runs
+//     the same way with the NV indices in NVChip and, when built with NV_KV_STORE, in the NVStore. The NV files
+//     are created in the current directory. Runs with many indices, such as -i 30000, need the NV space of
+//     NV_KV_STORE.
+//
+//     Usage: nv_model_test [-t steps] [-i indices] [-r seed]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "InternalRoutines.h"
+#include "Platform.h"
+#include "ExecCommand_fp.h"
+#include "Manufacture_fp.h"
+#include "TpmInstance_fp.h"
+#include "_TPM_Init_fp.h"
+//
+//     The indices of the model are MODEL_FIRST_INDEX and the next ones, each of up to MODEL_MAX_SIZE bytes.
+//
+#define MODEL_FIRST_INDEX       0x01520000
+#define MODEL_INDICES           24              // default number of indices
+#define MODEL_MAX_SIZE          192
+#define MODEL_PARAM_SIZE        1024
+typedef struct
+{
+    BOOL                 defined;
+    BOOL                 written;           // data is valid once the index is written
+    UINT16               size;
+    BYTE                 data[MODEL_MAX_SIZE];
+} MODEL_INDEX;
+static MODEL_INDEX      *s_model;
+static UINT32            s_indices = MODEL_INDICES;
+static BYTE              s_command[MAX_COMMAND_SIZE];
+static unsigned int      s_seed;
+//
+//
+//          Random()
+//
+//     This function returns the next value of a xorshift generator.
+//
+static UINT32
+Random(
+    void
+    )
+{
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 17;
+    s_seed ^= s_seed << 5;
+    return s_seed;
+}
+//
+//
+//          CommandExecute()
+//
+//     This function marshals a command with a password session with an empty password when session is TRUE,
+//     and executes it with ExecuteCommand().
+//
+//     Return Value                      Meaning
+//
+//     TPM_RC_SUCCESS                    the command succeeded
+//     other                             the response code of the command
+//
+static TPM_RC
+CommandExecute(
+    TPM_CC               commandCode,       // IN: command code
+    BOOL                 session,           // IN: authorize with a password session
+    UINT32               handleCount,       // IN: number of handles
+    TPM_HANDLE          *handles,           // IN: the handles
+    BYTE                *params,            // IN: the parameters
+    UINT32               paramSize,         // IN: size of params
+    BYTE               **response,          // OUT: the response
+    UINT32              *responseSize       // OUT: size of the response
+    )
+{
+    TPM_ST               tag = session ? TPM_ST_SESSIONS : TPM_ST_NO_SESSIONS;
+    TPM_HANDLE           sessionHandle = TPM_RS_PW;
+    TPM2B_NONCE          nonce = {{0}};
+    TPMA_SESSION         attributes = {0};
+    TPM2B_AUTH           hmac = {{0}};
+    UINT32               commandSize = 0;
+    UINT32               authSize;
+    BYTE                *buffer = s_command;
+    BYTE                *authSizeAt;
+    INT32                size = sizeof(s_command);
+    INT32                fieldSize = sizeof(UINT32);
+    UINT32               i;
+    TPM_ST_Marshal(&tag, &buffer, &size);
+    UINT32_Marshal(&commandSize, &buffer, &size);
+    TPM_CC_Marshal(&commandCode, &buffer, &size);
+    for(i = 0; i < handleCount; i++)
+        TPM_HANDLE_Marshal(&handles[i], &buffer, &size);
+    if(session)
+    {
+        authSizeAt = buffer;
+        buffer += sizeof(UINT32);
+        size -= sizeof(UINT32);
+        authSize = TPM_HANDLE_Marshal(&sessionHandle, &buffer, &size);
+        authSize += TPM2B_NONCE_Marshal(&nonce, &buffer, &size);
+        authSize += TPMA_SESSION_Marshal(&attributes, &buffer, &size);
+        authSize += TPM2B_AUTH_Marshal(&hmac, &buffer, &size);
+        UINT32_Marshal(&authSize, &authSizeAt, &fieldSize);
+    }
+    if(paramSize > 0)
+        MemoryCopy(buffer, params, paramSize, size);
+    buffer += paramSize;
+    commandSize = (UINT32)(buffer - s_command);
+    buffer = s_command + sizeof(TPM_ST);
+    fieldSize = sizeof(UINT32);
+    UINT32_Marshal(&commandSize, &buffer, &fieldSize);
+    ExecuteCommand(commandSize, s_command, responseSize, response);
+    return BYTE_ARRAY_TO_UINT32(*response + 6);
+}
+//
+//
+//          Startup()
+//
+//     This function powers the TPM on and starts it with TPM2_Startup(TPM_SU_CLEAR). The NV files are read
+//     again, so the TPM only has what was committed.
+//
+static TPM_RC
+Startup(
+    void
+    )
+{
+    BYTE                 params[2] = {0, TPM_SU_CLEAR};
+    BYTE                *response;
+    UINT32               responseSize;
+    _plat__Signal_PowerOn();
+    if(_plat__NVEnable(NULL) < 0)
+        return TPM_RC_FAILURE;
+    _plat__SetNvAvail();
+    _TPM_Init();
+    return CommandExecute(TPM_CC_Startup, FALSE, 0, NULL, params, sizeof(params),
+                          &response, &responseSize);
+}
+//
+//
+//          PowerCycle()
+//
+//     This function turns the TPM off, after TPM2_Shutdown(TPM_SU_CLEAR) when orderly is TRUE, and starts it
+//     again.
+//
+static TPM_RC
+PowerCycle(
+    BOOL                 orderly            // IN: shut the TPM down first
+    )
+{
+    BYTE                 params[2] = {0, TPM_SU_CLEAR};
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    if(orderly)
+    {
+        rc = CommandExecute(TPM_CC_Shutdown, FALSE, 0, NULL, params, sizeof(params),
+                            &response, &responseSize);
+        if(rc != TPM_RC_SUCCESS)
+            return rc;
+    }
+    // Power off disables NV
+    _plat__Signal_PowerOff();
+    return Startup();
+}
+//
+//
+//          ModelDefine()
+//
+//     This function defines index i of the model with a random size. TPM_RC_NV_SPACE leaves the model as it
+//     is.
+//
+static TPM_RC
+ModelDefine(
+    UINT32               i
+    )
+{
+    TPM_HANDLE           hierarchy = TPM_RH_OWNER;
+    TPM2B_AUTH           auth = {{0}};
+    TPM2B_NV_PUBLIC      nvPublic;
+    BYTE                 params[MODEL_PARAM_SIZE];
+    BYTE                *buffer = params;
+    INT32                size = sizeof(params);
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    MemorySet(&nvPublic, 0, sizeof(nvPublic));
+    nvPublic.t.nvPublic.nvIndex = MODEL_FIRST_INDEX + i;
+    nvPublic.t.nvPublic.nameAlg = TPM_ALG_SHA256;
+    nvPublic.t.nvPublic.attributes.TPMA_NV_AUTHWRITE = SET;
+    nvPublic.t.nvPublic.attributes.TPMA_NV_AUTHREAD = SET;
+    nvPublic.t.nvPublic.attributes.TPMA_NV_NO_DA = SET;
+    nvPublic.t.nvPublic.dataSize = (UINT16)(1 + Random() % MODEL_MAX_SIZE);
+    TPM2B_AUTH_Marshal(&auth, &buffer, &size);
+    TPM2B_NV_PUBLIC_Marshal(&nvPublic, &buffer, &size);
+    rc = CommandExecute(TPM_CC_NV_DefineSpace, TRUE, 1, &hierarchy, params,
+                        (UINT32)(buffer - params), &response, &responseSize);
+    if(rc == TPM_RC_NV_SPACE)
+        return TPM_RC_SUCCESS;
+    if(rc == TPM_RC_SUCCESS)
+    {
+        s_model[i].defined = TRUE;
+        s_model[i].written = FALSE;
+        s_model[i].size = nvPublic.t.nvPublic.dataSize;
+    }
+    return rc;
+}
+//
+//
+//          ModelUndefine()
+//
+//     This function undefines index i of the model.
+//
+static TPM_RC
+ModelUndefine(
+    UINT32               i
+    )
+{
+    TPM_HANDLE           handles[2] = {TPM_RH_OWNER, MODEL_FIRST_INDEX + i};
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    rc = CommandExecute(TPM_CC_NV_UndefineSpace, TRUE, 2, handles, NULL, 0, &response,
+                        &responseSize);
+    if(rc == TPM_RC_SUCCESS)
+        MemorySet(&s_model[i], 0, sizeof(s_model[i]));
+    return rc;
+}
+//
+//
+//          ModelWrite()
+//
+//     This function writes random data to index i of the model. The first write of an index covers all of
+//     it, so that the model does not depend on what an index holds before it is written; the next ones write a
+//     random part of it.
+//
+static TPM_RC
+ModelWrite(
+    UINT32               i
+    )
+{
+    TPM_HANDLE           handles[2] = {MODEL_FIRST_INDEX + i, MODEL_FIRST_INDEX + i};
+    TPM2B_MAX_NV_BUFFER  data;
+    UINT16               offset = 0;
+    BYTE                 params[MODEL_PARAM_SIZE];
+    BYTE                *buffer = params;
+    INT32                size = sizeof(params);
+    BYTE                *response;
+    UINT32               responseSize;
+    UINT32               j;
+    TPM_RC               rc;
+    data.t.size = s_model[i].size;
+    if(s_model[i].written)
+    {
+        offset = (UINT16)(Random() % s_model[i].size);
+        data.t.size = (UINT16)(1 + Random() % (s_model[i].size - offset));
+    }
+    for(j = 0; j < data.t.size; j++)
+        data.t.buffer[j] = (BYTE)Random();
+    TPM2B_MAX_NV_BUFFER_Marshal(&data, &buffer, &size);
+    UINT16_Marshal(&offset, &buffer, &size);
+    rc = CommandExecute(TPM_CC_NV_Write, TRUE, 2, handles, params,
+                        (UINT32)(buffer - params), &response, &responseSize);
+    if(rc == TPM_RC_SUCCESS)
+    {
+        s_model[i].written = TRUE;
+        MemoryCopy(s_model[i].data + offset, data.t.buffer, data.t.size,
+                   MODEL_MAX_SIZE - offset);
+    }
+    return rc;
+}
+//
+//
+//          ModelRead()
+//
+//     This function reads a random part of index i of the model and compares it with the model.
+//
+static TPM_RC
+ModelRead(
+    UINT32               i
+    )
+{
+    TPM_HANDLE           handles[2] = {MODEL_FIRST_INDEX + i, MODEL_FIRST_INDEX + i};
+    UINT16               offset = (UINT16)(Random() % s_model[i].size);
+    UINT16               readSize = (UINT16)(1 + Random() % (s_model[i].size - offset));
+    BYTE                 params[4];
+    BYTE                *buffer = params;
+    INT32                size = sizeof(params);
+    BYTE                *response;
+    UINT32               responseSize;
+    TPM_RC               rc;
+    UINT16_Marshal(&readSize, &buffer, &size);
+    UINT16_Marshal(&offset, &buffer, &size);
+    rc = CommandExecute(TPM_CC_NV_Read, TRUE, 2, handles, params, sizeof(params),
+                        &response, &responseSize);
+    if(rc != TPM_RC_SUCCESS)
+        return rc;
+    // header, parameterSize, then the TPM2B_MAX_NV_BUFFER
+    if(   BYTE_ARRAY_TO_UINT16(response + 14) != readSize
+       || memcmp(response + 16, s_model[i].data + offset, readSize) != 0)
+    {
+        fprintf(stderr, "index 0x%08x: %u bytes at %u differ from the model\n",
+                MODEL_FIRST_INDEX + i, readSize, offset);
+        return TPM_RC_FAILURE;
+    }
+    return TPM_RC_SUCCESS;
+}
+//
+//
+//          ModelCheckIndices()
+//
+//     This function checks that TPM2_GetCapability() returns the defined indices of the model, in order. The
+//     handles are read MAX_CAP_HANDLES at a time.
+//
+static TPM_RC
+ModelCheckIndices(
+    void
+    )
+{
+    TPM_CAP              capability = TPM_CAP_HANDLES;
+    TPM_HANDLE           first = MODEL_FIRST_INDEX;
+    UINT32               count = MAX_CAP_HANDLES;
+    BYTE                 params[12];
+    BYTE                *buffer;
+    INT32                size;
+    BYTE                *response;
+    UINT32               responseSize;
+    BYTE                 moreData;
+    UINT32               returned;
+    UINT32               i = 0;
+    UINT32               j;
+    TPM_RC               rc;
+    do
+    {
+        buffer = params;
+        size = sizeof(params);
+        TPM_CAP_Marshal(&capability, &buffer, &size);
+        UINT32_Marshal(&first, &buffer, &size);
+        UINT32_Marshal(&count, &buffer, &size);
+        rc = CommandExecute(TPM_CC_GetCapability, FALSE, 0, NULL, params, sizeof(params),
+                            &response, &responseSize);
+        if(rc != TPM_RC_SUCCESS)
+            return rc;
+        // header, moreData, capability, then the TPML_HANDLE
+        moreData = response[10];
+        returned = BYTE_ARRAY_TO_UINT32(response + 15);
+        for(j = 0; j < returned; j++, i++)
+        {
+            while(i < s_indices && !s_model[i].defined)
+                i++;
+            first = BYTE_ARRAY_TO_UINT32(response + 19 + 4 * j);
+            if(i == s_indices || first != MODEL_FIRST_INDEX + i)
+            {
+                fprintf(stderr, "index 0x%08x is not the next one of the model\n",
+                        first);
+                return TPM_RC_FAILURE;
+            }
+        }
+        first++;
+    } while(moreData == YES && returned != 0);
+    while(i < s_indices && !s_model[i].defined)
+        i++;
+    if(i != s_indices)
+    {
+        fprintf(stderr, "index 0x%08x of the model is missing\n",
+                MODEL_FIRST_INDEX + i);
+        return TPM_RC_FAILURE;
+    }
+    return TPM_RC_SUCCESS;
+}
+int
+main(
+    int                  argc,
+    char                *argv[]
+    )
+{
+    UINT32               steps = 10000;
+    UINT32               step;
+    UINT32               i;
+    UINT32               action;
+    TPM_RC               rc;
+    int                  opt;
+    s_seed = (unsigned int)time(NULL);
+    while((opt = getopt(argc, argv, "t:i:r:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': steps = (UINT32)atoi(optarg); break;
+            case 'i': s_indices = (UINT32)atoi(optarg); break;
+            case 'r': s_seed = (unsigned int)atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-t steps] [-i indices] [-r seed]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    s_model = calloc(s_indices, sizeof(MODEL_INDEX));
+    if(s_indices == 0 || s_model == NULL)
+    {
+        fprintf(stderr, "no model of %u indices\n", s_indices);
+        return 1;
+    }
+    printf("seed %u\n", s_seed);
+    // The generator state may not be 0
+    s_seed |= 1;
+#ifdef TPM_MULTI_INSTANCE
+    TpmInstanceSelect(TpmInstanceCreate("."));
+#endif
+    _plat__Signal_PowerOn();
+    if(_plat__NVEnable(NULL) < 0)
+    {
+        fprintf(stderr, "NV could not be enabled\n");
+        return 1;
+    }
+    _plat__SetNvAvail();
+    if(TPM_Manufacture(TRUE) != 0)
+    {
+        fprintf(stderr, "the TPM could not be manufactured\n");
+        return 1;
+    }
+    _plat__Signal_PowerOff();
+    rc = Startup();
+    for(step = 0; step < steps && rc == TPM_RC_SUCCESS; step++)
+    {
+        i = Random() % s_indices;
+        action = Random() % 64;
+        if(action == 0)
+            rc = PowerCycle(Random() % 2 == 0);
+        else if(action == 1)
+            rc = ModelCheckIndices();
+        else if(!s_model[i].defined)
+            rc = ModelDefine(i);
+        else if(action < 8)
+            rc = ModelUndefine(i);
+        else if(!s_model[i].written || action < 36)
+            rc = ModelWrite(i);
+        else
+            rc = ModelRead(i);
+    }
+    if(rc == TPM_RC_SUCCESS)
+        rc = PowerCycle(FALSE);
+    if(rc == TPM_RC_SUCCESS)
+        rc = ModelCheckIndices();
+    for(i = 0; i < s_indices && rc == TPM_RC_SUCCESS; i++)
+        if(s_model[i].written)
+            rc = ModelRead(i);
+    if(rc != TPM_RC_SUCCESS)
+    {
+        fprintf(stderr, "step %u failed: 0x%03x\n", step, rc);
+        return 1;
+    }
+    printf("%u steps match the model\n", steps);
+    return 0;
+}
@@ -0,0 +1,344 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//
+//     NV power-cut test. Each trial forks a child that keeps changing and committing the NV image and kills it
+//     with SIGKILL after a random delay, so that the child dies at a random point of _plat__NvCommit() or of the
+//     recovery in _plat__NVEnable(). The parent then enables NV, which recovers the image, and checks that
+//     the image is the one left by a whole number of commits. That number may not be larger than the number
+//     of commits the child had started, and it may not be smaller than the number of commits the child had
+//     acknowledged unless a group commit window allows commits to be lost. The next trial continues from the
+//     recovered image. With NV_KV_STORE, each commit also adds, changes or deletes entities of the NVStore, and
+//     the image holds them too, so that NVChip and the store are checked to recover to the same commit. The NV
+//     files are created in the current directory.
+//
+//     The test kills a process, so it checks the atomicity of the commits but not what reaches the disk when the
+//     power fails. It needs NV_JOURNAL or NV_KV_STORE; MMAP_BACKED_NV does not make commits atomic.
+//
+//     Usage: nv_powercut_test [-t trials] [-d max delay in us] [-s sync policy] [-g batch] [-w window]
+//                             [-r seed]
+//
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "Platform.h"
+#include "Implementation.h"
+//
+//     The most runs written by one commit and the largest run
+//
+#define POWERCUT_MAX_RUNS       4
+#define POWERCUT_MAX_RUN        2048
+#ifdef NV_KV_STORE
+//
+//     The entities of the store have the handles POWERCUT_FIRST_ENTITY and the next ones
+//
+#define POWERCUT_FIRST_ENTITY   0x01530000
+#define POWERCUT_ENTITIES       16
+#define POWERCUT_ENTITY_SIZE    256
+#endif
+//
+//     The NV image, with the entities of the store that are not in NVChip. An entity that is not in the store
+//     is all 0.
+//
+typedef struct
+{
+    unsigned char        chip[NV_MEMORY_SIZE];
+#ifdef NV_KV_STORE
+    unsigned char        present[POWERCUT_ENTITIES];
+    unsigned char        entities[POWERCUT_ENTITIES][POWERCUT_ENTITY_SIZE];
+#endif
+} POWERCUT_IMAGE;
+static POWERCUT_IMAGE    s_image;               // image of the last verified generation
+static POWERCUT_IMAGE    s_expected;
+static POWERCUT_IMAGE    s_recovered;
+//
+//
+//          Random()
+//
+//     This function returns the next value of a xorshift generator.
+//
+static unsigned int
+Random(
+    unsigned int        *state              // IN/OUT: generator state, not 0
+    )
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+//
+//
+//          ApplyGeneration()
+//
+//     This function makes the changes of commit generation to image. The changes only depend on generation,
+//     so the parent can repeat the commits of a child. When write is TRUE, the changes are also written to NV.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             the store is out of memory
+//
+static int
+ApplyGeneration(
+    unsigned int         generation,        // IN: number of the commit
+    POWERCUT_IMAGE      *image,             // IN/OUT: NV image
+    BOOL                 write              // IN: write the changes to NV
+    )
+{
+    unsigned int         state = generation * 2654435761u | 1;
+    unsigned int         runs = 1 + Random(&state) % POWERCUT_MAX_RUNS;
+    unsigned int         offset;
+    unsigned int         size;
+    unsigned int         i;
+    int                  result = 0;
+#ifdef NV_KV_STORE
+    unsigned int         entity;
+    unsigned char       *data;
+#endif
+    for(; runs > 0; runs--)
+    {
+        size = 1 + Random(&state) % POWERCUT_MAX_RUN;
+        offset = Random(&state) % (NV_MEMORY_SIZE - size + 1);
+        for(i = 0; i < size; i++)
+            image->chip[offset + i] = (unsigned char)Random(&state);
+        if(write)
+            _plat__NvMemoryWrite(offset, size, &image->chip[offset]);
+    }
+#ifdef NV_KV_STORE
+    // Add an entity, or delete it or change a part of it
+    entity = Random(&state) % POWERCUT_ENTITIES;
+    data = image->entities[entity];
+    if(!image->present[entity])
+    {
+        image->present[entity] = 1;
+        for(i = 0; i < POWERCUT_ENTITY_SIZE; i++)
+            data[i] = (unsigned char)Random(&state);
+        if(write)
+            result = _plat__NvEntityAdd(POWERCUT_FIRST_ENTITY + entity,
+                                        POWERCUT_ENTITY_SIZE, POWERCUT_ENTITY_SIZE,
+                                        data);
+    }
+    else if(Random(&state) % 4 == 0)
+    {
+        image->present[entity] = 0;
+        memset(data, 0, POWERCUT_ENTITY_SIZE);
+        if(write)
+            result = _plat__NvEntityDelete(POWERCUT_FIRST_ENTITY + entity);
+    }
+    else
+    {
+        size = 1 + Random(&state) % POWERCUT_ENTITY_SIZE;
+        offset = Random(&state) % (POWERCUT_ENTITY_SIZE - size + 1);
+        for(i = 0; i < size; i++)
+            data[offset + i] = (unsigned char)Random(&state);
+        if(write)
+            result = _plat__NvEntityWrite(POWERCUT_FIRST_ENTITY + entity, offset,
+                                          size, &data[offset]);
+    }
+#endif
+    return result;
+}
+//
+//
+//          ReadNv()
+//
+//     This function reads the image from NV, which is enabled.
+//
+static void
+ReadNv(
+    POWERCUT_IMAGE      *image              // OUT: NV image
+    )
+{
+#ifdef NV_KV_STORE
+    unsigned int         entity;
+#endif
+    _plat__NvMemoryRead(0, NV_MEMORY_SIZE, image->chip);
+#ifdef NV_KV_STORE
+    for(entity = 0; entity < POWERCUT_ENTITIES; entity++)
+    {
+        image->present[entity] =
+            _plat__NvEntityExists(POWERCUT_FIRST_ENTITY + entity) ? 1 : 0;
+        if(image->present[entity])
+            _plat__NvEntityRead(POWERCUT_FIRST_ENTITY + entity, 0, POWERCUT_ENTITY_SIZE,
+                                image->entities[entity]);
+        else
+            memset(image->entities[entity], 0, POWERCUT_ENTITY_SIZE);
+    }
+#endif
+}
+//
+//
+//          RunChild()
+//
+//     This function is the child of a trial. It enables NV and commits generation + 1, generation + 2 and so on
+//     until it is killed. The number of each commit is written to fd once _plat__NvCommit() has returned.
+//
+static void
+RunChild(
+    int                  fd,                // IN: pipe to the parent
+    unsigned int         generation,        // IN: generation of the NV image
+    int                  policy,            // IN: sync policy
+    unsigned int         batch,             // IN: group commit batch
+    unsigned int         window             // IN: group commit window
+    )
+{
+    static POWERCUT_IMAGE image;
+    if(_plat__NVEnable(NULL) != 0)
+        _exit(2);
+    _plat__NvSetSyncPolicy(policy);
+    _plat__NvSetGroupCommit(batch, window);
+    ReadNv(&image);
+    for(;;)
+    {
+        generation++;
+        if(   ApplyGeneration(generation, &image, TRUE) != 0
+           || _plat__NvCommit() != 0)
+            _exit(3);
+        if(write(fd, &generation, sizeof(generation)) != sizeof(generation))
+            _exit(4);
+    }
+}
+//
+//
+//          ReadImage()
+//
+//     This function enables NV, which recovers the image left by a killed child, and reads the image.
+//
+//     Return Value                      Meaning
+//
+//     0                                 success
+//     non-0                             NV could not be enabled
+//
+static int
+ReadImage(
+    POWERCUT_IMAGE      *image              // OUT: NV image
+    )
+{
+    if(_plat__NVEnable(NULL) != 0)
+        return 1;
+    ReadNv(image);
+    _plat__NVDisable();
+    return 0;
+}
+int
+main(
+    int                  argc,
+    char                *argv[]
+    )
+{
+    unsigned int         trials = 1000;
+    unsigned int         maxDelay = 20000;
+    int                  policy = NV_SYNC_NONE;
+    unsigned int         batch = 0;
+    unsigned int         window = 0;
+    unsigned int         seed = (unsigned int)time(NULL);
+    unsigned int         generation = 0;
+    unsigned int         acknowledged;
+    unsigned int         lowest;
+    unsigned int         found;
+    unsigned int         value;
+    unsigned int         trial;
+    unsigned long long   commits = 0;
+    unsigned int         inProgress = 0;
+    int                  fds[2];
+    int                  status;
+    pid_t                pid;
+    int                  opt;
+    while((opt = getopt(argc, argv, "t:d:s:g:w:r:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': trials = (unsigned int)atoi(optarg); break;
+            case 'd': maxDelay = (unsigned int)atoi(optarg); break;
+            case 's': policy = atoi(optarg); break;
+            case 'g': batch = (unsigned int)atoi(optarg); break;
+            case 'w': window = (unsigned int)atoi(optarg); break;
+            case 'r': seed = (unsigned int)atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-t trials] [-d max delay in us] "
+                        "[-s sync policy] [-g batch] [-w window] [-r seed]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    printf("seed %u\n", seed);
+    srand(seed);
+#ifdef TPM_MULTI_INSTANCE
+    _plat__InstanceSelect(_plat__InstanceCreate("."));
+#endif
+    // Start from whatever image the NV files hold
+    if(ReadImage(&s_image) != 0)
+    {
+        fprintf(stderr, "NV could not be enabled\n");
+        return 1;
+    }
+    for(trial = 0; trial < trials; trial++)
+    {
+        if(pipe(fds) != 0 || (pid = fork()) < 0)
+        {
+            perror("fork");
+            return 1;
+        }
+        if(pid == 0)
+        {
+            close(fds[0]);
+            RunChild(fds[1], generation, policy, batch, window);
+        }
+        close(fds[1]);
+        usleep(rand() % (maxDelay + 1));
+        kill(pid, SIGKILL);
+        acknowledged = generation;
+        while(read(fds[0], &value, sizeof(value)) == sizeof(value))
+            acknowledged = value;
+        close(fds[0]);
+        waitpid(pid, &status, 0);
+        if(!WIFSIGNALED(status))
+        {
+            fprintf(stderr, "trial %u: child failed with status %d\n", trial,
+                    WEXITSTATUS(status));
+            return 1;
+        }
+        if(ReadImage(&s_recovered) != 0)
+        {
+            fprintf(stderr, "trial %u: NV could not be recovered\n", trial);
+            return 1;
+        }
+        // Look for the generation of the recovered image, from the one the
+        // trial started with to the commit that was in progress
+        memcpy(&s_expected, &s_image, sizeof(s_image));
+        for(found = generation;
+            memcmp(&s_expected, &s_recovered, sizeof(s_recovered)) != 0; found++)
+        {
+            if(found > acknowledged)
+            {
+                fprintf(stderr, "trial %u: the image of generation %u is not the "
+                        "result of a commit between %u and %u\n", trial,
+                        generation, generation, acknowledged + 1);
+                return 1;
+            }
+            ApplyGeneration(found + 1, &s_expected, FALSE);
+        }
+        // Acknowledged commits may only be lost within a group commit window
+        lowest = (batch != 0 && window != 0) ? generation : acknowledged;
+        if(found < lowest)
+        {
+            fprintf(stderr, "trial %u: commit %u was acknowledged but the image "
+                    "is of generation %u\n", trial, acknowledged, found);
+            return 1;
+        }
+        if(found > acknowledged)
+            inProgress++;
+        commits += found - generation;
+        memcpy(&s_image, &s_recovered, sizeof(s_recovered));
+        generation = found;
+    }
+    printf("%u trials, %llu commits recovered, %u of them in progress when the "
+           "child was killed\n", trials, commits, inProgress);
+    return 0;
+}
@@ -78,91 +78,6 @@ UINT16 _cpri__CompleteHMAC(
       return _cpri__CompleteHash(&localState, dOutSize, dOut);
 }
 
-UINT16 _cpri__KDFa(
-  TPM_ALG_ID hashAlg,           //   IN: hash algorithm used in HMAC
-  TPM2B * key,                  //   IN: HMAC key
-  const char *label,            //   IN: a 0-byte terminated label used in KDF
-  TPM2B * contextU,             //   IN: context U
-  TPM2B * contextV,             //   IN: context V
-  UINT32 sizeInBits,            //   IN: size of generated key in bit
-  BYTE * keyStream,             //   OUT: key buffer
-  UINT32 * counterInOut,        //   IN/OUT: caller may provide the iteration
-  //   counter for incremental operations to
-  //   avoid large intermediate buffers.
-  BOOL once                     //   IN: TRUE if only one iteration is
-  // performed FALSE if iteration count determined by "sizeInBits"
-  )
-{
-    UINT32                         counter = 0;    // counter value
-    INT32                          lLen = 0;       // length of the label
-    INT16                          hLen;           // length of the hash
-    INT16                          bytes;          // number of bytes to produce
-    BYTE                          *stream = keyStream;
-    BYTE                           marshaledUint32[4];
-    CPRI_HASH_STATE                hashState;
-    TPM2B_MAX_HASH_BLOCK           hmacKey;
-    pAssert(key != NULL && keyStream != NULL);
-    pAssert(once == FALSE || (sizeInBits & 7) == 0);
-    if(counterInOut != NULL)
-        counter = *counterInOut;
-    // Prepare label buffer. Calculate its size and keep the last 0 byte
-    if(label != NULL)
-        for(lLen = 0; label[lLen++] != 0; );
-    // Get the hash size. If it is less than or 0, either the
-    // algorithm is not supported or the hash is TPM_ALG_NULL
-//
-   // In either case the digest size is zero. This is the only return
-   // other than the one at the end. All other exits from this function
-   // are fatal errors. After we check that the algorithm is supported
-   // anything else that goes wrong is an implementation flaw.
-   if((hLen = (INT16) _cpri__GetDigestSize(hashAlg)) == 0)
-       return 0;
-   // If the size of the request is larger than the numbers will handle,
-   // it is a fatal error.
-   pAssert(((sizeInBits + 7)/ 8) <= INT16_MAX);
-   bytes = once ? hLen : (INT16)((sizeInBits + 7) / 8);
-   // Generate required bytes
-   for (; bytes > 0; stream = &stream[hLen], bytes = bytes - hLen)
-   {
-       if(bytes < hLen)
-           hLen = bytes;
-        counter++;
-        // Start HMAC
-        if(_cpri__StartHMAC(hashAlg,
-                            FALSE,
-                            &hashState,
-                            key->size,
-                            &key->buffer[0],
-                            &hmacKey.b)          <= 0)
-            FAIL(FATAL_ERROR_INTERNAL);
-        // Adding counter
-        UINT32_TO_BYTE_ARRAY(counter, marshaledUint32);
-        _cpri__UpdateHash(&hashState, sizeof(UINT32), marshaledUint32);
-        // Adding label
-        if(label != NULL)
-            _cpri__UpdateHash(&hashState,   lLen, (BYTE *)label);
-        // Adding contextU
-        if(contextU != NULL)
-            _cpri__UpdateHash(&hashState, contextU->size, contextU->buffer);
-        // Adding contextV
-        if(contextV != NULL)
-            _cpri__UpdateHash(&hashState, contextV->size, contextV->buffer);
-        // Adding size in bits
-        UINT32_TO_BYTE_ARRAY(sizeInBits, marshaledUint32);
-        _cpri__UpdateHash(&hashState, sizeof(UINT32), marshaledUint32);
-        // Compute HMAC. At the start of each iteration, hLen is set
-        // to the smaller of hLen and bytes. This causes bytes to decrement
-        // exactly to zero to complete the loop
-        _cpri__CompleteHMAC(&hashState, &hmacKey.b, hLen, stream);
-   }
-   // Mask off bits if the required bits is not a multiple of byte size
-   if((sizeInBits % 8) != 0)
-       keyStream[0] &= ((1 << (sizeInBits % 8)) - 1);
-   if(counterInOut != NULL)
-       *counterInOut = counter;
-   return (CRYPT_RESULT)((sizeInBits + 7)/8);
-}
-
 UINT16 _cpri__KDFe(
   TPM_ALG_ID hashAlg,           //   IN: hash algorithm used in HMAC
   TPM2B * Z,                    //   IN: Z
@@ -0,0 +1,660 @@
+// Copyright 2015 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//
+//     Transport benchmark. For each transport, the program forks a server process that manufactures and starts
+//     a TPM and serves it with StartTcpServer() or StartLocalServer(). It then runs 1, 2, 4 and so on up to the
+//     given number of client connections at once, each on its own thread, sending TPM2_GetRandom() with
+//     TPM_SEND_COMMAND and waiting for each response. For each transport and number of connections it prints
+//     one JSON object per line with the commands per second of all the connections and the 50th and 99th
+//     percentile latencies, so that runs can be compared by scripts.
+//
+//     The transports are tcp (loopback), local (AF_UNIX socket) and, on Linux, ring: a local socket moved to a
+//     shared ring with TPM_MAP_SHARED_RING. The NV files of the TPM and the local sockets are created in the
+//     current directory.
+//
+//     Usage: transport_benchmark [-n commands per connection] [-c connections] [-p port] [transport...]
+//
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include "InternalRoutines.h"
+#include "Platform.h"
+#include "ExecCommand_fp.h"
+#include "Manufacture_fp.h"
+#include "TpmInstance_fp.h"
+#include "_TPM_Init_fp.h"
+#include "TpmTcpProtocol.h"
+//
+//     The transports
+//
+typedef enum
+{
+    TRANSPORT_TCP,
+    TRANSPORT_LOCAL,
+    TRANSPORT_RING
+} TRANSPORT;
+static const char       *s_transportNames[] = {"tcp", "local", "ring"};
+#define TRANSPORT_COUNT (sizeof(s_transportNames) / sizeof(s_transportNames[0]))
+#define BENCH_COMMAND_PATH      "tpm.sock"
+#define BENCH_PLATFORM_PATH     "tpm.sock.platform"
+#define BENCH_MAX_RESPONSE      1024
+static int               s_port = 2321;
+//
+//     TPM2_GetRandom() of 16 bytes, without sessions
+//
+static BYTE              s_command[] =
+{
+    0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b, 0x00, 0x10
+};
+//
+//     A client connection. With a shared ring, the requests and the responses go through the rings and the
+//     socket only keeps the connection open.
+//
+typedef struct
+{
+    int                  s;
+#ifdef __linux__
+    TPM_SHARED_RING     *shared;            // NULL unless the connection uses a shared ring
+    char                *requests;
+    char                *responses;
+    int                  serverBell;
+    int                  clientBell;
+#endif
+    pthread_barrier_t   *start;
+    UINT32               count;             // commands to send
+    UINT64              *times;             // latency of each command in ns
+    BOOL                 failed;
+} BENCH_CLIENT;
+#ifdef TPM_MULTI_INSTANCE
+static TPM_INSTANCE     *s_instance;
+#endif
+//
+//
+//          Now()
+//
+//     This function returns a monotonic time in nanoseconds.
+//
+static UINT64
+Now(
+    void
+    )
+{
+    struct timespec      now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+//
+//
+//          The server
+//
+//     The _rpc__ functions called by TcpServer.c. TPMCmdp.c is Windows-only, so the server process runs its
+//     TPM directly. The benchmark only sends commands, so the signals are ignored.
+//
+void _rpc__Signal_PowerOn(BOOL isReset) { (void)isReset; }
+void _rpc__Signal_PowerOff(void) {}
+void _rpc__ForceFailureMode(void) {}
+void _rpc__Signal_PhysicalPresenceOn(void) {}
+void _rpc__Signal_PhysicalPresenceOff(void) {}
+void _rpc__Signal_Hash_Start(void) {}
+void _rpc__Signal_Hash_Data(_IN_BUFFER input) { (void)input; }
+void _rpc__Signal_HashEnd(void) {}
+void _rpc__Signal_CancelOn(void) {}
+void _rpc__Signal_CancelOff(void) {}
+void _rpc__Signal_NvOn(void) {}
+void _rpc__Signal_NvOff(void) {}
+void
+_rpc__Get_CommandProfile(
+    BOOL                 reset,
+    _OUT_BUFFER         *profile
+    )
+{
+    (void)reset;
+    profile->BufferSize = 0;
+}
+void
+_rpc__Send_Command(
+    unsigned char        locality,
+    _IN_BUFFER           request,
+    _OUT_BUFFER         *response
+    )
+{
+#ifdef TPM_MULTI_INSTANCE
+    // The commands arrive on the worker threads of the server
+    TpmInstanceSelect(s_instance);
+#endif
+    _plat__LocalitySet(locality);
+    if(response->Buffer != NULL)
+        response->BufferSize = ExecuteCommandToBuffer(request.BufferSize, request.Buffer,
+                                                      response->BufferSize,
+                                                      response->Buffer);
+    else
+        ExecuteCommand(request.BufferSize, request.Buffer, &response->BufferSize,
+                       &response->Buffer);
+}
+//
+//
+//          RunServer()
+//
+//     This function is the server process. It manufactures the TPM, starts it with TPM2_Startup(TPM_SU_CLEAR)
+//     and serves it until a client sends TPM_STOP.
+//
+static int
+RunServer(
+    TRANSPORT            transport
+    )
+{
+    BYTE                 startup[] = {0x80, 0x01, 0x00, 0x00, 0x00, 0x0c,
+                                      0x00, 0x00, 0x01, 0x44, 0x00, 0x00};
+    BYTE                *response;
+    UINT32               responseSize;
+#ifdef TPM_MULTI_INSTANCE
+    s_instance = TpmInstanceCreate(".");
+    TpmInstanceSelect(s_instance);
+#endif
+    _plat__Signal_PowerOn();
+    if(_plat__NVEnable(NULL) < 0)
+        return 1;
+    _plat__SetNvAvail();
+    if(TPM_Manufacture(TRUE) != 0)
+        return 1;
+    _TPM_Init();
+    ExecuteCommand(sizeof(startup), startup, &responseSize, &response);
+    if(BYTE_ARRAY_TO_UINT32(response + 6) != TPM_RC_SUCCESS)
+        return 1;
+    // The server prints where it listens, which is not part of the results
+    if(freopen("/dev/null", "w", stdout) == NULL)
+        return 1;
+    if(transport == TRANSPORT_TCP)
+        return StartTcpServer(s_port) != 0;
+    return StartLocalServer(BENCH_COMMAND_PATH, BENCH_PLATFORM_PATH) != 0;
+}
+//
+//
+//          The clients
+//
+//          SendAll()
+//
+//     This function sends size bytes on a socket.
+//
+static BOOL
+SendAll(
+    int                  s,
+    const void          *data,
+    UINT32               size
+    )
+{
+    ssize_t              sent;
+    for(; size > 0; size -= (UINT32)sent, data = (const char *)data + sent)
+    {
+        sent = send(s, data, size, MSG_NOSIGNAL);
+        if(sent <= 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+//
+//
+//          ReceiveAll()
+//
+//     This function receives size bytes from a socket.
+//
+static BOOL
+ReceiveAll(
+    int                  s,
+    void                *data,
+    UINT32               size
+    )
+{
+    ssize_t              received;
+    for(; size > 0; size -= (UINT32)received, data = (char *)data + received)
+    {
+        received = recv(s, data, size, 0);
+        if(received <= 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+//
+//
+//          Connect()
+//
+//     This function connects to the command port of the server, or to its platform port when platform is TRUE.
+//
+//     Return Value                      Meaning
+//
+//     -1                                the server does not accept the connection
+//     other                             the socket
+//
+static int
+Connect(
+    TRANSPORT            transport,
+    BOOL                 platform
+    )
+{
+    struct sockaddr_in   address;
+    struct sockaddr_un   local;
+    int                  noDelay = 1;
+    int                  s;
+    if(transport == TRANSPORT_TCP)
+    {
+        s = socket(AF_INET, SOCK_STREAM, 0);
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((UINT16)(s_port + (platform ? 1 : 0)));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(s >= 0 && connect(s, (struct sockaddr *)&address, sizeof(address)) == 0)
+        {
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            return s;
+        }
+    }
+    else
+    {
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        strcpy(local.sun_path, platform ? BENCH_PLATFORM_PATH : BENCH_COMMAND_PATH);
+        if(s >= 0 && connect(s, (struct sockaddr *)&local, sizeof(local)) == 0)
+            return s;
+    }
+    if(s >= 0)
+        close(s);
+    return -1;
+}
+#ifdef __linux__
+//
+//
+//          MapRing()
+//
+//     This function moves a local connection to a shared ring with TPM_MAP_SHARED_RING.
+//
+static BOOL
+MapRing(
+    BENCH_CLIENT        *client
+    )
+{
+    UINT32               request = htonl(TPM_MAP_SHARED_RING);
+    UINT32               reply[2];
+    int                  fds[3];
+    struct iovec         data = {reply, sizeof(reply)};
+    struct msghdr        message;
+    struct cmsghdr      *control;
+    union
+    {
+        struct cmsghdr   header;
+        char             buffer[CMSG_SPACE(3 * sizeof(int))];
+    }                    controlBuffer;
+    char                *base;
+    if(!SendAll(client->s, &request, sizeof(request)))
+        return FALSE;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = controlBuffer.buffer;
+    message.msg_controllen = sizeof(controlBuffer.buffer);
+    if(recvmsg(client->s, &message, 0) != sizeof(reply))
+        return FALSE;
+    control = CMSG_FIRSTHDR(&message);
+    if(   control == NULL || control->cmsg_type != SCM_RIGHTS
+       || control->cmsg_len != CMSG_LEN(3 * sizeof(int))
+       || ntohl(reply[0]) != TPM_SHARED_RING_SIZE)
+        return FALSE;
+    memcpy(fds, CMSG_DATA(control), sizeof(fds));
+    base = mmap(NULL, TPM_SHARED_RING_DATA + 2 * TPM_SHARED_RING_SIZE,
+                PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    client->serverBell = fds[1];
+    client->clientBell = fds[2];
+    if(base == MAP_FAILED)
+        return FALSE;
+    client->shared = (TPM_SHARED_RING *)base;
+    client->requests = base + TPM_SHARED_RING_DATA;
+    client->responses = client->requests + TPM_SHARED_RING_SIZE;
+    return TRUE;
+}
+//
+//
+//          RingCopy()
+//
+//     This function copies size bytes to or from a ring at position, which is taken modulo the size of the
+//     ring.
+//
+static void
+RingCopy(
+    char                *ring,
+    UINT32               position,
+    void                *data,
+    UINT32               size,
+    BOOL                 toRing
+    )
+{
+    UINT32               offset = position % TPM_SHARED_RING_SIZE;
+    UINT32               first = TPM_SHARED_RING_SIZE - offset;
+    if(first > size)
+        first = size;
+    if(toRing)
+    {
+        memcpy(ring + offset, data, first);
+        memcpy(ring, (char *)data + first, size - first);
+    }
+    else
+    {
+        memcpy(data, ring + offset, first);
+        memcpy((char *)data + first, ring, size - first);
+    }
+}
+//
+//
+//          RingWait()
+//
+//     This function waits until the response ring holds size bytes.
+//
+static BOOL
+RingWait(
+    BENCH_CLIENT        *client,
+    UINT32               size
+    )
+{
+    UINT64               bell;
+    while(  __atomic_load_n(&client->shared->responseHead, __ATOMIC_ACQUIRE)
+          - client->shared->responseTail < size)
+    {
+        if(read(client->clientBell, &bell, sizeof(bell)) != sizeof(bell))
+            return FALSE;
+    }
+    return TRUE;
+}
+#endif
+//
+//
+//          Transact()
+//
+//     This function sends a command with TPM_SEND_COMMAND and receives its response.
+//
+static BOOL
+Transact(
+    BENCH_CLIENT        *client,
+    BYTE                *command,
+    UINT32               commandSize,
+    BYTE                *response,
+    UINT32              *responseSize
+    )
+{
+    BYTE                 request[9 + sizeof(s_command)];
+    UINT32               value;
+    UINT32               ack;
+    value = htonl(TPM_SEND_COMMAND);
+    memcpy(request, &value, 4);
+    request[4] = 0;                         // locality
+    value = htonl(commandSize);
+    memcpy(request + 5, &value, 4);
+    memcpy(request + 9, command, commandSize);
+#ifdef __linux__
+    if(client->shared != NULL)
+    {
+        UINT64           bell = 1;
+        UINT32           head;
+        UINT32           tail;
+        head = client->shared->requestHead;
+        RingCopy(client->requests, head, request, 9 + commandSize, TRUE);
+        __atomic_store_n(&client->shared->requestHead, head + 9 + commandSize,
+                         __ATOMIC_RELEASE);
+        if(write(client->serverBell, &bell, sizeof(bell)) != sizeof(bell))
+            return FALSE;
+        // {UINT32 OutBufferSize, BYTE[OutBufferSize] OutBuffer, UINT32 0}
+        tail = client->shared->responseTail;
+        if(!RingWait(client, 4))
+            return FALSE;
+        RingCopy(client->responses, tail, &value, 4, FALSE);
+        *responseSize = ntohl(value);
+        if(*responseSize > BENCH_MAX_RESPONSE || !RingWait(client, 8 + *responseSize))
+            return FALSE;
+        RingCopy(client->responses, tail + 4, response, *responseSize, FALSE);
+        RingCopy(client->responses, tail + 4 + *responseSize, &ack, 4, FALSE);
+        // The server only waits for the tail when the ring is full, which a
+        // client waiting for each response never fills, so the tail is handed
+        // back with the bell of the next request
+        __atomic_store_n(&client->shared->responseTail, tail + 8 + *responseSize,
+                         __ATOMIC_RELEASE);
+        return ack == 0;
+    }
+#endif
+    if(   !SendAll(client->s, request, 9 + commandSize)
+       || !ReceiveAll(client->s, &value, 4))
+        return FALSE;
+    *responseSize = ntohl(value);
+    return    *responseSize <= BENCH_MAX_RESPONSE
+           && ReceiveAll(client->s, response, *responseSize)
+           && ReceiveAll(client->s, &ack, 4)
+           && ack == 0;
+}
+//
+//
+//          ClientRoutine()
+//
+//     This function is run by each client thread. It sends its commands once all the clients are connected.
+//
+static void *
+ClientRoutine(
+    void                *parameter
+    )
+{
+    BENCH_CLIENT        *client = parameter;
+    BYTE                 response[BENCH_MAX_RESPONSE];
+    UINT32               responseSize;
+    UINT64               start;
+    UINT32               i;
+    pthread_barrier_wait(client->start);
+    for(i = 0; i < client->count; i++)
+    {
+        start = Now();
+        if(   !Transact(client, s_command, sizeof(s_command), response, &responseSize)
+           || BYTE_ARRAY_TO_UINT32(response + 6) != TPM_RC_SUCCESS)
+        {
+            client->failed = TRUE;
+            break;
+        }
+        client->times[i] = Now() - start;
+    }
+    return NULL;
+}
+//
+//
+//          CompareTimes()
+//
+//     qsort() comparison of two latencies
+//
+static int
+CompareTimes(
+    const void          *a,
+    const void          *b
+    )
+{
+    UINT64               x = *(const UINT64 *)a;
+    UINT64               y = *(const UINT64 *)b;
+    return x < y ? -1 : x > y;
+}
+//
+//
+//          RunClients()
+//
+//     This function runs connections clients of count commands each at once and prints their throughput and
+//     latencies.
+//
+static BOOL
+RunClients(
+    TRANSPORT            transport,
+    UINT32               connections,
+    UINT32               count
+    )
+{
+    BENCH_CLIENT        *clients = calloc(connections, sizeof(BENCH_CLIENT));
+    pthread_t           *threads = calloc(connections, sizeof(pthread_t));
+    UINT64              *times = calloc((size_t)connections * count, sizeof(UINT64));
+    pthread_barrier_t    start;
+    UINT64               elapsed;
+    UINT32               started;
+    UINT32               i;
+    BOOL                 ok = clients != NULL && threads != NULL && times != NULL;
+    pthread_barrier_init(&start, NULL, connections + 1);
+    // Connect every client before any command is sent
+    for(i = 0; i < connections && ok; i++)
+    {
+        clients[i].start = &start;
+        clients[i].count = count;
+        clients[i].times = times + (size_t)i * count;
+        clients[i].s = Connect(transport, FALSE);
+        ok = clients[i].s >= 0;
+#ifdef __linux__
+        if(ok && transport == TRANSPORT_RING)
+            ok = MapRing(&clients[i]);
+#endif
+    }
+    for(started = 0; started < connections && ok; started++)
+        ok = pthread_create(&threads[started], NULL, ClientRoutine, &clients[started]) == 0;
+    if(ok)
+    {
+        pthread_barrier_wait(&start);
+        elapsed = Now();
+        for(i = 0; i < started; i++)
+        {
+            pthread_join(threads[i], NULL);
+            ok = ok && !clients[i].failed;
+        }
+        elapsed = Now() - elapsed;
+    }
+    if(ok)
+    {
+        qsort(times, (size_t)connections * count, sizeof(UINT64), CompareTimes);
+        printf("{\"transport\": \"%s\", \"connections\": %u, \"count\": %u, "
+               "\"ops_per_sec\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu}\n",
+               s_transportNames[transport], connections, connections * count,
+               1e9 * connections * count / elapsed,
+               (unsigned long long)times[((size_t)connections * count - 1) / 2],
+               (unsigned long long)times[((size_t)connections * count - 1) * 99 / 100]);
+        fflush(stdout);
+    }
+    else
+        fprintf(stderr, "%s: %u connections failed\n", s_transportNames[transport],
+                connections);
+    // The client closes first, so that the server is not left in TIME_WAIT
+    for(i = 0; clients != NULL && i < connections; i++)
+    {
+        if(clients[i].s > 0)
+            close(clients[i].s);
+#ifdef __linux__
+        if(clients[i].shared != NULL)
+            munmap(clients[i].shared, TPM_SHARED_RING_DATA + 2 * TPM_SHARED_RING_SIZE);
+        if(clients[i].serverBell > 0)
+            close(clients[i].serverBell);
+        if(clients[i].clientBell > 0)
+            close(clients[i].clientBell);
+#endif
+    }
+    pthread_barrier_destroy(&start);
+    free(times);
+    free(threads);
+    free(clients);
+    return ok;
+}
+//
+//
+//          RunTransport()
+//
+//     This function starts a server for transport, runs the clients against it with more and more connections
+//     and stops the server.
+//
+static BOOL
+RunTransport(
+    TRANSPORT            transport,
+    UINT32               maxConnections,
+    UINT32               count
+    )
+{
+    UINT32               stop = htonl(TPM_STOP);
+    UINT32               connections;
+    BOOL                 ok = TRUE;
+    pid_t                pid;
+    int                  status;
+    int                  s = -1;
+    int                  i;
+    pid = fork();
+    if(pid < 0)
+        return FALSE;
+    if(pid == 0)
+        _exit(RunServer(transport));
+    // Wait for the server to listen
+    for(i = 0; i < 500 && (s = Connect(transport, TRUE)) < 0; i++)
+        usleep(10000);
+    if(s < 0)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        fprintf(stderr, "%s: the server did not start\n", s_transportNames[transport]);
+        return FALSE;
+    }
+    for(connections = 1; connections <= maxConnections && ok; connections *= 2)
+        ok = RunClients(transport, connections, count);
+    SendAll(s, &stop, sizeof(stop));
+    close(s);
+    waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+int
+main(
+    int                  argc,
+    char                *argv[]
+    )
+{
+    UINT32               count = 5000;
+    UINT32               maxConnections = 16;
+    BOOL                 selected;
+    UINT32               i;
+    int                  arg;
+    int                  opt;
+    int                  status = 0;
+    while((opt = getopt(argc, argv, "n:c:p:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': count = (UINT32)atoi(optarg); break;
+            case 'c': maxConnections = (UINT32)atoi(optarg); break;
+            case 'p': s_port = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n commands per connection] [-c connections] "
+                        "[-p port] [transport...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(count == 0 || maxConnections == 0)
+        return 1;
+    for(i = 0; i < TRANSPORT_COUNT; i++)
+    {
+#ifndef __linux__
+        if(i == TRANSPORT_RING)
+            continue;
+#endif
+        selected = optind == argc;
+        for(arg = optind; arg < argc; arg++)
+            selected |= strcmp(argv[arg], s_transportNames[i]) == 0;
+        if(selected && !RunTransport((TRANSPORT)i, maxConnections, count))
+            status = 1;
+    }
+    return status;
+}